@@ -0,0 +1,248 @@
+#ifndef _ANIMATION_HPP_
+#define _ANIMATION_HPP_
+
+#include "scene_io.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Refit until the SAH cost of a tree grows past this multiple of its cost
+// right after its last build
+constexpr double ANIMATION_REBUILD_RATIO = 1.5;
+
+/* the keys of a scene grouped per sphere and instance and sorted by time
+ */
+class Animation {
+public:
+    ~Animation() {}
+    Animation() = delete;
+    Animation(const Animation&) = delete;
+    explicit Animation(const SceneDesc& desc) :
+        _spheres(desc.sphere_count()), _instances(desc.instances().size()) {
+        for (const KeyRecord& k : desc.keys()) {
+            (k.kind == KEY_SPHERE ? _spheres : _instances)[k.index].push_back(&k);
+            _begin = std::min(_begin, k.time);
+            _end = std::max(_end, k.time);
+            _moves[k.kind] = true;
+        }
+        for (auto *track : { &_spheres, &_instances }) {
+            for (auto& keys : *track) {
+                std::stable_sort(keys.begin(), keys.end(), [](const KeyRecord *a, const KeyRecord *b) { return a->time < b->time; });
+            }
+        }
+        if (_begin > _end) {
+            _begin = _end = 0.0;
+        }
+    }
+
+    inline bool empty() const { return !_moves[KEY_SPHERE] && !_moves[KEY_INSTANCE]; }
+    inline double begin() const { return _begin; }
+    inline double end() const { return _end; }
+    inline bool moves(const KeyKind kind) const { return _moves[kind]; }
+
+    /* the sphere as keyed at time, unkeyed spheres stay as they are */
+    template <typename T>
+    TSphere<T> sphere(const size_t i, const double time, const Sphere& rest) const {
+        double v[8];
+        if (!sample(_spheres[i], time, v)) {
+            return TSphere<T>(tvec3<T>(rest.origin()), T(rest.radius()), rest.material());
+        }
+        return TSphere<T>(tvec3<T>(T(v[0]), T(v[1]), T(v[2])), T(v[3]), rest.material());
+    }
+
+    /* placement of an instance at time: the key scales and turns the
+     * linear part and moves the translation, which is where the object
+     * origin lands, so the pivot is that point
+     */
+    void instance(const size_t i, const double time, const InstanceRecord& r, double to_world[3][4]) const {
+        double v[8];
+        if (!sample(_instances[i], time, v)) {
+            memcpy(to_world, r.to_world, sizeof(r.to_world));
+            return;
+        }
+        double axis[3] = { v[3], v[4], v[5] };
+        const double len = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        for (int a = 0; a < 3; a++) {
+            axis[a] /= len;
+        }
+        /* Rodrigues, scaled */
+        const double rad = v[6] * M_PI / 180.0;
+        const double c = std::cos(rad), s = std::sin(rad), k = 1.0 - c;
+        const double x = axis[0], y = axis[1], z = axis[2];
+        const double m[3][3] = {
+            { c + x*x*k,   x*y*k - z*s, x*z*k + y*s },
+            { y*x*k + z*s, c + y*y*k,   y*z*k - x*s },
+            { z*x*k - y*s, z*y*k + x*s, c + z*z*k   },
+        };
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) {
+                to_world[a][b] = v[7] * (m[a][0] * r.to_world[0][b] + m[a][1] * r.to_world[1][b] + m[a][2] * r.to_world[2][b]);
+            }
+            to_world[a][3] = r.to_world[a][3] + v[a];
+        }
+    }
+private:
+    /* values at time, linear between the keys around it and held outside
+     * them. false when the object has no keys. an axis that cancels out
+     * between two keys keeps the earlier one
+     */
+    static bool sample(const std::vector<const KeyRecord *>& keys, const double time, double v[8]) {
+        if (keys.empty()) {
+            return false;
+        }
+        const KeyRecord *a = keys.front();
+        const KeyRecord *b = a;
+        for (const KeyRecord *k : keys) {
+            if (k->time <= time) {
+                a = b = k;
+            } else {
+                b = k;
+                break;
+            }
+        }
+        const double span = b->time - a->time;
+        const double f = span > 0.0 ? std::min(1.0, std::max(0.0, (time - a->time) / span)) : 0.0;
+        for (int i = 0; i < key_values(a->kind); i++) {
+            v[i] = a->value[i] + (b->value[i] - a->value[i]) * f;
+        }
+        if (a->kind == KEY_INSTANCE && !(v[3] * v[3] + v[4] * v[4] + v[5] * v[5] > 0.0)) {
+            memcpy(v + 3, a->value + 3, 3 * sizeof(double));
+        }
+        return true;
+    }
+
+    std::vector<std::vector<const KeyRecord *>> _spheres;
+    std::vector<std::vector<const KeyRecord *>> _instances;
+    double _begin = std::numeric_limits<double>::max();
+    double _end = -std::numeric_limits<double>::max();
+    bool _moves[2] = { false, false };
+};
+
+/* what a frame cost to get the accelerators ready, per tree the SAH cost
+ * against the cost right after its last build
+ */
+struct FrameUpdate {
+    double seconds;
+    double sphere_ratio;
+    double instance_ratio;
+    bool sphere_rebuilt;
+    bool instance_rebuilt;
+};
+
+/* the accelerators of an animated scene, kept across frames. spheres and
+ * instances take their keyed pose every frame and the BVH over each is
+ * refitted, a tree whose SAH cost has grown by rebuild_ratio since its
+ * last build is built again. meshes do not move, they are built once and
+ * instances keep referring to them
+ */
+template <typename T>
+class TAnimatedScene {
+public:
+    ~TAnimatedScene() {}
+    TAnimatedScene() = delete;
+    TAnimatedScene(const TAnimatedScene&) = delete;
+    TAnimatedScene(const SceneDesc& desc, const Animation& anim, const double time, const double rebuild_ratio = ANIMATION_REBUILD_RATIO);
+
+    inline TAccelerator<T> *accel() { return &_group; }
+    /* pose at time and refit, or rebuild what degraded */
+    FrameUpdate update(const double time);
+private:
+    void pose(const double time);
+
+    const SceneDesc& _desc;
+    const Animation& _anim;
+    double _rebuild_ratio;
+    std::vector<TSphere<T>> _storage;
+    std::vector<TSphere<T> *> _objects;
+    std::vector<const TTriangleMesh<T> *> _meshes;
+    std::vector<TInstance<T>> _instances;
+    TBVH<T> *_spheres = nullptr;
+    TInstanceBVH<T> *_top = nullptr;
+    double _sphere_cost = 0.0;
+    double _instance_cost = 0.0;
+    TGroup<T> _group;
+};
+
+template <typename T>
+TAnimatedScene<T>::TAnimatedScene(const SceneDesc& desc, const Animation& anim, const double time, const double rebuild_ratio) :
+    _desc(desc), _anim(anim), _rebuild_ratio(rebuild_ratio) {
+    std::vector<TTriangleMesh<T> *> placed;
+    for (const MeshRecord& m : desc.meshes()) {
+        TTriangleMesh<T> *mesh = new TTriangleMesh<T>(m.data, m.material);
+        if (m.placed) {
+            placed.push_back(mesh);
+        } else {
+            _group.hold(mesh);
+        }
+        _meshes.push_back(mesh);
+    }
+    _storage.reserve(desc.sphere_count());
+    pose(time);
+    for (auto& s : _storage) {
+        _objects.push_back(&s);
+    }
+    /* members in the order of a still render */
+    _spheres = new TBVH<T>(_objects);
+    _sphere_cost = sah_cost(_spheres->nodes());
+    _group.add(_spheres);
+    for (const auto mesh : placed) {
+        _group.add(mesh);
+    }
+    if (!_instances.empty()) {
+        _top = new TInstanceBVH<T>(std::vector<TInstance<T>>(_instances));
+        _instance_cost = sah_cost(_top->tree());
+        _group.add(_top);
+    }
+}
+
+template <typename T>
+void TAnimatedScene<T>::pose(const double time) {
+    _storage.clear();
+    for (size_t i = 0; i < _desc.sphere_count(); i++) {
+        _storage.push_back(_anim.sphere<T>(i, time, _desc.spheres()[i]));
+    }
+    _instances.clear();
+    for (size_t i = 0; i < _desc.instances().size(); i++) {
+        const InstanceRecord& r = _desc.instances()[i];
+        double to_world[3][4];
+        _anim.instance(i, time, r, to_world);
+        _instances.push_back(TInstance<T>(_meshes[r.mesh], to_world, r.material));
+    }
+}
+
+template <typename T>
+FrameUpdate TAnimatedScene<T>::update(const double time) {
+    auto start = std::chrono::steady_clock::now();
+    FrameUpdate u = { 0.0, 1.0, 1.0, false, false };
+    /* storage keeps its capacity, the object pointers stay valid */
+    pose(time);
+    if (_anim.moves(KEY_SPHERE)) {
+        _spheres->refit(_objects);
+        const double cost = sah_cost(_spheres->nodes());
+        u.sphere_ratio = _sphere_cost > 0.0 ? cost / _sphere_cost : 1.0;
+        if (u.sphere_ratio > _rebuild_ratio) {
+            TBVH<T> *fresh = new TBVH<T>(_objects);
+            _group.replace(_spheres, fresh);
+            _spheres = fresh;
+            _sphere_cost = sah_cost(_spheres->nodes());
+            u.sphere_rebuilt = true;
+        }
+    }
+    if (_top && _anim.moves(KEY_INSTANCE)) {
+        _top->refit(_instances);
+        const double cost = sah_cost(_top->tree());
+        u.instance_ratio = _instance_cost > 0.0 ? cost / _instance_cost : 1.0;
+        if (u.instance_ratio > _rebuild_ratio) {
+            TInstanceBVH<T> *fresh = new TInstanceBVH<T>(std::vector<TInstance<T>>(_instances));
+            _group.replace(_top, fresh);
+            _top = fresh;
+            _instance_cost = sah_cost(_top->tree());
+            u.instance_rebuilt = true;
+        }
+    }
+    u.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return u;
+}
+#endif
@@ -0,0 +1,139 @@
+#include "tracer.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/* render time against sphere count, BVH versus the linear object loop.
+ * every scene is a cloud of opaque spheres above the ground sphere, radius
+ * shrinks with the count so the cloud keeps roughly the same density
+ */
+
+static const vec3 eye(0, -0.15, 0);
+static const vec3 topleft(-2, 1, -2.0);
+
+struct BenchOptions {
+    int w = 160;
+    int h = 120;
+    size_t max_count = 1000000;
+    size_t max_linear = 10000;
+};
+
+static void make_scene(const size_t n, std::vector<Material>& mats, std::vector<Sphere *>& objects) {
+    mats.push_back(Material(vec3(0.087, 0.094, 0.080), vec3(0.087, 0.094, 0.080), 0.5, false, 0.0));
+    mats.push_back(Material(vec3(0.71, 0.52, 0.57), vec3(0.71, 0.52, 0.57), 1.0, false, 0.0));
+    mats.push_back(Material(vec3(0.8, 0.2, 0.2), vec3(0.8, 0.2, 0.2), 2.0, false, 0.0));
+    mats.push_back(Material(vec3(0.8, 0.6, 0.2), vec3(0.8, 0.6, 0.2), 4.0, false, 0.0));
+    mats.push_back(Material(vec3(0.2, 0.35, 0.5), vec3(0.2, 0.35, 0.5), 16.0, false, 0.0));
+
+    objects.push_back(new Sphere(vec3(0, -100.5, -2.25), 100, 0));
+
+    unsigned short xsubi[3] = { 0x330E, 0xABCD, 0x1234 };
+    const double radius = 0.35 * cbrt(18.0 / n);
+    for (size_t i = 0; i < n; i++) {
+        vec3 o(-2.0 + 4.0 * erand48(xsubi), -0.5 + 1.5 * erand48(xsubi), -4.5 + 3.0 * erand48(xsubi));
+        double r = radius * (0.5 + erand48(xsubi));
+        objects.push_back(new Sphere(o, r, 1 + i % 4));
+    }
+}
+
+/* one ray through every pixel centre, returns seconds */
+static double render(const Scene& scene, const int w, const int h, std::vector<vec3>& img) {
+    const vec3 u(4.0/w, 0.0, 0.0);
+    const vec3 v(0.0, -3.0/h, 0.0);
+    img.resize(w * h);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < h; i++) {
+        for (int j = 0; j < w; j++) {
+            vec3 rdir = topleft + u*(j+0.5) + v*(i+0.5) - eye;
+            rdir.normalize();
+            img[i * w + j] = tracer(scene, Ray(eye, rdir), 0, SampleRng(0, uint32_t(i * w + j), 0));
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double max_diff(const std::vector<vec3>& a, const std::vector<vec3>& b) {
+    double m = 0.0;
+    for (size_t i = 0; i < a.size(); i++) {
+        vec3 d = a[i] - b[i];
+        m = std::max(m, std::max(fabs(d.x()), std::max(fabs(d.y()), fabs(d.z()))));
+    }
+    return m;
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--size") && i + 2 < argc) {
+            opts.w = std::max(1, atoi(argv[++i]));
+            opts.h = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--max") && i + 1 < argc) {
+            opts.max_count = strtoull(argv[++i], nullptr, 10);
+        } else if (0 == strcmp(argv[i], "--max-linear") && i + 1 < argc) {
+            opts.max_linear = strtoull(argv[++i], nullptr, 10);
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--size W H] [--max N] [--max-linear N]\n";
+            return 1;
+        }
+    }
+
+    std::vector<LightBase *> lights;
+    lights.push_back(new ConstantLight(vec3(100, 0, 100), vec3(1.0, 1.0, 1.0), 1e4));
+    lights.push_back(new ConstantLight(vec3(100, 100, 100), vec3(1.0, 1.0, 1.0), 5e2));
+
+    std::cout << opts.w << "x" << opts.h << " primary rays, 1 spp, opaque spheres\n";
+    std::cout << std::setw(10) << "spheres" << std::setw(12) << "build ms"
+              << std::setw(10) << "nodes" << std::setw(12) << "bvh ms"
+              << std::setw(12) << "linear ms" << std::setw(10) << "speedup"
+              << std::setw(12) << "max diff" << "\n";
+
+    const size_t counts[] = { 8, 64, 512, 4096, 32768, 100000, 262144, 1000000 };
+    for (const size_t n : counts) {
+        if (n > opts.max_count) {
+            break;
+        }
+        std::vector<Material> mats;
+        std::vector<Sphere *> objects;
+        make_scene(n, mats, objects);
+
+        auto start = std::chrono::steady_clock::now();
+        BVH bvh(objects);
+        double build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        Scene scene;
+        scene.lights = lights;
+        scene.materials = mats;
+        scene.eye = eye;
+
+        std::vector<vec3> bvh_img;
+        scene.accel = &bvh;
+        double bvh_time = render(scene, opts.w, opts.h, bvh_img);
+
+        std::cout << std::fixed << std::setprecision(2)
+                  << std::setw(10) << n << std::setw(12) << build * 1e3
+                  << std::setw(10) << bvh.size() << std::setw(12) << bvh_time * 1e3;
+
+        if (n <= opts.max_linear) {
+            LinearList linear(objects);
+            std::vector<vec3> linear_img;
+            scene.accel = &linear;
+            double linear_time = render(scene, opts.w, opts.h, linear_img);
+            std::cout << std::setw(12) << linear_time * 1e3
+                      << std::setw(10) << linear_time / bvh_time
+                      << std::setw(12) << std::scientific << std::setprecision(1) << max_diff(bvh_img, linear_img);
+        } else {
+            std::cout << std::setw(12) << "-" << std::setw(10) << "-" << std::setw(12) << "-";
+        }
+        std::cout << std::endl;
+
+        for (auto o : objects) {
+            delete o;
+        }
+    }
+
+    return 0;
+}
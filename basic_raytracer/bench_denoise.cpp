@@ -0,0 +1,266 @@
+#include "tracer.hpp"
+#include "camera.hpp"
+#include "sampler.hpp"
+#include "progressive.hpp"
+#include "denoise.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/* denoise a few samples or trace many: the demo spheres under a cloud of
+ * small lights, each hit shading light tree draws so the low spp image
+ * carries real shading noise and not only edge aliasing. a high spp
+ * render shading every light is the reference; raw low spp, the low spp
+ * image through the a-trous filter and raw high spp are timed and their
+ * error against it reported. then the filter alone per ISA and thread
+ * count, with the largest difference of each ISA to the scalar kernel
+ */
+
+struct BenchOptions {
+    int w = 160;
+    int h = 120;
+    int spp = 4;
+    int high_spp = 40;
+    int ref_spp = 256;
+    size_t lights = 32;
+    uint light_samples = 1;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+static void make_scene(std::vector<Material>& mats, std::vector<Sphere *>& objects) {
+    mats.push_back(Material(vec3(0.087, 0.094, 0.080), vec3(0.087, 0.094, 0.080), 0.5, false, 0.0));
+    mats.push_back(Material(vec3(0.71, 0.52, 0.57), vec3(0.71, 0.52, 0.57), 1.0, false, 0.0));
+    mats.push_back(Material(vec3(0.8, 0.2, 0.2), vec3(0.8, 0.2, 0.2), 2.0, false, 0.0));
+    mats.push_back(Material(vec3(0.8, 0.6, 0.2), vec3(0.8, 0.6, 0.2), 4.0, false, 0.0));
+    mats.push_back(Material(vec3(0.35, 0.35, 0.25), vec3(0.35, 0.35, 0.25), 8.0, false, 0.0));
+    mats.push_back(Material(vec3(0.2, 0.35, 0.5), vec3(0.2, 0.35, 0.5), 16.0, false, 0.0));
+    mats.push_back(Material(vec3(0.38, 0.82, 0.71), vec3(0.38, 0.82, 0.71), 32.0, true, 1.3));
+    mats.push_back(Material(vec3(0.3, 0.8, 0.6), vec3(0.3, 0.8, 0.6), 64.0, true, 1.05));
+
+    objects.push_back(new Sphere(vec3(0, -100.5, -2.25), 100, 0));
+    objects.push_back(new Sphere(vec3(-1, 0, -2.25), 0.5, 1));
+    objects.push_back(new Sphere(vec3(0, 0, -2.25), 0.5, 2));
+    objects.push_back(new Sphere(vec3(1, 0, -2.25), 0.5, 3));
+    objects.push_back(new Sphere(vec3(-0.85, -0.35, -1.5), 0.15, 4));
+    objects.push_back(new Sphere(vec3(-0.55, -0.35, -1.5), 0.15, 5));
+    objects.push_back(new Sphere(vec3(-0.25, -0.35, -1.5), 0.15, 6));
+    objects.push_back(new Sphere(vec3(0.15, -0.3, -1.05), 0.2, 7));
+}
+
+static void make_lights(const size_t n, std::vector<LightBase *>& lights) {
+    unsigned short xsubi[3] = { 0x330E, 0x4C19, 0x0B17 };
+    for (size_t i = 0; i < n; i++) {
+        const vec3 o(-4.0 + 8.0 * erand48(xsubi), 0.8 + 3.0 * erand48(xsubi), -5.0 + 6.0 * erand48(xsubi));
+        const vec3 c(0.5 + 0.5 * erand48(xsubi), 0.5 + 0.5 * erand48(xsubi), 0.5 + 0.5 * erand48(xsubi));
+        lights.push_back(new ConstantLight(o, c, 0.02 + 0.2 * erand48(xsubi) * erand48(xsubi)));
+    }
+}
+
+/* one thread, random sub pixel points. aux, when given, gets the first hit
+ * features averaged as render.cpp does. returns seconds
+ */
+static double render(const Scene& scene, const View& view, const Sampler& sampler, const uint64_t seed, Framebuffer& fb, AuxImage *aux) {
+    const double spp_inv = 1.0 / view.spp;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < view.height; i++) {
+        for (int j = 0; j < view.width; j++) {
+            vec3 res;
+            Aux sum;
+            PixelEstimate est;
+            for (int k = 0; k < view.spp; k++) {
+                double jitter[2];
+                sampler.get_2d(j, i, uint32_t(i * view.width + j), uint32_t(k), 0, jitter);
+                const SampleRng rng(seed, uint32_t(i * view.width + j), uint32_t(k));
+                Aux a;
+                const vec3 c = trace_path(scene, camera_ray<double>(view, j, i, jitter[0], jitter[1]), 1e-3, rng, aux ? &a : nullptr);
+                res += c;
+                est.add(c);
+                sum.albedo += a.albedo;
+                sum.normal += a.normal;
+                sum.depth += a.depth;
+            }
+            fb.at(j, i) = res * spp_inv;
+            if (aux) {
+                aux->set(j, i, sum, spp_inv, est.variance());
+            }
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* root mean square over channels relative to the reference mean, and the
+ * relative difference of the image means
+ */
+static void error(const Framebuffer& ref, const Framebuffer& img, double& rel_rmse, double& bias) {
+    double se = 0.0;
+    double sum = 0.0;
+    double diff = 0.0;
+    for (int i = 0; i < ref.height(); i++) {
+        for (int j = 0; j < ref.width(); j++) {
+            for (int c = 0; c < 3; c++) {
+                const double d = img.at(j, i)[c] - ref.at(j, i)[c];
+                se += d * d;
+                diff += d;
+                sum += ref.at(j, i)[c];
+            }
+        }
+    }
+    const double n = 3.0 * ref.width() * ref.height();
+    rel_rmse = std::sqrt(se / n) / (sum / n);
+    bias = diff / sum;
+}
+
+static double max_diff(const Framebuffer& a, const Framebuffer& b) {
+    double m = 0.0;
+    for (int i = 0; i < a.height(); i++) {
+        for (int j = 0; j < a.width(); j++) {
+            for (int c = 0; c < 3; c++) {
+                m = std::max(m, std::fabs(a.at(j, i)[c] - b.at(j, i)[c]));
+            }
+        }
+    }
+    return m;
+}
+
+/* a filtered copy of fb, sec gets the filter time */
+static Framebuffer run_denoise(const Framebuffer& fb, const AuxImage& aux, const AtrousKernels& kernels, const unsigned threads, double& sec) {
+    Framebuffer out(fb);
+    TileScheduler *scheduler = threads > 1 ? new TileScheduler(threads) : nullptr;
+    auto start = std::chrono::steady_clock::now();
+    denoise(out, aux, DenoiseParams(), kernels, scheduler);
+    sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    delete scheduler;
+    return out;
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--size") && i + 2 < argc) {
+            opts.w = std::max(1, atoi(argv[++i]));
+            opts.h = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--spp") && i + 1 < argc) {
+            opts.spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--high-spp") && i + 1 < argc) {
+            opts.high_spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--ref-spp") && i + 1 < argc) {
+            opts.ref_spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--lights") && i + 1 < argc) {
+            opts.lights = std::max(1ull, strtoull(argv[++i], nullptr, 10));
+        } else if (0 == strcmp(argv[i], "--light-samples") && i + 1 < argc) {
+            opts.light_samples = uint(std::max(0, atoi(argv[++i])));
+        } else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc) {
+            opts.threads = std::max(1, atoi(argv[++i]));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--size W H] [--spp N] [--high-spp N] [--ref-spp N]\n"
+                      << "       [--lights N] [--light-samples K] [--threads N]\n"
+                      << "  --light-samples 0 shades every light, leaving edge aliasing as the only noise\n";
+            return 1;
+        }
+    }
+
+    std::vector<Material> mats;
+    std::vector<Sphere *> objects;
+    make_scene(mats, objects);
+    BVH bvh(objects);
+
+    Scene scene;
+    scene.accel = &bvh;
+    scene.materials = mats;
+    make_lights(opts.lights, scene.lights);
+    scene.eye = vec3(0, -0.15, 0);
+    const LightTree tree(scene.lights);
+
+    View view;
+    view.width = opts.w;
+    view.height = opts.h;
+    view.eye = scene.eye;
+    view.topleft = vec3(-2, 1, -2.0);
+    view.u = vec3(4.0 / opts.w, 0.0, 0.0);
+    view.v = vec3(0.0, -3.0 / opts.h, 0.0);
+
+    /* the reference gets its own seed so its noise is independent */
+    std::cout << opts.w << "x" << opts.h << ", " << opts.lights << " constant lights, "
+              << (opts.light_samples ? std::to_string(opts.light_samples) + " light tree draws per hit" : std::string("every light per hit"))
+              << ", tracing on one thread, reference " << opts.ref_spp << " spp every light\n";
+    Framebuffer ref(opts.w, opts.h);
+    view.spp = opts.ref_spp;
+    const double ref_sec = render(scene, view, RandomSampler(7), 7, ref, nullptr);
+
+    if (opts.light_samples) {
+        scene.light_tree = &tree;
+        scene.light_samples = opts.light_samples;
+    }
+    const RandomSampler sampler(1);
+    Framebuffer low(opts.w, opts.h);
+    AuxImage aux(opts.w, opts.h);
+    view.spp = opts.spp;
+    const double low_sec = render(scene, view, sampler, 1, low, &aux);
+    Framebuffer high(opts.w, opts.h);
+    view.spp = opts.high_spp;
+    const double high_sec = render(scene, view, sampler, 1, high, nullptr);
+
+    const AtrousKernels best = select_atrous(detect_isa());
+    double filter_sec;
+    const Framebuffer filtered = run_denoise(low, aux, best, opts.threads, filter_sec);
+
+    std::cout << std::setw(22) << "image" << std::setw(12) << "time ms" << std::setw(12) << "rel rmse" << std::setw(12) << "mean diff" << "\n";
+    const struct {
+        std::string name;
+        const Framebuffer *fb;
+        double sec;
+    } rows[] = {
+        { std::to_string(opts.spp) + " spp", &low, low_sec },
+        { std::to_string(opts.spp) + " spp denoised", &filtered, low_sec + filter_sec },
+        { std::to_string(opts.high_spp) + " spp", &high, high_sec },
+        { std::to_string(opts.ref_spp) + " spp reference", &ref, ref_sec },
+    };
+    for (const auto& r : rows) {
+        double rmse, bias;
+        error(ref, *r.fb, rmse, bias);
+        std::cout << std::setw(22) << r.name << std::fixed << std::setprecision(2) << std::setw(12) << r.sec * 1e3
+                  << std::setprecision(4) << std::setw(12) << rmse << std::setw(12) << bias << "\n";
+    }
+    std::cout << "filter " << std::setprecision(2) << filter_sec * 1e3 << " ms of the denoised time ("
+              << isa_name(best.isa) << ", " << opts.threads << " threads), " << DENOISE_PASSES << " passes\n\n";
+
+    std::cout << std::setw(8) << "isa" << std::setw(10) << "threads" << std::setw(12) << "filter ms"
+              << std::setw(14) << "Mpixel/s" << std::setw(14) << "max diff" << "\n";
+    double scalar_sec;
+    const Framebuffer scalar = run_denoise(low, aux, select_atrous(SIMD_SCALAR), 1, scalar_sec);
+    for (const SimdIsa isa : { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 }) {
+        if (!isa_supported(isa)) {
+            std::cout << std::setw(8) << isa_name(isa) << "  not supported here\n";
+            continue;
+        }
+        for (const unsigned threads : { 1u, opts.threads }) {
+            /* best of five */
+            double sec = 1e30;
+            double diff = 0.0;
+            for (int rep = 0; rep < 5; rep++) {
+                double s;
+                diff = std::max(diff, max_diff(scalar, run_denoise(low, aux, select_atrous(isa), threads, s)));
+                sec = std::min(sec, s);
+            }
+            std::cout << std::setw(8) << isa_name(isa) << std::setw(10) << threads << std::setprecision(2) << std::setw(12) << sec * 1e3
+                      << std::setw(14) << double(opts.w) * opts.h / sec * 1e-6 << std::scientific << std::setw(14)
+                      << diff << std::fixed << std::endl;
+            if (opts.threads == 1) {
+                break;
+            }
+        }
+    }
+
+    for (auto l : scene.lights) {
+        delete l;
+    }
+    for (auto o : objects) {
+        delete o;
+    }
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include "tracer.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <sys/resource.h>
+
+/* two level BVH memory and speed. one lumpy sphere of about 10k triangles
+ * is placed count times on a jittered cubic grid, each copy rotated and
+ * scaled, and traced with a pinhole camera outside the grid. memory is
+ * the bottom level once plus the instances and their top level nodes,
+ * against count copies of the triangles a flattened scene would need.
+ * a small count is also flattened into one mesh and traced both ways,
+ * the hits have to agree
+ */
+
+struct BenchOptions {
+    size_t count = 1000000;
+    uint32_t segments = 100; /* segments^2 triangles */
+    size_t check = 64;
+    int w = 512;
+    int h = 512;
+};
+
+static double since(const std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double peak_mb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0;
+}
+
+/* instance i on a grid of side n, unit spacing */
+static void placement(const size_t i, const size_t n, double m[3][4]) {
+    unsigned short xsubi[3] = { 0x330E, uint16_t(i), uint16_t(i >> 16) };
+    const double s = 0.25 + 0.15 * erand48(xsubi);
+    const double ay = 2.0 * M_PI * erand48(xsubi);
+    const double ax = M_PI * erand48(xsubi);
+    const double cy = cos(ay), sy = sin(ay), cx = cos(ax), sx = sin(ax);
+    const double r[3][3] = { { cy, sy * sx, sy * cx }, { 0.0, cx, -sx }, { -sy, cy * sx, cy * cx } };
+    const double p[3] = { double(i % n), double(i / n % n), -double(i / n / n) };
+    for (int a = 0; a < 3; a++) {
+        for (int b = 0; b < 3; b++) {
+            m[a][b] = s * r[a][b];
+        }
+        m[a][3] = p[a] + 0.2 * (erand48(xsubi) - 0.5);
+    }
+}
+
+static size_t grid_side(const size_t count) {
+    size_t n = 1;
+    while (n * n * n < count) {
+        n++;
+    }
+    return n;
+}
+
+/* rays from in front of the grid towards its centre, one per pixel */
+template <typename T>
+static std::vector<TRay<T>> camera_rays(const size_t n, const int w, const int h) {
+    const double c = 0.5 * (n - 1);
+    const tvec3<T> eye(T(c + 0.3 * n), T(c + 0.2 * n), T(1.2 * n));
+    std::vector<TRay<T>> rays;
+    for (int i = 0; i < h; i++) {
+        for (int j = 0; j < w; j++) {
+            const tvec3<T> target(T(c + n * (j + 0.5) / w - 0.5 * n), T(c - n * (i + 0.5) / h + 0.5 * n), T(-c));
+            tvec3<T> d = target - eye;
+            d.normalize();
+            rays.push_back(TRay<T>(eye, d));
+        }
+    }
+    return rays;
+}
+
+template <typename T>
+static void run(const MeshData& data, const BenchOptions& opts, const char *name) {
+    const TTriangleMesh<T> mesh(data, 0);
+    const size_t n = grid_side(opts.count);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<TInstance<T>> instances;
+    instances.reserve(opts.count);
+    for (size_t i = 0; i < opts.count; i++) {
+        double m[3][4];
+        placement(i, n, m);
+        instances.push_back(TInstance<T>(&mesh, m, uint32_t(i % 5)));
+    }
+    const TInstanceBVH<T> top(std::move(instances));
+    const double build = since(start);
+
+    const std::vector<TRay<T>> rays = camera_rays<T>(n, opts.w, opts.h);
+    const tvec3<T> light(T(2.0 * n), T(3.0 * n), T(2.0 * n));
+    size_t hits = 0;
+    size_t blocked = 0;
+    double closest = 0.0;
+    double occlusion = 0.0;
+    for (const auto& r : rays) {
+        THit<T> hit;
+        start = std::chrono::steady_clock::now();
+        const bool found = top.intersect(r, hit);
+        closest += since(start);
+        if (!found) {
+            continue;
+        }
+        hits++;
+        const tvec3<T> p = hit.offset(r.parameterize_at(hit.t), !hit.inside);
+        tvec3<T> d = light - p;
+        const T len = std::sqrt(dot(d, d));
+        d.normalize();
+        start = std::chrono::steady_clock::now();
+        blocked += top.occluded(TRay<T>(p, d), len);
+        occlusion += since(start);
+    }
+
+    const double flat = double(opts.count) * mesh.bytes();
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(8) << name << std::setw(12) << build * 1e3 << std::setw(10) << top.nodes()
+              << std::setw(10) << mesh.bytes() / 1048576.0 << std::setw(10) << top.bytes() / 1048576.0
+              << std::setw(10) << double(top.bytes()) / opts.count << std::setw(12) << flat / 1048576.0
+              << std::setw(8) << hits * 100.0 / rays.size() << std::setw(10) << rays.size() / closest * 1e-6
+              << std::setw(10) << hits / std::max(occlusion, 1e-9) * 1e-6 << "\n";
+    (void)blocked;
+}
+
+/* the first count instances flattened into one mesh, returns the rays
+ * whose hit distance differs by more than a relative 1e-9
+ */
+static size_t check(const MeshData& data, const BenchOptions& opts) {
+    const TriangleMesh mesh(data, 0);
+    const size_t n = grid_side(opts.check);
+    std::vector<Instance> instances;
+    MeshData flat;
+    for (size_t i = 0; i < opts.check; i++) {
+        double m[3][4];
+        placement(i, n, m);
+        instances.push_back(Instance(&mesh, m));
+        const uint32_t base = flat.vertices();
+        for (size_t v = 0; v < data.vertices(); v++) {
+            double q[3];
+            for (int a = 0; a < 3; a++) {
+                q[a] = m[a][0] * data.x[v] + m[a][1] * data.y[v] + m[a][2] * data.z[v] + m[a][3];
+            }
+            flat.add_vertex(q[0], q[1], q[2]);
+        }
+        for (const uint32_t v : data.index) {
+            flat.index.push_back(base + v);
+        }
+    }
+    const InstanceBVH top(std::move(instances));
+    const TriangleMesh flat_mesh(flat, 0);
+
+    size_t differ = 0;
+    for (const auto& r : camera_rays<double>(n, opts.w, opts.h)) {
+        Hit a;
+        Hit b;
+        const bool ha = top.intersect(r, a);
+        const bool hb = flat_mesh.intersect(r, b);
+        differ += ha != hb || (ha && std::fabs(a.t - b.t) > 1e-9 * b.t);
+    }
+    return differ;
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--count") && i + 1 < argc) {
+            opts.count = std::max(1ull, strtoull(argv[++i], nullptr, 10));
+        } else if (0 == strcmp(argv[i], "--segments") && i + 1 < argc) {
+            opts.segments = std::max(4, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--check") && i + 1 < argc) {
+            opts.check = strtoull(argv[++i], nullptr, 10);
+        } else if (0 == strcmp(argv[i], "--size") && i + 2 < argc) {
+            opts.w = std::max(1, atoi(argv[++i]));
+            opts.h = std::max(1, atoi(argv[++i]));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--count N] [--segments N] [--check N] [--size W H]\n";
+            return 1;
+        }
+    }
+
+    MeshData data;
+    const double centre[3] = { 0.0, 0.0, 0.0 };
+    make_lumpy_sphere(data, centre, 1.0, opts.segments / 2, opts.segments);
+    std::cout << opts.count << " instances of a " << data.triangles() << " triangle mesh, "
+              << opts.w << "x" << opts.h << " primary rays, one shadow ray per hit\n";
+    if (opts.check) {
+        std::cout << "check: " << opts.check << " instances against the flattened mesh, "
+                  << check(data, opts) << " rays differ\n";
+    }
+
+    std::cout << std::setw(8) << "type" << std::setw(12) << "build ms" << std::setw(10) << "nodes"
+              << std::setw(10) << "mesh MB" << std::setw(10) << "top MB" << std::setw(10) << "B/inst"
+              << std::setw(12) << "flat MB" << std::setw(8) << "hit %" << std::setw(10) << "Mr/s" << std::setw(10) << "shadow" << "\n";
+    run<double>(data, opts, "double");
+    run<float>(data, opts, "float");
+    std::cout << "peak memory " << peak_mb() << " MB\n";
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "tracer.hpp"
+#include "camera.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/* many light shading: the demo spheres lit by a cloud of small coloured
+ * constant lights around them. every light with its shadow ray per hit
+ * against a few lights per hit drawn from the light tree. the light draws
+ * are the only difference between the images, so the error against the
+ * every light render is the noise of the estimate
+ */
+
+struct BenchOptions {
+    int w = 160;
+    int h = 120;
+    int spp = 4;
+    size_t lights = 1000;
+};
+
+static void make_scene(std::vector<Material>& mats, std::vector<Sphere *>& objects) {
+    mats.push_back(Material(vec3(0.087, 0.094, 0.080), vec3(0.087, 0.094, 0.080), 0.5, false, 0.0));
+    mats.push_back(Material(vec3(0.71, 0.52, 0.57), vec3(0.71, 0.52, 0.57), 1.0, false, 0.0));
+    mats.push_back(Material(vec3(0.8, 0.2, 0.2), vec3(0.8, 0.2, 0.2), 2.0, false, 0.0));
+    mats.push_back(Material(vec3(0.8, 0.6, 0.2), vec3(0.8, 0.6, 0.2), 4.0, false, 0.0));
+    mats.push_back(Material(vec3(0.35, 0.35, 0.25), vec3(0.35, 0.35, 0.25), 8.0, false, 0.0));
+    mats.push_back(Material(vec3(0.2, 0.35, 0.5), vec3(0.2, 0.35, 0.5), 16.0, false, 0.0));
+    mats.push_back(Material(vec3(0.38, 0.82, 0.71), vec3(0.38, 0.82, 0.71), 32.0, true, 1.3));
+    mats.push_back(Material(vec3(0.3, 0.8, 0.6), vec3(0.3, 0.8, 0.6), 64.0, true, 1.05));
+
+    objects.push_back(new Sphere(vec3(0, -100.5, -2.25), 100, 0));
+    objects.push_back(new Sphere(vec3(-1, 0, -2.25), 0.5, 1));
+    objects.push_back(new Sphere(vec3(0, 0, -2.25), 0.5, 2));
+    objects.push_back(new Sphere(vec3(1, 0, -2.25), 0.5, 3));
+    objects.push_back(new Sphere(vec3(-0.85, -0.35, -1.5), 0.15, 4));
+    objects.push_back(new Sphere(vec3(-0.55, -0.35, -1.5), 0.15, 5));
+    objects.push_back(new Sphere(vec3(-0.25, -0.35, -1.5), 0.15, 6));
+    objects.push_back(new Sphere(vec3(0.15, -0.3, -1.05), 0.2, 7));
+}
+
+/* lights in a slab over and behind the spheres, clear of the surfaces so
+ * no single light dominates a pixel
+ */
+static void make_lights(const size_t n, std::vector<LightBase *>& lights) {
+    unsigned short xsubi[3] = { 0x330E, 0x4C19, 0x0B17 };
+    for (size_t i = 0; i < n; i++) {
+        const vec3 o(-4.0 + 8.0 * erand48(xsubi), 0.8 + 3.0 * erand48(xsubi), -5.0 + 6.0 * erand48(xsubi));
+        const vec3 c(0.5 + 0.5 * erand48(xsubi), 0.5 + 0.5 * erand48(xsubi), 0.5 + 0.5 * erand48(xsubi));
+        lights.push_back(new ConstantLight(o, c, 0.002 + 0.02 * erand48(xsubi) * erand48(xsubi)));
+    }
+}
+
+/* returns seconds */
+static double render(const Scene& scene, const View& view, std::vector<vec3>& img) {
+    img.assign(size_t(view.width) * view.height, vec3());
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < view.height; i++) {
+        for (int j = 0; j < view.width; j++) {
+            vec3 res;
+            for (int k = 0; k < view.spp; k++) {
+                const double dx = (k + 0.5) / view.spp;
+                const double dy = ((k * 7 + 3) % view.spp + 0.5) / view.spp;
+                res += trace_path(scene, camera_ray<double>(view, j, i, dx, dy), 1e-3, SampleRng(0, uint32_t(i * view.width + j), uint32_t(k)));
+            }
+            img[i * view.width + j] = res * (1.0 / view.spp);
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* root mean square over channels and mean of the reference, for a
+ * relative error, and the relative difference of the image means, which
+ * only the noise should move off zero
+ */
+static void error(const std::vector<vec3>& ref, const std::vector<vec3>& img, double& rmse, double& mean, double& bias) {
+    double se = 0.0;
+    double sum = 0.0;
+    double diff = 0.0;
+    for (size_t i = 0; i < ref.size(); i++) {
+        for (int c = 0; c < 3; c++) {
+            const double d = img[i][c] - ref[i][c];
+            se += d * d;
+            diff += d;
+            sum += ref[i][c];
+        }
+    }
+    rmse = std::sqrt(se / (3.0 * ref.size()));
+    mean = sum / (3.0 * ref.size());
+    bias = diff / sum;
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--size") && i + 2 < argc) {
+            opts.w = std::max(1, atoi(argv[++i]));
+            opts.h = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--spp") && i + 1 < argc) {
+            opts.spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--lights") && i + 1 < argc) {
+            opts.lights = std::max(1ull, strtoull(argv[++i], nullptr, 10));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--size W H] [--spp N] [--lights N]\n";
+            return 1;
+        }
+    }
+
+    std::vector<Material> mats;
+    std::vector<Sphere *> objects;
+    make_scene(mats, objects);
+    BVH bvh(objects);
+
+    Scene scene;
+    scene.accel = &bvh;
+    scene.materials = mats;
+    make_lights(opts.lights, scene.lights);
+    scene.eye = vec3(0, -0.15, 0);
+
+    auto start = std::chrono::steady_clock::now();
+    const LightTree tree(scene.lights);
+    const double build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    View view;
+    view.width = opts.w;
+    view.height = opts.h;
+    view.spp = opts.spp;
+    view.eye = scene.eye;
+    view.topleft = vec3(-2, 1, -2.0);
+    view.u = vec3(4.0 / opts.w, 0.0, 0.0);
+    view.v = vec3(0.0, -3.0 / opts.h, 0.0);
+
+    std::cout << opts.w << "x" << opts.h << " at " << opts.spp << " spp, " << opts.lights << " constant lights, light tree of "
+              << tree.size() << " nodes built in " << std::fixed << std::setprecision(2) << build * 1e3 << " ms, one thread\n"
+              << std::setw(10) << "per hit" << std::setw(12) << "time ms" << std::setw(10) << "speedup"
+              << std::setw(14) << "shadow/ray" << std::setw(12) << "rel rmse" << std::setw(12) << "mean diff" << "\n";
+
+    std::vector<vec3> ref;
+    uint64_t shadow0 = StatsRegistry::instance().collect().shadow_rays;
+    uint64_t hits0 = StatsRegistry::instance().collect().rays;
+    const double all = render(scene, view, ref);
+    TraceStats s = StatsRegistry::instance().collect();
+    std::cout << std::setw(10) << "all" << std::setw(12) << all * 1e3 << std::setw(10) << 1.0
+              << std::setw(14) << double(s.shadow_rays - shadow0) / double(s.rays - hits0) << std::setw(12) << 0.0 << std::setw(12) << 0.0 << std::endl;
+
+    scene.light_tree = &tree;
+    for (const uint k : { 1u, 2u, 4u, 8u, 16u, 64u }) {
+        scene.light_samples = k;
+        std::vector<vec3> img;
+        shadow0 = s.shadow_rays;
+        hits0 = s.rays;
+        const double sec = render(scene, view, img);
+        s = StatsRegistry::instance().collect();
+        double rmse, mean, bias;
+        error(ref, img, rmse, mean, bias);
+        std::cout << std::setw(10) << k << std::setw(12) << sec * 1e3 << std::setw(10) << all / sec
+                  << std::setw(14) << double(s.shadow_rays - shadow0) / double(s.rays - hits0)
+                  << std::setprecision(4) << std::setw(12) << rmse / mean << std::setw(12) << bias << std::setprecision(2) << std::endl;
+    }
+
+    for (auto l : scene.lights) {
+        delete l;
+    }
+    for (auto o : objects) {
+        delete o;
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include "tracer.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+/* triangle mesh throughput: streamed load, BVH build and closest hit and
+ * occlusion rays per second in double and float. the default mesh is a
+ * lumpy sphere of about a million triangles around the origin, rays come
+ * from a pinhole camera in front of it and shadow rays go from the hits
+ * towards a point light. closed meshes also get a watertightness check:
+ * rays from the centre through every vertex and edge midpoint must hit
+ */
+
+struct BenchOptions {
+    const char *mesh = nullptr;
+    const char *save = nullptr;
+    uint32_t segments = 1000; /* segments^2 triangles */
+    int w = 1000;
+    int h = 1000;
+};
+
+static double since(const std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double peak_mb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0;
+}
+
+/* a ray through every pixel centre of a camera at (0, 0, 3) looking down
+ * -z at the unit box, then a shadow ray from every hit to the light
+ */
+template <typename T>
+static void trace(const MeshData& data, const BenchOptions& opts, const char *name) {
+    typedef tvec3<T> V;
+    auto start = std::chrono::steady_clock::now();
+    TTriangleMesh<T> mesh(data, 0);
+    const double build = since(start);
+
+    const V eye(0, 0, 3);
+    const V light(5, 5, 5);
+    std::vector<TRay<T>> rays;
+    rays.reserve(size_t(opts.w) * opts.h);
+    for (int i = 0; i < opts.h; i++) {
+        for (int j = 0; j < opts.w; j++) {
+            V d(T(-1.2 + 2.4 * (j + 0.5) / opts.w), T(1.2 - 2.4 * (i + 0.5) / opts.h), T(-2.0));
+            d.normalize();
+            rays.push_back(TRay<T>(eye, d));
+        }
+    }
+
+    std::vector<TRay<T>> shadows;
+    std::vector<T> lengths;
+    start = std::chrono::steady_clock::now();
+    for (const auto& r : rays) {
+        THit<T> hit;
+        hit.t = std::numeric_limits<T>::max();
+        if (mesh.intersect(r, hit)) {
+            const V p = hit.offset(r.origin() + r.direction() * hit.t, !hit.inside);
+            V d = light - p;
+            const T len = std::sqrt(dot(d, d));
+            d.normalize();
+            shadows.push_back(TRay<T>(p, d));
+            lengths.push_back(len);
+        }
+    }
+    const double closest = since(start);
+
+    size_t blocked = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < shadows.size(); i++) {
+        blocked += mesh.occluded(shadows[i], lengths[i]);
+    }
+    const double occlusion = since(start);
+
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(8) << name << std::setw(12) << build * 1e3 << std::setw(10) << mesh.nodes()
+              << std::setw(10) << mesh.bytes() / 1048576.0
+              << std::setw(10) << shadows.size() * 100.0 / rays.size()
+              << std::setw(14) << rays.size() / closest * 1e-6
+              << std::setw(10) << blocked * 100.0 / std::max<size_t>(1, shadows.size())
+              << std::setw(14) << shadows.size() / occlusion * 1e-6 << "\n";
+}
+
+/* rays from inside a closed mesh through its vertices and edge midpoints,
+ * where the edge tests of neighbours are exactly zero. returns the misses
+ */
+template <typename T>
+static size_t leaks(const MeshData& data, const double centre[3]) {
+    typedef tvec3<T> V;
+    TTriangleMesh<T> mesh(data, 0);
+    const V o = V(T(centre[0]), T(centre[1]), T(centre[2]));
+    size_t missed = 0;
+    auto shoot = [&](const V& p) {
+        V d = p - o;
+        d.normalize();
+        THit<T> hit;
+        hit.t = std::numeric_limits<T>::max();
+        missed += !mesh.intersect(TRay<T>(o, d), hit);
+    };
+    for (uint32_t v = 0; v < data.vertices(); v++) {
+        shoot(V(T(data.x[v]), T(data.y[v]), T(data.z[v])));
+    }
+    for (size_t i = 0; i < data.index.size(); i++) {
+        const uint32_t a = data.index[i];
+        const uint32_t b = data.index[i % 3 == 2 ? i - 2 : i + 1];
+        shoot(V(T(0.5 * (data.x[a] + data.x[b])), T(0.5 * (data.y[a] + data.y[b])), T(0.5 * (data.z[a] + data.z[b]))));
+    }
+    return missed;
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--mesh") && i + 1 < argc) {
+            opts.mesh = argv[++i];
+        } else if (0 == strcmp(argv[i], "--save") && i + 1 < argc) {
+            opts.save = argv[++i];
+        } else if (0 == strcmp(argv[i], "--segments") && i + 1 < argc) {
+            opts.segments = std::max(4, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--size") && i + 2 < argc) {
+            opts.w = std::max(1, atoi(argv[++i]));
+            opts.h = std::max(1, atoi(argv[++i]));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--mesh FILE | --segments N] [--save FILE.ply] [--size W H]\n";
+            return 1;
+        }
+    }
+
+    MeshData data;
+    std::string err;
+    const double centre[3] = { 0.0, 0.0, 0.0 };
+    auto start = std::chrono::steady_clock::now();
+    if (opts.mesh) {
+        if (!load_mesh(opts.mesh, data, err)) {
+            std::cerr << err << "\n";
+            return 1;
+        }
+        std::cout << opts.mesh << ": loaded in ";
+    } else {
+        make_lumpy_sphere(data, centre, 1.0, opts.segments / 2, opts.segments);
+        std::cout << "lumpy sphere: generated in ";
+    }
+    std::cout << std::fixed << std::setprecision(2) << since(start) * 1e3 << " ms, "
+              << data.vertices() << " vertices, " << data.triangles() << " triangles\n";
+
+    if (opts.save) {
+        if (!save_ply(opts.save, data, err)) {
+            std::cerr << err << "\n";
+            return 1;
+        }
+        MeshData back;
+        start = std::chrono::steady_clock::now();
+        if (!load_mesh(opts.save, back, err)) {
+            std::cerr << err << "\n";
+            return 1;
+        }
+        const double seconds = since(start);
+        struct stat st;
+        stat(opts.save, &st);
+        std::cout << opts.save << ": " << st.st_size / 1048576.0 << " MB read back in " << seconds * 1e3 << " ms ("
+                  << st.st_size / 1048576.0 / seconds << " MB/s), " << back.triangles() << " triangles\n";
+    }
+
+    std::cout << opts.w << "x" << opts.h << " primary rays, one shadow ray per hit\n"
+              << std::setw(8) << "type" << std::setw(12) << "build ms" << std::setw(10) << "nodes"
+              << std::setw(10) << "MB" << std::setw(10) << "hit %" << std::setw(14) << "closest Mr/s"
+              << std::setw(10) << "shadow %" << std::setw(14) << "occluded Mr/s" << "\n";
+    trace<double>(data, opts, "double");
+    trace<float>(data, opts, "float");
+
+    if (!opts.mesh) {
+        std::cout << "watertight: " << data.vertices() + data.index.size() << " rays through vertices and edges, "
+                  << leaks<double>(data, centre) << " missed in double, " << leaks<float>(data, centre) << " in float\n";
+    }
+    std::cout << "peak memory " << peak_mb() << " MB\n";
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "geometry.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/* hit point offsetting under grazing rays. rays are shot almost tangent to
+ * spheres of very different size and distance from the origin, where the
+ * hit distance and so the hit point carry the largest error. every hit is
+ * moved outwards and inwards with the old fixed step bias loop and with
+ * the analytic Sphere::offset, reporting the loop iterations each needs
+ */
+
+struct BenchOptions {
+    size_t rays = 20000;
+};
+
+// Old bias step, float needs a larger one or the step is lost in rounding
+template <typename T> inline T loop_bias();
+template <> inline double loop_bias<double>() { return 1e-7; }
+template <> inline float loop_bias<float>() { return 1e-5f; }
+
+// Give up on the bias loop after this many steps
+constexpr uint64_t LOOP_CAP = 1ull << 20;
+
+/* the loops offset() replaced, returns the steps taken */
+template <typename T>
+static uint64_t bias_loop(const TSphere<T>& s, tvec3<T>& p, const bool outwards) {
+    const T r2 = s.radius() * s.radius();
+    tvec3<T> nor = outwards ? p - s.origin() : s.origin() - p;
+    nor.normalize();
+    uint64_t steps = 0;
+    for (;;) {
+        const T d2 = dot(p - s.origin(), p - s.origin());
+        if ((outwards ? d2 >= r2 : d2 <= r2) || steps == LOOP_CAP) {
+            break;
+        }
+        p += nor * loop_bias<T>();
+        steps++;
+    }
+    return steps;
+}
+
+/* strictly on the requested side, the condition the old loops exit on */
+template <typename T>
+static bool on_side(const TSphere<T>& s, const tvec3<T>& p, const bool outwards) {
+    const T d2 = dot(p - s.origin(), p - s.origin());
+    const T r2 = s.radius() * s.radius();
+    return outwards ? d2 >= r2 : d2 <= r2;
+}
+
+struct OffsetResult {
+    size_t hits = 0;
+    uint64_t loop_max = 0;
+    uint64_t loop_total = 0;
+    size_t loop_capped = 0;
+    uint64_t offset_max = 0; /* loop steps still needed after offset() */
+    size_t offset_wrong = 0;
+    double loop_sec = 0.0;
+    double offset_sec = 0.0;
+};
+
+template <typename T>
+static OffsetResult run(const BenchOptions& opts) {
+    typedef tvec3<T> V;
+    /* the demo scene ground and spheres, plus a tiny and a huge far one */
+    std::vector<TSphere<T>> spheres;
+    spheres.push_back(TSphere<T>(V(0, -100.5, -2.25), 100, 0));
+    spheres.push_back(TSphere<T>(V(0, 0, -2.25), 0.5, 0));
+    spheres.push_back(TSphere<T>(V(-0.25, -0.35, -1.5), 0.15, 0));
+    spheres.push_back(TSphere<T>(V(40, 3, -60), 0.01, 0));
+    spheres.push_back(TSphere<T>(V(0, -1e4, 0), 1e4 - 1, 0));
+
+    OffsetResult res;
+    unsigned short xsubi[3] = { 0x330E, 0xABCD, 0x1234 };
+    for (size_t i = 0; i < opts.rays; i++) {
+        const TSphere<T>& s = spheres[i % spheres.size()];
+        /* random surface point, a tangent through it tilted inwards by an
+         * angle between 1e-1 and 1e-7 radians
+         */
+        V n(T(erand48(xsubi) - 0.5), T(erand48(xsubi) - 0.5), T(erand48(xsubi) - 0.5));
+        n.normalize();
+        V t = cross(n, V(T(erand48(xsubi) - 0.5), T(erand48(xsubi) - 0.5), T(erand48(xsubi) - 0.5)));
+        t.normalize();
+        const T tilt = T(std::pow(10.0, -1.0 - 6.0 * erand48(xsubi)));
+        V d = t - n * tilt;
+        d.normalize();
+        const V target = s.origin() + n * s.radius();
+        const T dist = s.radius() * T(0.5 + 20.0 * erand48(xsubi));
+        const TRay<T> ray(target - d * dist, d);
+
+        THit<T> hit;
+        if (!s.closest_hit(ray, hit)) {
+            continue;
+        }
+        res.hits++;
+        const V pos = ray.parameterize_at(hit.t);
+
+        for (int side = 0; side < 2; side++) {
+            const bool outwards = side == 0;
+
+            V p = pos;
+            auto start = std::chrono::steady_clock::now();
+            const uint64_t steps = bias_loop(s, p, outwards);
+            res.loop_sec += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            res.loop_max = std::max(res.loop_max, steps);
+            res.loop_total += steps;
+            res.loop_capped += steps == LOOP_CAP ? 1 : 0;
+
+            start = std::chrono::steady_clock::now();
+            V q = s.offset(pos, outwards);
+            res.offset_sec += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            res.offset_wrong += on_side(s, q, outwards) ? 0 : 1;
+            res.offset_max = std::max(res.offset_max, bias_loop(s, q, outwards));
+        }
+    }
+    return res;
+}
+
+static void report(const char *name, const OffsetResult& r) {
+    const double n = 2.0 * std::max<size_t>(1, r.hits);
+    std::cout << std::setw(8) << name << std::setw(10) << r.hits
+              << std::setw(14) << r.loop_max << std::setw(12) << std::fixed << std::setprecision(2) << r.loop_total / n
+              << std::setw(10) << r.loop_capped << std::setw(12) << r.loop_sec / n * 1e9
+              << std::setw(14) << r.offset_max << std::setw(10) << r.offset_wrong
+              << std::setw(12) << r.offset_sec / n * 1e9 << "\n";
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--rays") && i + 1 < argc) {
+            opts.rays = std::max(1ull, strtoull(argv[++i], nullptr, 10));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--rays N]\n";
+            return 1;
+        }
+    }
+
+    std::cout << "grazing rays, bias loop (before) vs analytic offset (after), both sides of every hit\n";
+    std::cout << std::setw(8) << "type" << std::setw(10) << "hits"
+              << std::setw(14) << "loop max it" << std::setw(12) << "loop mean"
+              << std::setw(10) << "capped" << std::setw(12) << "loop ns"
+              << std::setw(14) << "offset max it" << std::setw(10) << "wrong"
+              << std::setw(12) << "offset ns" << "\n";
+    report("double", run<double>(opts));
+    report("float", run<float>(opts));
+    return 0;
+}
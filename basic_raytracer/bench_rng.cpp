@@ -0,0 +1,150 @@
+#include "rng.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/* random number throughput. the global drand48 the sample loop used to
+ * call, erand48 with per pixel state as the threaded renderer does, and
+ * the counter based SampleRng drawn in order and by dimension. every
+ * generator fills the same (pixel, sample, dimension) grid, and a chi
+ * square over a 2D histogram of the first two dimensions checks the
+ * jitter is still uniform
+ */
+
+struct BenchOptions {
+    uint32_t pixels = 1 << 16;
+    uint32_t spp = 16;
+    uint32_t dims = 8;
+};
+
+// Histogram cells per axis of the uniformity check
+constexpr int CHI_CELLS = 32;
+
+struct Result {
+    double seconds = 0.0;
+    double sum = 0.0; /* keeps the draws alive, mean check */
+    double chi2 = 0.0;
+};
+
+class Histogram {
+public:
+    Histogram() : _cells(CHI_CELLS * CHI_CELLS, 0) {}
+    inline void add(const double x, const double y) {
+        _cells[int(y * CHI_CELLS) * CHI_CELLS + int(x * CHI_CELLS)]++;
+        _n++;
+    }
+    double chi2() const {
+        const double expect = double(_n) / _cells.size();
+        double c = 0.0;
+        for (const uint64_t k : _cells) {
+            c += (k - expect) * (k - expect) / expect;
+        }
+        return c;
+    }
+private:
+    std::vector<uint64_t> _cells;
+    uint64_t _n = 0;
+};
+
+template <typename F>
+static Result run(const BenchOptions& opts, F draw_sample) {
+    Result res;
+    Histogram h;
+    std::vector<double> u(opts.dims);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t p = 0; p < opts.pixels; p++) {
+        for (uint32_t s = 0; s < opts.spp; s++) {
+            draw_sample(p, s, u.data());
+            for (uint32_t d = 0; d < opts.dims; d++) {
+                res.sum += u[d];
+            }
+            h.add(u[0], u[1]);
+        }
+    }
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    res.chi2 = h.chi2();
+    return res;
+}
+
+static void report(const char *name, const BenchOptions& opts, const Result& r, const double base) {
+    const double n = double(opts.pixels) * opts.spp * opts.dims;
+    std::cout << std::setw(20) << name << std::setw(12) << std::fixed << std::setprecision(2) << n / r.seconds * 1e-6
+              << std::setw(10) << r.seconds / n * 1e9 << std::setw(10) << base / r.seconds
+              << std::setw(10) << std::setprecision(4) << r.sum / n
+              << std::setw(10) << std::setprecision(1) << r.chi2 << "\n";
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--pixels") && i + 1 < argc) {
+            opts.pixels = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--spp") && i + 1 < argc) {
+            opts.spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--dims") && i + 1 < argc) {
+            opts.dims = std::max(2, atoi(argv[++i]));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--pixels N] [--spp N] [--dims N]\n";
+            return 1;
+        }
+    }
+
+    const uint64_t seed = 7;
+    std::cout << opts.pixels << " pixels x " << opts.spp << " spp x " << opts.dims << " dimensions\n"
+              << std::setw(20) << "generator" << std::setw(12) << "M/s" << std::setw(10) << "ns"
+              << std::setw(10) << "speedup" << std::setw(10) << "mean"
+              << std::setw(10) << "chi2" << "  (" << CHI_CELLS * CHI_CELLS - 1 << " dof)\n";
+
+    srand48(long(seed));
+    const uint32_t dims = opts.dims;
+    const Result drand = run(opts, [dims](uint32_t, uint32_t, double *u) {
+        for (uint32_t d = 0; d < dims; d++) {
+            u[d] = drand48();
+        }
+    });
+    report("drand48", opts, drand, drand.seconds);
+
+    /* harness cost: the same loops storing a constant */
+    const Result none = run(opts, [dims](uint32_t, uint32_t s, double *u) {
+        for (uint32_t d = 0; d < dims; d++) {
+            u[d] = (s & 1) ? 0.25 : 0.75;
+        }
+    });
+
+    std::vector<unsigned short> state(size_t(opts.pixels) * 3);
+    for (uint32_t p = 0; p < opts.pixels; p++) {
+        state[p * 3 + 0] = 0x330E;
+        state[p * 3 + 1] = (unsigned short)p;
+        state[p * 3 + 2] = (unsigned short)(p >> 16);
+    }
+    const Result erand = run(opts, [dims, &state](uint32_t p, uint32_t, double *u) {
+        for (uint32_t d = 0; d < dims; d++) {
+            u[d] = erand48(&state[p * 3]);
+        }
+    });
+    report("erand48 per pixel", opts, erand, drand.seconds);
+
+    const Result seq = run(opts, [dims, seed](uint32_t p, uint32_t s, double *u) {
+        SampleRng rng(seed, p, s);
+        for (uint32_t d = 0; d < dims; d++) {
+            u[d] = rng.next();
+        }
+    });
+    report("philox next", opts, seq, drand.seconds);
+
+    const Result direct = run(opts, [dims, seed](uint32_t p, uint32_t s, double *u) {
+        const SampleRng rng(seed, p, s);
+        for (uint32_t d = 0; d < dims; d++) {
+            u[d] = rng.uniform(d);
+        }
+    });
+    report("philox uniform(d)", opts, direct, drand.seconds);
+    std::cout << "harness overhead " << std::fixed << std::setprecision(2)
+              << none.seconds / (double(opts.pixels) * opts.spp * opts.dims) * 1e9 << " ns per number\n";
+    return 0;
+}
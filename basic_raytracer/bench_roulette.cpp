@@ -0,0 +1,196 @@
+#include "tracer.hpp"
+#include "camera.hpp"
+#include "sampler.hpp"
+#include "scene_io.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* path termination on a scene file: the recursive tracer walks every ray
+ * tree to TRACE_DEPTH, the iterative one prunes branches below a path
+ * weight (biased, the renderer default), russian roulette drops branches
+ * at random and scales up the survivors (unbiased). every policy renders
+ * the same sub pixel points, its time, rays per primary ray, mean ray
+ * depth and error against a finely pruned high spp reference are
+ * reported. roulette trades the rays it saves for noise, the mean
+ * difference should stay near zero where pruning darkens the image
+ */
+
+struct BenchOptions {
+    const char *scene = "scenes/demo.scene";
+    int width = 96;
+    int height = 72;
+    int spp = 8;
+    int ref_spp = 64;
+};
+
+// Path weight pruning of the reference, far below what a pixel resolves
+constexpr double REF_MIN_WEIGHT = 1e-6;
+
+/* how one row of the table terminates paths */
+struct Policy {
+    std::string name;
+    bool recursive;
+    double min_weight;
+    RoulettePolicy roulette;
+    uint depth;
+    double p;
+};
+
+struct Result {
+    double seconds;
+    double rays_per_primary;
+    double mean_depth;
+};
+
+static TraceStats counters() {
+    return StatsRegistry::instance().collect();
+}
+
+/* returns seconds, the ray counters of the render go to res */
+static double render(Scene& scene, const View& view, const Sampler& sampler, const uint64_t seed, const int spp, const Policy& pol, std::vector<vec3>& img, Result& res) {
+    scene.roulette = pol.roulette;
+    scene.roulette_depth = pol.depth;
+    scene.roulette_p = pol.p;
+    const TraceStats before = counters();
+    img.assign(size_t(view.width) * view.height, vec3());
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < view.height; i++) {
+        for (int j = 0; j < view.width; j++) {
+            vec3 sum;
+            for (int k = 0; k < spp; k++) {
+                double uv[2];
+                sampler.get_2d(j, i, uint32_t(i * view.width + j), uint32_t(k), 0, uv);
+                const Ray r = camera_ray<double>(view, j, i, uv[0], uv[1]);
+                const SampleRng rng(seed, uint32_t(i * view.width + j), uint32_t(k));
+                sum += pol.recursive ? tracer(scene, r, 0, rng) : trace_path(scene, r, pol.min_weight, rng);
+            }
+            img[i * view.width + j] = sum * (1.0 / spp);
+        }
+    }
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const TraceStats after = counters();
+    TraceStats delta;
+    for (int d = 0; d < STATS_DEPTH_BINS; d++) {
+        delta.depth[d] = after.depth[d] - before.depth[d];
+    }
+    const uint64_t primary = after.primary_rays - before.primary_rays;
+    res.rays_per_primary = primary ? double(after.rays - before.rays) / primary : 0.0;
+    res.mean_depth = delta.mean_depth();
+    return res.seconds;
+}
+
+/* root mean square over channels relative to the reference mean, and the
+ * relative difference of the image means
+ */
+static void error(const std::vector<vec3>& ref, const std::vector<vec3>& img, double& rel_rmse, double& bias) {
+    double se = 0.0;
+    double sum = 0.0;
+    double diff = 0.0;
+    for (size_t i = 0; i < ref.size(); i++) {
+        for (int c = 0; c < 3; c++) {
+            const double d = img[i][c] - ref[i][c];
+            se += d * d;
+            diff += d;
+            sum += ref[i][c];
+        }
+    }
+    const double n = 3.0 * ref.size();
+    rel_rmse = std::sqrt(se / n) / (sum / n);
+    bias = diff / sum;
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--scene") && i + 1 < argc) {
+            opts.scene = argv[++i];
+        } else if (0 == strcmp(argv[i], "--size") && i + 2 < argc) {
+            opts.width = std::max(1, atoi(argv[++i]));
+            opts.height = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--spp") && i + 1 < argc) {
+            opts.spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--ref-spp") && i + 1 < argc) {
+            opts.ref_spp = std::max(1, atoi(argv[++i]));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--scene FILE] [--size W H] [--spp N] [--ref-spp N]\n";
+            return 1;
+        }
+    }
+#if !TRACE_STATS
+    std::cout << "ray counts need TRACE_STATS, the path length columns are zero\n";
+#endif
+
+    SceneDesc desc;
+    std::string err;
+    if (!desc.load(opts.scene, err)) {
+        std::cerr << opts.scene << ": " << err << "\n";
+        return 1;
+    }
+    desc.settings.width = opts.width;
+    desc.settings.height = opts.height;
+    const View view = make_view(desc);
+
+    std::vector<Sphere *> objects;
+    for (size_t i = 0; i < desc.sphere_count(); i++) {
+        objects.push_back(&desc.spheres()[i]);
+    }
+    BVH bvh(objects);
+    Scene scene;
+    scene.accel = &bvh;
+    for (size_t i = 0; i < desc.light_count(); i++) {
+        const LightRecord& l = desc.lights()[i];
+        scene.lights.push_back(new ConstantLight(vec3(l.origin[0], l.origin[1], l.origin[2]),
+            vec3(l.illumination[0], l.illumination[1], l.illumination[2]), l.energy));
+    }
+    for (size_t i = 0; i < desc.material_count(); i++) {
+        scene.materials.push_back(to_material(desc.materials()[i]));
+    }
+    scene.eye = view.eye;
+
+    std::vector<vec3> ref, img;
+    Result res;
+    const Policy ref_policy = { "reference", false, REF_MIN_WEIGHT, ROULETTE_OFF, 0, 1.0 };
+    render(scene, view, RandomSampler(7), 7, opts.ref_spp, ref_policy, ref, res);
+    std::cout << view.width << "x" << view.height << " at " << opts.spp << " spp, one thread, reference " << opts.ref_spp
+              << " spp pruned at " << REF_MIN_WEIGHT << " in " << std::fixed << std::setprecision(2) << res.seconds << " s\n";
+
+    const Policy policies[] = {
+        { "full tree", true, 0.0, ROULETTE_OFF, 0, 1.0 },
+        { "pruned 1e-3", false, 1e-3, ROULETTE_OFF, 0, 1.0 },
+        { "weight depth 1", false, 0.0, ROULETTE_WEIGHT, 1, TRACE_ROULETTE_FLOOR },
+        { "weight depth 2", false, 0.0, ROULETTE_WEIGHT, 2, TRACE_ROULETTE_FLOOR },
+        { "weight depth 3", false, 0.0, ROULETTE_WEIGHT, 3, TRACE_ROULETTE_FLOOR },
+        { "weight depth 5", false, 0.0, ROULETTE_WEIGHT, 5, TRACE_ROULETTE_FLOOR },
+        { "weight d3 p 0.2", false, 0.0, ROULETTE_WEIGHT, 3, 0.2 },
+        { "fixed depth 3", false, 0.0, ROULETTE_FIXED, 3, TRACE_ROULETTE_FIXED },
+        { "fixed depth 3 p 0.8", false, 0.0, ROULETTE_FIXED, 3, 0.8 },
+    };
+    std::cout << std::setw(20) << "policy" << std::setw(11) << "time ms" << std::setw(9) << "saved" << std::setw(12) << "rays/prim"
+              << std::setw(12) << "mean depth" << std::setw(11) << "rel rmse" << std::setw(11) << "mean diff" << "\n";
+    double full = 0.0;
+    const RandomSampler sampler(1);
+    for (const Policy& pol : policies) {
+        const double sec = render(scene, view, sampler, 1, opts.spp, pol, img, res);
+        if (pol.recursive) {
+            full = sec;
+        }
+        double rmse, bias;
+        error(ref, img, rmse, bias);
+        std::cout << std::setw(20) << pol.name << std::fixed << std::setprecision(2) << std::setw(11) << sec * 1e3
+                  << std::setw(8) << (1.0 - sec / full) * 100.0 << "%" << std::setw(12) << res.rays_per_primary
+                  << std::setw(12) << res.mean_depth << std::setprecision(4) << std::setw(11) << rmse
+                  << std::setw(11) << bias << std::endl;
+    }
+
+    for (auto l : scene.lights) {
+        delete l;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include "tracer.hpp"
+#include "camera.hpp"
+#include "sampler.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/* convergence of the samplers on a scene file. a high spp sobol render
+ * with its own seed is the reference, every sampler renders the scene at
+ * power of two sample counts and the RMSE against the reference is
+ * written as CSV (sampler,spp,rmse,seconds) for plotting. comment lines
+ * at the end give the spp each sampler needs to match random at the
+ * largest count
+ */
+
+// Path weight pruning of the renderer default
+constexpr double MIN_WEIGHT = 1e-3;
+
+struct BenchOptions {
+    const char *scene = "scenes/demo.scene";
+    int width = 96;
+    int height = 72;
+    int max_spp = 64;
+    int ref_spp = 512;
+};
+
+static double render(const Scene& scene, const View& view, const Sampler& sampler, const int spp, std::vector<vec3>& img) {
+    img.assign(size_t(view.width) * view.height, vec3());
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < view.height; i++) {
+        for (int j = 0; j < view.width; j++) {
+            vec3 res;
+            for (int k = 0; k < spp; k++) {
+                double uv[2];
+                sampler.get_2d(j, i, uint32_t(i * view.width + j), uint32_t(k), 0, uv);
+                res += trace_path(scene, camera_ray<double>(view, j, i, uv[0], uv[1]), MIN_WEIGHT, SampleRng(0, uint32_t(i * view.width + j), uint32_t(k)));
+            }
+            img[i * view.width + j] = res * (1.0 / spp);
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double rmse(const std::vector<vec3>& a, const std::vector<vec3>& b) {
+    double s = 0.0;
+    for (size_t i = 0; i < a.size(); i++) {
+        const vec3 d = a[i] - b[i];
+        s += dot(d, d);
+    }
+    return std::sqrt(s / (3.0 * a.size()));
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--scene") && i + 1 < argc) {
+            opts.scene = argv[++i];
+        } else if (0 == strcmp(argv[i], "--size") && i + 2 < argc) {
+            opts.width = std::max(1, atoi(argv[++i]));
+            opts.height = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--max-spp") && i + 1 < argc) {
+            opts.max_spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--ref-spp") && i + 1 < argc) {
+            opts.ref_spp = std::max(1, atoi(argv[++i]));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--scene FILE] [--size W H] [--max-spp N] [--ref-spp N]\n";
+            return 1;
+        }
+    }
+
+    SceneDesc desc;
+    std::string err;
+    if (!desc.load(opts.scene, err)) {
+        std::cerr << opts.scene << ": " << err << "\n";
+        return 1;
+    }
+    /* the camera spans the same canvas at the bench resolution */
+    desc.settings.width = opts.width;
+    desc.settings.height = opts.height;
+    const View view = make_view(desc);
+
+    std::vector<Sphere *> objects;
+    for (size_t i = 0; i < desc.sphere_count(); i++) {
+        objects.push_back(&desc.spheres()[i]);
+    }
+    BVH bvh(objects);
+    Scene scene;
+    scene.accel = &bvh;
+    for (size_t i = 0; i < desc.light_count(); i++) {
+        const LightRecord& l = desc.lights()[i];
+        scene.lights.push_back(new ConstantLight(vec3(l.origin[0], l.origin[1], l.origin[2]),
+            vec3(l.illumination[0], l.illumination[1], l.illumination[2]), l.energy));
+    }
+    for (size_t i = 0; i < desc.material_count(); i++) {
+        scene.materials.push_back(to_material(desc.materials()[i]));
+    }
+    scene.eye = view.eye;
+
+    std::vector<vec3> ref, img;
+    {
+        SobolSampler s(0x9e3779b9);
+        const double sec = render(scene, view, s, opts.ref_spp, ref);
+        std::cout << "# reference: sobol " << opts.ref_spp << " spp, " << view.width << "x" << view.height
+                  << ", " << std::fixed << std::setprecision(2) << sec << " s\n" << std::defaultfloat;
+    }
+
+    const char *names[] = { "random", "stratified", "sobol", "bluenoise" };
+    std::vector<std::vector<double>> errors;
+    std::cout << "sampler,spp,rmse,seconds\n";
+    for (const char *name : names) {
+        errors.push_back(std::vector<double>());
+        for (int spp = 1; spp <= opts.max_spp; spp *= 2) {
+            Sampler *s = make_sampler(name, 1, spp);
+            const double sec = render(scene, view, *s, spp, img);
+            delete s;
+            errors.back().push_back(rmse(img, ref));
+            std::cout << name << "," << spp << "," << std::scientific << std::setprecision(4) << errors.back().back()
+                      << "," << std::fixed << std::setprecision(4) << sec << "\n" << std::defaultfloat;
+        }
+    }
+
+    /* spp at which each sampler first reaches the random error at the top
+     * count, log interpolated between the measured counts
+     */
+    const double target = errors[0].back();
+    for (size_t n = 0; n < errors.size(); n++) {
+        const std::vector<double>& e = errors[n];
+        double spp = -1.0;
+        for (size_t k = 0; k < e.size(); k++) {
+            if (e[k] <= target) {
+                spp = double(1 << k);
+                if (k > 0 && e[k - 1] > target) {
+                    const double t = std::log(e[k - 1] / target) / std::log(e[k - 1] / e[k]);
+                    spp = std::pow(2.0, k - 1 + t);
+                }
+                break;
+            }
+        }
+        std::cout << "# " << names[n] << " matches random at " << opts.max_spp << " spp with ";
+        if (spp > 0) {
+            std::cout << std::fixed << std::setprecision(1) << spp << " spp\n" << std::defaultfloat;
+        } else {
+            std::cout << "more than " << opts.max_spp << " spp\n";
+        }
+    }
+
+    for (auto l : scene.lights) {
+        delete l;
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "bvh.hpp"
+#include "scene_io.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+/* scene loading at scale. a random field of spheres is written as text and
+ * as binary, then each is loaded back and timed, together with the BVH
+ * build over the loaded spheres for scale
+ */
+
+struct BenchOptions {
+    size_t spheres = 1000000;
+    std::string prefix = "bench_scene";
+};
+
+static void random_scene(SceneDesc& desc, const size_t n) {
+    desc.settings = RenderSettings { 1600, 1200, 40, 0 };
+    desc.camera = CameraRecord { { 0, -0.15, 0 }, { -2, 1, -2 }, { 4, 0, 0 }, { 0, -3, 0 } };
+    for (int i = 0; i < 16; i++) {
+        const double c = i / 16.0;
+        desc.add_material(MaterialRecord { { c, 0.5, 1 - c }, { c, 0.5, 1 - c }, double(1 << (i % 7)), 1.3, uint32_t(i % 5 == 0), 0 });
+    }
+    desc.add_light(LightRecord { { 100, 0, 100 }, { 1, 1, 1 }, 1e4 });
+    unsigned short xsubi[3] = { 0x330E, 0xABCD, 0x1234 };
+    for (size_t i = 0; i < n; i++) {
+        const vec3 c(erand48(xsubi) * 200 - 100, erand48(xsubi) * 200 - 100, -erand48(xsubi) * 200 - 2);
+        desc.add_sphere(Sphere(c, 0.01 + 0.2 * erand48(xsubi), uint32_t(i % 16)));
+    }
+}
+
+static double since(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e3;
+}
+
+static bool load(const char *name, const std::string& path, const size_t n) {
+    std::string err;
+    auto start = std::chrono::steady_clock::now();
+    SceneDesc desc;
+    if (!desc.load(path.c_str(), err)) {
+        std::cerr << path << ": " << err << "\n";
+        return false;
+    }
+    const double load_ms = since(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<Sphere *> objects;
+    objects.reserve(desc.sphere_count());
+    for (size_t i = 0; i < desc.sphere_count(); i++) {
+        objects.push_back(&desc.spheres()[i]);
+    }
+    BVH bvh(objects);
+    const double bvh_ms = since(start);
+
+    std::cout << std::setw(8) << name << std::setw(12) << desc.sphere_count()
+              << std::setw(12) << std::fixed << std::setprecision(2) << load_ms
+              << std::setw(14) << load_ms * 1e6 / std::max<size_t>(1, n)
+              << std::setw(12) << bvh_ms << "\n";
+    return desc.sphere_count() == n;
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--spheres") && i + 1 < argc) {
+            opts.spheres = std::max(1ull, strtoull(argv[++i], nullptr, 10));
+        } else if (0 == strcmp(argv[i], "--prefix") && i + 1 < argc) {
+            opts.prefix = argv[++i];
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--spheres N] [--prefix PATH]\n";
+            return 1;
+        }
+    }
+
+    const std::string text = opts.prefix + ".scene";
+    const std::string binary = opts.prefix + ".bin";
+    std::string err;
+    {
+        SceneDesc desc;
+        random_scene(desc, opts.spheres);
+        auto start = std::chrono::steady_clock::now();
+        if (!desc.save_text(text.c_str(), err)) {
+            std::cerr << err << "\n";
+            return 1;
+        }
+        const double text_ms = since(start);
+        start = std::chrono::steady_clock::now();
+        if (!desc.save_binary(binary.c_str(), err)) {
+            std::cerr << err << "\n";
+            return 1;
+        }
+        std::cout << "saved " << opts.spheres << " spheres: text " << std::fixed << std::setprecision(2)
+                  << text_ms << " ms, binary " << since(start) << " ms\n";
+    }
+
+    std::cout << std::setw(8) << "format" << std::setw(12) << "spheres"
+              << std::setw(12) << "load ms" << std::setw(14) << "ns/sphere"
+              << std::setw(12) << "bvh ms" << "\n";
+    const bool ok = load("text", text, opts.spheres) && load("binary", binary, opts.spheres);
+    remove(text.c_str());
+    remove(binary.c_str());
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+#include "simd_sphere.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/* rays/sec of the SoA sphere kernels on every ISA path this CPU supports:
+ * one ray against all spheres (closest hit and occlusion) and 8 ray
+ * packets against all spheres. hits and distances must match the scalar
+ * path bit for bit
+ */
+
+struct BenchOptions {
+    size_t spheres = 64;
+    size_t rays = 1 << 20;
+};
+
+struct RaySet {
+    std::vector<double> o, d; /* xyz interleaved */
+};
+
+static void make_input(const BenchOptions& opts, std::vector<Material>& mats, std::vector<Sphere *>& objects, RaySet& rays) {
+    unsigned short xsubi[3] = { 0x330E, 0xABCD, 0x1234 };
+    mats.push_back(Material(vec3(0.8, 0.2, 0.2), vec3(0.8, 0.2, 0.2), 2.0, false, 0.0));
+    mats.push_back(Material(vec3(0.2, 0.35, 0.5), vec3(0.2, 0.35, 0.5), 16.0, false, 0.0));
+    for (size_t i = 0; i < opts.spheres; i++) {
+        vec3 o(-2.0 + 4.0 * erand48(xsubi), -2.0 + 4.0 * erand48(xsubi), -6.0 + 4.0 * erand48(xsubi));
+        objects.push_back(new Sphere(o, 0.05 + 0.4 * erand48(xsubi), uint32_t(i % mats.size())));
+    }
+    rays.o.resize(opts.rays * 3);
+    rays.d.resize(opts.rays * 3);
+    for (size_t i = 0; i < opts.rays; i++) {
+        /* from around the eye towards the sphere box */
+        vec3 o(-0.5 + erand48(xsubi), -0.5 + erand48(xsubi), erand48(xsubi));
+        vec3 target(-2.0 + 4.0 * erand48(xsubi), -2.0 + 4.0 * erand48(xsubi), -6.0 + 4.0 * erand48(xsubi));
+        vec3 d = target - o;
+        d.normalize();
+        for (int a = 0; a < 3; a++) {
+            rays.o[i * 3 + a] = o[a];
+            rays.d[i * 3 + a] = d[a];
+        }
+    }
+}
+
+static double seconds_since(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--spheres") && i + 1 < argc) {
+            opts.spheres = std::max(1ull, strtoull(argv[++i], nullptr, 10));
+        } else if (0 == strcmp(argv[i], "--rays") && i + 1 < argc) {
+            opts.rays = std::max(8ull, strtoull(argv[++i], nullptr, 10)) / 8 * 8;
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--spheres N] [--rays N]\n";
+            return 1;
+        }
+    }
+
+    std::vector<Material> mats;
+    std::vector<Sphere *> objects;
+    RaySet rays;
+    make_input(opts, mats, objects, rays);
+    SphereSoA soa(objects);
+
+    std::cout << opts.rays << " rays x " << opts.spheres << " spheres, detected " << isa_name(detect_isa()) << "\n";
+    std::cout << std::setw(8) << "isa" << std::setw(16) << "nearest Mray/s"
+              << std::setw(16) << "occlude Mray/s" << std::setw(16) << "packet Mray/s"
+              << std::setw(12) << "mismatch" << "\n";
+
+    std::vector<int> ref_hit(opts.rays);
+    std::vector<double> ref_t(opts.rays);
+    std::vector<bool> ref_occ(opts.rays);
+    const SimdIsa isas[] = { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 };
+    for (const SimdIsa isa : isas) {
+        if (!isa_supported(isa)) {
+            std::cout << std::setw(8) << isa_name(isa) << "  not supported\n";
+            continue;
+        }
+        const SphereKernels k = select_kernels(isa);
+        size_t mismatch = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < opts.rays; i++) {
+            double t = std::numeric_limits<double>::max();
+            bool inside = false;
+            int hit = k.nearest(soa, &rays.o[i * 3], &rays.d[i * 3], t, inside);
+            if (isa == SIMD_SCALAR) {
+                ref_hit[i] = hit;
+                ref_t[i] = t;
+            } else if (hit != ref_hit[i] || t != ref_t[i]) {
+                mismatch++;
+            }
+        }
+        const double nearest = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        uint64_t tests = 0;
+        for (size_t i = 0; i < opts.rays; i++) {
+            bool occ = k.occluded(soa, &rays.o[i * 3], &rays.d[i * 3], 4.0, tests);
+            if (isa == SIMD_SCALAR) {
+                ref_occ[i] = occ;
+            } else if (occ != ref_occ[i]) {
+                mismatch++;
+            }
+        }
+        const double occluded = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        RayPacket8 p;
+        for (size_t i = 0; i < opts.rays; i += 8) {
+            for (int l = 0; l < 8; l++) {
+                p.ox[l] = rays.o[(i + l) * 3 + 0];
+                p.oy[l] = rays.o[(i + l) * 3 + 1];
+                p.oz[l] = rays.o[(i + l) * 3 + 2];
+                p.dx[l] = rays.d[(i + l) * 3 + 0];
+                p.dy[l] = rays.d[(i + l) * 3 + 1];
+                p.dz[l] = rays.d[(i + l) * 3 + 2];
+                p.t[l] = std::numeric_limits<double>::max();
+                p.hit[l] = -1;
+                p.inside[l] = false;
+            }
+            for (size_t s = 0; s < soa.size(); s++) {
+                k.packet(soa, s, p);
+            }
+            for (int l = 0; l < 8; l++) {
+                if (p.hit[l] != ref_hit[i + l] || p.t[l] != ref_t[i + l]) {
+                    mismatch++;
+                }
+            }
+        }
+        const double packet = seconds_since(start);
+
+        std::cout << std::fixed << std::setprecision(2)
+                  << std::setw(8) << isa_name(isa)
+                  << std::setw(16) << opts.rays / nearest * 1e-6
+                  << std::setw(16) << opts.rays / occluded * 1e-6
+                  << std::setw(16) << opts.rays / packet * 1e-6
+                  << std::setw(12) << mismatch << std::endl;
+    }
+
+    for (auto o : objects) {
+        delete o;
+    }
+    return 0;
+}
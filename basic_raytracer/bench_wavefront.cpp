@@ -0,0 +1,179 @@
+#include "tracer.hpp"
+#include "wavefront.hpp"
+#include "camera.hpp"
+#include "scheduler.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/* depth first against wavefront tracing as the scene outgrows the caches.
+ * a cloud of mirror and glass spheres above the ground sphere, so most
+ * primary rays spawn a tree of reflection and refraction rays. the image
+ * is traced tile by tile on one thread: per sample with trace_path, and
+ * as one wavefront per tile, with and without sorting each generation
+ */
+
+struct BenchOptions {
+    int w = 320;
+    int h = 240;
+    int spp = 4;
+    int tile = 32;
+    size_t max_count = 1000000;
+    double min_weight = 1e-3;
+};
+
+static void make_scene(const size_t n, std::vector<Material>& mats, std::vector<Sphere *>& objects) {
+    mats.push_back(Material(vec3(0.087, 0.094, 0.080), vec3(0.087, 0.094, 0.080), 0.5, false, 0.0));
+    mats.push_back(Material(vec3(0.71, 0.52, 0.57), vec3(0.71, 0.52, 0.57), 1.0, false, 0.0));
+    mats.push_back(Material(vec3(0.8, 0.6, 0.2), vec3(0.8, 0.6, 0.2), 4.0, false, 0.0));
+    mats.push_back(Material(vec3(0.38, 0.82, 0.71), vec3(0.38, 0.82, 0.71), 32.0, true, 1.3));
+
+    objects.push_back(new Sphere(vec3(0, -100.5, -2.25), 100, 0));
+
+    unsigned short xsubi[3] = { 0x330E, 0xABCD, 0x1234 };
+    const double radius = 0.35 * cbrt(18.0 / n);
+    for (size_t i = 0; i < n; i++) {
+        vec3 o(-2.0 + 4.0 * erand48(xsubi), -0.5 + 1.5 * erand48(xsubi), -4.5 + 3.0 * erand48(xsubi));
+        double r = radius * (0.5 + erand48(xsubi));
+        objects.push_back(new Sphere(o, r, 1 + i % 3));
+    }
+}
+
+/* fixed sub pixel points, the same for both tracers */
+static void jitter(const int k, const int spp, double& dx, double& dy) {
+    dx = (k + 0.5) / spp;
+    dy = ((k * 7 + 3) % spp + 0.5) / spp;
+}
+
+/* returns seconds */
+static double render(const Scene& scene, const View& view, const BenchOptions& opts, const int mode, std::vector<vec3>& img) {
+    img.assign(size_t(view.width) * view.height, vec3());
+    auto start = std::chrono::steady_clock::now();
+    for (const Tile& t : split_tiles(view.width, view.height, opts.tile)) {
+        if (mode == 0) {
+            for (int i = t.y0; i < t.y1; i++) {
+                for (int j = t.x0; j < t.x1; j++) {
+                    for (int k = 0; k < view.spp; k++) {
+                        double dx, dy;
+                        jitter(k, view.spp, dx, dy);
+                        img[i * view.width + j] += trace_path(scene, camera_ray<double>(view, j, i, dx, dy), opts.min_weight,
+                            SampleRng(0, uint32_t(i * view.width + j), uint32_t(k)));
+                    }
+                }
+            }
+            continue;
+        }
+        Wavefront wave(scene, opts.min_weight, 0, mode == 2);
+        std::vector<vec3> radiance(size_t(t.x1 - t.x0) * (t.y1 - t.y0) * view.spp);
+        for (int i = t.y0; i < t.y1; i++) {
+            for (int j = t.x0; j < t.x1; j++) {
+                const uint32_t slot = uint32_t(((i - t.y0) * (t.x1 - t.x0) + j - t.x0) * view.spp);
+                for (int k = 0; k < view.spp; k++) {
+                    double dx, dy;
+                    jitter(k, view.spp, dx, dy);
+                    wave.push(camera_ray<double>(view, j, i, dx, dy), slot + k, uint32_t(i * view.width + j), uint32_t(k));
+                }
+            }
+        }
+        wave.run(radiance);
+        for (int i = t.y0; i < t.y1; i++) {
+            for (int j = t.x0; j < t.x1; j++) {
+                const size_t slot = size_t((i - t.y0) * (t.x1 - t.x0) + j - t.x0) * view.spp;
+                for (int k = 0; k < view.spp; k++) {
+                    img[i * view.width + j] += radiance[slot + k];
+                }
+            }
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double max_diff(const std::vector<vec3>& a, const std::vector<vec3>& b) {
+    double m = 0.0;
+    for (size_t i = 0; i < a.size(); i++) {
+        vec3 d = a[i] - b[i];
+        m = std::max(m, std::max(fabs(d.x()), std::max(fabs(d.y()), fabs(d.z()))));
+    }
+    return m;
+}
+
+int main(int argc, char const *argv[])
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--size") && i + 2 < argc) {
+            opts.w = std::max(1, atoi(argv[++i]));
+            opts.h = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--spp") && i + 1 < argc) {
+            opts.spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--tile") && i + 1 < argc) {
+            opts.tile = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--max") && i + 1 < argc) {
+            opts.max_count = strtoull(argv[++i], nullptr, 10);
+        } else if (0 == strcmp(argv[i], "--min-weight") && i + 1 < argc) {
+            opts.min_weight = std::max(0.0, atof(argv[++i]));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--size W H] [--spp N] [--tile N] [--max N] [--min-weight W]\n";
+            return 1;
+        }
+    }
+
+    std::vector<LightBase *> lights;
+    lights.push_back(new ConstantLight(vec3(100, 0, 100), vec3(1.0, 1.0, 1.0), 1e4));
+    lights.push_back(new ConstantLight(vec3(100, 100, 100), vec3(1.0, 1.0, 1.0), 5e2));
+
+    View view;
+    view.width = opts.w;
+    view.height = opts.h;
+    view.spp = opts.spp;
+    view.eye = vec3(0, -0.15, 0);
+    view.topleft = vec3(-2, 1, -2.0);
+    view.u = vec3(4.0 / opts.w, 0.0, 0.0);
+    view.v = vec3(0.0, -3.0 / opts.h, 0.0);
+
+    std::cout << opts.w << "x" << opts.h << " at " << opts.spp << " spp in " << opts.tile << " pixel tiles, "
+              << "mirror and glass spheres, one thread\n"
+              << std::setw(10) << "spheres" << std::setw(10) << "bvh MB" << std::setw(10) << "Mrays"
+              << std::setw(12) << "depth ms" << std::setw(12) << "unsorted" << std::setw(12) << "sorted"
+              << std::setw(10) << "speedup" << std::setw(12) << "max diff" << "\n";
+
+    const size_t counts[] = { 1000, 10000, 100000, 1000000, 4000000 };
+    for (const size_t n : counts) {
+        if (n > opts.max_count) {
+            break;
+        }
+        std::vector<Material> mats;
+        std::vector<Sphere *> objects;
+        make_scene(n, mats, objects);
+        BVH bvh(objects);
+        const double mb = (bvh.size() * sizeof(BVHNode) + objects.size() * sizeof(Sphere)) / 1048576.0;
+
+        Scene scene;
+        scene.accel = &bvh;
+        scene.lights = lights;
+        scene.materials = mats;
+        scene.eye = view.eye;
+
+        std::vector<vec3> depth_img, flat_img, sorted_img;
+        const uint64_t rays0 = StatsRegistry::instance().collect().rays;
+        const double depth = render(scene, view, opts, 0, depth_img);
+        const double rays = double(StatsRegistry::instance().collect().rays - rays0);
+        const double flat = render(scene, view, opts, 1, flat_img);
+        const double sorted = render(scene, view, opts, 2, sorted_img);
+
+        std::cout << std::fixed << std::setprecision(2)
+                  << std::setw(10) << n << std::setw(10) << mb << std::setw(10) << rays * 1e-6
+                  << std::setw(12) << depth * 1e3 << std::setw(12) << flat * 1e3 << std::setw(12) << sorted * 1e3
+                  << std::setw(10) << depth / sorted
+                  << std::setw(12) << std::scientific << std::setprecision(1)
+                  << std::max(max_diff(depth_img, flat_img), max_diff(depth_img, sorted_img)) << std::endl;
+
+        for (auto o : objects) {
+            delete o;
+        }
+    }
+    return 0;
+}
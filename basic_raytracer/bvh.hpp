@@ -0,0 +1,613 @@
+#ifndef _BVH_HPP_
+#define _BVH_HPP_
+
+#include "geometry.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+struct AABB {
+    double lo[3] = { std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max() };
+    double hi[3] = { -std::numeric_limits<double>::max(), -std::numeric_limits<double>::max(), -std::numeric_limits<double>::max() };
+
+    inline void grow(const AABB& b) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], b.lo[a]);
+            hi[a] = std::max(hi[a], b.hi[a]);
+        }
+    }
+    inline void grow(const double p[3]) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], p[a]);
+            hi[a] = std::max(hi[a], p[a]);
+        }
+    }
+    inline bool empty() const { return lo[0] > hi[0]; }
+    inline double area() const {
+        double dx = hi[0] - lo[0];
+        double dy = hi[1] - lo[1];
+        double dz = hi[2] - lo[2];
+        if (dx < 0.0 || dy < 0.0 || dz < 0.0) {
+            return 0.0;
+        }
+        return 2.0 * (dx*dy + dy*dz + dz*dx);
+    }
+};
+
+/* closest hit and occlusion queries over the objects of a scene
+ */
+template <typename T>
+class TAccelerator {
+public:
+    virtual ~TAccelerator() {}
+    virtual bool intersect(const TRay<T>& r, THit<T>& hit) const = 0;
+    /* true as soon as anything blocks the ray within (0, tmax) */
+    virtual bool occluded(const TRay<T>& r, const T tmax) const = 0;
+    /* box around everything the queries can hit, empty when nothing */
+    virtual AABB bounds() const = 0;
+};
+
+template <typename T>
+inline void grow_sphere(AABB& box, const TSphere<T>& s) {
+    const vec3 o(s.origin());
+    const double r = s.radius();
+    const double lo[3] = { o[0] - r, o[1] - r, o[2] - r };
+    const double hi[3] = { o[0] + r, o[1] + r, o[2] + r };
+    box.grow(lo);
+    box.grow(hi);
+}
+
+/* reference: test every object in turn
+ */
+template <typename T>
+class TLinearList : public TAccelerator<T> {
+public:
+    ~TLinearList() {}
+    TLinearList() = delete;
+    explicit TLinearList(const std::vector<TSphere<T> *>& objects) : _objects(objects) {}
+    bool intersect(const TRay<T>& r, THit<T>& hit) const final {
+        bool found = false;
+        uint64_t hits = 0;
+        for (const auto objiter : _objects) {
+            const bool closer = objiter->closest_hit(r, hit);
+            found |= closer;
+            hits += closer;
+        }
+        TRACE_STAT(TraceStats& stats = thread_stats(); stats.sphere_tests += _objects.size(); stats.sphere_hits += hits);
+        (void)hits;
+        return found;
+    }
+    bool occluded(const TRay<T>& r, const T tmax) const final {
+        uint64_t tests = 0;
+        bool blocked = false;
+        for (const auto objiter : _objects) {
+            tests++;
+            if (objiter->occludes(r, tmax)) {
+                blocked = true;
+                break;
+            }
+        }
+        TRACE_STAT(thread_stats().shadow_tests += tests);
+        (void)tests;
+        return blocked;
+    }
+    AABB bounds() const final {
+        AABB box;
+        for (const auto s : _objects) {
+            grow_sphere(box, *s);
+        }
+        return box;
+    }
+private:
+    std::vector<TSphere<T> *> _objects;
+};
+
+/* accelerators queried one after the other, the spheres of a scene next
+ * to its meshes. one virtual call per member and query. the group owns
+ * its members and the held accelerators, which are never queried but
+ * stay alive for the instances that refer to them
+ */
+template <typename T>
+class TGroup : public TAccelerator<T> {
+public:
+    ~TGroup() {
+        for (const auto m : _members) {
+            delete m;
+        }
+        for (const auto m : _held) {
+            delete m;
+        }
+    }
+    TGroup() {}
+    TGroup(const TGroup&) = delete;
+    inline void add(TAccelerator<T> *member) { _members.push_back(member); }
+    inline void hold(TAccelerator<T> *geometry) { _held.push_back(geometry); }
+    /* swaps a member for a rebuilt one and deletes the old */
+    void replace(TAccelerator<T> *member, TAccelerator<T> *fresh) {
+        for (auto& m : _members) {
+            if (m == member) {
+                delete m;
+                m = fresh;
+            }
+        }
+    }
+    bool intersect(const TRay<T>& r, THit<T>& hit) const final {
+        bool found = false;
+        for (const auto m : _members) {
+            found |= m->intersect(r, hit);
+        }
+        return found;
+    }
+    bool occluded(const TRay<T>& r, const T tmax) const final {
+        for (const auto m : _members) {
+            if (m->occluded(r, tmax)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    AABB bounds() const final {
+        AABB box;
+        for (const auto m : _members) {
+            box.grow(m->bounds());
+        }
+        return box;
+    }
+private:
+    std::vector<TAccelerator<T> *> _members;
+    std::vector<TAccelerator<T> *> _held;
+};
+
+/* flattened in depth first order: the first child of an interior node is
+ * the next node in the array, the second one lives at offset
+ */
+template <typename T>
+struct TBVHNode {
+    T lo[3];
+    T hi[3];
+    uint32_t offset; /* leaf: first primitive, interior: second child */
+    uint16_t count;  /* primitives of a leaf, 0 for interior nodes */
+    uint16_t axis;   /* split axis of interior nodes */
+};
+
+/* primitive as the builder sees it: bounds, centroid and its index in
+ * the caller's array
+ */
+struct BVHBuildPrim {
+    AABB box;
+    double centroid[3];
+    uint32_t index;
+};
+
+/* top down build with a binned surface area heuristic, in double
+ * precision whatever the node type. nodes are appended in depth first
+ * order and prims is permuted into leaf order, leaf offsets index it.
+ * from depth BVH_MEDIAN_DEPTH on nodes split at the object median, so
+ * lopsided SAH splits of clustered inputs can not grow the tree past the
+ * traversal stack
+ */
+template <typename T>
+class TBVHBuilder {
+public:
+    TBVHBuilder(std::vector<BVHBuildPrim>& prims, std::vector<TBVHNode<T>>& nodes, const uint32_t max_leaf) :
+        _prims(prims), _nodes(nodes), _max_leaf(std::max(1u, max_leaf)) {}
+    void run() {
+        if (!_prims.empty()) {
+            _nodes.reserve(_nodes.size() + 2 * _prims.size());
+            build(0, _prims.size(), 0);
+        }
+    }
+private:
+    uint32_t build(const uint32_t begin, const uint32_t end, const int depth);
+    uint32_t median_split(const uint32_t self, const uint32_t begin, const uint32_t end, const AABB& cbounds);
+
+    std::vector<BVHBuildPrim>& _prims;
+    std::vector<TBVHNode<T>>& _nodes;
+    uint32_t _max_leaf;
+};
+
+/* box of the root, empty for an empty tree */
+template <typename T>
+inline AABB node_bounds(const std::vector<TBVHNode<T>>& nodes) {
+    AABB box;
+    if (!nodes.empty()) {
+        for (int a = 0; a < 3; a++) {
+            box.lo[a] = nodes[0].lo[a];
+            box.hi[a] = nodes[0].hi[a];
+        }
+    }
+    return box;
+}
+
+constexpr int BVH_SAH_BINS = 16;
+constexpr int BVH_STACK = 64;
+// Depth from which nodes halve their primitives, 32 more levels split 2^32 of them
+constexpr int BVH_MEDIAN_DEPTH = BVH_STACK - 32;
+
+/* relative box padding, a few ulps of the node precision so grazing hits
+ * are not culled by the box
+ */
+template <typename T> inline double bvh_pad();
+template <> inline double bvh_pad<double>() { return 1e-9; }
+template <> inline double bvh_pad<float>() { return 1e-5; }
+
+/* boxes recomputed bottom up after the primitives moved, the topology
+ * stays. children follow their parent in the array, so a reverse sweep
+ * sees both before the parent. leaf_box(i) is the padded box of the
+ * primitive in leaf slot i
+ */
+template <typename T, typename F>
+void refit_nodes(std::vector<TBVHNode<T>>& nodes, F leaf_box) {
+    for (size_t k = nodes.size(); k-- > 0;) {
+        TBVHNode<T>& n = nodes[k];
+        AABB box;
+        if (n.count) {
+            for (uint32_t i = n.offset; i < n.offset + n.count; i++) {
+                box.grow(leaf_box(i));
+            }
+        } else {
+            const TBVHNode<T> *c[2] = { &nodes[k + 1], &nodes[n.offset] };
+            for (int a = 0; a < 3; a++) {
+                box.lo[a] = std::min(c[0]->lo[a], c[1]->lo[a]);
+                box.hi[a] = std::max(c[0]->hi[a], c[1]->hi[a]);
+            }
+        }
+        for (int a = 0; a < 3; a++) {
+            n.lo[a] = T(box.lo[a]);
+            n.hi[a] = T(box.hi[a]);
+        }
+    }
+}
+
+/* expected cost of a random ray through the root under the surface area
+ * heuristic, the builder's unit costs. refitting keeps the topology of
+ * the last build while boxes grow and overlap, the ratio against the cost
+ * right after that build says when to build again
+ */
+template <typename T>
+double sah_cost(const std::vector<TBVHNode<T>>& nodes) {
+    const double root = node_bounds(nodes).area();
+    if (!(root > 0.0)) {
+        return 0.0;
+    }
+    double cost = 0.0;
+    for (const auto& n : nodes) {
+        AABB box;
+        for (int a = 0; a < 3; a++) {
+            box.lo[a] = n.lo[a];
+            box.hi[a] = n.hi[a];
+        }
+        cost += box.area() / root * (n.count ? n.count : 1);
+    }
+    return cost;
+}
+
+/* halves the run at the median centroid along the widest centroid axis,
+ * returns the first primitive of the second half
+ */
+template <typename T>
+uint32_t TBVHBuilder<T>::median_split(const uint32_t self, const uint32_t begin, const uint32_t end, const AABB& cbounds) {
+    int a = 0;
+    for (int k = 1; k < 3; k++) {
+        if (cbounds.hi[k] - cbounds.lo[k] > cbounds.hi[a] - cbounds.lo[a]) {
+            a = k;
+        }
+    }
+    const uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(&_prims[0] + begin, &_prims[0] + mid, &_prims[0] + end, [a](const BVHBuildPrim& l, const BVHBuildPrim& r) {
+        return l.centroid[a] < r.centroid[a];
+    });
+    _nodes[self].axis = a;
+    return mid;
+}
+
+template <typename T>
+uint32_t TBVHBuilder<T>::build(const uint32_t begin, const uint32_t end, const int depth) {
+    const uint32_t self = _nodes.size();
+    _nodes.push_back(TBVHNode<T>());
+
+    AABB bounds, cbounds;
+    for (uint32_t i = begin; i < end; i++) {
+        bounds.grow(_prims[i].box);
+        cbounds.grow(_prims[i].centroid);
+    }
+    for (int a = 0; a < 3; a++) {
+        _nodes[self].lo[a] = T(bounds.lo[a]);
+        _nodes[self].hi[a] = T(bounds.hi[a]);
+    }
+
+    const uint32_t n = end - begin;
+    if (n == 1 || (depth >= BVH_MEDIAN_DEPTH && n <= _max_leaf)) {
+        _nodes[self].offset = begin;
+        _nodes[self].count = n;
+        _nodes[self].axis = 0;
+        return self;
+    }
+    if (depth >= BVH_MEDIAN_DEPTH) {
+        const uint32_t mid = median_split(self, begin, end, cbounds);
+        build(begin, mid, depth + 1);
+        const uint32_t second = build(mid, end, depth + 1);
+        _nodes[self].offset = second;
+        _nodes[self].count = 0;
+        return self;
+    }
+
+    /* binned SAH over the centroid bounds, traversal and intersection
+     * cost are taken as equal
+     */
+    int best_axis = -1;
+    int best_split = 0;
+    double best_cost = std::numeric_limits<double>::max();
+    for (int a = 0; a < 3; a++) {
+        const double extent = cbounds.hi[a] - cbounds.lo[a];
+        if (extent <= 0.0) {
+            continue;
+        }
+        AABB bin_box[BVH_SAH_BINS];
+        uint32_t bin_cnt[BVH_SAH_BINS] = {};
+        const double scale = BVH_SAH_BINS / extent;
+        for (uint32_t i = begin; i < end; i++) {
+            int b = std::min(BVH_SAH_BINS - 1, int((_prims[i].centroid[a] - cbounds.lo[a]) * scale));
+            bin_box[b].grow(_prims[i].box);
+            bin_cnt[b]++;
+        }
+
+        double right_area[BVH_SAH_BINS];
+        uint32_t right_cnt[BVH_SAH_BINS];
+        AABB acc;
+        uint32_t cnt = 0;
+        for (int b = BVH_SAH_BINS - 1; b > 0; b--) {
+            acc.grow(bin_box[b]);
+            cnt += bin_cnt[b];
+            right_area[b] = acc.area();
+            right_cnt[b] = cnt;
+        }
+
+        acc = AABB();
+        cnt = 0;
+        for (int b = 0; b < BVH_SAH_BINS - 1; b++) {
+            acc.grow(bin_box[b]);
+            cnt += bin_cnt[b];
+            if (cnt == 0 || right_cnt[b + 1] == 0) {
+                continue;
+            }
+            double cost = acc.area() * cnt + right_area[b + 1] * right_cnt[b + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_split = b + 1;
+            }
+        }
+    }
+
+    const double area = bounds.area();
+    const double leaf_cost = n;
+    best_cost = area > 0.0 ? 1.0 + best_cost / area : std::numeric_limits<double>::max();
+
+    uint32_t mid = begin;
+    if (best_axis >= 0 && (n > _max_leaf || best_cost < leaf_cost)) {
+        const int a = best_axis;
+        const double lo = cbounds.lo[a];
+        const double scale = BVH_SAH_BINS / (cbounds.hi[a] - cbounds.lo[a]);
+        BVHBuildPrim *p = std::partition(&_prims[begin], &_prims[0] + end, [&](const BVHBuildPrim& bp) {
+            return std::min(BVH_SAH_BINS - 1, int((bp.centroid[a] - lo) * scale)) < best_split;
+        });
+        mid = p - &_prims[0];
+        _nodes[self].axis = a;
+    } else if (n > _max_leaf) {
+        /* all centroids coincide, split the run in half */
+        mid = begin + n / 2;
+        _nodes[self].axis = 0;
+    } else {
+        _nodes[self].offset = begin;
+        _nodes[self].count = n;
+        _nodes[self].axis = 0;
+        return self;
+    }
+
+    build(begin, mid, depth + 1);
+    const uint32_t second = build(mid, end, depth + 1);
+    _nodes[self].offset = second;
+    _nodes[self].count = 0;
+    return self;
+}
+
+/* bounding volume hierarchy over spheres. spheres are copied in leaf
+ * order so a leaf touches one contiguous run of memory
+ */
+template <typename T>
+class TBVH : public TAccelerator<T> {
+public:
+    ~TBVH() {}
+    TBVH() = delete;
+    TBVH(const TBVH&) = delete;
+    explicit TBVH(const std::vector<TSphere<T> *>& objects, const uint32_t max_leaf = 4);
+    /* takes the spheres as they are now, in the order of construction */
+    void refit(const std::vector<TSphere<T> *>& objects);
+    bool intersect(const TRay<T>& r, THit<T>& hit) const final;
+    bool occluded(const TRay<T>& r, const T tmax) const final;
+    AABB bounds() const final { return node_bounds(_nodes); }
+    inline size_t size() const { return _nodes.size(); }
+    inline const std::vector<TBVHNode<T>>& nodes() const { return _nodes; }
+private:
+    std::vector<TBVHNode<T>> _nodes;
+    std::vector<TSphere<T>> _prims;
+    std::vector<uint32_t> _order; /* leaf slot to caller's index */
+};
+
+template <typename T>
+static inline AABB sphere_box(const TSphere<T>& s) {
+    const vec3 o(s.origin());
+    const double r = s.radius();
+    const double pad = r * bvh_pad<T>();
+    AABB box;
+    for (int a = 0; a < 3; a++) {
+        box.lo[a] = o[a] - r - pad;
+        box.hi[a] = o[a] + r + pad;
+    }
+    return box;
+}
+
+template <typename T>
+TBVH<T>::TBVH(const std::vector<TSphere<T> *>& objects, const uint32_t max_leaf) {
+    std::vector<BVHBuildPrim> prims(objects.size());
+    for (uint32_t i = 0; i < objects.size(); i++) {
+        const vec3 o(objects[i]->origin());
+        prims[i].box = sphere_box(*objects[i]);
+        for (int a = 0; a < 3; a++) {
+            prims[i].centroid[a] = o[a];
+        }
+        prims[i].index = i;
+    }
+    TBVHBuilder<T>(prims, _nodes, max_leaf).run();
+
+    _prims.reserve(prims.size());
+    _order.reserve(prims.size());
+    for (const auto& p : prims) {
+        _prims.push_back(*objects[p.index]);
+        _order.push_back(p.index);
+    }
+}
+
+template <typename T>
+void TBVH<T>::refit(const std::vector<TSphere<T> *>& objects) {
+    for (size_t i = 0; i < _prims.size(); i++) {
+        _prims[i] = *objects[_order[i]];
+    }
+    refit_nodes(_nodes, [&](const uint32_t i) { return sphere_box(_prims[i]); });
+}
+
+template <typename T>
+static inline bool slab_test(const TBVHNode<T>& n, const T org[3], const T inv[3], const T tmax) {
+    T t0 = T(0.0);
+    T t1 = tmax;
+    for (int a = 0; a < 3; a++) {
+        T tn = (n.lo[a] - org[a]) * inv[a];
+        T tf = (n.hi[a] - org[a]) * inv[a];
+        if (tn > tf) {
+            std::swap(tn, tf);
+        }
+        /* NaN from 0 * inf leaves the interval untouched */
+        t0 = tn > t0 ? tn : t0;
+        t1 = tf < t1 ? tf : t1;
+        if (t0 > t1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+bool TBVH<T>::intersect(const TRay<T>& r, THit<T>& hit) const {
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    const tvec3<T> o = r.origin();
+    const tvec3<T> d = r.direction();
+    const T org[3] = { o.x(), o.y(), o.z() };
+    const T inv[3] = { T(1.0) / d.x(), T(1.0) / d.y(), T(1.0) / d.z() };
+    const bool neg[3] = { inv[0] < T(0.0), inv[1] < T(0.0), inv[2] < T(0.0) };
+
+    bool found = false;
+    uint64_t tests = 0;
+    uint64_t hits = 0;
+    uint32_t stack[BVH_STACK];
+    int sp = 0;
+    uint32_t cur = 0;
+    for (;;) {
+        const TBVHNode<T>& n = _nodes[cur];
+        if (slab_test(n, org, inv, hit.t)) {
+            if (n.count) {
+                for (uint32_t i = 0; i < n.count; i++) {
+                    const bool closer = _prims[n.offset + i].closest_hit(r, hit);
+                    found |= closer;
+                    hits += closer;
+                }
+                tests += n.count;
+            } else {
+                /* visit the child nearer along the split axis first */
+                if (neg[n.axis]) {
+                    stack[sp++] = cur + 1;
+                    cur = n.offset;
+                } else {
+                    stack[sp++] = n.offset;
+                    cur = cur + 1;
+                }
+                continue;
+            }
+        }
+        if (sp == 0) {
+            break;
+        }
+        cur = stack[--sp];
+    }
+    TRACE_STAT(TraceStats& stats = thread_stats(); stats.sphere_tests += tests; stats.sphere_hits += hits);
+    (void)tests;
+    (void)hits;
+    return found;
+}
+
+template <typename T>
+bool TBVH<T>::occluded(const TRay<T>& r, const T tmax) const {
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    const tvec3<T> o = r.origin();
+    const tvec3<T> d = r.direction();
+    const T org[3] = { o.x(), o.y(), o.z() };
+    const T inv[3] = { T(1.0) / d.x(), T(1.0) / d.y(), T(1.0) / d.z() };
+    const bool neg[3] = { inv[0] < T(0.0), inv[1] < T(0.0), inv[2] < T(0.0) };
+
+    uint64_t tests = 0;
+    uint64_t nodes = 0;
+    bool blocked = false;
+    uint32_t stack[BVH_STACK];
+    int sp = 0;
+    uint32_t cur = 0;
+    for (;;) {
+        const TBVHNode<T>& n = _nodes[cur];
+        nodes++;
+        if (slab_test(n, org, inv, tmax)) {
+            if (n.count) {
+                for (uint32_t i = 0; i < n.count; i++) {
+                    tests++;
+                    if (_prims[n.offset + i].occludes(r, tmax)) {
+                        blocked = true;
+                        break;
+                    }
+                }
+                if (blocked) {
+                    break;
+                }
+            } else {
+                if (neg[n.axis]) {
+                    stack[sp++] = cur + 1;
+                    cur = n.offset;
+                } else {
+                    stack[sp++] = n.offset;
+                    cur = cur + 1;
+                }
+                continue;
+            }
+        }
+        if (sp == 0) {
+            break;
+        }
+        cur = stack[--sp];
+    }
+
+    TRACE_STAT(TraceStats& stats = thread_stats(); stats.shadow_tests += tests; stats.shadow_nodes += nodes);
+    (void)tests;
+    (void)nodes;
+    return blocked;
+}
+
+typedef TAccelerator<double> Accelerator;
+typedef TLinearList<double> LinearList;
+typedef TBVHNode<double> BVHNode;
+typedef TBVH<double> BVH;
+#endif
@@ -0,0 +1,42 @@
+#ifndef _CAMERA_HPP_
+#define _CAMERA_HPP_
+
+#include "scene_io.hpp"
+
+/* image size, samples per pixel and camera of the scene being rendered,
+ * u and v step one pixel right and down across the canvas
+ */
+struct View {
+    int width;
+    int height;
+    int spp;
+    vec3 eye;
+    vec3 topleft;
+    vec3 u;
+    vec3 v;
+};
+
+inline View make_view(const SceneDesc& desc) {
+    const CameraRecord& c = desc.camera;
+    View view;
+    view.width = desc.settings.width;
+    view.height = desc.settings.height;
+    view.spp = desc.settings.spp;
+    view.eye = vec3(c.eye[0], c.eye[1], c.eye[2]);
+    view.topleft = vec3(c.topleft[0], c.topleft[1], c.topleft[2]);
+    view.u = vec3(c.right[0]/view.width, c.right[1]/view.width, c.right[2]/view.width);
+    view.v = vec3(c.down[0]/view.height, c.down[1]/view.height, c.down[2]/view.height);
+    return view;
+}
+
+/* ray through the point (j + dx, i + dy) of the canvas, in the precision
+ * of the tracer
+ */
+template <typename T>
+inline TRay<T> camera_ray(const View& view, const int j, const int i, const double dx, const double dy) {
+    const tvec3<T> eye(view.eye);
+    tvec3<T> rdir = tvec3<T>(view.topleft) + tvec3<T>(view.u)*T(j+dx) + tvec3<T>(view.v)*T(i+dy) - eye;
+    rdir.normalize();
+    return TRay<T>(eye, rdir);
+}
+#endif
@@ -0,0 +1,450 @@
+#ifndef _CHECKPOINT_HPP_
+#define _CHECKPOINT_HPP_
+
+#include "framebuffer.hpp"
+#include "progressive.hpp"
+#include "scene_io.hpp"
+#include "scheduler.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+// Checkpoint: seconds between writes
+constexpr double CHECKPOINT_INTERVAL = 60.0;
+
+constexpr char CHECKPOINT_MAGIC[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '0', '1' };
+
+/* a fixed spp render keeps finished tiles, a progressive one the estimate
+ * of every pixel after a pass
+ */
+enum CheckpointMode : uint32_t {
+    CHECKPOINT_TILES,
+    CHECKPOINT_PASSES,
+};
+
+/* checkpoint file, in host byte order: the header, then count tile records
+ * each followed by its pixels as three doubles in row order, or, for
+ * passes, width * height pixel records in row order
+ */
+struct CheckpointHeader {
+    char magic[8];
+    uint64_t fingerprint; /* of the scene and the options the image depends on */
+    uint32_t width;
+    uint32_t height;
+    uint32_t mode;
+    uint32_t count;       /* tile records, or passes done */
+    double seconds;       /* render time spent up to the checkpoint */
+};
+
+struct CheckpointTile {
+    int32_t x0, y0, x1, y1;
+};
+
+struct CheckpointPixel {
+    double sum[3];
+    double mean;
+    double m2;
+    uint32_t n;
+    uint32_t done;
+};
+
+/* estimates after a pass, on their way to the writer thread */
+struct CheckpointSnapshot {
+    std::vector<PixelEstimate> pixels;
+    int width = 0;
+    int height = 0;
+    uint32_t passes = 0;
+    double seconds = 0.0;
+};
+
+/* FNV-1a, continues from h */
+inline uint64_t fnv1a(const void *data, const size_t bytes, uint64_t h = 0xcbf29ce484222325ull) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < bytes; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+template <typename V>
+inline uint64_t fnv1a(const std::vector<V>& v, const uint64_t h) {
+    return fnv1a(v.data(), v.size() * sizeof(V), h);
+}
+
+/* everything in a scene that changes its pixels. sphere records are
+ * hashed field by field, their padding is not initialised
+ */
+inline uint64_t scene_fingerprint(const SceneDesc& desc) {
+    uint64_t h = fnv1a(&desc.settings, sizeof(desc.settings));
+    h = fnv1a(&desc.camera, sizeof(desc.camera), h);
+    h = fnv1a(desc.materials(), desc.material_count() * sizeof(MaterialRecord), h);
+    h = fnv1a(desc.lights(), desc.light_count() * sizeof(LightRecord), h);
+    for (size_t i = 0; i < desc.sphere_count(); i++) {
+        const Sphere& s = desc.spheres()[i];
+        const double v[4] = { s.origin().x(), s.origin().y(), s.origin().z(), s.radius() };
+        const uint32_t m = s.material();
+        h = fnv1a(v, sizeof(v), h);
+        h = fnv1a(&m, sizeof(m), h);
+    }
+    for (const MeshRecord& m : desc.meshes()) {
+        const uint32_t v[2] = { m.material, m.placed };
+        h = fnv1a(v, sizeof(v), h);
+        h = fnv1a(m.data.x, h);
+        h = fnv1a(m.data.y, h);
+        h = fnv1a(m.data.z, h);
+        h = fnv1a(m.data.index, h);
+    }
+    h = fnv1a(desc.instances(), h);
+    return fnv1a(desc.keys(), h);
+}
+
+/* periodic checkpoints of one image and resuming from them. render
+ * threads only record which tiles they finished, a thread of its own
+ * copies those pixels out of the framebuffer and writes them, so a write
+ * never holds up the render. finished tiles are not written to again,
+ * reading them needs no lock beyond the one that publishes them. a
+ * progressive render hands over a plain copy of its estimates between
+ * passes, the writer encodes it; the two snapshots are swapped, not
+ * reallocated, so a hand over costs one copy of the pixels. every
+ * write goes to a temporary file that is renamed over the checkpoint, a
+ * kill during a write leaves the previous checkpoint whole
+ */
+class Checkpoint {
+public:
+    ~Checkpoint() { stop(); }
+    Checkpoint() = delete;
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint(const std::string& path, const uint64_t fingerprint, const double interval = CHECKPOINT_INTERVAL) :
+        _path(path), _fingerprint(fingerprint), _interval(interval) {}
+
+    inline const std::string& path() const { return _path; }
+    /* set once the render left something to resume, a budget ran out */
+    inline bool kept() const { return _keep; }
+
+    /* true when there is no checkpoint or one for this image in mode */
+    bool check(const CheckpointMode mode, const int w, const int h, std::string& err) const;
+
+    /* pixels of the tiles a checkpoint has go into fb and the tiles to
+     * done, seconds is the render time they took. false with err empty
+     * when there is no checkpoint to resume
+     */
+    bool resume(Framebuffer& fb, std::vector<Tile>& done, double& seconds, std::string& err);
+    /* the estimates after the last pass the checkpoint has */
+    bool resume(ProgressiveImage& img, uint32_t& passes, double& seconds, std::string& err);
+
+    /* start writing the tiles of fb as they finish, done are those that
+     * already are, seconds the time they took
+     */
+    void track(const Framebuffer& fb, const std::vector<Tile>& done, const double seconds);
+    /* called by render threads */
+    void finished(const Tile& t) {
+        std::lock_guard<std::mutex> lk(_lock);
+        _tiles.push_back(CheckpointTile { t.x0, t.y0, t.x1, t.y1 });
+    }
+
+    /* progressive renders: true once a pass should be handed over */
+    bool due() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - _last).count() >= _interval;
+    }
+    /* copies the estimates after passes, a snapshot still waiting for the
+     * writer is replaced. keep makes it the last one and keeps it for
+     * another run
+     */
+    void submit(const ProgressiveImage& img, const uint32_t passes, const double seconds, const bool keep = false);
+
+    /* stops the writer, only a kept snapshot is still written */
+    void stop();
+    /* the finished image is on disk, the checkpoint is no longer needed */
+    void remove() {
+        stop();
+        unlink(_path.c_str());
+    }
+
+    friend std::ostream & operator<<(std::ostream &os, const Checkpoint& c) {
+        os << "checkpoint " << c._path << ": " << c._writes << " writes";
+        if (c._writes) {
+            os << ", last " << std::fixed << std::setprecision(2) << c._last_bytes / 1048576.0 << " MB, "
+               << c._write_sec * 1e3 / c._writes << " ms per write on the writer thread";
+        }
+        if (c._failed) {
+            os << ", " << c._failed << " FAILED";
+        }
+        return os << "\n";
+    }
+private:
+    bool read_header(FILE *f, const CheckpointMode mode, const int w, const int h, CheckpointHeader& hd, std::string& err) const;
+    void start();
+    void loop();
+    void encode(std::string& out, const std::vector<CheckpointTile>& tiles) const;
+    void encode(std::string& out, const CheckpointSnapshot& s) const;
+    bool write(const std::string& data);
+    double elapsed() const {
+        return _seconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+    }
+
+    std::string _path;
+    uint64_t _fingerprint;
+    double _interval;
+    std::chrono::steady_clock::time_point _last = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point _start;
+    double _seconds = 0.0;
+
+    const Framebuffer *_fb = nullptr;
+    std::vector<CheckpointTile> _tiles; /* under _lock, only grows */
+    size_t _written = 0;                /* tiles in the last write */
+    CheckpointSnapshot _snapshot;       /* under _lock */
+    bool _pending = false;              /* _snapshot waits for the writer */
+    bool _keep = false;
+
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::thread _thread;
+    bool _quit = false;
+    /* writer thread only */
+    uint64_t _writes = 0;
+    uint64_t _failed = 0;
+    size_t _last_bytes = 0;
+    double _write_sec = 0.0;
+};
+
+inline bool Checkpoint::read_header(FILE *f, const CheckpointMode mode, const int w, const int h, CheckpointHeader& hd, std::string& err) const {
+    if (fread(&hd, sizeof(hd), 1, f) != 1 || memcmp(hd.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC))) {
+        err = _path + ": not a checkpoint";
+        return false;
+    }
+    if (hd.fingerprint != _fingerprint || hd.mode != mode || int(hd.width) != w || int(hd.height) != h) {
+        err = _path + ": written for another scene or other options, remove it to start over";
+        return false;
+    }
+    return true;
+}
+
+inline bool Checkpoint::check(const CheckpointMode mode, const int w, const int h, std::string& err) const {
+    FILE *f = fopen(_path.c_str(), "rb");
+    if (!f) {
+        return true;
+    }
+    CheckpointHeader hd;
+    const bool ok = read_header(f, mode, w, h, hd, err);
+    fclose(f);
+    return ok;
+}
+
+inline bool Checkpoint::resume(Framebuffer& fb, std::vector<Tile>& done, double& seconds, std::string& err) {
+    err.clear();
+    FILE *f = fopen(_path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    CheckpointHeader hd;
+    bool ok = read_header(f, CHECKPOINT_TILES, fb.width(), fb.height(), hd, err);
+    std::vector<double> px;
+    for (uint32_t i = 0; ok && i < hd.count; i++) {
+        CheckpointTile t;
+        ok = fread(&t, sizeof(t), 1, f) == 1 &&
+             t.x0 >= 0 && t.y0 >= 0 && t.x0 < t.x1 && t.y0 < t.y1 && t.x1 <= fb.width() && t.y1 <= fb.height();
+        if (ok) {
+            px.resize(size_t(t.x1 - t.x0) * (t.y1 - t.y0) * 3);
+            ok = fread(px.data(), sizeof(double), px.size(), f) == px.size();
+        }
+        if (!ok) {
+            err = _path + ": truncated tile record";
+            break;
+        }
+        const double *p = px.data();
+        for (int y = t.y0; y < t.y1; y++) {
+            for (int x = t.x0; x < t.x1; x++, p += 3) {
+                fb.at(x, y) = vec3(p[0], p[1], p[2]);
+            }
+        }
+        done.push_back(Tile { t.x0, t.y0, t.x1, t.y1 });
+    }
+    fclose(f);
+    seconds = ok ? hd.seconds : 0.0;
+    return ok;
+}
+
+inline bool Checkpoint::resume(ProgressiveImage& img, uint32_t& passes, double& seconds, std::string& err) {
+    err.clear();
+    FILE *f = fopen(_path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    CheckpointHeader hd;
+    bool ok = read_header(f, CHECKPOINT_PASSES, img.width(), img.height(), hd, err);
+    if (ok) {
+        std::vector<CheckpointPixel> px(size_t(img.width()) * img.height());
+        ok = fread(px.data(), sizeof(CheckpointPixel), px.size(), f) == px.size();
+        if (!ok) {
+            err = _path + ": truncated pixel records";
+        }
+        for (size_t i = 0; ok && i < px.size(); i++) {
+            PixelEstimate& p = img.at(int(i % img.width()), int(i / img.width()));
+            p.sum = vec3(px[i].sum[0], px[i].sum[1], px[i].sum[2]);
+            p.mean = px[i].mean;
+            p.m2 = px[i].m2;
+            p.n = px[i].n;
+            p.done = px[i].done != 0;
+        }
+    }
+    fclose(f);
+    passes = ok ? hd.count : 0;
+    seconds = ok ? hd.seconds : 0.0;
+    return ok;
+}
+
+inline void Checkpoint::track(const Framebuffer& fb, const std::vector<Tile>& done, const double seconds) {
+    _fb = &fb;
+    for (const Tile& t : done) {
+        _tiles.push_back(CheckpointTile { t.x0, t.y0, t.x1, t.y1 });
+    }
+    _written = _tiles.size();
+    _seconds = seconds;
+    start();
+}
+
+inline void Checkpoint::submit(const ProgressiveImage& img, const uint32_t passes, const double seconds, const bool keep) {
+    _last = std::chrono::steady_clock::now();
+    _keep = keep;
+    /* copied here, the next pass changes the estimates. the writer only
+     * holds the lock to swap snapshots, the copy goes into the buffer it
+     * handed back
+     */
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        _snapshot.pixels.assign(img.pixels().begin(), img.pixels().end());
+        _snapshot.width = img.width();
+        _snapshot.height = img.height();
+        _snapshot.passes = passes;
+        _snapshot.seconds = seconds;
+        _pending = true;
+    }
+    if (!_thread.joinable()) {
+        start();
+    }
+    _wake.notify_all();
+}
+
+inline void Checkpoint::start() {
+    _start = std::chrono::steady_clock::now();
+    _last = _start;
+    _quit = false;
+    _thread = std::thread(&Checkpoint::loop, this);
+}
+
+inline void Checkpoint::stop() {
+    if (!_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        _quit = true;
+    }
+    _wake.notify_all();
+    _thread.join();
+}
+
+/* header and the tiles with their pixels */
+inline void Checkpoint::encode(std::string& out, const std::vector<CheckpointTile>& tiles) const {
+    size_t bytes = sizeof(CheckpointHeader);
+    for (const CheckpointTile& t : tiles) {
+        bytes += sizeof(t) + size_t(t.x1 - t.x0) * (t.y1 - t.y0) * 3 * sizeof(double);
+    }
+    out.resize(bytes);
+    CheckpointHeader hd = { {}, _fingerprint, uint32_t(_fb->width()), uint32_t(_fb->height()), CHECKPOINT_TILES, uint32_t(tiles.size()), elapsed() };
+    memcpy(hd.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    memcpy(&out[0], &hd, sizeof(hd));
+    size_t at = sizeof(hd);
+    for (const CheckpointTile& t : tiles) {
+        memcpy(&out[at], &t, sizeof(t));
+        at += sizeof(t);
+        for (int y = t.y0; y < t.y1; y++) {
+            for (int x = t.x0; x < t.x1; x++) {
+                const vec3& c = _fb->at(x, y);
+                const double rgb[3] = { c.r(), c.g(), c.b() };
+                memcpy(&out[at], rgb, sizeof(rgb));
+                at += sizeof(rgb);
+            }
+        }
+    }
+}
+
+/* header and the pixel records of a pass */
+inline void Checkpoint::encode(std::string& out, const CheckpointSnapshot& s) const {
+    out.resize(sizeof(CheckpointHeader) + sizeof(CheckpointPixel) * s.pixels.size());
+    CheckpointHeader hd = { {}, _fingerprint, uint32_t(s.width), uint32_t(s.height), CHECKPOINT_PASSES, s.passes, s.seconds };
+    memcpy(hd.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    memcpy(&out[0], &hd, sizeof(hd));
+    size_t at = sizeof(hd);
+    for (const PixelEstimate& p : s.pixels) {
+        const CheckpointPixel c = { { p.sum.r(), p.sum.g(), p.sum.b() }, p.mean, p.m2, p.n, p.done };
+        memcpy(&out[at], &c, sizeof(c));
+        at += sizeof(c);
+    }
+}
+
+/* write, flush to the device, then rename over the checkpoint */
+inline bool Checkpoint::write(const std::string& data) {
+    const std::string tmp = _path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    bool ok = f && fwrite(data.data(), 1, data.size(), f) == data.size() && 0 == fflush(f) && 0 == fsync(fileno(f));
+    ok = f && 0 == fclose(f) && ok;
+    return ok && 0 == rename(tmp.c_str(), _path.c_str());
+}
+
+inline void Checkpoint::loop() {
+    std::string data;
+    std::vector<CheckpointTile> tiles;
+    CheckpointSnapshot pass;
+    std::unique_lock<std::mutex> lk(_lock);
+    for (;;) {
+        if (_fb) {
+            _wake.wait_for(lk, std::chrono::duration<double>(_interval), [this]{ return _quit; });
+        } else {
+            _wake.wait(lk, [this]{ return _quit || _pending; });
+        }
+        if (_quit && (_fb || !_pending)) {
+            return;
+        }
+        const size_t count = _tiles.size();
+        if (_fb && count == _written) {
+            continue;
+        }
+        /* the list is copied under the lock, the pixels it names are
+         * copied without, their tiles are finished
+         */
+        if (_fb) {
+            tiles.assign(_tiles.begin(), _tiles.begin() + count);
+        } else {
+            std::swap(pass, _snapshot);
+            _pending = false;
+        }
+        lk.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        if (_fb) {
+            encode(data, tiles);
+        } else {
+            encode(data, pass);
+        }
+        const bool ok = write(data);
+        const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        lk.lock();
+        _written = count;
+        _writes++;
+        _failed += !ok;
+        _last_bytes = data.size();
+        _write_sec += sec;
+    }
+}
+#endif
@@ -0,0 +1,482 @@
+#ifndef _DENOISE_HPP_
+#define _DENOISE_HPP_
+
+#include "framebuffer.hpp"
+#include "scheduler.hpp"
+#include "simd_sphere.hpp"
+#include "tracer.hpp"
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// A-trous passes, pass i samples 2^i pixels apart
+constexpr int DENOISE_PASSES = 3;
+
+// Edge stopping scales: colour distance in standard deviations of the
+// pixel, normal distance, albedo distance and depth difference relative to
+// the depth of the pixel and the tap distance
+constexpr float DENOISE_SIGMA_COLOR = 8.0f;
+constexpr float DENOISE_SIGMA_NORMAL = 0.3f;
+constexpr float DENOISE_SIGMA_ALBEDO = 0.1f;
+constexpr float DENOISE_SIGMA_DEPTH = 0.08f;
+
+// Variance below which a pixel counts as noise free
+constexpr float DENOISE_VARIANCE_FLOOR = 1e-6f;
+
+// Depth below which a pixel counts as a miss for the relative depth term
+constexpr float DENOISE_DEPTH_FLOOR = 1e-3f;
+
+// Rows per scheduler task
+constexpr int DENOISE_BAND = 8;
+
+/* first hit features of every pixel as float planes, averaged over the
+ * samples of the pixel, and the variance of the pixel's mean luminance.
+ * render threads write disjoint pixels
+ */
+class AuxImage {
+public:
+    ~AuxImage() {}
+    AuxImage() = delete;
+    AuxImage(const int w, const int h) : _width(w), _height(h), _planes(size_t(w) * h * 8, 0.0f) {}
+    inline int width() const { return _width; }
+    inline int height() const { return _height; }
+    inline const float *albedo(const int c) const { return plane(c); }
+    inline const float *normal(const int c) const { return plane(3 + c); }
+    inline const float *depth() const { return plane(6); }
+    inline const float *variance() const { return plane(7); }
+
+    /* the sum of a pixel's samples times scale */
+    template <typename T>
+    void set(const int x, const int y, const TAux<T>& sum, const T scale, const double variance) {
+        const size_t p = size_t(y) * _width + x;
+        for (int c = 0; c < 3; c++) {
+            _planes[size_t(c) * plane_size() + p] = float(sum.albedo[c] * scale);
+            _planes[size_t(3 + c) * plane_size() + p] = float(sum.normal[c] * scale);
+        }
+        _planes[6 * plane_size() + p] = float(sum.depth * scale);
+        _planes[7 * plane_size() + p] = float(variance);
+    }
+
+    /* viewable copies: albedo as is, normals mapped to [0, 1], depth grey */
+    Framebuffer albedo_image() const { return image(0, 1.0, 0.0); }
+    Framebuffer normal_image() const { return image(3, 0.5, 0.5); }
+    Framebuffer depth_image() const {
+        Framebuffer fb(_width, _height);
+        for (int i = 0; i < _height; i++) {
+            for (int j = 0; j < _width; j++) {
+                const double z = depth()[size_t(i) * _width + j];
+                fb.at(j, i) = vec3(z, z, z);
+            }
+        }
+        return fb;
+    }
+private:
+    inline size_t plane_size() const { return size_t(_width) * _height; }
+    inline const float *plane(const int k) const { return &_planes[size_t(k) * plane_size()]; }
+
+    Framebuffer image(const int first, const double scale, const double bias) const {
+        Framebuffer fb(_width, _height);
+        for (int i = 0; i < _height; i++) {
+            for (int j = 0; j < _width; j++) {
+                const size_t p = size_t(i) * _width + j;
+                fb.at(j, i) = vec3(plane(first)[p], plane(first + 1)[p], plane(first + 2)[p]) * scale + vec3(bias, bias, bias);
+            }
+        }
+        return fb;
+    }
+
+    int _width;
+    int _height;
+    std::vector<float> _planes;
+};
+
+struct DenoiseParams {
+    int passes = DENOISE_PASSES;
+    float sigma_color = DENOISE_SIGMA_COLOR;
+    float sigma_normal = DENOISE_SIGMA_NORMAL;
+    float sigma_albedo = DENOISE_SIGMA_ALBEDO;
+    float sigma_depth = DENOISE_SIGMA_DEPTH;
+};
+
+/* one a-trous pass: colour and variance planes in and out, the features
+ * and the inverse scales of the pass
+ */
+struct AtrousPass {
+    int width;
+    int height;
+    int step;
+    const float *in[3];
+    const float *var_in;
+    float *out[3];
+    float *var_out;
+    const float *albedo[3];
+    const float *normal[3];
+    const float *depth;
+    float inv_color;  /* 1 / sigma^2 */
+    float inv_normal;
+    float inv_albedo;
+    float inv_depth;  /* 1 / (sigma step) */
+};
+
+/* B3 spline taps */
+static const float ATROUS_TAPS[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+/* the vector kernels evaluate the same expressions lane wise in the same
+ * order, the filtered image does not depend on the ISA. pixels x0 to x1
+ * of row y, the scalar kernel takes any range, the vector ones only
+ * pixels whose taps are all inside the row and a multiple of their width
+ */
+typedef void (*AtrousKernel)(const AtrousPass& p, const int y, const int x0, const int x1);
+
+/* e^x for x <= 0: 2^x split into integer and fraction, a degree 5
+ * polynomial for 2^f, the integer goes into the exponent bits. within
+ * 2e-4 relative, plenty for a weight
+ */
+static inline float atrous_exp(float x) {
+    x = std::max(x, -80.0f);
+    const float t = x * 1.44269504f;
+    const float i = std::floor(t);
+    const float f = t - i;
+    float p = 1.33335581e-3f;
+    p = p * f + 9.61812911e-3f;
+    p = p * f + 5.55041087e-2f;
+    p = p * f + 2.40226507e-1f;
+    p = p * f + 6.93147182e-1f;
+    p = p * f + 1.0f;
+    const int32_t bits = (int32_t(i) + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+static void atrous_scalar(const AtrousPass& p, const int y, const int x0, const int x1) {
+    for (int x = x0; x < x1; x++) {
+        const size_t at = size_t(y) * p.width + x;
+        const float c0 = p.in[0][at], c1 = p.in[1][at], c2 = p.in[2][at];
+        const float n0 = p.normal[0][at], n1 = p.normal[1][at], n2 = p.normal[2][at];
+        const float a0 = p.albedo[0][at], a1 = p.albedo[1][at], a2 = p.albedo[2][at];
+        const float z = p.depth[at];
+        const float inv_c = p.inv_color / std::max(p.var_in[at], DENOISE_VARIANCE_FLOOR);
+        const float inv_z = p.inv_depth / std::max(z, DENOISE_DEPTH_FLOOR);
+        float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, sv = 0.0f, ws = 0.0f;
+        for (int dy = 0; dy < 5; dy++) {
+            const int qy = y + (dy - 2) * p.step;
+            if (qy < 0 || qy >= p.height) {
+                continue;
+            }
+            for (int dx = 0; dx < 5; dx++) {
+                const int qx = x + (dx - 2) * p.step;
+                if (qx < 0 || qx >= p.width) {
+                    continue;
+                }
+                const size_t q = size_t(qy) * p.width + qx;
+                float d, dc, dn, da;
+                d = p.in[0][q] - c0; dc = d * d;
+                d = p.in[1][q] - c1; dc = dc + d * d;
+                d = p.in[2][q] - c2; dc = dc + d * d;
+                d = p.normal[0][q] - n0; dn = d * d;
+                d = p.normal[1][q] - n1; dn = dn + d * d;
+                d = p.normal[2][q] - n2; dn = dn + d * d;
+                d = p.albedo[0][q] - a0; da = d * d;
+                d = p.albedo[1][q] - a1; da = da + d * d;
+                d = p.albedo[2][q] - a2; da = da + d * d;
+                const float dz = std::fabs(p.depth[q] - z);
+                const float e = dc * inv_c + dn * p.inv_normal + da * p.inv_albedo + dz * inv_z;
+                const float w = ATROUS_TAPS[dy] * ATROUS_TAPS[dx] * atrous_exp(-e);
+                s0 = s0 + w * p.in[0][q];
+                s1 = s1 + w * p.in[1][q];
+                s2 = s2 + w * p.in[2][q];
+                sv = sv + w * w * p.var_in[q];
+                ws = ws + w;
+            }
+        }
+        /* the centre tap has weight 9/64, ws is never 0 */
+        const float inv_ws = 1.0f / ws;
+        p.out[0][at] = s0 * inv_ws;
+        p.out[1][at] = s1 * inv_ws;
+        p.out[2][at] = s2 * inv_ws;
+        p.var_out[at] = sv * inv_ws * inv_ws;
+    }
+}
+
+SIMD_AVX2_KERNEL static inline __m256 atrous_exp_avx2(__m256 x) {
+    x = _mm256_max_ps(x, _mm256_set1_ps(-80.0f));
+    const __m256 t = _mm256_mul_ps(x, _mm256_set1_ps(1.44269504f));
+    const __m256 i = _mm256_floor_ps(t);
+    const __m256 f = _mm256_sub_ps(t, i);
+    __m256 p = _mm256_set1_ps(1.33335581e-3f);
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(9.61812911e-3f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(5.55041087e-2f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.40226507e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(6.93147182e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+    const __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(i), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+}
+
+SIMD_AVX2_KERNEL static void atrous_avx2(const AtrousPass& p, const int y, const int x0, const int x1) {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    for (int x = x0; x < x1; x += 8) {
+        const size_t at = size_t(y) * p.width + x;
+        const __m256 c0 = _mm256_loadu_ps(p.in[0] + at), c1 = _mm256_loadu_ps(p.in[1] + at), c2 = _mm256_loadu_ps(p.in[2] + at);
+        const __m256 n0 = _mm256_loadu_ps(p.normal[0] + at), n1 = _mm256_loadu_ps(p.normal[1] + at), n2 = _mm256_loadu_ps(p.normal[2] + at);
+        const __m256 a0 = _mm256_loadu_ps(p.albedo[0] + at), a1 = _mm256_loadu_ps(p.albedo[1] + at), a2 = _mm256_loadu_ps(p.albedo[2] + at);
+        const __m256 z = _mm256_loadu_ps(p.depth + at);
+        const __m256 inv_c = _mm256_div_ps(_mm256_set1_ps(p.inv_color), _mm256_max_ps(_mm256_loadu_ps(p.var_in + at), _mm256_set1_ps(DENOISE_VARIANCE_FLOOR)));
+        const __m256 inv_z = _mm256_div_ps(_mm256_set1_ps(p.inv_depth), _mm256_max_ps(z, _mm256_set1_ps(DENOISE_DEPTH_FLOOR)));
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), sv = _mm256_setzero_ps(), ws = _mm256_setzero_ps();
+        for (int dy = 0; dy < 5; dy++) {
+            const int qy = y + (dy - 2) * p.step;
+            if (qy < 0 || qy >= p.height) {
+                continue;
+            }
+            for (int dx = 0; dx < 5; dx++) {
+                const size_t q = size_t(qy) * p.width + x + (dx - 2) * p.step;
+                __m256 d, dc, dn, da;
+                d = _mm256_sub_ps(_mm256_loadu_ps(p.in[0] + q), c0); dc = _mm256_mul_ps(d, d);
+                d = _mm256_sub_ps(_mm256_loadu_ps(p.in[1] + q), c1); dc = _mm256_add_ps(dc, _mm256_mul_ps(d, d));
+                d = _mm256_sub_ps(_mm256_loadu_ps(p.in[2] + q), c2); dc = _mm256_add_ps(dc, _mm256_mul_ps(d, d));
+                d = _mm256_sub_ps(_mm256_loadu_ps(p.normal[0] + q), n0); dn = _mm256_mul_ps(d, d);
+                d = _mm256_sub_ps(_mm256_loadu_ps(p.normal[1] + q), n1); dn = _mm256_add_ps(dn, _mm256_mul_ps(d, d));
+                d = _mm256_sub_ps(_mm256_loadu_ps(p.normal[2] + q), n2); dn = _mm256_add_ps(dn, _mm256_mul_ps(d, d));
+                d = _mm256_sub_ps(_mm256_loadu_ps(p.albedo[0] + q), a0); da = _mm256_mul_ps(d, d);
+                d = _mm256_sub_ps(_mm256_loadu_ps(p.albedo[1] + q), a1); da = _mm256_add_ps(da, _mm256_mul_ps(d, d));
+                d = _mm256_sub_ps(_mm256_loadu_ps(p.albedo[2] + q), a2); da = _mm256_add_ps(da, _mm256_mul_ps(d, d));
+                const __m256 dz = _mm256_andnot_ps(sign, _mm256_sub_ps(_mm256_loadu_ps(p.depth + q), z));
+                __m256 e = _mm256_mul_ps(dc, inv_c);
+                e = _mm256_add_ps(e, _mm256_mul_ps(dn, _mm256_set1_ps(p.inv_normal)));
+                e = _mm256_add_ps(e, _mm256_mul_ps(da, _mm256_set1_ps(p.inv_albedo)));
+                e = _mm256_add_ps(e, _mm256_mul_ps(dz, inv_z));
+                const __m256 w = _mm256_mul_ps(_mm256_set1_ps(ATROUS_TAPS[dy] * ATROUS_TAPS[dx]), atrous_exp_avx2(_mm256_xor_ps(e, sign)));
+                s0 = _mm256_add_ps(s0, _mm256_mul_ps(w, _mm256_loadu_ps(p.in[0] + q)));
+                s1 = _mm256_add_ps(s1, _mm256_mul_ps(w, _mm256_loadu_ps(p.in[1] + q)));
+                s2 = _mm256_add_ps(s2, _mm256_mul_ps(w, _mm256_loadu_ps(p.in[2] + q)));
+                sv = _mm256_add_ps(sv, _mm256_mul_ps(_mm256_mul_ps(w, w), _mm256_loadu_ps(p.var_in + q)));
+                ws = _mm256_add_ps(ws, w);
+            }
+        }
+        const __m256 inv_ws = _mm256_div_ps(_mm256_set1_ps(1.0f), ws);
+        _mm256_storeu_ps(p.out[0] + at, _mm256_mul_ps(s0, inv_ws));
+        _mm256_storeu_ps(p.out[1] + at, _mm256_mul_ps(s1, inv_ws));
+        _mm256_storeu_ps(p.out[2] + at, _mm256_mul_ps(s2, inv_ws));
+        _mm256_storeu_ps(p.var_out + at, _mm256_mul_ps(_mm256_mul_ps(sv, inv_ws), inv_ws));
+    }
+}
+
+SIMD_AVX512_KERNEL static inline __m512 atrous_exp_avx512(__m512 x) {
+    /* the full mask zeroing forms, the plain ones pass an undefined source
+     * that GCC 12 warns about once inlined
+     */
+    x = _mm512_maskz_max_ps(0xFFFF, x, _mm512_set1_ps(-80.0f));
+    const __m512 t = _mm512_mul_ps(x, _mm512_set1_ps(1.44269504f));
+    const __m512 i = _mm512_maskz_roundscale_ps(0xFFFF, t, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    const __m512 f = _mm512_sub_ps(t, i);
+    __m512 p = _mm512_set1_ps(1.33335581e-3f);
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(9.61812911e-3f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(5.55041087e-2f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(2.40226507e-1f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(6.93147182e-1f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(1.0f));
+    const __m512i bits = _mm512_maskz_slli_epi32(0xFFFF, _mm512_add_epi32(_mm512_maskz_cvttps_epi32(0xFFFF, i), _mm512_set1_epi32(127)), 23);
+    return _mm512_mul_ps(p, _mm512_castsi512_ps(bits));
+}
+
+SIMD_AVX512_KERNEL static void atrous_avx512(const AtrousPass& p, const int y, const int x0, const int x1) {
+    const __m512i abs_mask = _mm512_set1_epi32(0x7FFFFFFF);
+    const __m512i sign = _mm512_set1_epi32(int32_t(0x80000000u));
+    for (int x = x0; x < x1; x += 16) {
+        const size_t at = size_t(y) * p.width + x;
+        const __m512 c0 = _mm512_loadu_ps(p.in[0] + at), c1 = _mm512_loadu_ps(p.in[1] + at), c2 = _mm512_loadu_ps(p.in[2] + at);
+        const __m512 n0 = _mm512_loadu_ps(p.normal[0] + at), n1 = _mm512_loadu_ps(p.normal[1] + at), n2 = _mm512_loadu_ps(p.normal[2] + at);
+        const __m512 a0 = _mm512_loadu_ps(p.albedo[0] + at), a1 = _mm512_loadu_ps(p.albedo[1] + at), a2 = _mm512_loadu_ps(p.albedo[2] + at);
+        const __m512 z = _mm512_loadu_ps(p.depth + at);
+        const __m512 inv_c = _mm512_div_ps(_mm512_set1_ps(p.inv_color), _mm512_maskz_max_ps(0xFFFF, _mm512_loadu_ps(p.var_in + at), _mm512_set1_ps(DENOISE_VARIANCE_FLOOR)));
+        const __m512 inv_z = _mm512_div_ps(_mm512_set1_ps(p.inv_depth), _mm512_maskz_max_ps(0xFFFF, z, _mm512_set1_ps(DENOISE_DEPTH_FLOOR)));
+        __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps(), sv = _mm512_setzero_ps(), ws = _mm512_setzero_ps();
+        for (int dy = 0; dy < 5; dy++) {
+            const int qy = y + (dy - 2) * p.step;
+            if (qy < 0 || qy >= p.height) {
+                continue;
+            }
+            for (int dx = 0; dx < 5; dx++) {
+                const size_t q = size_t(qy) * p.width + x + (dx - 2) * p.step;
+                __m512 d, dc, dn, da;
+                d = _mm512_sub_ps(_mm512_loadu_ps(p.in[0] + q), c0); dc = _mm512_mul_ps(d, d);
+                d = _mm512_sub_ps(_mm512_loadu_ps(p.in[1] + q), c1); dc = _mm512_add_ps(dc, _mm512_mul_ps(d, d));
+                d = _mm512_sub_ps(_mm512_loadu_ps(p.in[2] + q), c2); dc = _mm512_add_ps(dc, _mm512_mul_ps(d, d));
+                d = _mm512_sub_ps(_mm512_loadu_ps(p.normal[0] + q), n0); dn = _mm512_mul_ps(d, d);
+                d = _mm512_sub_ps(_mm512_loadu_ps(p.normal[1] + q), n1); dn = _mm512_add_ps(dn, _mm512_mul_ps(d, d));
+                d = _mm512_sub_ps(_mm512_loadu_ps(p.normal[2] + q), n2); dn = _mm512_add_ps(dn, _mm512_mul_ps(d, d));
+                d = _mm512_sub_ps(_mm512_loadu_ps(p.albedo[0] + q), a0); da = _mm512_mul_ps(d, d);
+                d = _mm512_sub_ps(_mm512_loadu_ps(p.albedo[1] + q), a1); da = _mm512_add_ps(da, _mm512_mul_ps(d, d));
+                d = _mm512_sub_ps(_mm512_loadu_ps(p.albedo[2] + q), a2); da = _mm512_add_ps(da, _mm512_mul_ps(d, d));
+                /* AVX-512F has no float logic ops, the masks go through the integer unit */
+                const __m512 dz = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(_mm512_sub_ps(_mm512_loadu_ps(p.depth + q), z)), abs_mask));
+                __m512 e = _mm512_mul_ps(dc, inv_c);
+                e = _mm512_add_ps(e, _mm512_mul_ps(dn, _mm512_set1_ps(p.inv_normal)));
+                e = _mm512_add_ps(e, _mm512_mul_ps(da, _mm512_set1_ps(p.inv_albedo)));
+                e = _mm512_add_ps(e, _mm512_mul_ps(dz, inv_z));
+                const __m512 ne = _mm512_castsi512_ps(_mm512_xor_epi32(_mm512_castps_si512(e), sign));
+                const __m512 w = _mm512_mul_ps(_mm512_set1_ps(ATROUS_TAPS[dy] * ATROUS_TAPS[dx]), atrous_exp_avx512(ne));
+                s0 = _mm512_add_ps(s0, _mm512_mul_ps(w, _mm512_loadu_ps(p.in[0] + q)));
+                s1 = _mm512_add_ps(s1, _mm512_mul_ps(w, _mm512_loadu_ps(p.in[1] + q)));
+                s2 = _mm512_add_ps(s2, _mm512_mul_ps(w, _mm512_loadu_ps(p.in[2] + q)));
+                sv = _mm512_add_ps(sv, _mm512_mul_ps(_mm512_mul_ps(w, w), _mm512_loadu_ps(p.var_in + q)));
+                ws = _mm512_add_ps(ws, w);
+            }
+        }
+        const __m512 inv_ws = _mm512_div_ps(_mm512_set1_ps(1.0f), ws);
+        _mm512_storeu_ps(p.out[0] + at, _mm512_mul_ps(s0, inv_ws));
+        _mm512_storeu_ps(p.out[1] + at, _mm512_mul_ps(s1, inv_ws));
+        _mm512_storeu_ps(p.out[2] + at, _mm512_mul_ps(s2, inv_ws));
+        _mm512_storeu_ps(p.var_out + at, _mm512_mul_ps(_mm512_mul_ps(sv, inv_ws), inv_ws));
+    }
+}
+
+/* 3x3 binomial blur of the variance rows y0 to y1, four samples leave a
+ * pixel's own estimate too noisy to trust alone
+ */
+static void prefilter_variance(const float *in, float *out, const int w, const int h, const int y0, const int y1) {
+    static const float taps[3] = { 0.25f, 0.5f, 0.25f };
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < w; x++) {
+            float s = 0.0f, ws = 0.0f;
+            for (int dy = 0; dy < 3; dy++) {
+                const int qy = y + dy - 1;
+                if (qy < 0 || qy >= h) {
+                    continue;
+                }
+                for (int dx = 0; dx < 3; dx++) {
+                    const int qx = x + dx - 1;
+                    if (qx < 0 || qx >= w) {
+                        continue;
+                    }
+                    s += taps[dy] * taps[dx] * in[size_t(qy) * w + qx];
+                    ws += taps[dy] * taps[dx];
+                }
+            }
+            out[size_t(y) * w + x] = s / ws;
+        }
+    }
+}
+
+struct AtrousKernels {
+    SimdIsa isa;
+    AtrousKernel row;
+    int lanes;
+};
+
+/* falls back to the widest supported ISA when the requested one is missing */
+inline AtrousKernels select_atrous(SimdIsa isa) {
+    if (!isa_supported(isa)) {
+        isa = detect_isa();
+    }
+    AtrousKernels k;
+    k.isa = isa;
+    switch (isa) {
+        case SIMD_AVX512:
+            k.row = atrous_avx512;
+            k.lanes = 16;
+            break;
+        case SIMD_AVX2:
+            k.row = atrous_avx2;
+            k.lanes = 8;
+            break;
+        default:
+            k.row = atrous_scalar;
+            k.lanes = 1;
+            break;
+    }
+    return k;
+}
+
+/* edge avoiding a-trous wavelet filter (Dammertz et al. 2010) of fb in
+ * place, with the colour term scaled by the noise as in SVGF (Schied et
+ * al. 2017). every pass is a 5x5 B3 spline with holes 2^i pixels apart, a
+ * tap is weighted down by how far its colour, normal, albedo and depth
+ * are from the pixel's, so the blur stays within surfaces and a colour
+ * step only goes when the pixel's own variance explains it. the variance
+ * goes through the passes with the squared weights, a pixel that was
+ * smoothed tolerates less later on. the variance is blurred once up
+ * front, a few samples give too rough an estimate per pixel. each pass
+ * splits the rows into bands for the scheduler, the border columns a
+ * vector kernel can not reach go through the scalar one
+ */
+inline void denoise(Framebuffer& fb, const AuxImage& aux, const DenoiseParams& params, const AtrousKernels& kernels, TileScheduler *scheduler) {
+    const int w = fb.width();
+    const int h = fb.height();
+    const size_t n = size_t(w) * h;
+    /* two sets of colour and variance planes, read one write the other */
+    std::vector<float> planes(n * 8);
+    for (int i = 0; i < h; i++) {
+        for (int j = 0; j < w; j++) {
+            for (int c = 0; c < 3; c++) {
+                planes[c * n + size_t(i) * w + j] = float(fb.at(j, i)[c]);
+            }
+        }
+    }
+
+    std::vector<Tile> bands;
+    for (int y = 0; y < h; y += DENOISE_BAND) {
+        bands.push_back(Tile { 0, y, w, std::min(y + DENOISE_BAND, h) });
+    }
+    const auto run = [&](const TileFunc& job) {
+        if (scheduler) {
+            scheduler->run(bands, job);
+        } else {
+            for (const auto& t : bands) {
+                job(t, 0);
+            }
+        }
+    };
+    run([&](const Tile& t, unsigned) {
+        prefilter_variance(aux.variance(), &planes[3 * n], w, h, t.y0, t.y1);
+    });
+
+    AtrousPass p;
+    p.width = w;
+    p.height = h;
+    for (int c = 0; c < 3; c++) {
+        p.albedo[c] = aux.albedo(c);
+        p.normal[c] = aux.normal(c);
+    }
+    p.depth = aux.depth();
+    p.inv_color = 1.0f / (params.sigma_color * params.sigma_color);
+    p.inv_normal = 1.0f / (params.sigma_normal * params.sigma_normal);
+    p.inv_albedo = 1.0f / (params.sigma_albedo * params.sigma_albedo);
+
+    int src = 0;
+    for (int pass = 0; pass < params.passes; pass++) {
+        p.step = 1 << pass;
+        /* depth grows with the tap distance across a slanted surface */
+        p.inv_depth = 1.0f / (params.sigma_depth * float(p.step));
+        for (int c = 0; c < 3; c++) {
+            p.in[c] = &planes[(src * 4 + c) * n];
+            p.out[c] = &planes[((1 - src) * 4 + c) * n];
+        }
+        p.var_in = &planes[(src * 4 + 3) * n];
+        p.var_out = &planes[((1 - src) * 4 + 3) * n];
+        /* columns [lo, hi) have every tap inside the row */
+        const int lo = std::min(2 * p.step, w);
+        const int hi = lo + std::max(0, w - 2 * p.step - lo) / kernels.lanes * kernels.lanes;
+        run([&](const Tile& t, unsigned) {
+            for (int y = t.y0; y < t.y1; y++) {
+                atrous_scalar(p, y, 0, lo);
+                kernels.row(p, y, lo, hi);
+                atrous_scalar(p, y, hi, w);
+            }
+        });
+        src = 1 - src;
+    }
+
+    for (int i = 0; i < h; i++) {
+        for (int j = 0; j < w; j++) {
+            const size_t at = size_t(i) * w + j;
+            fb.at(j, i) = vec3(planes[src * 4 * n + at], planes[(src * 4 + 1) * n + at], planes[(src * 4 + 2) * n + at]);
+        }
+    }
+}
+#endif
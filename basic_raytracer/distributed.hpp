@@ -0,0 +1,549 @@
+#ifndef _DISTRIBUTED_HPP_
+#define _DISTRIBUTED_HPP_
+
+#include "framebuffer.hpp"
+#include "scheduler.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Tiles a worker holds at once, the next one is on its way while it
+// traces the current one
+constexpr size_t NET_PIPELINE = 2;
+
+// A tile out this many times the mean tile time is traced again by an
+// idle worker, whichever copy comes back first is kept
+constexpr double NET_STRAGGLER_FACTOR = 2.0;
+
+// Spawned workers: give up when none has connected after this many seconds
+constexpr double NET_CONNECT_TIMEOUT = 30.0;
+
+constexpr uint32_t NET_MAGIC = 0x52544E31; /* "RTN1" */
+
+/* every message is a NetHeader followed by bytes of payload, host byte
+ * order, both ends run the same build:
+ *
+ *   hello   worker -> coordinator  magic, fingerprint, width, height
+ *   tile    coordinator -> worker  a NetTile to trace
+ *   pixels  worker -> coordinator  the NetTile, CPU seconds it took, then its
+ *                                  pixels as three doubles in row order
+ *   quit    coordinator -> worker  no more tiles
+ */
+enum NetMessage : uint32_t {
+    NET_HELLO,
+    NET_TILE,
+    NET_PIXELS,
+    NET_QUIT,
+};
+
+struct NetHeader {
+    uint32_t type;
+    uint32_t bytes;
+};
+
+struct NetHello {
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t reserved;
+    uint64_t fingerprint;
+};
+
+struct NetTile {
+    uint32_t id; /* index into the coordinator's tile list */
+    int32_t x0, y0, x1, y1;
+};
+
+/* unix:PATH or HOST:PORT over TCP. listen binds it, connect reaches it,
+ * both return -1 with err set on failure
+ */
+inline int net_socket(const std::string& address, const bool listen_on, std::string& err) {
+    int fd = -1;
+    if (0 == address.compare(0, 5, "unix:")) {
+        struct sockaddr_un sa = {};
+        sa.sun_family = AF_UNIX;
+        const std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(sa.sun_path)) {
+            err = address + ": bad socket path";
+            return -1;
+        }
+        memcpy(sa.sun_path, path.c_str(), path.size());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_on) {
+            unlink(path.c_str());
+        }
+        if (fd >= 0 && (listen_on ? bind(fd, (struct sockaddr *)&sa, sizeof(sa)) : connect(fd, (struct sockaddr *)&sa, sizeof(sa)))) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        const size_t colon = address.rfind(':');
+        if (colon == std::string::npos) {
+            err = address + ": expected unix:PATH or HOST:PORT";
+            return -1;
+        }
+        struct addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = listen_on ? AI_PASSIVE : 0;
+        struct addrinfo *res = nullptr;
+        const std::string host = address.substr(0, colon);
+        if (getaddrinfo(host.empty() ? nullptr : host.c_str(), address.c_str() + colon + 1, &hints, &res)) {
+            err = address + ": cannot resolve";
+            return -1;
+        }
+        fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        const int one = 1;
+        if (fd >= 0) {
+            setsockopt(fd, listen_on ? SOL_SOCKET : IPPROTO_TCP, listen_on ? SO_REUSEADDR : TCP_NODELAY, &one, sizeof(one));
+        }
+        if (fd >= 0 && (listen_on ? bind(fd, res->ai_addr, res->ai_addrlen) : connect(fd, res->ai_addr, res->ai_addrlen))) {
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+    }
+    if (fd >= 0 && listen_on && listen(fd, 64)) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        err = address + ": " + strerror(errno);
+    }
+    return fd;
+}
+
+/* whole buffers or false, a peer that went away does not raise SIGPIPE */
+inline bool net_send(const int fd, const void *data, size_t bytes) {
+    const char *p = static_cast<const char *>(data);
+    while (bytes) {
+        const ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= size_t(n);
+    }
+    return true;
+}
+
+inline bool net_recv(const int fd, void *data, size_t bytes) {
+    char *p = static_cast<char *>(data);
+    while (bytes) {
+        const ssize_t n = recv(fd, p, bytes, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= size_t(n);
+    }
+    return true;
+}
+
+inline bool net_message(const int fd, const NetMessage type, const void *payload, const uint32_t bytes) {
+    const NetHeader h = { type, bytes };
+    return net_send(fd, &h, sizeof(h)) && (!bytes || net_send(fd, payload, bytes));
+}
+
+/* worker side: say hello, then trace every tile the coordinator sends
+ * with fn into fb and send the pixels back until it says quit or closes
+ * between messages, as it does once the image is done before it took this
+ * worker. false when the connection breaks otherwise
+ */
+inline bool serve_tiles(const int fd, const uint64_t fingerprint, Framebuffer& fb, const TileFunc& fn) {
+    const NetHello hello = { NET_MAGIC, uint32_t(fb.width()), uint32_t(fb.height()), 0, fingerprint };
+    if (!net_message(fd, NET_HELLO, &hello, sizeof(hello))) {
+        return false;
+    }
+    std::string out;
+    for (;;) {
+        NetHeader h;
+        char first;
+        const ssize_t n = recv(fd, &first, 1, MSG_PEEK);
+        if (n == 0) {
+            return true;
+        }
+        if (n < 0 || !net_recv(fd, &h, sizeof(h))) {
+            return false;
+        }
+        if (h.type == NET_QUIT) {
+            return true;
+        }
+        NetTile t;
+        if (h.type != NET_TILE || h.bytes != sizeof(t) || !net_recv(fd, &t, sizeof(t)) ||
+            t.x0 < 0 || t.y0 < 0 || t.x0 >= t.x1 || t.y0 >= t.y1 || t.x1 > fb.width() || t.y1 > fb.height()) {
+            return false;
+        }
+        /* CPU time, workers sharing cores do not count the waiting */
+        struct timespec a, b;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &a);
+        run_tile(fn, Tile { t.x0, t.y0, t.x1, t.y1 }, 0);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &b);
+        const double sec = double(b.tv_sec - a.tv_sec) + 1e-9 * double(b.tv_nsec - a.tv_nsec);
+
+        out.resize(sizeof(t) + sizeof(sec) + size_t(t.x1 - t.x0) * (t.y1 - t.y0) * 3 * sizeof(double));
+        memcpy(&out[0], &t, sizeof(t));
+        memcpy(&out[sizeof(t)], &sec, sizeof(sec));
+        size_t at = sizeof(t) + sizeof(sec);
+        for (int y = t.y0; y < t.y1; y++) {
+            for (int x = t.x0; x < t.x1; x++) {
+                const vec3& c = fb.at(x, y);
+                const double rgb[3] = { c.r(), c.g(), c.b() };
+                memcpy(&out[at], rgb, sizeof(rgb));
+                at += sizeof(rgb);
+            }
+        }
+        if (!net_message(fd, NET_PIXELS, out.data(), uint32_t(out.size()))) {
+            /* the coordinator may have finished while this tile was
+             * traced, then a quit waits behind the tiles it had sent
+             */
+            for (NetTile skip; net_recv(fd, &h, sizeof(h)); ) {
+                if (h.type == NET_QUIT) {
+                    return true;
+                }
+                if (h.type != NET_TILE || h.bytes != sizeof(skip) || !net_recv(fd, &skip, sizeof(skip))) {
+                    break;
+                }
+            }
+            return false;
+        }
+    }
+}
+
+/* hands tiles of one image to worker processes over a listening socket
+ * and assembles the pixels they send back. every worker holds up to
+ * NET_PIPELINE tiles. once no tile is left to hand out, an idle worker
+ * traces again a tile that has been out for NET_STRAGGLER_FACTOR times
+ * the mean tile time, so a slow or stopped worker does not hold up the
+ * image, the first copy back is kept. a worker that disconnects gives
+ * its tiles back. runs on the calling thread, one poll loop
+ */
+class TileCoordinator {
+public:
+    struct WorkerStats {
+        uint64_t tiles = 0;      /* kept */
+        uint64_t duplicates = 0; /* traced after another copy came back */
+        uint64_t reassigned = 0; /* handed this worker as a straggler copy */
+        double busy = 0.0;       /* CPU seconds the worker reported tracing */
+        bool lost = false;
+    };
+
+    ~TileCoordinator() {}
+    TileCoordinator() = delete;
+    TileCoordinator(const TileCoordinator&) = delete;
+    /* spawned are worker processes to watch, when they all exit before
+     * connecting the coordinator gives up
+     */
+    TileCoordinator(const int listen_fd, const uint64_t fingerprint, Framebuffer& fb, const std::vector<pid_t>& spawned) :
+        _listen(listen_fd), _fingerprint(fingerprint), _fb(fb), _spawned(spawned) {}
+
+    /* every tile traced and in fb. finished is called for each as it
+     * lands, on this thread
+     */
+    bool run(const std::vector<Tile>& tiles, const std::function<void(const Tile&)>& finished, std::string& err);
+
+    inline double seconds() const { return _seconds; }
+    inline const std::vector<WorkerStats>& workers() const { return _stats; }
+    /* workers that traced, not those dropped on hello */
+    inline size_t traced() const {
+        return std::max<size_t>(std::count_if(_stats.begin(), _stats.end(), [](const WorkerStats& s) { return s.busy > 0.0; }), 1);
+    }
+    /* parallel efficiency T1 / (N TN), baseline is the wall time of the
+     * same image traced by one worker
+     */
+    inline double efficiency(const double baseline) const {
+        return _seconds > 0.0 ? baseline / (traced() * _seconds) : 0.0;
+    }
+
+    friend std::ostream & operator<<(std::ostream &os, const TileCoordinator& c) {
+        double busy = 0.0;
+        uint64_t reassigned = 0;
+        uint64_t duplicates = 0;
+        for (size_t i = 0; i < c._stats.size(); i++) {
+            const WorkerStats& s = c._stats[i];
+            os << "worker " << std::setw(3) << i << ": " << std::setw(6) << s.tiles << " tiles, "
+               << std::setw(4) << s.reassigned << " reassigned, " << std::setw(4) << s.duplicates << " late, busy "
+               << std::fixed << std::setprecision(2) << s.busy << " s" << (s.lost ? ", lost" : "") << "\n";
+            busy += s.busy;
+            reassigned += s.reassigned;
+            duplicates += s.duplicates;
+        }
+        /* the share of their wall time the workers traced, it misses the
+         * overheads a worker adds to the tracing itself, efficiency() needs
+         * a one worker run
+         */
+        os << "distributed: " << c._stats.size() << " workers, " << std::fixed << std::setprecision(2) << c._seconds
+           << " s wall, " << busy << " s tracing, utilization " << (c._seconds > 0.0 ? busy / (c.traced() * c._seconds) * 100.0 : 0.0)
+           << "%, " << reassigned << " tiles reassigned, " << duplicates << " traced twice\n";
+        return os;
+    }
+private:
+    struct Worker {
+        int fd = -1;
+        bool ready = false; /* said hello */
+        std::vector<std::pair<uint32_t, std::chrono::steady_clock::time_point>> out;
+        std::chrono::steady_clock::time_point last; /* of the last reply */
+        std::string in;     /* bytes of a message not complete yet */
+    };
+
+    void drop(Worker& w);
+    bool receive(Worker& w, const std::vector<Tile>& tiles, const std::function<void(const Tile&)>& finished, std::string& err);
+    bool pick(const Worker& w, uint32_t& id);
+
+    int _listen;
+    uint64_t _fingerprint;
+    Framebuffer& _fb;
+    std::vector<pid_t> _spawned;
+
+    std::vector<Worker> _workers;
+    std::vector<WorkerStats> _stats;
+    std::deque<uint32_t> _pending;
+    std::vector<uint8_t> _done;
+    std::vector<uint8_t> _copies; /* workers a tile is out at */
+    size_t _left = 0;
+    double _tile_sec = 0.0;       /* service time seen here, over kept tiles */
+    uint64_t _tile_count = 0;
+    double _seconds = 0.0;
+};
+
+inline void TileCoordinator::drop(Worker& w) {
+    if (w.fd < 0) {
+        return;
+    }
+    close(w.fd);
+    w.fd = -1;
+    for (const auto& o : w.out) {
+        if (--_copies[o.first] == 0 && !_done[o.first]) {
+            _pending.push_front(o.first);
+        }
+    }
+    w.out.clear();
+    _stats[&w - &_workers[0]].lost = _left > 0;
+}
+
+/* next tile for w: a pending one, or the oldest straggler w does not
+ * already hold
+ */
+inline bool TileCoordinator::pick(const Worker& w, uint32_t& id) {
+    while (!_pending.empty()) {
+        id = _pending.front();
+        _pending.pop_front();
+        if (!_done[id]) {
+            return true;
+        }
+    }
+    if (!_tile_count) {
+        return false;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const double limit = NET_STRAGGLER_FACTOR * _tile_sec / _tile_count;
+    double oldest = limit;
+    bool found = false;
+    for (const Worker& o : _workers) {
+        if (&o == &w || o.fd < 0) {
+            continue;
+        }
+        for (const auto& t : o.out) {
+            const double age = std::chrono::duration<double>(now - t.second).count();
+            const bool mine = std::count_if(w.out.begin(), w.out.end(), [&](const std::pair<uint32_t, std::chrono::steady_clock::time_point>& m) { return m.first == t.first; });
+            if (!_done[t.first] && !mine && _copies[t.first] < 2 && age > oldest) {
+                oldest = age;
+                id = t.first;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+/* handles every complete message in w.in */
+inline bool TileCoordinator::receive(Worker& w, const std::vector<Tile>& tiles, const std::function<void(const Tile&)>& finished, std::string& err) {
+    WorkerStats& stats = _stats[&w - &_workers[0]];
+    size_t at = 0;
+    for (;;) {
+        NetHeader h;
+        if (w.in.size() - at < sizeof(h)) {
+            break;
+        }
+        memcpy(&h, &w.in[at], sizeof(h));
+        if (w.in.size() - at - sizeof(h) < h.bytes) {
+            break;
+        }
+        const char *p = &w.in[at + sizeof(h)];
+        at += sizeof(h) + h.bytes;
+        if (h.type == NET_HELLO && h.bytes == sizeof(NetHello)) {
+            NetHello hello;
+            memcpy(&hello, p, sizeof(hello));
+            if (hello.magic != NET_MAGIC || hello.fingerprint != _fingerprint ||
+                int(hello.width) != _fb.width() || int(hello.height) != _fb.height()) {
+                std::cerr << "worker " << (&w - &_workers[0]) << " renders another scene or other options, dropped\n";
+                drop(w);
+                return true;
+            }
+            w.ready = true;
+            w.last = std::chrono::steady_clock::now();
+            continue;
+        }
+        NetTile t;
+        double sec;
+        if (h.type != NET_PIXELS || !w.ready || h.bytes < sizeof(t) + sizeof(sec)) {
+            err = "unexpected message from a worker";
+            return false;
+        }
+        memcpy(&t, p, sizeof(t));
+        memcpy(&sec, p + sizeof(t), sizeof(sec));
+        const auto held = std::find_if(w.out.begin(), w.out.end(), [&](const std::pair<uint32_t, std::chrono::steady_clock::time_point>& o) { return o.first == t.id; });
+        if (held == w.out.end() || t.id >= tiles.size() || t.x0 != tiles[t.id].x0 || t.y0 != tiles[t.id].y0 ||
+            t.x1 != tiles[t.id].x1 || t.y1 != tiles[t.id].y1 ||
+            h.bytes != sizeof(t) + sizeof(sec) + size_t(t.x1 - t.x0) * (t.y1 - t.y0) * 3 * sizeof(double)) {
+            err = "worker sent a tile it was not given";
+            return false;
+        }
+        /* from when the worker could start on it to the reply */
+        const auto now = std::chrono::steady_clock::now();
+        const double service = std::chrono::duration<double>(now - std::max(held->second, w.last)).count();
+        w.last = now;
+        w.out.erase(held);
+        _copies[t.id]--;
+        stats.busy += sec;
+        if (_done[t.id]) {
+            stats.duplicates++;
+            continue;
+        }
+        const char *px = p + sizeof(t) + sizeof(sec);
+        for (int y = t.y0; y < t.y1; y++) {
+            for (int x = t.x0; x < t.x1; x++) {
+                double rgb[3];
+                memcpy(rgb, px, sizeof(rgb));
+                px += sizeof(rgb);
+                _fb.at(x, y) = vec3(rgb[0], rgb[1], rgb[2]);
+            }
+        }
+        _done[t.id] = 1;
+        _left--;
+        _tile_sec += service;
+        _tile_count++;
+        stats.tiles++;
+        finished(tiles[t.id]);
+    }
+    w.in.erase(0, at);
+    return true;
+}
+
+inline bool TileCoordinator::run(const std::vector<Tile>& tiles, const std::function<void(const Tile&)>& finished, std::string& err) {
+    auto start = std::chrono::steady_clock::now();
+    _done.assign(tiles.size(), 0);
+    _copies.assign(tiles.size(), 0);
+    _left = tiles.size();
+    for (uint32_t i = 0; i < tiles.size(); i++) {
+        _pending.push_back(i);
+    }
+    std::vector<struct pollfd> fds;
+    std::vector<char> buf(1 << 16);
+    bool ok = true;
+    while (_left && ok) {
+        /* top every ready worker up to the pipeline depth */
+        for (Worker& w : _workers) {
+            uint32_t id;
+            while (w.fd >= 0 && w.ready && w.out.size() < NET_PIPELINE && pick(w, id)) {
+                const Tile& t = tiles[id];
+                const NetTile msg = { id, t.x0, t.y0, t.x1, t.y1 };
+                _stats[&w - &_workers[0]].reassigned += _copies[id] > 0;
+                w.out.push_back(std::make_pair(id, std::chrono::steady_clock::now()));
+                _copies[id]++;
+                if (!net_message(w.fd, NET_TILE, &msg, sizeof(msg))) {
+                    drop(w);
+                }
+            }
+        }
+
+        fds.clear();
+        fds.push_back(pollfd { _listen, POLLIN, 0 });
+        for (const Worker& w : _workers) {
+            fds.push_back(pollfd { w.fd, POLLIN, 0 });
+        }
+        /* a short timeout so stragglers are found while everyone waits */
+        const int n = poll(fds.data(), fds.size(), 50);
+        if (n < 0 && errno != EINTR) {
+            err = std::string("poll: ") + strerror(errno);
+            ok = false;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            const int fd = accept(_listen, nullptr, nullptr);
+            if (fd >= 0) {
+                const int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                _workers.push_back(Worker());
+                _workers.back().fd = fd;
+                _stats.push_back(WorkerStats());
+            }
+        }
+        for (size_t i = 1; i < fds.size() && ok; i++) {
+            Worker& w = _workers[i - 1];
+            if (w.fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            const ssize_t got = recv(w.fd, buf.data(), buf.size(), 0);
+            if (got <= 0) {
+                if (got < 0 && errno == EINTR) {
+                    continue;
+                }
+                drop(w);
+                continue;
+            }
+            w.in.append(buf.data(), size_t(got));
+            ok = receive(w, tiles, finished, err);
+        }
+
+        /* spawned workers that all exited before the image was done */
+        const bool connected = std::count_if(_workers.begin(), _workers.end(), [](const Worker& w) { return w.fd >= 0; });
+        if (!connected && !_spawned.empty()) {
+            size_t alive = 0;
+            for (const pid_t pid : _spawned) {
+                alive += pid > 0 && 0 == waitpid(pid, nullptr, WNOHANG);
+            }
+            const double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (!alive || (_workers.empty() && waited > NET_CONNECT_TIMEOUT)) {
+                err = "no workers left";
+                ok = false;
+            }
+        }
+    }
+
+    for (Worker& w : _workers) {
+        if (w.fd >= 0) {
+            net_message(w.fd, NET_QUIT, nullptr, 0);
+            drop(w);
+        }
+    }
+    _seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return ok;
+}
+#endif
@@ -0,0 +1,26 @@
+#ifndef _FRAMEBUFFER_HPP_
+#define _FRAMEBUFFER_HPP_
+
+#include "vec3.hpp"
+#include <vector>
+
+/* linear radiance of every pixel, row major from the top left corner.
+ * render threads write disjoint tiles so no locking is needed
+ */
+class Framebuffer {
+public:
+    ~Framebuffer() {}
+    Framebuffer() = delete;
+    Framebuffer(const int w, const int h) : _width(w), _height(h), _pixels(w * h) {}
+    Framebuffer(const Framebuffer&) = default;
+    Framebuffer(Framebuffer&&) = default;
+    inline int width() const { return _width; }
+    inline int height() const { return _height; }
+    inline vec3& at(const int x, const int y) { return _pixels[y * _width + x]; }
+    inline const vec3& at(const int x, const int y) const { return _pixels[y * _width + x]; }
+private:
+    int _width;
+    int _height;
+    std::vector<vec3> _pixels;
+};
+#endif
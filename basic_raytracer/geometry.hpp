@@ -2,59 +2,85 @@
 #define _GEOMETRY_HPP_
 
 #include "vec3.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 
-class Ray {
+template <typename T>
+class TRay {
 public:
-    ~Ray() {}
-    Ray() = delete;
-    Ray(const vec3& o, const vec3& dir) : _origin(o), _direction(dir) {}
-    Ray(const Ray& r) : _origin(r.origin()), _direction(r.direction()) {}
-    inline vec3 origin() const { return _origin; }
-    inline vec3 direction() const { return _direction; }
-    inline vec3 parameterize_at(const double t) const { return _origin + _direction * t; }
-    Ray operator=(const Ray& r) { return Ray(r); }
-    friend std::ostream & operator<<(std::ostream &os, const Ray& r) {
+    ~TRay() {}
+    TRay() = delete;
+    TRay(const tvec3<T>& o, const tvec3<T>& dir) : _origin(o), _direction(dir) {}
+    TRay(const TRay& r) : _origin(r.origin()), _direction(r.direction()) {}
+    inline tvec3<T> origin() const { return _origin; }
+    inline tvec3<T> direction() const { return _direction; }
+    inline tvec3<T> parameterize_at(const T t) const { return _origin + _direction * t; }
+    TRay& operator=(const TRay& r) {
+        _origin = r.origin();
+        _direction = r.direction();
+        return *this;
+    }
+    friend std::ostream & operator<<(std::ostream &os, const TRay& r) {
         os << "[" << r.origin() << " " << r.direction() << "]";
         return os;
     }
 private:
-    vec3 _origin;
-    vec3 _direction;
+    tvec3<T> _origin;
+    tvec3<T> _direction;
 };
 
-class Material;
-class Sphere {
+template <typename T> struct THit;
+template <typename T> class TTriangleMesh;
+template <typename T> class TInstance;
+
+/* the material is an index into the material table of the scene. the
+ * layout is plain (centre, radius, material, pad) so scene files can be
+ * mapped straight onto an array of spheres
+ */
+template <typename T>
+class TSphere {
 public:
-    ~Sphere() {}
-    Sphere() = delete;
-    Sphere(const Sphere& s) :
+    ~TSphere() {}
+    TSphere() = delete;
+    TSphere(const TSphere& s) :
         _origin(s.origin()),
         _radius(s.radius()),
-        _matte(s.matte()) {}
+        _material(s.material()) {}
 
-    Sphere(const vec3& o, const double r, Material *m) :
+    TSphere(const tvec3<T>& o, const T r, const uint32_t m) :
         _origin(o),
         _radius(r),
-        _matte(m) {}
+        _material(m) {}
 
-    inline vec3 origin() const { return _origin; }
-    inline double radius() const { return _radius; }
-    inline Material* matte() const { return _matte; }
+    inline tvec3<T> origin() const { return _origin; }
+    inline T radius() const { return _radius; }
+    inline uint32_t material() const { return _material; }
 
-    Sphere operator=(const Sphere& s) { return Sphere(s); }
-    friend std::ostream & operator<<(std::ostream &os, const Sphere& s) {
+    TSphere& operator=(const TSphere& s) {
+        _origin = s.origin();
+        _radius = s.radius();
+        _material = s.material();
+        return *this;
+    }
+    friend std::ostream & operator<<(std::ostream &os, const TSphere& s) {
         os << "[" << s.origin() << " " << s.radius() << "]";
         return os;
     }
-    bool intersect(const Ray& r, double& t0, double& t1, bool& inside);
+    bool intersect(const TRay<T>& r, T& t0, T& t1, bool& inside) const;
+    bool closest_hit(const TRay<T>& r, THit<T>& hit) const;
+    bool occludes(const TRay<T>& r, const T tmax) const;
+    tvec3<T> offset(const tvec3<T>& p, const bool outwards) const;
 private:
-    vec3 _origin;
-    double _radius;
-    Material *_matte;
+    tvec3<T> _origin;
+    T _radius;
+    uint32_t _material;
+    uint32_t _pad = 0;
 };
 
-bool Sphere::intersect(const Ray& r, double& t0, double& t1, bool& inside) {
-    vec3 oc = r.origin() - _origin;
+template <typename T>
+bool TSphere<T>::intersect(const TRay<T>& r, T& t0, T& t1, bool& inside) const {
+    tvec3<T> oc = r.origin() - _origin;
     if (dot(oc, oc) < _radius*_radius) {
         /* ray origin is inside the sphere
          */
@@ -64,67 +90,170 @@ bool Sphere::intersect(const Ray& r, double& t0, double& t1, bool& inside) {
          */
         inside = false;
     }
-    double a = dot(r.direction(), r.direction());
-    double b = dot(oc, r.direction()) * 2.0;
-    double c = dot(oc, oc) - _radius * _radius;
-    double delta = b*b - 4*a*c;
-
-    if (delta >= 0.0) {
-        t0 = (-b - sqrt(delta))/(2.0*a);
-        t1 = (-b + sqrt(delta))/(2.0*a);
+    T a = dot(r.direction(), r.direction());
+    T b = dot(oc, r.direction()) * T(2.0);
+    T c = dot(oc, oc) - _radius * _radius;
+    T delta = b*b - 4*a*c;
+
+    if (delta >= T(0.0)) {
+        t0 = (-b - std::sqrt(delta))/(T(2.0)*a);
+        t1 = (-b + std::sqrt(delta))/(T(2.0)*a);
         return true;
     }
     return false;
 }
 
-class Material {
+/* nearest surface along a ray, t is the entry distance for rays coming from
+ * outside and the exit distance for rays starting inside the object. a
+ * hit is on a sphere or on a triangle of a mesh, whoever moves it sets
+ * all three pointers. for triangles inside means the back face was hit.
+ * inst is the instance that placed the sphere or mesh, the surface
+ * queries map through it
+ */
+template <typename T>
+struct THit {
+    T t = std::numeric_limits<T>::max();
+    const TSphere<T> *obj = nullptr;
+    const TTriangleMesh<T> *mesh = nullptr;
+    uint32_t prim = 0; /* triangle of mesh */
+    const TInstance<T> *inst = nullptr;
+    bool inside = false;
+
+    inline bool found() const { return obj != nullptr || mesh != nullptr; }
+    /* the surface at a hit point pos, defined with the instances */
+    uint32_t material() const;
+    tvec3<T> normal(const tvec3<T>& pos) const; /* unit, out of the object */
+    tvec3<T> offset(const tvec3<T>& pos, const bool outwards) const;
+    /* the same in the object space of the sphere or mesh */
+    tvec3<T> local_normal(const tvec3<T>& p) const;
+    tvec3<T> local_offset(const tvec3<T>& p, const bool outwards) const;
+};
+
+template <typename T>
+bool TSphere<T>::closest_hit(const TRay<T>& r, THit<T>& hit) const {
+    T t0 = std::numeric_limits<T>::max();
+    T t1 = std::numeric_limits<T>::max();
+    bool inside = false;
+
+    if (!intersect(r, t0, t1, inside)) {
+        return false;
+    }
+    assert((t0 != 0.0) && (t1 != 0.0)); /* origin of ray is on the surface of the object and direct outwards */
+    /* inside: t0 < 0 < t1, take the exit point.
+     * outside: both roots behind the origin means the sphere is behind the ray
+     */
+    T t = inside ? t1 : t0;
+    if (t < T(0.0) || t >= hit.t) {
+        return false;
+    }
+    hit.t = t;
+    hit.obj = this;
+    hit.mesh = nullptr;
+    hit.inst = nullptr;
+    hit.inside = inside;
+    return true;
+}
+
+/* any root in (0, tmax), only takes a square root when the sphere is not
+ * already behind the ray
+ */
+template <typename T>
+bool TSphere<T>::occludes(const TRay<T>& r, const T tmax) const {
+    tvec3<T> oc = r.origin() - _origin;
+    tvec3<T> d = r.direction();
+    T a = dot(d, d);
+    T half_b = dot(oc, d);
+    T c = dot(oc, oc) - _radius * _radius;
+
+    if (c >= T(0.0) && half_b >= T(0.0)) {
+        /* origin outside (or on the surface) and moving away */
+        return false;
+    }
+    T delta = half_b*half_b - a*c;
+    if (delta < T(0.0)) {
+        return false;
+    }
+    if (c < T(0.0)) {
+        /* origin inside, blocked unless the exit lies beyond tmax */
+        return (-half_b + std::sqrt(delta)) < tmax * a;
+    }
+    return (-half_b - std::sqrt(delta)) < tmax * a;
+}
+
+// Hit point offset in units of epsilon times the magnitude of the sphere
+constexpr int SPHERE_OFFSET_ULPS = 64;
+
+/* p lies on the surface up to rounding, place it on the same radial line
+ * strictly outside (or inside) the sphere. the distance to the surface is
+ * a bound on the rounding error of the coordinates and of the r*r test,
+ * so the point lands on the requested side in one step
+ */
+template <typename T>
+tvec3<T> TSphere<T>::offset(const tvec3<T>& p, const bool outwards) const {
+    tvec3<T> n = p - _origin;
+    n.normalize();
+    const T scale = std::max(std::max(std::fabs(_origin.x()), std::fabs(_origin.y())), std::fabs(_origin.z())) + _radius;
+    const T err = T(SPHERE_OFFSET_ULPS) * std::numeric_limits<T>::epsilon() * scale;
+    return _origin + n * (outwards ? _radius + err : _radius - err);
+}
+
+template <typename T>
+class TMaterial {
 public:
-    ~Material() {}
-    Material(const vec3& kd, const vec3& ks, const double sf, const bool tsp, const double ri) :
+    ~TMaterial() {}
+    TMaterial(const tvec3<T>& kd, const tvec3<T>& ks, const T sf, const bool tsp, const T ri) :
         _kdiffuse(kd),
         _kspecular(ks),
         _specular_factor(sf),
         _transparent(tsp),
         _refract_idx(ri) {}
-    Material(const Material&) = delete;
-    inline vec3 kdiffuse() const { return _kdiffuse; }
-    inline vec3 kspecular() const { return _kspecular; }
-    inline double specular_factor() const { return _specular_factor; }
+    inline tvec3<T> kdiffuse() const { return _kdiffuse; }
+    inline tvec3<T> kspecular() const { return _kspecular; }
+    inline T specular_factor() const { return _specular_factor; }
     inline bool transparent() const { return _transparent; }
-    inline double refract_idx() const { return _refract_idx; }
+    inline T refract_idx() const { return _refract_idx; }
 private:
-    vec3 _kdiffuse;
-    vec3 _kspecular;
-    double _specular_factor;
+    tvec3<T> _kdiffuse;
+    tvec3<T> _kspecular;
+    T _specular_factor;
     bool _transparent;
-    double _refract_idx;
+    T _refract_idx;
 };
 
-class LightBase {
+template <typename T>
+class TLightBase {
 public:
-    ~LightBase() {}
-    LightBase() = delete;
-    explicit LightBase(const vec3& o, const vec3& i, double e) : _origin(o), _illumination(i), _energy(e) {}
-    inline vec3 origin() const { return _origin; }
-    inline vec3 illumination() const { return _illumination*_energy; }
-    inline double energy() const { return _energy; }
-    virtual vec3 calc_illumination(const vec3& pos) const = 0;
-    friend std::ostream & operator<<(std::ostream &os, const LightBase& l) {
+    virtual ~TLightBase() {}
+    TLightBase() = delete;
+    explicit TLightBase(const tvec3<T>& o, const tvec3<T>& i, T e) : _origin(o), _illumination(i), _energy(e) {}
+    inline tvec3<T> origin() const { return _origin; }
+    inline tvec3<T> illumination() const { return _illumination*_energy; }
+    inline T energy() const { return _energy; }
+    virtual tvec3<T> calc_illumination(const tvec3<T>& pos) const = 0;
+    friend std::ostream & operator<<(std::ostream &os, const TLightBase& l) {
         os << "[" << l.origin() << " " << l.illumination() << "]";
         return os;
     }
 private:
-    vec3 _origin;
-    vec3 _illumination;
-    double _energy;
+    tvec3<T> _origin;
+    tvec3<T> _illumination;
+    T _energy;
 };
 
-class ConstantLight : public LightBase{
+template <typename T>
+class TConstantLight : public TLightBase<T> {
 public:
-    ~ConstantLight() {}
-    ConstantLight() = delete;
-    explicit ConstantLight(const vec3& o, const vec3& i, double e) : LightBase(o, i, e) {}
-    ConstantLight operator=(const ConstantLight& l) = delete;
-    vec3 calc_illumination(const vec3& pos) const final { return this->illumination(); }
+    ~TConstantLight() {}
+    TConstantLight() = delete;
+    explicit TConstantLight(const tvec3<T>& o, const tvec3<T>& i, T e) : TLightBase<T>(o, i, e) {}
+    TConstantLight operator=(const TConstantLight& l) = delete;
+    tvec3<T> calc_illumination(const tvec3<T>& pos) const final { return this->illumination(); }
 };
+
+typedef TRay<double> Ray;
+typedef TSphere<double> Sphere;
+typedef THit<double> Hit;
+typedef TMaterial<double> Material;
+typedef TLightBase<double> LightBase;
+typedef TConstantLight<double> ConstantLight;
 #endif
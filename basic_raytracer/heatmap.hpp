@@ -0,0 +1,154 @@
+#ifndef _HEATMAP_HPP_
+#define _HEATMAP_HPP_
+
+#include "framebuffer.hpp"
+#include "image_io.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+enum HeatmapMode {
+    HEATMAP_OFF,
+    HEATMAP_NS,    /* wall time of the pixel's samples */
+    HEATMAP_TESTS, /* primitive tests of closest hit and occlusion queries */
+};
+
+inline const char *heatmap_name(const HeatmapMode m) {
+    switch (m) {
+    case HEATMAP_OFF: return "off";
+    case HEATMAP_NS: return "ns";
+    case HEATMAP_TESTS: return "tests";
+    }
+    return "?";
+}
+
+inline bool parse_heatmap(const char *s, HeatmapMode& m) {
+    if (0 == strcmp(s, "ns")) {
+        m = HEATMAP_NS;
+    } else if (0 == strcmp(s, "tests") && TRACE_STATS) {
+        /* test counts come from the stats layer */
+        m = HEATMAP_TESTS;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* cost of one pixel, measured around its samples with the clock the tile
+ * timing uses, or as the growth of the thread's test counters
+ */
+class PixelMeter {
+public:
+    explicit PixelMeter(const HeatmapMode m) : _mode(m) {}
+    inline void start() {
+        if (_mode == HEATMAP_NS) {
+            _t0 = std::chrono::steady_clock::now();
+        } else {
+            _tests0 = tests();
+        }
+    }
+    inline double stop() const {
+        if (_mode == HEATMAP_NS) {
+            return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - _t0).count();
+        }
+        return double(tests() - _tests0);
+    }
+private:
+    static inline uint64_t tests() {
+#if TRACE_STATS
+        const TraceStats& s = thread_stats();
+        return s.sphere_tests + s.triangle_tests + s.shadow_tests;
+#else
+        return 0;
+#endif
+    }
+
+    HeatmapMode _mode;
+    std::chrono::steady_clock::time_point _t0;
+    uint64_t _tests0 = 0;
+};
+
+/* per pixel costs, progressive passes add to them */
+class CostMap {
+public:
+    ~CostMap() {}
+    CostMap() = delete;
+    CostMap(const int w, const int h, const HeatmapMode m) : _width(w), _height(h), _mode(m), _cost(size_t(w) * h, 0.0) {}
+    inline HeatmapMode mode() const { return _mode; }
+    inline double& at(const int x, const int y) { return _cost[size_t(y) * _width + x]; }
+
+    /* raw cost in every channel, for the PFM */
+    Framebuffer raw() const {
+        Framebuffer fb(_width, _height);
+        for (int i = 0; i < _height; i++) {
+            for (int j = 0; j < _width; j++) {
+                const double c = _cost[size_t(i) * _width + j];
+                fb.at(j, i) = vec3(c, c, c);
+            }
+        }
+        return fb;
+    }
+
+    /* cost through a black, purple, orange, yellow ramp, saturating at
+     * scale. the writers apply the display gamma, so the ramp is stored
+     * squared to come out as designed
+     */
+    Framebuffer colour(const double scale) const {
+        static const double stops[5][3] = {
+            { 0.0, 0.0, 0.02 }, { 0.34, 0.06, 0.43 }, { 0.73, 0.21, 0.33 }, { 0.98, 0.55, 0.04 }, { 0.99, 1.0, 0.64 },
+        };
+        Framebuffer fb(_width, _height);
+        for (int i = 0; i < _height; i++) {
+            for (int j = 0; j < _width; j++) {
+                const double x = std::min(1.0, _cost[size_t(i) * _width + j] / std::max(scale, 1e-30)) * 4.0;
+                const int k = std::min(3, int(x));
+                const double f = x - k;
+                double c[3];
+                for (int a = 0; a < 3; a++) {
+                    const double v = stops[k][a] + (stops[k + 1][a] - stops[k][a]) * f;
+                    c[a] = TRACE_GAMMA ? v * v : v;
+                }
+                fb.at(j, i) = vec3(c[0], c[1], c[2]);
+            }
+        }
+        return fb;
+    }
+
+    /* cost at quantile q over the pixels */
+    double quantile(const double q) const {
+        std::vector<double> s = _cost;
+        const size_t k = std::min(s.size() - 1, size_t(q * s.size()));
+        std::nth_element(s.begin(), s.begin() + k, s.end());
+        return s[k];
+    }
+
+    friend std::ostream & operator<<(std::ostream &os, const CostMap& m) {
+        std::vector<double> s = m._cost;
+        std::sort(s.begin(), s.end(), std::greater<double>());
+        double total = 0.0;
+        for (const double c : s) {
+            total += c;
+        }
+        double top = 0.0;
+        for (size_t i = 0; i < s.size() / 10; i++) {
+            top += s[i];
+        }
+        const std::string unit = std::string(" ") + heatmap_name(m._mode);
+        os << std::fixed << std::setprecision(1)
+           << "pixel cost      mean " << total / s.size() << unit << ", median " << s[s.size() / 2]
+           << ", p99 " << m.quantile(0.99) << ", max " << s.front() << "\n"
+           << "                costliest 10% of pixels take " << (total > 0.0 ? top * 100.0 / total : 0.0) << "% of the total\n";
+        return os;
+    }
+private:
+    int _width;
+    int _height;
+    HeatmapMode _mode;
+    std::vector<double> _cost;
+};
+#endif
@@ -0,0 +1,312 @@
+#ifndef _IMAGE_IO_HPP_
+#define _IMAGE_IO_HPP_
+
+#include "framebuffer.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TRACE_GAMMA 1
+
+enum ImageFormat {
+    IMAGE_P3,  /* ASCII PPM */
+    IMAGE_P6,  /* binary PPM */
+    IMAGE_QOI, /* lossless "quite OK image" */
+    IMAGE_PFM, /* linear float RGB for compositing */
+};
+
+inline const char *format_name(const ImageFormat f) {
+    switch (f) {
+    case IMAGE_P3: return "p3";
+    case IMAGE_P6: return "p6";
+    case IMAGE_QOI: return "qoi";
+    case IMAGE_PFM: return "pfm";
+    }
+    return "?";
+}
+
+inline const char *format_extension(const ImageFormat f) {
+    switch (f) {
+    case IMAGE_P3: return ".ppm";
+    case IMAGE_P6: return ".ppm";
+    case IMAGE_QOI: return ".qoi";
+    case IMAGE_PFM: return ".pfm";
+    }
+    return "";
+}
+
+struct ImageTarget {
+    ImageFormat format;
+    std::string path;
+};
+
+inline bool parse_format(const char *s, ImageFormat& f) {
+    const ImageFormat all[] = { IMAGE_P3, IMAGE_P6, IMAGE_QOI, IMAGE_PFM };
+    for (const ImageFormat a : all) {
+        if (0 == strcmp(s, format_name(a))) {
+            f = a;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* display value of a linear radiance channel. P3 writes it as is, values
+ * above 1 included, the binary formats clamp it to a byte
+ */
+static inline int to_byte(const double c) {
+#if TRACE_GAMMA
+    return int(sqrt(c)*255);
+#else
+    return int(c*255);
+#endif
+}
+
+static inline uint8_t to_u8(const double c) {
+    const int b = to_byte(c);
+    return uint8_t(b < 0 ? 0 : (b > 255 ? 255 : b));
+}
+
+static void encode_p3(const Framebuffer& fb, std::string& out) {
+    out = "P3\n" + std::to_string(fb.width()) + " " + std::to_string(fb.height()) + "\n255\n";
+    for (int i = 0; i < fb.height(); i++) {
+        for (int j = 0; j < fb.width(); j++) {
+            const vec3& res = fb.at(j, i);
+            for (int c = 0; c < 3; c++) {
+                const int v = to_byte(res[c]);
+                if (v >= 0 && v < 1000) {
+                    /* the common case, skip the formatted path */
+                    if (v >= 100) {
+                        out += char('0' + v / 100);
+                    }
+                    if (v >= 10) {
+                        out += char('0' + v / 10 % 10);
+                    }
+                    out += char('0' + v % 10);
+                    out += ' ';
+                } else {
+                    out += std::to_string(v) + " ";
+                }
+            }
+        }
+        out += "\n";
+    }
+}
+
+static void encode_p6(const Framebuffer& fb, std::string& out) {
+    out = "P6\n" + std::to_string(fb.width()) + " " + std::to_string(fb.height()) + "\n255\n";
+    size_t at = out.size();
+    out.resize(at + size_t(fb.width()) * fb.height() * 3);
+    for (int i = 0; i < fb.height(); i++) {
+        for (int j = 0; j < fb.width(); j++) {
+            const vec3& res = fb.at(j, i);
+            for (int c = 0; c < 3; c++) {
+                out[at++] = char(to_u8(res[c]));
+            }
+        }
+    }
+}
+
+/* QOI, RGB channels, chunk layout per the qoiformat.org specification */
+static void encode_qoi(const Framebuffer& fb, std::string& out) {
+    const uint32_t w = fb.width();
+    const uint32_t h = fb.height();
+    out.clear();
+    out.reserve(14 + size_t(w) * h * 4 + 8);
+    out += "qoif";
+    for (const uint32_t v : { w, h }) {
+        out += char(v >> 24);
+        out += char(v >> 16);
+        out += char(v >> 8);
+        out += char(v);
+    }
+    out += char(3); /* channels */
+    out += char(0); /* sRGB with linear alpha */
+
+    struct Px { uint8_t r, g, b, a; };
+    Px index[64] = {};
+    Px prev = { 0, 0, 0, 255 };
+    int run = 0;
+    const size_t n = size_t(w) * h;
+    for (size_t p = 0; p < n; p++) {
+        const vec3& res = fb.at(p % w, p / w);
+        const Px px = { to_u8(res.r()), to_u8(res.g()), to_u8(res.b()), 255 };
+        if (px.r == prev.r && px.g == prev.g && px.b == prev.b) {
+            run++;
+            if (run == 62 || p + 1 == n) {
+                out += char(0xc0 | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run) {
+            out += char(0xc0 | (run - 1));
+            run = 0;
+        }
+        const int slot = (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+        if (index[slot].r == px.r && index[slot].g == px.g && index[slot].b == px.b && index[slot].a == px.a) {
+            out += char(slot);
+        } else {
+            index[slot] = px;
+            const int8_t dr = int8_t(px.r - prev.r);
+            const int8_t dg = int8_t(px.g - prev.g);
+            const int8_t db = int8_t(px.b - prev.b);
+            const int8_t dr_dg = int8_t(dr - dg);
+            const int8_t db_dg = int8_t(db - dg);
+            if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+                out += char(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+            } else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 && db_dg < 8) {
+                out += char(0x80 | (dg + 32));
+                out += char((dr_dg + 8) << 4 | (db_dg + 8));
+            } else {
+                out += char(0xfe);
+                out += char(px.r);
+                out += char(px.g);
+                out += char(px.b);
+            }
+        }
+        prev = px;
+    }
+    out.append(7, char(0));
+    out += char(1);
+}
+
+/* little endian float RGB, rows from the bottom up, linear radiance */
+static void encode_pfm(const Framebuffer& fb, std::string& out) {
+    out = "PF\n" + std::to_string(fb.width()) + " " + std::to_string(fb.height()) + "\n-1.0\n";
+    size_t at = out.size();
+    out.resize(at + size_t(fb.width()) * fb.height() * 3 * sizeof(float));
+    for (int i = fb.height() - 1; i >= 0; i--) {
+        for (int j = 0; j < fb.width(); j++) {
+            const vec3& res = fb.at(j, i);
+            const float rgb[3] = { float(res.r()), float(res.g()), float(res.b()) };
+            memcpy(&out[at], rgb, sizeof(rgb));
+            at += sizeof(rgb);
+        }
+    }
+}
+
+inline void encode_image(const Framebuffer& fb, const ImageFormat f, std::string& out) {
+    switch (f) {
+    case IMAGE_P3: encode_p3(fb, out); break;
+    case IMAGE_P6: encode_p6(fb, out); break;
+    case IMAGE_QOI: encode_qoi(fb, out); break;
+    case IMAGE_PFM: encode_pfm(fb, out); break;
+    }
+}
+
+/* encodes and writes images on its own thread so the render threads go on
+ * with the next frame. jobs own their framebuffer, submit takes it over
+ */
+class ImageWriter {
+public:
+    struct Record {
+        std::string path;
+        ImageFormat format;
+        size_t bytes;
+        double seconds; /* encode plus write */
+        bool ok;
+    };
+
+    /* submit blocks while max_pending images wait to be written, 0 never
+     * blocks. a sequence keeps a few frames in flight instead of all
+     */
+    explicit ImageWriter(const size_t max_pending = 0) : _max_pending(max_pending), _thread(&ImageWriter::loop, this) {}
+    ImageWriter(const ImageWriter&) = delete;
+    ~ImageWriter() {
+        {
+            std::lock_guard<std::mutex> lk(_lock);
+            _quit = true;
+        }
+        _wake.notify_all();
+        _thread.join();
+    }
+
+    /* the same framebuffer in several formats is encoded in order */
+    void submit(Framebuffer&& fb, const std::vector<ImageTarget>& targets) {
+        {
+            std::unique_lock<std::mutex> lk(_lock);
+            _room.wait(lk, [this]{ return _max_pending == 0 || _jobs.size() < _max_pending; });
+            _jobs.push_back(Job { std::move(fb), targets });
+        }
+        _wake.notify_all();
+    }
+
+    /* blocks until every submitted image is on disk */
+    void wait() {
+        std::unique_lock<std::mutex> lk(_lock);
+        _idle.wait(lk, [this]{ return _jobs.empty() && !_busy; });
+    }
+
+    std::vector<Record> records() {
+        std::lock_guard<std::mutex> lk(_lock);
+        return _records;
+    }
+
+    friend std::ostream & operator<<(std::ostream &os, ImageWriter& w) {
+        for (const auto& r : w.records()) {
+            os << "wrote " << std::setw(4) << format_name(r.format) << " " << r.path << ": "
+               << (r.ok ? "" : "FAILED, ") << r.bytes << " bytes in "
+               << std::fixed << std::setprecision(2) << r.seconds * 1e3 << " ms\n";
+        }
+        return os;
+    }
+private:
+    struct Job {
+        Framebuffer fb;
+        std::vector<ImageTarget> targets;
+    };
+
+    void loop() {
+        std::string buf;
+        std::unique_lock<std::mutex> lk(_lock);
+        for (;;) {
+            _wake.wait(lk, [this]{ return _quit || !_jobs.empty(); });
+            if (_jobs.empty()) {
+                return;
+            }
+            Job job = std::move(_jobs.front());
+            _jobs.pop_front();
+            _busy = true;
+            lk.unlock();
+            _room.notify_all();
+
+            std::vector<Record> done;
+            for (const auto& t : job.targets) {
+                auto start = std::chrono::steady_clock::now();
+                encode_image(job.fb, t.format, buf);
+                FILE *file = fopen(t.path.c_str(), "wb");
+                bool ok = file && fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+                ok = file && 0 == fclose(file) && ok;
+                const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                done.push_back(Record { t.path, t.format, buf.size(), sec, ok });
+            }
+
+            lk.lock();
+            _records.insert(_records.end(), done.begin(), done.end());
+            _busy = false;
+            _idle.notify_all();
+        }
+    }
+
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    std::condition_variable _room;
+    std::deque<Job> _jobs;
+    std::vector<Record> _records;
+    bool _busy = false;
+    bool _quit = false;
+    size_t _max_pending;
+    std::thread _thread;
+};
+#endif
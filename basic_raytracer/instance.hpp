@@ -0,0 +1,354 @@
+#ifndef _INSTANCE_HPP_
+#define _INSTANCE_HPP_
+
+#include "bvh.hpp"
+#include "mesh.hpp"
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Instance material that keeps the material of the geometry
+constexpr uint32_t INSTANCE_GEOMETRY_MATERIAL = 0xFFFFFFFFu;
+
+/* affine map x' = L x + t as the rows of a 3x4 matrix, t in the last
+ * column
+ */
+template <typename T>
+struct TAffine {
+    T m[3][4];
+
+    inline tvec3<T> point(const tvec3<T>& p) const {
+        return tvec3<T>(m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                        m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                        m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+    }
+    inline tvec3<T> vector(const tvec3<T>& v) const {
+        return tvec3<T>(m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                        m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                        m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+    }
+    /* L^T v, takes normals through the inverse map */
+    inline tvec3<T> transposed(const tvec3<T>& v) const {
+        return tvec3<T>(m[0][0]*v.x() + m[1][0]*v.y() + m[2][0]*v.z(),
+                        m[0][1]*v.x() + m[1][1]*v.y() + m[2][1]*v.z(),
+                        m[0][2]*v.x() + m[1][2]*v.y() + m[2][2]*v.z());
+    }
+};
+
+/* inverse of an affine map, false when the linear part is singular */
+template <typename S, typename D>
+inline bool invert_affine(const S m[3][4], D inv[3][4]) {
+    const double a[3][3] = {
+        { double(m[0][0]), double(m[0][1]), double(m[0][2]) },
+        { double(m[1][0]), double(m[1][1]), double(m[1][2]) },
+        { double(m[2][0]), double(m[2][1]), double(m[2][2]) },
+    };
+    const double c[3][3] = {
+        { a[1][1]*a[2][2] - a[1][2]*a[2][1], a[0][2]*a[2][1] - a[0][1]*a[2][2], a[0][1]*a[1][2] - a[0][2]*a[1][1] },
+        { a[1][2]*a[2][0] - a[1][0]*a[2][2], a[0][0]*a[2][2] - a[0][2]*a[2][0], a[0][2]*a[1][0] - a[0][0]*a[1][2] },
+        { a[1][0]*a[2][1] - a[1][1]*a[2][0], a[0][1]*a[2][0] - a[0][0]*a[2][1], a[0][0]*a[1][1] - a[0][1]*a[1][0] },
+    };
+    const double det = a[0][0]*c[0][0] + a[0][1]*c[1][0] + a[0][2]*c[2][0];
+    if (!(std::fabs(det) > 0.0) || !std::isfinite(det)) {
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        double t = 0.0;
+        for (int j = 0; j < 3; j++) {
+            inv[i][j] = D(c[i][j] / det);
+            t -= c[i][j] / det * double(m[j][3]);
+        }
+        inv[i][3] = D(t);
+    }
+    return true;
+}
+
+/* one placement of shared geometry: the map from world into its object
+ * space and a material that replaces the geometry's unless it is
+ * INSTANCE_GEOMETRY_MATERIAL. the geometry is not owned and is not an
+ * instance BVH itself, one level of instancing. the map back to world is
+ * only needed when shading and is inverted then, which keeps an instance
+ * at a 3x4 matrix, a pointer and a material
+ */
+template <typename T>
+class TInstance {
+public:
+    ~TInstance() {}
+    TInstance() = delete;
+    /* to_world has to be invertible, scene validation checks it */
+    TInstance(const TAccelerator<T> *geometry, const double to_world[3][4], const uint32_t material = INSTANCE_GEOMETRY_MATERIAL) :
+        _geometry(geometry), _material(material) {
+        invert_affine(to_world, _to_object.m);
+    }
+
+    inline const TAccelerator<T> *geometry() const { return _geometry; }
+    inline uint32_t material() const { return _material; }
+    inline const TAffine<T>& to_object() const { return _to_object; }
+    TAffine<T> to_world() const {
+        TAffine<T> w;
+        invert_affine(_to_object.m, w.m);
+        return w;
+    }
+    /* the direction is not renormalised, so t means the same on both sides */
+    inline TRay<T> to_local(const TRay<T>& r) const {
+        return TRay<T>(_to_object.point(r.origin()), _to_object.vector(r.direction()));
+    }
+    /* world box around the corners of the geometry's box */
+    AABB bounds() const {
+        const AABB local = _geometry->bounds();
+        AABB box;
+        if (local.empty()) {
+            return box;
+        }
+        const TAffine<T> w = to_world();
+        for (int k = 0; k < 8; k++) {
+            const tvec3<T> c(T(k & 1 ? local.hi[0] : local.lo[0]), T(k & 2 ? local.hi[1] : local.lo[1]), T(k & 4 ? local.hi[2] : local.lo[2]));
+            const tvec3<T> p = w.point(c);
+            const double q[3] = { double(p.x()), double(p.y()), double(p.z()) };
+            box.grow(q);
+        }
+        return box;
+    }
+private:
+    TAffine<T> _to_object;
+    const TAccelerator<T> *_geometry;
+    uint32_t _material;
+};
+
+/* top level of a two level hierarchy: a BVH over instance boxes whose
+ * leaves move the ray into the object space of each instance and query
+ * the shared bottom level there. instances are kept in leaf order
+ */
+template <typename T>
+class TInstanceBVH : public TAccelerator<T> {
+public:
+    ~TInstanceBVH() {}
+    TInstanceBVH() = delete;
+    TInstanceBVH(const TInstanceBVH&) = delete;
+    explicit TInstanceBVH(std::vector<TInstance<T>>&& instances, const uint32_t max_leaf = 2);
+    /* takes the instances as they are now, in the order of construction */
+    void refit(const std::vector<TInstance<T>>& instances);
+    bool intersect(const TRay<T>& r, THit<T>& hit) const final;
+    bool occluded(const TRay<T>& r, const T tmax) const final;
+    AABB bounds() const final { return node_bounds(_nodes); }
+
+    inline size_t size() const { return _instances.size(); }
+    inline size_t nodes() const { return _nodes.size(); }
+    inline size_t bytes() const {
+        return _instances.size() * (sizeof(TInstance<T>) + sizeof(uint32_t)) + _nodes.size() * sizeof(TBVHNode<T>);
+    }
+    inline const std::vector<TBVHNode<T>>& tree() const { return _nodes; }
+private:
+    std::vector<TBVHNode<T>> _nodes;
+    std::vector<TInstance<T>> _instances;
+    std::vector<uint32_t> _order; /* leaf slot to caller's index */
+};
+
+/* world box of an instance padded by a few ulps of its largest coordinate */
+template <typename T>
+static inline AABB instance_box(const TInstance<T>& inst) {
+    AABB box = inst.bounds();
+    double scale = 0.0;
+    for (int a = 0; a < 3; a++) {
+        scale = std::max(scale, std::max(std::fabs(box.lo[a]), std::fabs(box.hi[a])));
+    }
+    const double pad = scale * bvh_pad<T>();
+    for (int a = 0; a < 3; a++) {
+        box.lo[a] -= pad;
+        box.hi[a] += pad;
+    }
+    return box;
+}
+
+template <typename T>
+TInstanceBVH<T>::TInstanceBVH(std::vector<TInstance<T>>&& instances, const uint32_t max_leaf) :
+    _instances(std::move(instances)) {
+    const size_t n = _instances.size();
+    std::vector<BVHBuildPrim> prims(n);
+    for (uint32_t i = 0; i < n; i++) {
+        BVHBuildPrim& p = prims[i];
+        p.box = instance_box(_instances[i]);
+        for (int a = 0; a < 3; a++) {
+            p.centroid[a] = 0.5 * (p.box.lo[a] + p.box.hi[a]);
+        }
+        p.index = i;
+    }
+    TBVHBuilder<T>(prims, _nodes, max_leaf).run();
+    _order.resize(n);
+    for (uint32_t i = 0; i < n; i++) {
+        _order[i] = prims[i].index;
+    }
+
+    /* into leaf order in place, cycle by cycle, so a large scene never
+     * holds two copies of its instances
+     */
+    std::vector<bool> done(n, false);
+    for (uint32_t i = 0; i < n; i++) {
+        if (done[i]) {
+            continue;
+        }
+        const TInstance<T> first = _instances[i];
+        uint32_t j = i;
+        while (prims[j].index != i) {
+            _instances[j] = _instances[prims[j].index];
+            done[j] = true;
+            j = prims[j].index;
+        }
+        _instances[j] = first;
+        done[j] = true;
+    }
+}
+
+template <typename T>
+void TInstanceBVH<T>::refit(const std::vector<TInstance<T>>& instances) {
+    for (size_t i = 0; i < _instances.size(); i++) {
+        _instances[i] = instances[_order[i]];
+    }
+    refit_nodes(_nodes, [&](const uint32_t i) { return instance_box(_instances[i]); });
+}
+
+template <typename T>
+bool TInstanceBVH<T>::intersect(const TRay<T>& r, THit<T>& hit) const {
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    const tvec3<T> o = r.origin();
+    const tvec3<T> d = r.direction();
+    const T org[3] = { o.x(), o.y(), o.z() };
+    const T inv[3] = { T(1.0) / d.x(), T(1.0) / d.y(), T(1.0) / d.z() };
+    const bool neg[3] = { inv[0] < T(0.0), inv[1] < T(0.0), inv[2] < T(0.0) };
+
+    bool found = false;
+    uint64_t tests = 0;
+    uint32_t stack[BVH_STACK];
+    int sp = 0;
+    uint32_t cur = 0;
+    for (;;) {
+        const TBVHNode<T>& n = _nodes[cur];
+        if (slab_test(n, org, inv, hit.t)) {
+            if (n.count) {
+                for (uint32_t i = n.offset; i < n.offset + n.count; i++) {
+                    const TInstance<T>& inst = _instances[i];
+                    if (inst.geometry()->intersect(inst.to_local(r), hit)) {
+                        hit.inst = &inst;
+                        found = true;
+                    }
+                }
+                tests += n.count;
+            } else {
+                if (neg[n.axis]) {
+                    stack[sp++] = cur + 1;
+                    cur = n.offset;
+                } else {
+                    stack[sp++] = n.offset;
+                    cur = cur + 1;
+                }
+                continue;
+            }
+        }
+        if (sp == 0) {
+            break;
+        }
+        cur = stack[--sp];
+    }
+    TRACE_STAT(thread_stats().instance_tests += tests);
+    (void)tests;
+    return found;
+}
+
+template <typename T>
+bool TInstanceBVH<T>::occluded(const TRay<T>& r, const T tmax) const {
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    const tvec3<T> o = r.origin();
+    const tvec3<T> d = r.direction();
+    const T org[3] = { o.x(), o.y(), o.z() };
+    const T inv[3] = { T(1.0) / d.x(), T(1.0) / d.y(), T(1.0) / d.z() };
+    const bool neg[3] = { inv[0] < T(0.0), inv[1] < T(0.0), inv[2] < T(0.0) };
+
+    uint64_t tests = 0;
+    uint64_t nodes = 0;
+    bool blocked = false;
+    uint32_t stack[BVH_STACK];
+    int sp = 0;
+    uint32_t cur = 0;
+    for (;;) {
+        const TBVHNode<T>& n = _nodes[cur];
+        nodes++;
+        if (slab_test(n, org, inv, tmax)) {
+            if (n.count) {
+                for (uint32_t i = n.offset; i < n.offset + n.count; i++) {
+                    const TInstance<T>& inst = _instances[i];
+                    tests++;
+                    if (inst.geometry()->occluded(inst.to_local(r), tmax)) {
+                        blocked = true;
+                        break;
+                    }
+                }
+                if (blocked) {
+                    break;
+                }
+            } else {
+                if (neg[n.axis]) {
+                    stack[sp++] = cur + 1;
+                    cur = n.offset;
+                } else {
+                    stack[sp++] = n.offset;
+                    cur = cur + 1;
+                }
+                continue;
+            }
+        }
+        if (sp == 0) {
+            break;
+        }
+        cur = stack[--sp];
+    }
+
+    TRACE_STAT(TraceStats& stats = thread_stats(); stats.instance_tests += tests; stats.shadow_nodes += nodes);
+    (void)tests;
+    (void)nodes;
+    return blocked;
+}
+
+template <typename T>
+uint32_t THit<T>::material() const {
+    if (inst && inst->material() != INSTANCE_GEOMETRY_MATERIAL) {
+        return inst->material();
+    }
+    return mesh ? mesh->material() : obj->material();
+}
+
+template <typename T>
+tvec3<T> THit<T>::normal(const tvec3<T>& pos) const {
+    if (!inst) {
+        return local_normal(pos);
+    }
+    tvec3<T> n = inst->to_object().transposed(local_normal(inst->to_object().point(pos)));
+    n.normalize();
+    return n;
+}
+
+/* the object space step of the sphere or triangle taken back to world,
+ * plus a step for the rounding of pos against the world coordinates
+ */
+template <typename T>
+tvec3<T> THit<T>::offset(const tvec3<T>& pos, const bool outwards) const {
+    if (!inst) {
+        return local_offset(pos, outwards);
+    }
+    const TAffine<T> w = inst->to_world();
+    const tvec3<T> p = inst->to_object().point(pos);
+    const tvec3<T> step = w.vector(local_offset(p, outwards) - p);
+    T scale = std::max(std::max(std::fabs(pos.x()), std::fabs(pos.y())), std::fabs(pos.z()));
+    scale += std::max(std::max(std::fabs(w.m[0][3]), std::fabs(w.m[1][3])), std::fabs(w.m[2][3]));
+    const T err = T(TRIANGLE_OFFSET_ULPS) * std::numeric_limits<T>::epsilon() * scale;
+    return pos + step + normal(pos) * (outwards ? err : -err);
+}
+
+typedef TInstance<double> Instance;
+typedef TInstanceBVH<double> InstanceBVH;
+#endif
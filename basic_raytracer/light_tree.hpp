@@ -0,0 +1,218 @@
+#ifndef _LIGHT_TREE_HPP_
+#define _LIGHT_TREE_HPP_
+
+#include "geometry.hpp"
+#include "rng.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+/* subtree of lights: the box around their origins and their summed power,
+ * depth first like TBVHNode, the first child follows its parent
+ */
+template <typename T>
+struct TLightNode {
+    T lo[3];
+    T hi[3];
+    T power;
+    uint32_t offset; /* leaf: index into the light order, interior: second child */
+    uint32_t count;  /* 1 for leaves, 0 for interior nodes */
+};
+
+/* tree over point lights for picking one light per sample in proportion
+ * to an estimate of what it adds at a shading point: power over squared
+ * distance, clamped to the box size so a point inside a cluster does not
+ * favour one child without bound, and nothing for boxes wholly behind the
+ * surface, whose lights the shading would weigh by zero anyway. each draw
+ * walks from the root choosing a child by that estimate, so it is
+ * O(log n) and the probability of the light it returns is exact
+ */
+template <typename T>
+class TLightTree {
+public:
+    ~TLightTree() {}
+    TLightTree() = delete;
+    TLightTree(const TLightTree&) = delete;
+    explicit TLightTree(const std::vector<TLightBase<T> *>& lights);
+
+    /* a light for the point pos with normal nor from u in [0, 1), or -1
+     * when the walk ends in a subtree no light of which can reach it. pdf
+     * is the probability of the pick. a zero normal keeps the lights
+     * behind the surface
+     */
+    int sample(const tvec3<T>& pos, const tvec3<T>& nor, T u, T& pdf) const;
+    inline size_t size() const { return _nodes.size(); }
+private:
+    uint32_t build(const uint32_t begin, const uint32_t end);
+    T importance(const TLightNode<T>& n, const tvec3<T>& pos, const tvec3<T>& nor) const;
+
+    const std::vector<TLightBase<T> *>& _lights;
+    std::vector<TLightNode<T>> _nodes;
+    std::vector<uint32_t> _order; /* leaf order to index into lights */
+};
+
+/* power of a light as the luminance of what it emits */
+template <typename T>
+inline T light_power(const TLightBase<T>& l) {
+    const tvec3<T> e = l.illumination();
+    return T(0.2126) * e.x() + T(0.7152) * e.y() + T(0.0722) * e.z();
+}
+
+template <typename T>
+TLightTree<T>::TLightTree(const std::vector<TLightBase<T> *>& lights) : _lights(lights) {
+    _order.resize(lights.size());
+    for (uint32_t i = 0; i < lights.size(); i++) {
+        _order[i] = i;
+    }
+    if (!lights.empty()) {
+        _nodes.reserve(2 * lights.size());
+        build(0, lights.size());
+    }
+}
+
+/* median split along the widest extent of the origins, the tree stays
+ * balanced whatever the layout
+ */
+template <typename T>
+uint32_t TLightTree<T>::build(const uint32_t begin, const uint32_t end) {
+    const uint32_t self = _nodes.size();
+    _nodes.push_back(TLightNode<T>());
+    TLightNode<T> n;
+    n.power = T(0.0);
+    for (int a = 0; a < 3; a++) {
+        n.lo[a] = std::numeric_limits<T>::max();
+        n.hi[a] = -std::numeric_limits<T>::max();
+    }
+    for (uint32_t i = begin; i < end; i++) {
+        const TLightBase<T>& l = *_lights[_order[i]];
+        for (int a = 0; a < 3; a++) {
+            n.lo[a] = std::min(n.lo[a], l.origin()[a]);
+            n.hi[a] = std::max(n.hi[a], l.origin()[a]);
+        }
+        n.power += std::max(T(0.0), light_power(l));
+    }
+    if (end - begin == 1) {
+        n.offset = begin;
+        n.count = 1;
+        _nodes[self] = n;
+        return self;
+    }
+
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+        if (n.hi[a] - n.lo[a] > n.hi[axis] - n.lo[axis]) {
+            axis = a;
+        }
+    }
+    const uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(&_order[begin], &_order[mid], &_order[0] + end, [&](const uint32_t a, const uint32_t b) {
+        return _lights[a]->origin()[axis] < _lights[b]->origin()[axis];
+    });
+    n.count = 0;
+    _nodes[self] = n;
+    build(begin, mid);
+    _nodes[self].offset = build(mid, end);
+    return self;
+}
+
+template <typename T>
+T TLightTree<T>::importance(const TLightNode<T>& n, const tvec3<T>& pos, const tvec3<T>& nor) const {
+    /* lit only from the side the normal points to, a box whose corners
+     * are all behind the surface is, being convex, behind it too
+     */
+    bool front = false;
+    for (int k = 0; k < 8 && !front; k++) {
+        const tvec3<T> c(k & 1 ? n.hi[0] : n.lo[0], k & 2 ? n.hi[1] : n.lo[1], k & 4 ? n.hi[2] : n.lo[2]);
+        front = dot(c - pos, nor) >= T(0.0);
+    }
+    if (!front) {
+        return T(0.0);
+    }
+    T d2 = T(0.0);
+    T r2 = T(0.0);
+    for (int a = 0; a < 3; a++) {
+        const T c = T(0.5) * (n.lo[a] + n.hi[a]) - pos[a];
+        const T h = T(0.5) * (n.hi[a] - n.lo[a]);
+        d2 += c * c;
+        r2 += h * h;
+    }
+    return n.power / std::max(d2, std::max(r2, std::numeric_limits<T>::min()));
+}
+
+template <typename T>
+int TLightTree<T>::sample(const tvec3<T>& pos, const tvec3<T>& nor, T u, T& pdf) const {
+    pdf = T(1.0);
+    if (_nodes.empty()) {
+        return -1;
+    }
+    uint32_t cur = 0;
+    if (!(importance(_nodes[cur], pos, nor) > T(0.0))) {
+        return -1;
+    }
+    while (!_nodes[cur].count) {
+        const uint32_t first = cur + 1;
+        const uint32_t second = _nodes[cur].offset;
+        const T a = importance(_nodes[first], pos, nor);
+        const T b = importance(_nodes[second], pos, nor);
+        if (!(a + b > T(0.0))) {
+            return -1;
+        }
+        const T p = a / (a + b);
+        /* reuse u for the next level: rescale the part that picked */
+        if (u < p) {
+            pdf *= p;
+            u = std::min(u / p, T(1.0) - std::numeric_limits<T>::epsilon());
+            cur = first;
+        } else {
+            pdf *= T(1.0) - p;
+            u = std::min((u - p) / (T(1.0) - p), T(1.0) - std::numeric_limits<T>::epsilon());
+            cur = second;
+        }
+    }
+    return int(_order[_nodes[cur].offset]);
+}
+
+// Blocks of a hit_random stream, four draws each
+constexpr uint32_t HIT_BLOCKS = 0x10000;
+// Depths a hit_random stream tells apart
+constexpr uint32_t HIT_DEPTHS = 0x4000;
+// Light tree draws per hit, past them the blocks would repeat
+constexpr uint32_t MAX_LIGHT_SAMPLES = 4 * HIT_BLOCKS;
+
+/* what a hit draws for, each has a counter bit of its own so no light
+ * count reaches the roulette draw
+ */
+enum HitStream {
+    HIT_LIGHTS = 0,
+    HIT_ROULETTE = 1,
+};
+
+/* four numbers in [0, 1) for a hit in the ray tree of the sample of rng,
+ * keyed by its seed, pixel and sample, by the bits of the hit position
+ * and by the stream, the depth below HIT_DEPTHS and a block below
+ * HIT_BLOCKS. the lights a hit samples change with the seed and from
+ * sample to sample, and do not depend on which thread shades it or in
+ * which order
+ */
+template <typename T>
+inline void hit_random(const SampleRng& rng, const tvec3<T>& pos, const HitStream stream, const uint32_t depth, const uint32_t block, T out[4]) {
+    uint32_t w[3];
+    for (int a = 0; a < 3; a++) {
+        const double v = double(pos[a]);
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        w[a] = uint32_t(bits) ^ uint32_t(bits >> 32);
+    }
+    uint32_t bits[4];
+    rng.draw(w[0] ^ w[1] * PHILOX_M0 ^ w[2] * PHILOX_M1,
+             uint32_t(stream) << 30 | (depth & (HIT_DEPTHS - 1)) << 16 | (block & (HIT_BLOCKS - 1)), bits);
+    for (int i = 0; i < 4; i++) {
+        out[i] = std::min(T(to_unit(bits[i])), T(1.0) - std::numeric_limits<T>::epsilon());
+    }
+}
+
+typedef TLightTree<double> LightTree;
+#endif
@@ -0,0 +1,351 @@
+#ifndef _MESH_HPP_
+#define _MESH_HPP_
+
+#include "bvh.hpp"
+#include "mesh_io.hpp"
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Hit point offset in units of epsilon times the magnitude of the triangle
+constexpr int TRIANGLE_OFFSET_ULPS = 64;
+
+/* ax * by - ay * bx with the sign of the exact value. the plain
+ * difference decides unless it is within its rounding error of zero, then
+ * Kahan's difference of products on a fused multiply add does. both
+ * triangles of an edge evaluate the same two products, so they agree on
+ * the side of every ray
+ */
+template <typename T>
+static inline T edge_function(const T ax, const T ay, const T bx, const T by) {
+    const T p = ax * by;
+    const T q = ay * bx;
+    const T e = p - q;
+    if (std::fabs(e) > T(2.0) * std::numeric_limits<T>::epsilon() * (std::fabs(p) + std::fabs(q))) {
+        return e;
+    }
+    const T err = std::fma(-ay, bx, q);
+    return std::fma(ax, by, -q) + err;
+}
+
+/* ray set up for the watertight ray/triangle test (Woop, Benthin and Wald
+ * 2013): the dominant direction axis becomes z and a shear turns the ray
+ * into the +z axis, so the edge functions of neighbouring triangles are
+ * evaluated on identical values and a ray through a shared edge or
+ * vertex hits at least one of them
+ */
+template <typename T>
+struct TWatertightRay {
+    T org[3];
+    int kx, ky, kz;
+    T sx, sy, sz;
+
+    explicit TWatertightRay(const TRay<T>& r) {
+        const tvec3<T> o = r.origin();
+        const tvec3<T> d = r.direction();
+        org[0] = o.x();
+        org[1] = o.y();
+        org[2] = o.z();
+        const T ad[3] = { std::fabs(d.x()), std::fabs(d.y()), std::fabs(d.z()) };
+        kz = ad[0] > ad[1] ? (ad[0] > ad[2] ? 0 : 2) : (ad[1] > ad[2] ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        /* keep the winding of the sheared triangle */
+        if (d[kz] < T(0.0)) {
+            std::swap(kx, ky);
+        }
+        sx = d[kx] / d[kz];
+        sy = d[ky] / d[kz];
+        sz = T(1.0) / d[kz];
+    }
+};
+
+/* indexed triangles over vertex positions stored as separate x, y and z
+ * arrays, with their own BVH. the mesh is one member of the scene
+ * accelerator, so a query costs one virtual call per mesh and the
+ * triangles of a leaf are tested inline. triangles are kept in leaf order
+ * and hit from both sides, the counter clockwise side is the outside
+ */
+template <typename T>
+class TTriangleMesh : public TAccelerator<T> {
+public:
+    ~TTriangleMesh() {}
+    TTriangleMesh() = delete;
+    TTriangleMesh(const TTriangleMesh&) = delete;
+    TTriangleMesh(const MeshData& data, const uint32_t material, const uint32_t max_leaf = 4);
+    bool intersect(const TRay<T>& r, THit<T>& hit) const final;
+    bool occluded(const TRay<T>& r, const T tmax) const final;
+    AABB bounds() const final { return node_bounds(_nodes); }
+
+    inline uint32_t material() const { return _material; }
+    inline size_t triangles() const { return _index.size() / 3; }
+    inline size_t vertices() const { return _x.size(); }
+    inline size_t nodes() const { return _nodes.size(); }
+    inline size_t bytes() const {
+        return (_x.size() + _y.size() + _z.size()) * sizeof(T) + _index.size() * sizeof(uint32_t) + _nodes.size() * sizeof(TBVHNode<T>);
+    }
+    inline tvec3<T> vertex(const uint32_t v) const { return tvec3<T>(_x[v], _y[v], _z[v]); }
+    /* unit geometric normal of the counter clockwise side */
+    tvec3<T> normal(const uint32_t prim) const;
+    /* p on triangle prim up to rounding, moved off its plane */
+    tvec3<T> offset(const uint32_t prim, const tvec3<T>& p, const bool outwards) const;
+private:
+    /* edge functions of the sheared triangle, false when the ray passes
+     * outside. det is their sum and tdet the hit distance times det
+     */
+    static inline bool edge_test(const T a[3], const T b[3], const T c[3], const TWatertightRay<T>& wr, T& det, T& tdet);
+    inline bool test(const uint32_t prim, const TWatertightRay<T>& wr, const T tmax, T& t, bool& back) const;
+
+    std::vector<T> _x;
+    std::vector<T> _y;
+    std::vector<T> _z;
+    std::vector<uint32_t> _index; /* three per triangle */
+    std::vector<TBVHNode<T>> _nodes;
+    uint32_t _material;
+};
+
+template <typename T>
+TTriangleMesh<T>::TTriangleMesh(const MeshData& data, const uint32_t material, const uint32_t max_leaf) :
+    _x(data.x.begin(), data.x.end()),
+    _y(data.y.begin(), data.y.end()),
+    _z(data.z.begin(), data.z.end()),
+    _material(material) {
+    const size_t n = data.triangles();
+    std::vector<BVHBuildPrim> prims(n);
+    for (uint32_t i = 0; i < n; i++) {
+        BVHBuildPrim& p = prims[i];
+        double scale = 0.0;
+        for (int k = 0; k < 3; k++) {
+            const uint32_t v = data.index[3 * i + k];
+            const double q[3] = { data.x[v], data.y[v], data.z[v] };
+            p.box.grow(q);
+            scale = std::max(scale, std::max(std::max(std::fabs(q[0]), std::fabs(q[1])), std::fabs(q[2])));
+        }
+        /* node bounds are rounded to T, pad by the magnitude so a triangle
+         * lying in an axis plane keeps a box the slab test can enter
+         */
+        const double pad = scale * bvh_pad<T>();
+        for (int a = 0; a < 3; a++) {
+            p.box.lo[a] -= pad;
+            p.box.hi[a] += pad;
+            p.centroid[a] = 0.5 * (p.box.lo[a] + p.box.hi[a]);
+        }
+        p.index = i;
+    }
+    TBVHBuilder<T>(prims, _nodes, max_leaf).run();
+
+    _index.reserve(3 * n);
+    for (const auto& p : prims) {
+        for (int k = 0; k < 3; k++) {
+            _index.push_back(data.index[3 * p.index + k]);
+        }
+    }
+}
+
+template <typename T>
+inline bool TTriangleMesh<T>::edge_test(const T a[3], const T b[3], const T c[3], const TWatertightRay<T>& wr, T& det, T& tdet) {
+    const T ax = a[wr.kx] - wr.sx * a[wr.kz];
+    const T ay = a[wr.ky] - wr.sy * a[wr.kz];
+    const T bx = b[wr.kx] - wr.sx * b[wr.kz];
+    const T by = b[wr.ky] - wr.sy * b[wr.kz];
+    const T cx = c[wr.kx] - wr.sx * c[wr.kz];
+    const T cy = c[wr.ky] - wr.sy * c[wr.kz];
+    const T u = edge_function(cx, cy, bx, by);
+    const T v = edge_function(ax, ay, cx, cy);
+    const T w = edge_function(bx, by, ax, ay);
+    if ((u < T(0.0) || v < T(0.0) || w < T(0.0)) && (u > T(0.0) || v > T(0.0) || w > T(0.0))) {
+        return false;
+    }
+    det = u + v + w;
+    if (det == T(0.0)) {
+        return false;
+    }
+    const T az = wr.sz * a[wr.kz];
+    const T bz = wr.sz * b[wr.kz];
+    const T cz = wr.sz * c[wr.kz];
+    tdet = u * az + v * bz + w * cz;
+    return true;
+}
+
+/* hit in (0, tmax), back is true for the clockwise side */
+template <typename T>
+inline bool TTriangleMesh<T>::test(const uint32_t prim, const TWatertightRay<T>& wr, const T tmax, T& t, bool& back) const {
+    const uint32_t *idx = &_index[3 * prim];
+    const T a[3] = { _x[idx[0]] - wr.org[0], _y[idx[0]] - wr.org[1], _z[idx[0]] - wr.org[2] };
+    const T b[3] = { _x[idx[1]] - wr.org[0], _y[idx[1]] - wr.org[1], _z[idx[1]] - wr.org[2] };
+    const T c[3] = { _x[idx[2]] - wr.org[0], _y[idx[2]] - wr.org[1], _z[idx[2]] - wr.org[2] };
+    T det, tdet;
+    if (!edge_test(a, b, c, wr, det, tdet)) {
+        return false;
+    }
+    /* seen along the sheared ray the counter clockwise side has a
+     * positive determinant
+     */
+    back = det < T(0.0);
+    if (det < T(0.0)) {
+        det = -det;
+        tdet = -tdet;
+    }
+    if (tdet <= T(0.0) || tdet >= tmax * det) {
+        return false;
+    }
+    t = tdet / det;
+    return true;
+}
+
+template <typename T>
+bool TTriangleMesh<T>::intersect(const TRay<T>& r, THit<T>& hit) const {
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    const TWatertightRay<T> wr(r);
+    const tvec3<T> d = r.direction();
+    const T inv[3] = { T(1.0) / d.x(), T(1.0) / d.y(), T(1.0) / d.z() };
+    const bool neg[3] = { inv[0] < T(0.0), inv[1] < T(0.0), inv[2] < T(0.0) };
+
+    bool found = false;
+    uint64_t tests = 0;
+    uint64_t hits = 0;
+    uint32_t stack[BVH_STACK];
+    int sp = 0;
+    uint32_t cur = 0;
+    for (;;) {
+        const TBVHNode<T>& n = _nodes[cur];
+        if (slab_test(n, wr.org, inv, hit.t)) {
+            if (n.count) {
+                for (uint32_t i = n.offset; i < n.offset + n.count; i++) {
+                    T t;
+                    bool back;
+                    if (test(i, wr, hit.t, t, back)) {
+                        hit.t = t;
+                        hit.obj = nullptr;
+                        hit.mesh = this;
+                        hit.prim = i;
+                        hit.inst = nullptr;
+                        hit.inside = back;
+                        found = true;
+                        hits++;
+                    }
+                }
+                tests += n.count;
+            } else {
+                if (neg[n.axis]) {
+                    stack[sp++] = cur + 1;
+                    cur = n.offset;
+                } else {
+                    stack[sp++] = n.offset;
+                    cur = cur + 1;
+                }
+                continue;
+            }
+        }
+        if (sp == 0) {
+            break;
+        }
+        cur = stack[--sp];
+    }
+    TRACE_STAT(TraceStats& stats = thread_stats(); stats.triangle_tests += tests; stats.triangle_hits += hits);
+    (void)tests;
+    (void)hits;
+    return found;
+}
+
+template <typename T>
+bool TTriangleMesh<T>::occluded(const TRay<T>& r, const T tmax) const {
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    const TWatertightRay<T> wr(r);
+    const tvec3<T> d = r.direction();
+    const T inv[3] = { T(1.0) / d.x(), T(1.0) / d.y(), T(1.0) / d.z() };
+    const bool neg[3] = { inv[0] < T(0.0), inv[1] < T(0.0), inv[2] < T(0.0) };
+
+    uint64_t tests = 0;
+    uint64_t nodes = 0;
+    bool blocked = false;
+    uint32_t stack[BVH_STACK];
+    int sp = 0;
+    uint32_t cur = 0;
+    for (;;) {
+        const TBVHNode<T>& n = _nodes[cur];
+        nodes++;
+        if (slab_test(n, wr.org, inv, tmax)) {
+            if (n.count) {
+                for (uint32_t i = n.offset; i < n.offset + n.count; i++) {
+                    T t;
+                    bool back;
+                    tests++;
+                    if (test(i, wr, tmax, t, back)) {
+                        blocked = true;
+                        break;
+                    }
+                }
+                if (blocked) {
+                    break;
+                }
+            } else {
+                if (neg[n.axis]) {
+                    stack[sp++] = cur + 1;
+                    cur = n.offset;
+                } else {
+                    stack[sp++] = n.offset;
+                    cur = cur + 1;
+                }
+                continue;
+            }
+        }
+        if (sp == 0) {
+            break;
+        }
+        cur = stack[--sp];
+    }
+
+    TRACE_STAT(TraceStats& stats = thread_stats(); stats.shadow_tests += tests; stats.shadow_nodes += nodes);
+    (void)tests;
+    (void)nodes;
+    return blocked;
+}
+
+template <typename T>
+tvec3<T> TTriangleMesh<T>::normal(const uint32_t prim) const {
+    const uint32_t *idx = &_index[3 * prim];
+    const tvec3<T> a = vertex(idx[0]);
+    tvec3<T> n = cross(vertex(idx[1]) - a, vertex(idx[2]) - a);
+    n.normalize();
+    return n;
+}
+
+/* the distance to the plane is a bound on the rounding of the hit point
+ * and of the sheared edge tests, as the sphere offset does it
+ */
+template <typename T>
+tvec3<T> TTriangleMesh<T>::offset(const uint32_t prim, const tvec3<T>& p, const bool outwards) const {
+    const uint32_t *idx = &_index[3 * prim];
+    T scale = std::max(std::max(std::fabs(p.x()), std::fabs(p.y())), std::fabs(p.z()));
+    for (int k = 0; k < 3; k++) {
+        const uint32_t v = idx[k];
+        scale = std::max(scale, std::max(std::max(std::fabs(_x[v]), std::fabs(_y[v])), std::fabs(_z[v])));
+    }
+    const T err = T(TRIANGLE_OFFSET_ULPS) * std::numeric_limits<T>::epsilon() * scale;
+    return p + normal(prim) * (outwards ? err : -err);
+}
+
+template <typename T>
+tvec3<T> THit<T>::local_normal(const tvec3<T>& p) const {
+    if (mesh) {
+        return mesh->normal(prim);
+    }
+    tvec3<T> n = p - obj->origin();
+    n.normalize();
+    return n;
+}
+
+template <typename T>
+tvec3<T> THit<T>::local_offset(const tvec3<T>& p, const bool outwards) const {
+    return mesh ? mesh->offset(prim, p, outwards) : obj->offset(p, outwards);
+}
+
+typedef TTriangleMesh<double> TriangleMesh;
+#endif
@@ -0,0 +1,439 @@
+#ifndef _MESH_IO_HPP_
+#define _MESH_IO_HPP_
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/* triangle mesh as read from a file: vertex positions as separate x, y
+ * and z arrays and three vertex indices per triangle, polygons are split
+ * into fans around their first vertex.
+ *
+ * OBJ reads the v and f records, f takes v, v/vt, v//vn and v/vt/vn
+ * references and negative (relative) indices, everything else is skipped.
+ * PLY reads ascii, binary_little_endian and binary_big_endian files with
+ * x, y, z vertex properties of any scalar type and a vertex_indices (or
+ * vertex_index) list on the faces, other elements and properties are
+ * skipped. both are parsed as they are read, the file is never held in
+ * memory
+ */
+struct MeshData {
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+    std::vector<uint32_t> index;
+
+    inline size_t vertices() const { return x.size(); }
+    inline size_t triangles() const { return index.size() / 3; }
+    inline void add_vertex(const double vx, const double vy, const double vz) {
+        x.push_back(vx);
+        y.push_back(vy);
+        z.push_back(vz);
+    }
+    inline void add_triangle(const uint32_t a, const uint32_t b, const uint32_t c) {
+        index.push_back(a);
+        index.push_back(b);
+        index.push_back(c);
+    }
+    /* fan of a polygon given by its vertex indices */
+    void add_polygon(const uint32_t *v, const size_t n) {
+        for (size_t k = 1; k + 1 < n; k++) {
+            add_triangle(v[0], v[k], v[k + 1]);
+        }
+    }
+    bool validate(std::string& err) const {
+        for (size_t i = 0; i < index.size(); i++) {
+            if (index[i] >= x.size()) {
+                err = "triangle " + std::to_string(i / 3) + " refers to vertex " + std::to_string(index[i])
+                    + " of " + std::to_string(x.size());
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+inline bool load_obj(const char *path, MeshData& mesh, std::string& err) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        err = std::string("cannot open ") + path;
+        return false;
+    }
+    char *line = nullptr;
+    size_t cap = 0;
+    size_t lineno = 0;
+    bool ok = true;
+    std::vector<uint32_t> poly;
+    while (ok && getline(&line, &cap, f) != -1) {
+        lineno++;
+        const char *p = line;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            p++;
+            double v[3];
+            for (int k = 0; k < 3 && ok; k++) {
+                char *end;
+                v[k] = strtod(p, &end);
+                ok = end != p;
+                p = end;
+            }
+            mesh.add_vertex(v[0], v[1], v[2]);
+        } else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            p++;
+            poly.clear();
+            for (;;) {
+                char *end;
+                const long i = strtol(p, &end, 10);
+                if (end == p) {
+                    break;
+                }
+                /* texture and normal references are not used */
+                p = end;
+                while (*p && !isspace((unsigned char)*p)) {
+                    p++;
+                }
+                const long v = i > 0 ? i - 1 : long(mesh.vertices()) + i;
+                if (i == 0 || v < 0) {
+                    ok = false;
+                    break;
+                }
+                poly.push_back(uint32_t(v));
+            }
+            ok = ok && poly.size() >= 3;
+            if (ok) {
+                mesh.add_polygon(poly.data(), poly.size());
+            }
+        }
+    }
+    const bool failed = ferror(f) != 0;
+    free(line);
+    fclose(f);
+    if (!ok || failed) {
+        err = std::string(path) + ":" + std::to_string(lineno) + (failed ? ": read error" : ": bad record");
+        return false;
+    }
+    if (!mesh.validate(err)) {
+        err = std::string(path) + ": " + err;
+        return false;
+    }
+    return true;
+}
+
+enum PlyType {
+    PLY_NONE,
+    PLY_I8, PLY_U8, PLY_I16, PLY_U16, PLY_I32, PLY_U32, PLY_F32, PLY_F64,
+};
+
+inline PlyType ply_type(const std::string& s) {
+    static const char *names[][2] = {
+        { "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+        { "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" },
+    };
+    for (int t = 0; t < 8; t++) {
+        if (s == names[t][0] || s == names[t][1]) {
+            return PlyType(t + 1);
+        }
+    }
+    return PLY_NONE;
+}
+
+inline size_t ply_size(const PlyType t) {
+    static const size_t sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+    return sizes[t];
+}
+
+/* one value at a time from the body of a PLY file */
+class PlyReader {
+public:
+    enum Format { ASCII, LITTLE, BIG };
+
+    PlyReader(FILE *f, const Format fmt) : _f(f), _fmt(fmt) {
+        const uint16_t one = 1;
+        uint8_t b;
+        memcpy(&b, &one, 1);
+        _swap = (fmt == LITTLE && b != 1) || (fmt == BIG && b == 1);
+    }
+
+    bool read(const PlyType t, double& v) {
+        if (_fmt == ASCII) {
+            return 1 == fscanf(_f, "%lf", &v);
+        }
+        uint8_t b[8];
+        const size_t n = ply_size(t);
+        if (n == 0 || fread(b, 1, n, _f) != n) {
+            return false;
+        }
+        if (_swap) {
+            std::reverse(b, b + n);
+        }
+        switch (t) {
+        case PLY_I8: { int8_t x; memcpy(&x, b, 1); v = x; break; }
+        case PLY_U8: { uint8_t x; memcpy(&x, b, 1); v = x; break; }
+        case PLY_I16: { int16_t x; memcpy(&x, b, 2); v = x; break; }
+        case PLY_U16: { uint16_t x; memcpy(&x, b, 2); v = x; break; }
+        case PLY_I32: { int32_t x; memcpy(&x, b, 4); v = x; break; }
+        case PLY_U32: { uint32_t x; memcpy(&x, b, 4); v = x; break; }
+        case PLY_F32: { float x; memcpy(&x, b, 4); v = x; break; }
+        case PLY_F64: { memcpy(&v, b, 8); break; }
+        case PLY_NONE: return false;
+        }
+        return true;
+    }
+private:
+    FILE *_f;
+    Format _fmt;
+    bool _swap;
+};
+
+inline bool load_ply(const char *path, MeshData& mesh, std::string& err) {
+    struct Property {
+        std::string name;
+        PlyType type;
+        PlyType count_type; /* PLY_NONE unless a list */
+    };
+    struct Element {
+        std::string name;
+        uint64_t count;
+        std::vector<Property> props;
+    };
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        err = std::string("cannot open ") + path;
+        return false;
+    }
+    auto fail = [&](const std::string& what) {
+        fclose(f);
+        err = std::string(path) + ": " + what;
+        return false;
+    };
+
+    /* header, one keyword per line */
+    char line[1024];
+    if (!fgets(line, sizeof(line), f) || strncmp(line, "ply", 3) != 0) {
+        return fail("not a PLY file");
+    }
+    PlyReader::Format fmt = PlyReader::ASCII;
+    bool have_format = false;
+    std::vector<Element> elements;
+    for (;;) {
+        if (!fgets(line, sizeof(line), f)) {
+            return fail("header ends early");
+        }
+        char a[64] = {}, b[64] = {}, c[64] = {}, d[64] = {}, e[64] = {};
+        const int n = sscanf(line, "%63s %63s %63s %63s %63s", a, b, c, d, e);
+        const std::string key = n > 0 ? a : "";
+        if (key == "end_header") {
+            break;
+        } else if (key == "format" && n >= 2) {
+            const std::string s = b;
+            if (s == "ascii") {
+                fmt = PlyReader::ASCII;
+            } else if (s == "binary_little_endian") {
+                fmt = PlyReader::LITTLE;
+            } else if (s == "binary_big_endian") {
+                fmt = PlyReader::BIG;
+            } else {
+                return fail("unknown format " + s);
+            }
+            have_format = true;
+        } else if (key == "element" && n == 3) {
+            elements.push_back(Element { b, strtoull(c, nullptr, 10), {} });
+        } else if (key == "property" && !elements.empty()) {
+            Property p;
+            if (std::string(b) == "list" && n == 5) {
+                p = Property { e, ply_type(d), ply_type(c) };
+                if (p.count_type == PLY_NONE) {
+                    return fail(std::string("bad list count type ") + c);
+                }
+            } else if (n == 3) {
+                p = Property { c, ply_type(b), PLY_NONE };
+            } else {
+                return fail("bad property line");
+            }
+            if (p.type == PLY_NONE) {
+                return fail("bad property type");
+            }
+            elements.back().props.push_back(p);
+        } else if (key != "comment" && key != "obj_info" && !key.empty()) {
+            return fail("unknown header line " + key);
+        }
+    }
+    if (!have_format) {
+        return fail("no format line");
+    }
+
+    PlyReader reader(f, fmt);
+    std::vector<uint32_t> poly;
+    for (const Element& el : elements) {
+        const bool is_vertex = el.name == "vertex";
+        const bool is_face = el.name == "face";
+        int xyz[3] = { -1, -1, -1 };
+        int list = -1;
+        for (size_t k = 0; k < el.props.size(); k++) {
+            const Property& p = el.props[k];
+            if (is_vertex && p.count_type == PLY_NONE && p.name.size() == 1 && p.name[0] >= 'x' && p.name[0] <= 'z') {
+                xyz[p.name[0] - 'x'] = int(k);
+            } else if (is_face && p.count_type != PLY_NONE && (p.name == "vertex_indices" || p.name == "vertex_index")) {
+                list = int(k);
+            }
+        }
+        if (is_vertex && (xyz[0] < 0 || xyz[1] < 0 || xyz[2] < 0)) {
+            return fail("vertices without x, y and z");
+        }
+        if (is_face && list < 0) {
+            return fail("faces without vertex_indices");
+        }
+        if (is_vertex) {
+            mesh.x.reserve(mesh.x.size() + el.count);
+            mesh.y.reserve(mesh.y.size() + el.count);
+            mesh.z.reserve(mesh.z.size() + el.count);
+        } else if (is_face) {
+            mesh.index.reserve(mesh.index.size() + 3 * el.count);
+        }
+
+        for (uint64_t i = 0; i < el.count; i++) {
+            double pos[3] = {};
+            for (size_t k = 0; k < el.props.size(); k++) {
+                const Property& p = el.props[k];
+                double v;
+                if (p.count_type == PLY_NONE) {
+                    if (!reader.read(p.type, v)) {
+                        return fail("body ends early");
+                    }
+                    for (int a = 0; a < 3; a++) {
+                        if (int(k) == xyz[a]) {
+                            pos[a] = v;
+                        }
+                    }
+                    continue;
+                }
+                double cnt;
+                if (!reader.read(p.count_type, cnt) || cnt < 0.0) {
+                    return fail("body ends early");
+                }
+                poly.clear();
+                for (uint64_t j = 0; j < uint64_t(cnt); j++) {
+                    if (!reader.read(p.type, v)) {
+                        return fail("body ends early");
+                    }
+                    poly.push_back(uint32_t(v));
+                }
+                if (int(k) == list) {
+                    if (poly.size() < 3) {
+                        return fail("face " + std::to_string(i) + " has fewer than 3 vertices");
+                    }
+                    mesh.add_polygon(poly.data(), poly.size());
+                }
+            }
+            if (is_vertex) {
+                mesh.add_vertex(pos[0], pos[1], pos[2]);
+            }
+        }
+    }
+    fclose(f);
+    if (!mesh.validate(err)) {
+        err = std::string(path) + ": " + err;
+        return false;
+    }
+    return true;
+}
+
+inline bool has_extension(const char *path, const char *ext) {
+    const size_t n = strlen(path);
+    const size_t m = strlen(ext);
+    if (n < m) {
+        return false;
+    }
+    for (size_t i = 0; i < m; i++) {
+        if (tolower((unsigned char)path[n - m + i]) != ext[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* format by extension, .obj or .ply */
+inline bool load_mesh(const char *path, MeshData& mesh, std::string& err) {
+    if (has_extension(path, ".obj")) {
+        return load_obj(path, mesh, err);
+    } else if (has_extension(path, ".ply")) {
+        return load_ply(path, mesh, err);
+    }
+    err = std::string(path) + ": meshes are read from .obj or .ply files";
+    return false;
+}
+
+/* binary PLY in host byte order, float positions and int indices */
+inline bool save_ply(const char *path, const MeshData& mesh, std::string& err) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        err = std::string("cannot write ") + path;
+        return false;
+    }
+    const uint16_t one = 1;
+    uint8_t b;
+    memcpy(&b, &one, 1);
+    fprintf(f, "ply\nformat %s 1.0\nelement vertex %zu\nproperty float x\nproperty float y\nproperty float z\n"
+               "element face %zu\nproperty list uchar int vertex_indices\nend_header\n",
+            b == 1 ? "binary_little_endian" : "binary_big_endian", mesh.vertices(), mesh.triangles());
+    bool ok = true;
+    for (size_t i = 0; i < mesh.vertices() && ok; i++) {
+        const float v[3] = { float(mesh.x[i]), float(mesh.y[i]), float(mesh.z[i]) };
+        ok = fwrite(v, sizeof(v), 1, f) == 1;
+    }
+    for (size_t i = 0; i < mesh.triangles() && ok; i++) {
+        const uint8_t n = 3;
+        const int32_t v[3] = { int32_t(mesh.index[3 * i]), int32_t(mesh.index[3 * i + 1]), int32_t(mesh.index[3 * i + 2]) };
+        ok = fwrite(&n, 1, 1, f) == 1 && fwrite(v, sizeof(v), 1, f) == 1;
+    }
+    ok = 0 == fclose(f) && ok;
+    if (!ok) {
+        err = std::string("cannot write ") + path;
+    }
+    return ok;
+}
+
+/* closed sphere of rings x segments quads with radial bumps, two poles
+ * and 2 * rings * segments triangles, wound counter clockwise seen from
+ * outside. a stand in for a scanned asset in benchmarks
+ */
+inline void make_lumpy_sphere(MeshData& mesh, const double centre[3], const double radius, const uint32_t rings, const uint32_t segments) {
+    const uint32_t base = mesh.vertices();
+    auto bump = [](const double theta, const double phi) {
+        return 1.0 + 0.08 * std::sin(7.0 * theta) * std::cos(5.0 * phi) + 0.03 * std::sin(23.0 * theta + 11.0 * phi);
+    };
+    mesh.add_vertex(centre[0], centre[1] + radius * bump(0.0, 0.0), centre[2]);
+    for (uint32_t i = 1; i < rings; i++) {
+        const double theta = M_PI * i / rings;
+        for (uint32_t j = 0; j < segments; j++) {
+            const double phi = 2.0 * M_PI * j / segments;
+            const double r = radius * bump(theta, phi);
+            mesh.add_vertex(centre[0] + r * std::sin(theta) * std::cos(phi), centre[1] + r * std::cos(theta),
+                            centre[2] - r * std::sin(theta) * std::sin(phi));
+        }
+    }
+    mesh.add_vertex(centre[0], centre[1] - radius * bump(M_PI, 0.0), centre[2]);
+
+    const uint32_t south = mesh.vertices() - 1;
+    auto ring = [&](const uint32_t i, const uint32_t j) { return base + 1 + (i - 1) * segments + j % segments; };
+    for (uint32_t j = 0; j < segments; j++) {
+        mesh.add_triangle(base, ring(1, j), ring(1, j + 1));
+        mesh.add_triangle(south, ring(rings - 1, j + 1), ring(rings - 1, j));
+    }
+    for (uint32_t i = 1; i + 1 < rings; i++) {
+        for (uint32_t j = 0; j < segments; j++) {
+            mesh.add_triangle(ring(i, j), ring(i + 1, j), ring(i + 1, j + 1));
+            mesh.add_triangle(ring(i, j), ring(i + 1, j + 1), ring(i, j + 1));
+        }
+    }
+}
+#endif
@@ -0,0 +1,197 @@
+#ifndef _PREVIEW_HPP_
+#define _PREVIEW_HPP_
+
+#include "progressive.hpp"
+#include "scheduler.hpp"
+#include "image_io.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Frames a preview cycles through: one written, one latest, one shown
+constexpr int PREVIEW_FRAMES = 3;
+
+/* what a published frame shows */
+struct PreviewInfo {
+    uint32_t pass = 0;
+    double spp = 0.0;     /* mean over the image */
+    double seconds = 0.0; /* render time at the end of the pass */
+};
+
+/* RGBA8 frames of a progressive render, triple buffered between the
+ * render and one viewer. render threads resolve the tiles they just traced
+ * into the back frame, the pass is then published as the latest; the
+ * viewer takes the latest into the front frame it reads. publishing and
+ * taking swap two indices under a lock and never wait on each other, so a
+ * slow viewer skips passes and never holds up the render. storage may be
+ * memory the viewer reads in place, a mapped staging buffer
+ */
+class PreviewFrames {
+public:
+    ~PreviewFrames() {}
+    PreviewFrames() = delete;
+    PreviewFrames(const PreviewFrames&) = delete;
+    /* storage holds PREVIEW_FRAMES frames of bytes() each, null allocates them here */
+    PreviewFrames(const int w, const int h, uint8_t *storage = nullptr) : _width(w), _height(h), _storage(storage) {
+        if (!_storage) {
+            _own.resize(bytes() * PREVIEW_FRAMES);
+            _storage = _own.data();
+        }
+    }
+    inline int width() const { return _width; }
+    inline int height() const { return _height; }
+    inline size_t bytes() const { return size_t(_width) * _height * 4; }
+
+    /* render side: the display values of a tile into the back frame. done
+     * pixels are written as well, the back frame last held an older pass
+     */
+    void resolve(const ProgressiveImage& img, const Tile& t) {
+        uint8_t *dst = _storage + _back * bytes();
+        for (int i = t.y0; i < t.y1; i++) {
+            uint8_t *px = dst + (size_t(i) * _width + t.x0) * 4;
+            for (int j = t.x0; j < t.x1; j++, px += 4) {
+                const PixelEstimate& p = img.at(j, i);
+                const vec3 c = p.n ? p.sum * (1.0 / p.n) : vec3();
+                px[0] = to_u8(c.r());
+                px[1] = to_u8(c.g());
+                px[2] = to_u8(c.b());
+                px[3] = 255;
+            }
+        }
+    }
+
+    /* render side: the back frame, every tile resolved, becomes the latest */
+    void publish(const PreviewInfo& info) {
+        {
+            std::lock_guard<std::mutex> lk(_lock);
+            _info[_back] = info;
+            std::swap(_back, _latest);
+            _fresh = true;
+        }
+        _ready.notify_all();
+    }
+
+    /* render side: no more frames, a waiting viewer returns once it has the last */
+    void close() {
+        {
+            std::lock_guard<std::mutex> lk(_lock);
+            _closed = true;
+        }
+        _ready.notify_all();
+    }
+
+    /* viewer side: true when a frame was published since the last one
+     * taken. only the viewer takes frames, so it stays true until it does
+     */
+    bool fresh() {
+        std::lock_guard<std::mutex> lk(_lock);
+        return _fresh;
+    }
+
+    /* viewer side: the latest frame becomes the front one, false when
+     * nothing was published since the last call
+     */
+    bool acquire(PreviewInfo& info) {
+        std::lock_guard<std::mutex> lk(_lock);
+        return take(info);
+    }
+
+    /* viewer side: acquire that blocks for the next frame, false once the
+     * render closed and its last frame was taken
+     */
+    bool wait(PreviewInfo& info) {
+        std::unique_lock<std::mutex> lk(_lock);
+        _ready.wait(lk, [this]{ return _fresh || _closed; });
+        return take(info);
+    }
+
+    /* the front frame and its frame index into the storage */
+    inline const uint8_t *front() const { return _storage + _front * bytes(); }
+    inline uint32_t front_index() const { return _front; }
+private:
+    bool take(PreviewInfo& info) {
+        if (!_fresh) {
+            return false;
+        }
+        std::swap(_front, _latest);
+        _fresh = false;
+        info = _info[_front];
+        return true;
+    }
+
+    int _width;
+    int _height;
+    uint8_t *_storage;
+    std::vector<uint8_t> _own;
+    uint32_t _back = 0;
+    uint32_t _latest = 1;
+    uint32_t _front = 2;
+    bool _fresh = false;
+    bool _closed = false;
+    PreviewInfo _info[PREVIEW_FRAMES];
+    std::mutex _lock;
+    std::condition_variable _ready;
+};
+
+/* headless viewer: writes every frame it takes as NAME_pass_NNNN.ppm on
+ * its own thread. passes published while it writes are skipped as a
+ * window would skip them, the last pass is always written
+ */
+class PreviewDump {
+public:
+    PreviewDump() = delete;
+    PreviewDump(const PreviewDump&) = delete;
+    PreviewDump(PreviewFrames& frames, const std::string& base) : _frames(frames), _base(base), _thread(&PreviewDump::loop, this) {}
+    ~PreviewDump() { wait(); }
+
+    /* blocks until the last frame is on disk, the render has to close the frames first */
+    void wait() {
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    friend std::ostream & operator<<(std::ostream &os, const PreviewDump& d) {
+        return os << "preview: wrote " << d._written << " frames up to pass " << d._last << " as " << d._base << "_pass_*.ppm"
+                  << (d._failed ? ", some FAILED" : "") << "\n";
+    }
+private:
+    void loop() {
+        const int w = _frames.width();
+        const int h = _frames.height();
+        const std::string head = "P6\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n";
+        std::string buf;
+        PreviewInfo info;
+        while (_frames.wait(info)) {
+            buf = head;
+            buf.resize(head.size() + size_t(w) * h * 3);
+            const uint8_t *src = _frames.front();
+            char *dst = &buf[head.size()];
+            for (size_t p = 0; p < size_t(w) * h; p++, src += 4) {
+                *dst++ = char(src[0]);
+                *dst++ = char(src[1]);
+                *dst++ = char(src[2]);
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "_pass_%04u.ppm", info.pass);
+            FILE *file = fopen((_base + name).c_str(), "wb");
+            bool ok = file && fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+            ok = file && 0 == fclose(file) && ok;
+            _failed |= !ok;
+            _written++;
+            _last = info.pass;
+        }
+    }
+
+    PreviewFrames& _frames;
+    std::string _base;
+    uint32_t _written = 0;
+    uint32_t _last = 0;
+    bool _failed = false;
+    std::thread _thread;
+};
+#endif
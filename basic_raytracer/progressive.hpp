@@ -0,0 +1,99 @@
+#ifndef _PROGRESSIVE_HPP_
+#define _PROGRESSIVE_HPP_
+
+#include "framebuffer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Two sided 95% normal quantile
+constexpr double PROGRESSIVE_Z95 = 1.96;
+
+// Relative error is measured against at least this luminance
+constexpr double PROGRESSIVE_FLOOR = 1e-2;
+
+/* running estimate of one pixel: the radiance sum the image is resolved
+ * from, and Welford mean and variance of the sample luminance for the
+ * stopping rule. n is also the index of the next sample, so passes
+ * continue the random sequence of a fixed sample count render
+ */
+struct PixelEstimate {
+    vec3 sum;
+    double mean = 0.0;
+    double m2 = 0.0;
+    uint32_t n = 0;
+    bool done = false;
+
+    void add(const vec3& c) {
+        sum += c;
+        const double l = 0.2126 * c.r() + 0.7152 * c.g() + 0.0722 * c.b();
+        n++;
+        const double d = l - mean;
+        mean += d / n;
+        m2 += d * (l - mean);
+    }
+
+    /* variance of the mean luminance, 0 below two samples */
+    double variance() const {
+        return n < 2 ? 0.0 : m2 / (n - 1) / n;
+    }
+
+    /* half width of the 95% confidence interval of the mean luminance */
+    double half_width() const {
+        if (n < 2) {
+            return std::numeric_limits<double>::max();
+        }
+        return PROGRESSIVE_Z95 * std::sqrt(variance());
+    }
+
+    bool converged(const double rel_error) const {
+        return half_width() <= rel_error * std::max(mean, PROGRESSIVE_FLOOR);
+    }
+};
+
+/* per pixel estimates of a progressive render, pixels drop out of later
+ * passes once their interval is narrow enough or they hit the sample cap
+ */
+class ProgressiveImage {
+public:
+    ~ProgressiveImage() {}
+    ProgressiveImage() = delete;
+    ProgressiveImage(const int w, const int h) : _width(w), _height(h), _pixels(w * h) {}
+    inline int width() const { return _width; }
+    inline int height() const { return _height; }
+    inline PixelEstimate& at(const int x, const int y) { return _pixels[y * _width + x]; }
+    inline const PixelEstimate& at(const int x, const int y) const { return _pixels[y * _width + x]; }
+    inline const std::vector<PixelEstimate>& pixels() const { return _pixels; }
+
+    uint64_t samples() const {
+        uint64_t s = 0;
+        for (const auto& p : _pixels) {
+            s += p.n;
+        }
+        return s;
+    }
+
+    size_t active() const {
+        size_t a = 0;
+        for (const auto& p : _pixels) {
+            a += p.done ? 0 : 1;
+        }
+        return a;
+    }
+
+    void resolve(Framebuffer& fb) const {
+        for (int i = 0; i < _height; i++) {
+            for (int j = 0; j < _width; j++) {
+                const PixelEstimate& p = at(j, i);
+                fb.at(j, i) = p.n ? p.sum * (1.0 / p.n) : vec3();
+            }
+        }
+    }
+private:
+    int _width;
+    int _height;
+    std::vector<PixelEstimate> _pixels;
+};
+#endif
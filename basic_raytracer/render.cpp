@@ -1,21 +1,32 @@
-#include "geometry.hpp"
-#include <fstream>
+#include "tracer.hpp"
+#include "simd_sphere.hpp"
+#include "framebuffer.hpp"
+#include "scheduler.hpp"
+#include "progressive.hpp"
+#include "sampler.hpp"
+#include "camera.hpp"
+#include "image_io.hpp"
+#include "heatmap.hpp"
+#include "animation.hpp"
+#include "wavefront.hpp"
+#include "checkpoint.hpp"
+#include "distributed.hpp"
+#include "preview.hpp"
+#include "denoise.hpp"
 #include <cstdlib>
+#include <cstring>
 #include <limits>
 #include <vector>
 #include <iomanip>
+#include <chrono>
+#include <sstream>
 
 // PPM
 constexpr int TRACE_W = 1600;
 constexpr int TRACE_H = 1200;
-constexpr char TRACE_PPM[] = "1600 1200\n";
 
 // AA
 constexpr int TRACE_SSAA = 40;
-constexpr double TRACE_SSAA_INV = 1.0 / TRACE_SSAA;
-
-// Recursive depth
-constexpr uint TRACE_DEPTH = 40;
 
 // Object and canvas plane
 constexpr double CANVAS_Z = -2.0;
@@ -27,259 +38,1223 @@ constexpr double PERSPECTIVE_EYE_Y = -0.15;
 constexpr double PERSPECTIVE_EYE_Z = 0.0;
 static const vec3 ray_origin(0, -0.15, PERSPECTIVE_EYE_Z);
 
-// LI Ambient
-static vec3 TRACE_AMBIENT = vec3(0.009, 0.009, 0.01);
-#define TRACE_GAMMA 1
-
 // Scanline
 static const vec3 topleft(-2, 1, CANVAS_Z);
-// u increase from left to right (positive x axis)
-static const vec3 u(4.0/TRACE_W, 0.0, 0.0);
-// v increase from top to bottom (negative y axis)
-static const vec3 v(0.0, -3.0/TRACE_H, 0.0);
-
-static double bias = 1e-7;
-
-#define TRACE_LI_DIFFUSE 1
-#define TRACE_LI_SPECULAR 1
+// canvas edges, u and v step one pixel along them
+static const vec3 canvas_right(4.0, 0.0, 0.0);
+static const vec3 canvas_down(0.0, -3.0, 0.0);
 
-vec3 tracer(const std::vector<Sphere *>& objects, const std::vector<LightBase *>& lights, const Ray& r, const uint depth);
+// Tile edge in pixels
+constexpr int TRACE_TILE = 32;
 
-int main(int argc, char const *argv[])
-{
-    std::ofstream pfile;
-    pfile.open("render.ppm");
-    pfile << "P3\n" << TRACE_PPM << "255\n";
+// Secondary rays with a smaller path weight are not traced
+constexpr double TRACE_MIN_WEIGHT = 1e-3;
 
-    std::vector<Sphere *> objects_family;
-    // OBJECT: origin, radius, material; Material: kdiffuse, kspecular, specular_factor, transparent, refraction index;
-    objects_family.push_back(new Sphere(vec3(0, -100.5, OBJECT_Z), 100, new Material(vec3(0.087, 0.094, 0.080), vec3(0.087, 0.094, 0.080), 0.5, false, 0.0)));
+// Progressive mode: samples of the first pass and of every later pass, fewer
+// first samples let edge pixels whose samples agree by chance stop too early
+constexpr int TRACE_MIN_SPP = 16;
+constexpr int TRACE_PASS_SPP = 4;
 
-    objects_family.push_back(new Sphere(vec3(-1, 0, OBJECT_Z), 0.5, new Material(vec3(0.71, 0.52, 0.57), vec3(0.71, 0.52, 0.57), 1.0, false, 0.0)));
-    objects_family.push_back(new Sphere(vec3(0, 0, OBJECT_Z), 0.5, new Material(vec3(0.8, 0.2, 0.2), vec3(0.8, 0.2, 0.2), 2.0, false, 0.0)));
-    objects_family.push_back(new Sphere(vec3(1, 0, OBJECT_Z), 0.5, new Material(vec3(0.8, 0.6, 0.2), vec3(0.8, 0.6, 0.2), 4.0, false, 0.0)));
+// Sequence mode: encoded frames that may wait for the writer before the
+// renderer blocks
+constexpr size_t SEQUENCE_PENDING_FRAMES = 2;
 
-    objects_family.push_back(new Sphere(vec3(-0.85, -0.35, OBJECT_Z+0.75), 0.15, new Material(vec3(0.35, 0.35, 0.25), vec3(0.35, 0.35, 0.25), 8.0, false, 0.0)));
-    objects_family.push_back(new Sphere(vec3(-0.55, -0.35, OBJECT_Z+0.75), 0.15, new Material(vec3(0.2, 0.35, 0.5), vec3(0.2, 0.35, 0.5), 16.0, false, 0.0)));
-    objects_family.push_back(new Sphere(vec3(-0.25, -0.35, OBJECT_Z+0.75), 0.15, new Material(vec3(0.38, 0.82, 0.71), vec3(0.38, 0.82, 0.71), 32.0, true, 1.3)));
+struct RenderOptions {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    long seed = 0;
+    const char *sampler = "random";
+    const char *stats = nullptr;
+    HeatmapMode heatmap = HEATMAP_OFF;
+    int tile = TRACE_TILE;
+    const char *accel = "bvh";
+    const char *precision = "double";
+    bool compare_precision = false;
+    bool recursive = false;
+    bool wavefront = false;
+    uint light_samples = 0;   /* 0 shades every light */
+    RoulettePolicy roulette = ROULETTE_OFF;
+    uint roulette_depth = TRACE_ROULETTE_DEPTH;
+    double roulette_p = -1.0; /* < 0 is the default of the policy */
+    double min_weight = TRACE_MIN_WEIGHT;
+    double ci = 0.0;          /* progressive stopping threshold, 0 renders the scene spp */
+    int min_spp = TRACE_MIN_SPP;
+    int pass_spp = TRACE_PASS_SPP;
+    int max_spp = 0;          /* 0 is the scene spp */
+    double max_time = 0.0;    /* seconds, 0 is unlimited */
+    uint64_t max_samples = 0; /* over the whole image, 0 is unlimited */
+    std::vector<ImageFormat> formats;
+    const char *output = "render";
+    const char *scene = nullptr;
+    const char *export_text = nullptr;
+    const char *export_binary = nullptr;
+    int frames = 0;           /* sequence mode when > 0 */
+    double rebuild_ratio = ANIMATION_REBUILD_RATIO;
+    const char *checkpoint = nullptr;
+    double checkpoint_interval = CHECKPOINT_INTERVAL;
+    int distribute = -1;          /* local worker processes, -1 traces here */
+    const char *listen = nullptr; /* coordinator address */
+    const char *worker = nullptr; /* worker mode, the coordinator to reach */
+    double baseline = 0.0;        /* one worker wall time of the image, for the parallel efficiency */
+    const char *preview = nullptr; /* headless preview, base name of the pass frames */
+    bool denoise = false;     /* also write the a-trous filtered image */
+    bool aov = false;         /* also write the first hit albedo, normal and depth */
+};
 
-    objects_family.push_back(new Sphere(vec3(0.15, -0.3, OBJECT_Z+1.2), 0.2, new Material(vec3(0.3, 0.8, 0.6), vec3(0.3, 0.8, 0.6), 64.0, true, 1.05)));
+static void usage(const char *prog) {
+    std::cerr << "usage: " << prog << " [--threads N] [--seed N] [--tile N] [--accel bvh|linear|soa]\n"
+              << "       [--precision double|float] [--compare-precision]\n"
+              << "       [--tracer iterative|recursive|wavefront] [--min-weight W] [--light-samples N]\n"
+              << "       [--roulette off|weight|fixed] [--roulette-depth N] [--roulette-p P]\n"
+              << "       [--ci E] [--min-spp N] [--pass-spp N] [--max-spp N] [--max-time S] [--max-samples N]\n"
+              << "       [--format p6|p3|qoi|pfm[,...]] [--output NAME]\n"
+              << "       [--scene FILE] [--export-text FILE] [--export-binary FILE]\n"
+              << "       [--sampler " SAMPLER_NAMES "] [--stats FILE] [--heatmap ns|tests]\n"
+              << "       [--frames N] [--rebuild-ratio R] [--checkpoint FILE] [--checkpoint-interval S]\n"
+              << "       [--distribute N] [--listen unix:PATH|HOST:PORT] [--worker unix:PATH|HOST:PORT]\n"
+              << "       [--baseline S]\n"
+              << "       [--preview NAME] [--denoise] [--aov]\n"
+              << "  --threads N  render threads, 1 takes the serial scanline path\n"
+              << "  --seed N     seed of the per pixel jitter sequence\n"
+              << "  --sampler S  sub pixel points: random (default), stratified over the spp,\n"
+              << "               Owen scrambled sobol, or bluenoise rotated sobol\n"
+              << "  --tile N     tile edge in pixels (default " << TRACE_TILE << ")\n"
+              << "  --accel A    bvh (default), linear object loop or soa SIMD loop\n"
+              << "  --precision P       scalar type of the tracer, double (default) or float\n"
+              << "  --compare-precision render with both, report the speedup and the largest\n"
+              << "                      per pixel difference, write the double image\n"
+              << "  --tracer T   iterative stack walk (default), the recursive reference or\n"
+              << "               wavefront, a tile's rays one bounce at a time, sorted for\n"
+              << "               coherence (not in progressive mode)\n"
+              << "  --light-samples N  shade N lights per hit drawn from a light tree by\n"
+              << "                  distance and power, weighted to an unbiased estimate\n"
+              << "                  (default 0 shades every light, at most " << MAX_LIGHT_SAMPLES << ")\n"
+              << "  --roulette R    russian roulette on reflected and refracted rays, unbiased:\n"
+              << "                  weight survives with the path weight, at least P, and never\n"
+              << "                  scales a ray up; fixed survives with P and scales by 1 / P\n"
+              << "                  (default off, the tree is traced to the depth or weight limit)\n"
+              << "  --roulette-depth N  rays this deep or deeper play (default " << TRACE_ROULETTE_DEPTH << ")\n"
+              << "  --roulette-p P  survival floor of weight (default " << TRACE_ROULETTE_FLOOR << "), survival\n"
+              << "                  probability of fixed (default " << TRACE_ROULETTE_FIXED << ")\n"
+              << "  --min-weight W  prune iterative branches below this path weight\n"
+              << "                  (default " << TRACE_MIN_WEIGHT << ", 0 traces the full tree)\n"
+              << "  --ci E         progressive rendering, a pixel stops once the 95% confidence\n"
+              << "                 interval of its luminance is within E of the mean (e.g. 0.05)\n"
+              << "  --min-spp N    samples of the first pass (default " << TRACE_MIN_SPP << ")\n"
+              << "  --pass-spp N   samples per pixel of every later pass (default " << TRACE_PASS_SPP << ")\n"
+              << "  --max-spp N    per pixel sample cap (default the scene spp)\n"
+              << "  --max-time S   stop after the pass that crosses S seconds\n"
+              << "  --max-samples N  stop after the pass that crosses N samples in total\n"
+              << "  --format F,...   image formats, written on a background thread (default p6)\n"
+              << "  --output NAME    output file name without extension (default render)\n"
+              << "  --scene FILE         text or binary scene, the built in demo scene otherwise\n"
+              << "  --export-text FILE   write the scene as text and exit\n"
+              << "  --export-binary FILE write the scene in the mappable binary form and exit\n"
+              << "  --stats FILE     write the ray counters, depth histogram and tile times as JSON\n"
+              << "  --heatmap C      also write the per pixel cost as NAME.cost.ppm and NAME.cost.pfm,\n"
+              << "                   C is ns of wall time or sphere tests (needs TRACE_STATS)\n"
+              << "  --frames N        render N frames over the time span of the scene keys to\n"
+              << "                    NAME_0000.ext and on, refitting the bvh between frames\n"
+              << "  --rebuild-ratio R build a refitted tree again once its SAH cost reaches R\n"
+              << "                    times its cost after the last build (default " << ANIMATION_REBUILD_RATIO << ")\n"
+              << "  --checkpoint FILE  save finished tiles, or the progressive estimates after a\n"
+              << "                     pass, to FILE every interval and resume from it when it\n"
+              << "                     exists. removed once the image is written, kept when a\n"
+              << "                     progressive budget stops the render (single images only)\n"
+              << "  --checkpoint-interval S  seconds between checkpoints (default " << CHECKPOINT_INTERVAL << ")\n"
+              << "  --distribute N   coordinate: hand tiles to N worker processes started here and\n"
+              << "                   to any other worker that connects, trace nothing here\n"
+              << "  --listen ADDR    where the coordinator takes workers (default a unix socket\n"
+              << "                   under /tmp), with --distribute 0 it only waits for others\n"
+              << "  --worker ADDR    trace tiles for the coordinator at ADDR on one thread, with\n"
+              << "                   the same scene and image options (fixed spp single images)\n"
+              << "  --baseline S     wall time of the image on one worker, the coordinator reports\n"
+              << "                   the parallel efficiency S / (N T) of its N workers taking T\n"
+              << "  --preview NAME   headless preview of a progressive render (needs --ci): the\n"
+              << "                   passes a preview window would show go to NAME_pass_NNNN.ppm\n"
+              << "                   on their own thread, passes it falls behind on are skipped\n"
+              << "  --denoise  also write NAME.denoised.ext, the image through an edge avoiding\n"
+              << "             a-trous filter guided by the first hit albedo, normal and depth\n"
+              << "             and by the sample variance of each pixel\n"
+              << "  --aov      also write those features as NAME.albedo.pfm, NAME.normal.pfm\n"
+              << "             and NAME.depth.pfm (both fixed spp local single images, no checkpoint)\n";
+}
 
-    std::vector<LightBase *> lights_family;
-    // position, illumination, core energy
-    lights_family.push_back(new ConstantLight(vec3(100, 0, 100), vec3(1.0, 1.0, 1.0), 1e4));
-    lights_family.push_back(new ConstantLight(vec3(100, 100, 100), vec3(1.0, 1.0, 1.0), 5e2));
-
-    for (int i = 0; i < TRACE_H; i++) {
-        for (int j = 0; j < TRACE_W; j++) {
-            vec3 res;
-            for (int k = 0; k < TRACE_SSAA; k++) {
-                vec3 ro = ray_origin;
-                vec3 rdir = topleft + u*(j+drand48()) + v*(i+drand48()) - ray_origin;
-                rdir.normalize();
-                Ray r(ro, rdir);
-                res += tracer(objects_family, lights_family, r, 0);
+static bool parse_options(int argc, char const *argv[], RenderOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--threads") && i + 1 < argc) {
+            opts.threads = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--seed") && i + 1 < argc) {
+            opts.seed = atol(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--sampler") && i + 1 < argc) {
+            opts.sampler = argv[++i];
+            Sampler *s = make_sampler(opts.sampler, 0, 1);
+            if (!s) {
+                usage(argv[0]);
+                return false;
+            }
+            delete s;
+        } else if (0 == strcmp(argv[i], "--tile") && i + 1 < argc) {
+            opts.tile = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--accel") && i + 1 < argc) {
+            opts.accel = argv[++i];
+        } else if (0 == strcmp(argv[i], "--precision") && i + 1 < argc) {
+            opts.precision = argv[++i];
+            if (strcmp(opts.precision, "double") && strcmp(opts.precision, "float")) {
+                usage(argv[0]);
+                return false;
+            }
+        } else if (0 == strcmp(argv[i], "--tracer") && i + 1 < argc) {
+            const char *t = argv[++i];
+            if (strcmp(t, "iterative") && strcmp(t, "recursive") && strcmp(t, "wavefront")) {
+                usage(argv[0]);
+                return false;
+            }
+            opts.recursive = 0 == strcmp(t, "recursive");
+            opts.wavefront = 0 == strcmp(t, "wavefront");
+        } else if (0 == strcmp(argv[i], "--light-samples") && i + 1 < argc) {
+            opts.light_samples = uint(std::max(0, atoi(argv[++i])));
+        } else if (0 == strcmp(argv[i], "--roulette") && i + 1 < argc) {
+            const char *r = argv[++i];
+            if (strcmp(r, "off") && strcmp(r, "weight") && strcmp(r, "fixed")) {
+                usage(argv[0]);
+                return false;
+            }
+            opts.roulette = 0 == strcmp(r, "weight") ? ROULETTE_WEIGHT : (0 == strcmp(r, "fixed") ? ROULETTE_FIXED : ROULETTE_OFF);
+        } else if (0 == strcmp(argv[i], "--roulette-depth") && i + 1 < argc) {
+            opts.roulette_depth = uint(std::max(1, atoi(argv[++i])));
+        } else if (0 == strcmp(argv[i], "--roulette-p") && i + 1 < argc) {
+            opts.roulette_p = atof(argv[++i]);
+            if (!(opts.roulette_p > 0.0 && opts.roulette_p <= 1.0)) {
+                std::cerr << "--roulette-p takes a probability in (0, 1]\n";
+                return false;
+            }
+        } else if (0 == strcmp(argv[i], "--min-weight") && i + 1 < argc) {
+            opts.min_weight = std::max(0.0, atof(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--ci") && i + 1 < argc) {
+            opts.ci = std::max(0.0, atof(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--min-spp") && i + 1 < argc) {
+            opts.min_spp = std::max(2, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--pass-spp") && i + 1 < argc) {
+            opts.pass_spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--max-spp") && i + 1 < argc) {
+            opts.max_spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--max-time") && i + 1 < argc) {
+            opts.max_time = std::max(0.0, atof(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--max-samples") && i + 1 < argc) {
+            opts.max_samples = strtoull(argv[++i], nullptr, 10);
+        } else if (0 == strcmp(argv[i], "--format") && i + 1 < argc) {
+            std::string list = argv[++i];
+            for (size_t b = 0, e; b <= list.size(); b = e + 1) {
+                e = std::min(list.find(',', b), list.size());
+                ImageFormat f;
+                if (!parse_format(list.substr(b, e - b).c_str(), f)) {
+                    usage(argv[0]);
+                    return false;
+                }
+                opts.formats.push_back(f);
+            }
+        } else if (0 == strcmp(argv[i], "--output") && i + 1 < argc) {
+            opts.output = argv[++i];
+        } else if (0 == strcmp(argv[i], "--heatmap") && i + 1 < argc) {
+            if (!parse_heatmap(argv[++i], opts.heatmap)) {
+                usage(argv[0]);
+                return false;
             }
-            res = res * TRACE_SSAA_INV;
-#if TRACE_GAMMA
-            pfile << int(sqrt(res.r())*255) << " " << int(sqrt(res.g())*255) << " " << int(sqrt(res.b())*255) << " ";
-#else
-            pfile << int(res.r()*255) << " " << int(res.g()*255) << " " << int(res.b()*255) << " ";
-#endif
+        } else if (0 == strcmp(argv[i], "--stats") && i + 1 < argc) {
+            opts.stats = argv[++i];
+        } else if (0 == strcmp(argv[i], "--scene") && i + 1 < argc) {
+            opts.scene = argv[++i];
+        } else if (0 == strcmp(argv[i], "--export-text") && i + 1 < argc) {
+            opts.export_text = argv[++i];
+        } else if (0 == strcmp(argv[i], "--export-binary") && i + 1 < argc) {
+            opts.export_binary = argv[++i];
+        } else if (0 == strcmp(argv[i], "--frames") && i + 1 < argc) {
+            opts.frames = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--rebuild-ratio") && i + 1 < argc) {
+            opts.rebuild_ratio = std::max(1.0, atof(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--checkpoint") && i + 1 < argc) {
+            opts.checkpoint = argv[++i];
+        } else if (0 == strcmp(argv[i], "--checkpoint-interval") && i + 1 < argc) {
+            opts.checkpoint_interval = std::max(0.0, atof(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--distribute") && i + 1 < argc) {
+            opts.distribute = std::max(0, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--listen") && i + 1 < argc) {
+            opts.listen = argv[++i];
+            opts.distribute = std::max(0, opts.distribute);
+        } else if (0 == strcmp(argv[i], "--worker") && i + 1 < argc) {
+            opts.worker = argv[++i];
+        } else if (0 == strcmp(argv[i], "--baseline") && i + 1 < argc) {
+            opts.baseline = std::max(0.0, atof(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--preview") && i + 1 < argc) {
+            opts.preview = argv[++i];
+        } else if (0 == strcmp(argv[i], "--denoise")) {
+            opts.denoise = true;
+        } else if (0 == strcmp(argv[i], "--aov")) {
+            opts.aov = true;
+        } else if (0 == strcmp(argv[i], "--compare-precision")) {
+            opts.compare_precision = true;
+        } else {
+            usage(argv[0]);
+            return false;
         }
-        pfile << "\n";
-        std::cout << "Ray Trace Processing: " << std::fixed << std::setprecision(2) << i* 100.0 / TRACE_H << "%\r";
     }
+    if (opts.formats.empty()) {
+        opts.formats.push_back(IMAGE_P6);
+    }
+    if (opts.light_samples > MAX_LIGHT_SAMPLES) {
+        std::cerr << "at most " << MAX_LIGHT_SAMPLES << " light samples per hit, past them the draws would repeat\n";
+        return false;
+    }
+    if ((opts.distribute >= 0 || opts.worker) && (opts.ci > 0.0 || opts.frames || opts.compare_precision)) {
+        std::cerr << "distributed renders are fixed spp single images\n";
+        return false;
+    }
+    /* the wavefront interleaves the rays of a tile's pixels */
+    if (opts.wavefront && opts.heatmap == HEATMAP_NS) {
+        std::cerr << "the wavefront tracer has no wall time per pixel, use --heatmap tests\n";
+        return false;
+    }
+    if (opts.frames && (opts.heatmap != HEATMAP_OFF || opts.compare_precision)) {
+        std::cerr << "the heatmap and the precision comparison are for single images, not sequences\n";
+        return false;
+    }
+    if (opts.checkpoint && (opts.frames || opts.compare_precision)) {
+        std::cerr << "checkpoints are for single images, not sequences or precision comparisons\n";
+        return false;
+    }
+    if (opts.baseline > 0.0 && opts.distribute < 0) {
+        std::cerr << "the baseline is for the coordinator of a distributed render\n";
+        return false;
+    }
+    if (opts.preview && (opts.ci <= 0.0 || opts.frames || opts.compare_precision || opts.distribute >= 0 || opts.worker)) {
+        std::cerr << "the preview shows the passes of a local progressive single image\n";
+        return false;
+    }
+    /* resumed tiles come back without their features */
+    if ((opts.denoise || opts.aov) && (opts.ci > 0.0 || opts.frames || opts.compare_precision || opts.wavefront ||
+                                       opts.checkpoint || opts.distribute >= 0 || opts.worker)) {
+        std::cerr << "denoising and AOVs are for fixed spp local single images of the iterative or recursive tracer, without checkpoints\n";
+        return false;
+    }
+    return true;
+}
 
-    pfile.close();
-
-    return 0;
+/* sample k of pixel (j, i). the sampler points and the draws at the hits
+ * are keyed by (seed, pixel, sample), so the image does not depend on
+ * which thread traces which tile or in which pass. jitter is drawn in
+ * double so both precisions sample the same sub pixel positions
+ */
+template <typename T>
+static tvec3<T> trace_sample(const TScene<T>& scene, const View& view, const Sampler& sampler, const RenderOptions& opts, const int j, const int i, const int k, TAux<T> *aux = nullptr) {
+    double jitter[2];
+    sampler.get_2d(j, i, uint32_t(i * view.width + j), uint32_t(k), 0, jitter);
+    const TRay<T> r = camera_ray<T>(view, j, i, jitter[0], jitter[1]);
+    const SampleRng rng(uint64_t(opts.seed), uint32_t(i * view.width + j), uint32_t(k));
+    if (opts.recursive) {
+        return tracer(scene, r, 0, rng, aux);
+    }
+    return trace_path(scene, r, T(opts.min_weight), rng, aux);
 }
 
-vec3 tracer(const std::vector<Sphere *>& objects, const std::vector<LightBase *>& lights, const Ray& r, const uint depth) {
-    /* iterate until find the hit object
-     */
-    double tnearest = std::numeric_limits<double>::max();
-    Sphere *obj = nullptr;
-    /* when non-transparent object is very close to transparent object
-     * it becomes very diffult to handle the hit position biasing
-     */
-    bool ray_origin_inside_object = false;
-
-    for (const auto objiter : objects) {
-        double t0 = std::numeric_limits<double>::max();
-        double t1 = std::numeric_limits<double>::max();
-        bool inside = false;
-
-        if (objiter->intersect(r, t0, t1, inside)) {
-            assert((t0 != 0.0) && (t1 != 0.0)); /* origin of ray is on the surface of the object and direct outwards */
-            if (inside) {
-                assert(t0 < 0.0);
-                assert(t1 > 0.0);
-                ray_origin_inside_object = true;
-                if (t1 < tnearest) {
-                    tnearest = t1;
-                    obj = objiter;
+template <typename T>
+static void render_tile(const TScene<T>& scene, const View& view, const Sampler& sampler, const Tile& tile, const RenderOptions& opts, Framebuffer& fb, CostMap *cost, AuxImage *aux = nullptr) {
+    const T spp_inv = T(1.0 / view.spp);
+    PixelMeter meter(cost ? cost->mode() : HEATMAP_OFF);
+    for (int i = tile.y0; i < tile.y1; i++) {
+        for (int j = tile.x0; j < tile.x1; j++) {
+            if (cost) {
+                meter.start();
+            }
+            tvec3<T> res;
+            if (aux) {
+                /* the features are averaged over the samples as the colour
+                 * is, the luminance variance tells the filter the noise
+                 */
+                TAux<T> sum;
+                PixelEstimate est;
+                for (int k = 0; k < view.spp; k++) {
+                    TAux<T> a;
+                    const tvec3<T> c = trace_sample(scene, view, sampler, opts, j, i, k, &a);
+                    res += c;
+                    est.add(vec3(c));
+                    sum.albedo += a.albedo;
+                    sum.normal += a.normal;
+                    sum.depth += a.depth;
                 }
+                aux->set(j, i, sum, spp_inv, est.variance());
             } else {
-                if ((t0 <= 0.0) && (t1 <= 0.0)) {
-                    /* ray is shooting outwards sphere and sphere is behind
-                     */
-                } else if (t0 >= 0.0) {
-                    if (t0 < tnearest) {
-                        tnearest = t0;
-                        obj = objiter;
-                        ray_origin_inside_object = false;
-                    }
-                } else {
-                    assert(0);
+                for (int k = 0; k < view.spp; k++) {
+                    res += trace_sample(scene, view, sampler, opts, j, i, k);
                 }
             }
+            fb.at(j, i) = vec3(res * spp_inv);
+            if (cost) {
+                cost->at(j, i) = meter.stop();
+            }
         }
     }
+}
 
-    if (nullptr == obj) {
-        return TRACE_AMBIENT;
-    }
-
-    /* calculate the position and normal of the hit point
-     * and add a bias of the original hit point.
-     * after parameterize t, we can not gaurantee, that position is absolutely
-     * the same relative location of inside or outside the objects
-     */ 
-    vec3 pos = r.parameterize_at(tnearest);
-    vec3 nor;
-    vec3 C = TRACE_AMBIENT;
-
-    if(false == obj->matte()->transparent()) {
-        nor = pos - obj->origin();
-        nor.normalize();
-        /* bias hit position outwards sphere's origin for non-transparent objects
-         * so that there's no chance for next ray's origin resident inside
-         * non-transparent objects after recursive iterations
-         */
-        while (dot(pos-obj->origin(), pos-obj->origin()) < obj->radius()*obj->radius()) {
-            pos += nor * bias;
-        }
-
-        /* calculate local illumination (ambient, diffuse, specular)
-         * generate shadow ray from hit point towards lights, if it
-         * doesn't intersect any objects than shade LI
-         */
-        for (const auto lightiter : lights) {
-            vec3 shadow_ray_dir = lightiter->origin() - pos;
-            shadow_ray_dir.normalize();
-            Ray shadow_ray(pos, shadow_ray_dir);
-
-            bool inshadow = false;
-            for (const auto objiter : objects) {
-                double t0 = std::numeric_limits<double>::max();
-                double t1 = std::numeric_limits<double>::max();
-                bool inside = false;
-                if (objiter->intersect(shadow_ray, t0, t1, inside)) {
-                    inshadow = true;
-                    if (t0 <= 0.0 && t1 <= 0.0) {
-                        inshadow = false;
-                    }
-                }
+/* every sample of the tile queued at once and traced as a wavefront. the
+ * samples of a pixel are summed in sample order as render_tile does, and
+ * so are the primitive tests of the heatmap. rays of different pixels run
+ * interleaved, so there is no wall time per pixel
+ */
+template <typename T>
+static void render_tile_wavefront(const TScene<T>& scene, const View& view, const Sampler& sampler, const Tile& tile, const RenderOptions& opts, Framebuffer& fb, CostMap *cost) {
+    const T spp_inv = T(1.0 / view.spp);
+    const int w = tile.x1 - tile.x0;
+    const int pixels = w * (tile.y1 - tile.y0);
+    TWavefront<T> wave(scene, T(opts.min_weight), uint64_t(opts.seed));
+    std::vector<tvec3<T>> radiance(size_t(pixels) * view.spp);
+    for (int i = tile.y0; i < tile.y1; i++) {
+        for (int j = tile.x0; j < tile.x1; j++) {
+            const uint32_t slot = uint32_t(((i - tile.y0) * w + j - tile.x0) * view.spp);
+            for (int k = 0; k < view.spp; k++) {
+                double jitter[2];
+                sampler.get_2d(j, i, uint32_t(i * view.width + j), uint32_t(k), 0, jitter);
+                wave.push(camera_ray<T>(view, j, i, jitter[0], jitter[1]), slot + k, uint32_t(i * view.width + j), uint32_t(k));
             }
+        }
+    }
+    std::vector<double> tests(cost ? radiance.size() : 0);
+    wave.run(radiance, cost ? &tests : nullptr);
+    for (int i = tile.y0; i < tile.y1; i++) {
+        for (int j = tile.x0; j < tile.x1; j++) {
+            const size_t slot = size_t((i - tile.y0) * w + j - tile.x0) * view.spp;
+            tvec3<T> res;
+            double c = 0.0;
+            for (int k = 0; k < view.spp; k++) {
+                res += radiance[slot + k];
+                c += cost ? tests[slot + k] : 0.0;
+            }
+            fb.at(j, i) = vec3(res * spp_inv);
+            if (cost) {
+                cost->at(j, i) = c;
+            }
+        }
+    }
+}
+
+/* render in passes over the pixels that are still active. the first pass
+ * takes min_spp samples so every pixel has a variance estimate, later
+ * passes add pass_spp until the pixel converges or reaches max_spp. the
+ * time and sample budgets are checked between passes, and so is the
+ * checkpoint interval. a resumed render goes on after the last pass the
+ * checkpoint has, its time counts towards the time budget. with a
+ * preview every tile is resolved into it once traced and every pass is
+ * published
+ */
+template <typename T>
+static void render_progressive(const TScene<T>& scene, const View& view, const Sampler& sampler, const RenderOptions& opts, Framebuffer& fb, CostMap *cost, Checkpoint *checkpoint, PreviewFrames *preview) {
+    ProgressiveImage img(view.width, view.height);
+    uint32_t resumed = 0;
+    double before = 0.0;
+    std::string err;
+    if (checkpoint && checkpoint->resume(img, resumed, before, err)) {
+        std::cout << "resumed " << checkpoint->path() << " after pass " << resumed << ", "
+                  << std::fixed << std::setprecision(2) << before << " s\n";
+    } else if (!err.empty()) {
+        std::cout << err << ", starting over\n";
+    }
 
-            if (false == inshadow) {
-                double distance = dot(lightiter->origin() - pos, lightiter->origin() - pos);
-                distance = 1.0 / distance;
-
-#if TRACE_LI_DIFFUSE
-                double diffuse = std::max(0.0, dot(nor, shadow_ray_dir));
-                C += lightiter->calc_illumination(pos) * obj->matte()->kdiffuse() * diffuse * distance;
-#endif
-
-#if TRACE_LI_SPECULAR
-                vec3 pos2eye = ray_origin - pos;
-                pos2eye.normalize();
-
-                vec3 specular_light;
-                if (dot(shadow_ray_dir, nor) < 0.0) {
-                    /* no specular light */
-                } else {
-                    specular_light = reflect(pos - lightiter->origin(), nor);
-                    specular_light.normalize();
+    const int max_spp = std::max(opts.max_spp ? opts.max_spp : view.spp, 2);
+    int pass_spp = resumed ? opts.pass_spp : std::min(opts.min_spp, max_spp);
+    const TileFunc pass = [&](const Tile& tile, unsigned) {
+        PixelMeter meter(cost ? cost->mode() : HEATMAP_OFF);
+        for (int i = tile.y0; i < tile.y1; i++) {
+            for (int j = tile.x0; j < tile.x1; j++) {
+                PixelEstimate& p = img.at(j, i);
+                if (p.done) {
+                    continue;
                 }
-                double specular = std::max(0.0, dot(pos2eye, specular_light));
+                if (cost) {
+                    meter.start();
+                }
+                const int n = std::min<int>(pass_spp, max_spp - p.n);
+                for (int k = 0; k < n; k++) {
+                    p.add(vec3(trace_sample(scene, view, sampler, opts, j, i, int(p.n))));
+                }
+                if (cost) {
+                    cost->at(j, i) += meter.stop();
+                }
+                p.done = int(p.n) >= max_spp || (int(p.n) >= opts.min_spp && p.converged(opts.ci));
+            }
+        }
+        if (preview) {
+            preview->resolve(img, tile);
+        }
+    };
+
+    const double pixels = double(view.width) * view.height;
+    std::vector<Tile> tiles = split_tiles(view.width, view.height, opts.tile);
+    TileScheduler *scheduler = opts.threads > 1 ? new TileScheduler(opts.threads) : nullptr;
+    auto start = std::chrono::steady_clock::now();
+    const char *stop = "all pixels converged";
+    uint64_t samples = 0;
+    for (uint32_t passes = resumed + 1; ; passes++) {
+        if (scheduler) {
+            scheduler->run(tiles, pass);
+        } else {
+            for (const auto& t : tiles) {
+                run_tile(pass, t, 0);
+            }
+        }
+        pass_spp = opts.pass_spp;
 
-                C += lightiter->calc_illumination(pos) * obj->matte()->kdiffuse() * pow(specular, obj->matte()->specular_factor()) * distance;
-#endif
+        const double elapsed = before + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const size_t active = img.active();
+        samples = img.samples();
+        std::cout << "pass " << std::setw(3) << passes << ": " << std::setw(8) << active << " active pixels, "
+                  << std::fixed << std::setprecision(2) << double(samples) / pixels << " spp, "
+                  << elapsed << " s" << std::endl;
+        if (preview) {
+            PreviewInfo info;
+            info.pass = passes;
+            info.spp = double(samples) / pixels;
+            info.seconds = elapsed;
+            preview->publish(info);
+        }
+        if (active == 0) {
+            break;
+        }
+        if (opts.max_time > 0.0 && elapsed >= opts.max_time) {
+            stop = "time budget";
+        } else if (opts.max_samples && samples >= opts.max_samples) {
+            stop = "sample budget";
+        } else {
+            if (checkpoint && checkpoint->due()) {
+                checkpoint->submit(img, passes, elapsed);
             }
+            continue;
+        }
+        /* a larger budget can go on from here */
+        if (checkpoint) {
+            checkpoint->submit(img, passes, elapsed, true);
         }
+        break;
     }
+    delete scheduler;
+    img.resolve(fb);
 
-    if (depth < TRACE_DEPTH) {
-        /* recursive to calculate global illumination
-         */
-        if (obj->matte()->transparent()) {
-            if (ray_origin_inside_object) {
-                /* reflection pull pos towards origin
-                 */
-                nor = obj->origin() - pos;
-                nor.normalize();
-                vec3 modify_reflect_pos = pos;
-                while (dot(modify_reflect_pos-obj->origin(), modify_reflect_pos-obj->origin()) > obj->radius()*obj->radius()) {
-                    modify_reflect_pos += nor * bias;
-                }
+    const double fixed = pixels * view.spp;
+    std::cout << "progressive: stopped on " << stop << ", " << samples << " samples, "
+              << std::fixed << std::setprecision(2) << double(samples) / pixels << " spp, "
+              << samples * 100.0 / fixed << "% of " << view.spp << " spp\n";
+}
 
-                vec3 refldir = reflect(r.direction(), nor);
-                Ray next_reflect_ray(modify_reflect_pos, refldir.normalize());
-                C += tracer(objects, lights, next_reflect_ray, depth+1)*0.25;
-                /* refraction push pos outwards origin
-                 */
-                vec3 modify_refract_pos = pos;
-                while (dot(modify_refract_pos-obj->origin(), modify_refract_pos-obj->origin()) < obj->radius()*obj->radius()) {
-                    modify_refract_pos = modify_refract_pos - nor * bias;
-                }
+/* the scene that used to be hard coded: the ground, three large and three
+ * small spheres and a glass sphere in front, lit by two constant lights
+ */
+static void demo_scene(SceneDesc& desc) {
+    desc.settings = RenderSettings { TRACE_W, TRACE_H, TRACE_SSAA, 0 };
+    for (int a = 0; a < 3; a++) {
+        desc.camera.eye[a] = ray_origin[a];
+        desc.camera.topleft[a] = topleft[a];
+        desc.camera.right[a] = canvas_right[a];
+        desc.camera.down[a] = canvas_down[a];
+    }
 
-                vec3 rin = r.direction();
-                rin.normalize();
+    // Material: kdiffuse, kspecular, specular_factor, transparent, refraction index;
+    const MaterialRecord materials[] = {
+        { { 0.087, 0.094, 0.080 }, { 0.087, 0.094, 0.080 }, 0.5, 0.0, 0, 0 },
+        { { 0.71, 0.52, 0.57 }, { 0.71, 0.52, 0.57 }, 1.0, 0.0, 0, 0 },
+        { { 0.8, 0.2, 0.2 }, { 0.8, 0.2, 0.2 }, 2.0, 0.0, 0, 0 },
+        { { 0.8, 0.6, 0.2 }, { 0.8, 0.6, 0.2 }, 4.0, 0.0, 0, 0 },
+        { { 0.35, 0.35, 0.25 }, { 0.35, 0.35, 0.25 }, 8.0, 0.0, 0, 0 },
+        { { 0.2, 0.35, 0.5 }, { 0.2, 0.35, 0.5 }, 16.0, 0.0, 0, 0 },
+        { { 0.38, 0.82, 0.71 }, { 0.38, 0.82, 0.71 }, 32.0, 1.3, 1, 0 },
+        { { 0.3, 0.8, 0.6 }, { 0.3, 0.8, 0.6 }, 64.0, 1.05, 1, 0 },
+    };
+    for (const auto& m : materials) {
+        desc.add_material(m);
+    }
 
-                if (dot(rin, nor) < 0.0) {
-                    vec3 refradir = refract(rin, nor, obj->matte()->refract_idx());
-                    Ray next_refract_ray(modify_refract_pos, refradir.normalize());
-                    C += tracer(objects, lights, next_refract_ray, depth+1)*0.75;
-                }
+    // OBJECT: origin, radius, material index;
+    desc.add_sphere(Sphere(vec3(0, -100.5, OBJECT_Z), 100, 0));
+
+    desc.add_sphere(Sphere(vec3(-1, 0, OBJECT_Z), 0.5, 1));
+    desc.add_sphere(Sphere(vec3(0, 0, OBJECT_Z), 0.5, 2));
+    desc.add_sphere(Sphere(vec3(1, 0, OBJECT_Z), 0.5, 3));
+
+    desc.add_sphere(Sphere(vec3(-0.85, -0.35, OBJECT_Z+0.75), 0.15, 4));
+    desc.add_sphere(Sphere(vec3(-0.55, -0.35, OBJECT_Z+0.75), 0.15, 5));
+    desc.add_sphere(Sphere(vec3(-0.25, -0.35, OBJECT_Z+0.75), 0.15, 6));
+
+    desc.add_sphere(Sphere(vec3(0.15, -0.3, OBJECT_Z+1.2), 0.2, 7));
+
+    // position, illumination, core energy
+    desc.add_light(LightRecord { { 100, 0, 100 }, { 1.0, 1.0, 1.0 }, 1e4 });
+    desc.add_light(LightRecord { { 100, 100, 100 }, { 1.0, 1.0, 1.0 }, 5e2 });
+}
+
+/* double tracers use the loaded spheres in place, other precisions get a
+ * converted copy
+ */
+static void scene_objects(const SceneDesc& desc, std::vector<Sphere>&, std::vector<Sphere *>& objects) {
+    for (size_t i = 0; i < desc.sphere_count(); i++) {
+        objects.push_back(&desc.spheres()[i]);
+    }
+}
+
+template <typename T>
+static void scene_objects(const SceneDesc& desc, std::vector<TSphere<T>>& storage, std::vector<TSphere<T> *>& objects) {
+    storage.reserve(desc.sphere_count());
+    for (size_t i = 0; i < desc.sphere_count(); i++) {
+        const Sphere& s = desc.spheres()[i];
+        storage.push_back(TSphere<T>(tvec3<T>(s.origin()), T(s.radius()), s.material()));
+    }
+    for (auto& s : storage) {
+        objects.push_back(&s);
+    }
+}
+
+static TAccelerator<double> *make_accel(const RenderOptions& opts, const std::vector<Sphere *>& objects) {
+    if (0 == strcmp(opts.accel, "linear")) {
+        return new LinearList(objects);
+    } else if (0 == strcmp(opts.accel, "soa")) {
+        SoAList *soa = new SoAList(objects);
+        std::cout << "soa kernels: " << isa_name(soa->isa()) << "\n";
+        return soa;
+    }
+    return new BVH(objects);
+}
+
+static TAccelerator<float> *make_accel(const RenderOptions& opts, const std::vector<TSphere<float> *>& objects) {
+    if (0 == strcmp(opts.accel, "linear")) {
+        return new TLinearList<float>(objects);
+    } else if (0 == strcmp(opts.accel, "soa")) {
+        /* the SIMD kernels are double only */
+        std::cout << "soa kernels have no float path, using bvh\n";
+    }
+    return new TBVH<float>(objects);
+}
+
+/* the sphere accelerator alone, or grouped with a triangle mesh and its
+ * BVH per mesh record and a top level BVH over the instances. geometry
+ * records are built once and only reached through instances
+ */
+template <typename T>
+static TAccelerator<T> *add_meshes(const SceneDesc& desc, TAccelerator<T> *spheres) {
+    if (desc.meshes().empty()) {
+        return spheres;
+    }
+    TGroup<T> *group = new TGroup<T>();
+    group->add(spheres);
+    std::vector<const TTriangleMesh<T> *> meshes;
+    for (const MeshRecord& m : desc.meshes()) {
+        auto start = std::chrono::steady_clock::now();
+        TTriangleMesh<T> *mesh = new TTriangleMesh<T>(m.data, m.material);
+        std::cout << (m.placed ? "mesh " : "geometry ") << m.path << ": " << mesh->triangles() << " triangles, "
+                  << mesh->nodes() << " nodes, " << std::fixed << std::setprecision(2) << mesh->bytes() / 1048576.0
+                  << " MB, built in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e3 << " ms\n";
+        if (m.placed) {
+            group->add(mesh);
+        } else {
+            group->hold(mesh);
+        }
+        meshes.push_back(mesh);
+    }
+    if (!desc.instances().empty()) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<TInstance<T>> instances;
+        instances.reserve(desc.instances().size());
+        for (const InstanceRecord& r : desc.instances()) {
+            instances.push_back(TInstance<T>(meshes[r.mesh], r.to_world, r.material));
+        }
+        TInstanceBVH<T> *top = new TInstanceBVH<T>(std::move(instances));
+        std::cout << "instances: " << top->size() << ", " << top->nodes() << " nodes, " << std::fixed << std::setprecision(2)
+                  << top->bytes() / 1048576.0 << " MB, built in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e3 << " ms\n";
+        group->add(top);
+    }
+    return group;
+}
+
+/* lights, materials, eye and roulette of the scene and the light tree when lights
+ * are sampled, the accelerator is the caller's
+ */
+template <typename T>
+static void scene_shading(const RenderOptions& opts, const SceneDesc& desc, const View& view, TScene<T>& scene) {
+    typedef tvec3<T> V;
+    for (size_t i = 0; i < desc.light_count(); i++) {
+        const LightRecord& l = desc.lights()[i];
+        scene.lights.push_back(new TConstantLight<T>(V(l.origin[0], l.origin[1], l.origin[2]),
+            V(l.illumination[0], l.illumination[1], l.illumination[2]), T(l.energy)));
+    }
+    for (size_t i = 0; i < desc.material_count(); i++) {
+        const Material m = to_material(desc.materials()[i]);
+        scene.materials.push_back(TMaterial<T>(V(m.kdiffuse()), V(m.kspecular()), T(m.specular_factor()), m.transparent(), T(m.refract_idx())));
+    }
+    scene.eye = V(view.eye);
+    scene.roulette = opts.roulette;
+    scene.roulette_depth = opts.roulette_depth;
+    scene.roulette_p = T(opts.roulette_p > 0.0 ? opts.roulette_p : (opts.roulette == ROULETTE_FIXED ? TRACE_ROULETTE_FIXED : TRACE_ROULETTE_FLOOR));
+    if (opts.light_samples) {
+        auto start = std::chrono::steady_clock::now();
+        scene.light_tree = new TLightTree<T>(scene.lights);
+        scene.light_samples = opts.light_samples;
+        std::cout << "light tree: " << scene.lights.size() << " lights, " << scene.light_tree->size() << " nodes, built in "
+                  << std::fixed << std::setprecision(2)
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e3 << " ms, "
+                  << opts.light_samples << " samples per hit\n";
+    }
+}
+
+template <typename T>
+static void free_shading(TScene<T>& scene) {
+    delete scene.light_tree;
+    for (auto l : scene.lights) {
+        delete l;
+    }
+}
+
+/* stratified splits the pixel into the most samples it can get */
+static Sampler *scene_sampler(const RenderOptions& opts, const View& view) {
+    const int budget = opts.ci > 0.0 && opts.max_spp ? opts.max_spp : view.spp;
+    return make_sampler(opts.sampler, uint64_t(opts.seed), budget);
+}
+
+/* the tiles a checkpoint does not cover yet, the pixels it has go into
+ * fb and the checkpoint goes on from there. a tile it covers only in part,
+ * after a change of tile size or thread count, is traced again, the pixels
+ * come out the same
+ */
+static std::vector<Tile> resume_tiles(Checkpoint& checkpoint, Framebuffer& fb, const std::vector<Tile>& tiles) {
+    std::vector<Tile> done;
+    double seconds = 0.0;
+    std::string err;
+    if (!checkpoint.resume(fb, done, seconds, err) && !err.empty()) {
+        std::cout << err << ", starting over\n";
+        done.clear();
+    }
+    std::vector<uint8_t> covered(size_t(fb.width()) * fb.height(), 0);
+    for (const Tile& t : done) {
+        for (int y = t.y0; y < t.y1; y++) {
+            std::fill(&covered[size_t(y) * fb.width() + t.x0], &covered[size_t(y) * fb.width()] + t.x1, 1);
+        }
+    }
+    std::vector<Tile> todo;
+    for (const Tile& t : tiles) {
+        bool all = true;
+        for (int y = t.y0; y < t.y1 && all; y++) {
+            for (int x = t.x0; x < t.x1 && all; x++) {
+                all = covered[size_t(y) * fb.width() + x] != 0;
+            }
+        }
+        if (!all) {
+            todo.push_back(t);
+        }
+    }
+    if (!done.empty()) {
+        std::cout << "resumed " << checkpoint.path() << ": " << tiles.size() - todo.size() << " of " << tiles.size()
+                  << " tiles done in " << std::fixed << std::setprecision(2) << seconds << " s\n";
+    }
+    checkpoint.track(fb, done, seconds);
+    return todo;
+}
+
+/* one image of the scene as it is, returns the wall time in seconds.
+ * report prints the per thread tile counts
+ */
+template <typename T>
+static double trace_image(const RenderOptions& opts, const TScene<T>& scene, const View& view, const Sampler& sampler, Framebuffer& fb, CostMap *cost, const bool report, Checkpoint *checkpoint = nullptr, PreviewFrames *preview = nullptr, AuxImage *aux = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    if (opts.ci > 0.0) {
+        render_progressive(scene, view, sampler, opts, fb, cost, checkpoint, preview);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    const TileFunc job = [&](const Tile& t, unsigned) {
+        if (opts.wavefront) {
+            render_tile_wavefront(scene, view, sampler, t, opts, fb, cost);
+        } else {
+            render_tile(scene, view, sampler, t, opts, fb, cost, aux);
+        }
+        if (checkpoint) {
+            checkpoint->finished(t);
+        }
+    };
+    /* serial reference path: scanlines in order on this thread
+     */
+    std::vector<Tile> tiles;
+    if (opts.threads == 1) {
+        for (int i = 0; i < view.height; i++) {
+            tiles.push_back(Tile { 0, i, view.width, i + 1 });
+        }
+    } else {
+        tiles = split_tiles(view.width, view.height, opts.tile);
+    }
+    if (checkpoint) {
+        tiles = resume_tiles(*checkpoint, fb, tiles);
+    }
+
+    if (opts.threads == 1) {
+        for (const Tile& t : tiles) {
+            run_tile(job, t, 0);
+            std::cout << "Ray Trace Processing: " << std::fixed << std::setprecision(2) << t.y0 * 100.0 / view.height << "%\r";
+        }
+    } else {
+        TileScheduler scheduler(opts.threads);
+        scheduler.run(tiles, job);
+        if (report) {
+            std::cout << "\n" << scheduler;
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* the accelerator, lights and sampler of the scene for a tracer of
+ * scalar type T, handed to fn and freed once it returns
+ */
+template <typename T, typename F>
+static void with_scene(const RenderOptions& opts, const SceneDesc& desc, const View& view, const F& fn) {
+    std::vector<TSphere<T>> storage;
+    std::vector<TSphere<T> *> objects_family;
+    scene_objects(desc, storage, objects_family);
+
+    auto build_start = std::chrono::steady_clock::now();
+    TAccelerator<T> *accel = add_meshes(desc, make_accel(opts, objects_family));
+    std::cout << "accelerator built in " << std::fixed << std::setprecision(2)
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count() * 1e3 << " ms\n";
+
+    TScene<T> scene;
+    scene.accel = accel;
+    scene_shading(opts, desc, view, scene);
+    Sampler *sampler = scene_sampler(opts, view);
+
+    fn(scene, *sampler);
+
+    delete sampler;
+    delete accel;
+    free_shading(scene);
+}
+
+/* render the scene with a tracer of scalar type T, returns the wall
+ * time of the trace in seconds
+ */
+template <typename T>
+static double render(const RenderOptions& opts, const SceneDesc& desc, const View& view, Framebuffer& fb, CostMap *cost = nullptr, Checkpoint *checkpoint = nullptr, PreviewFrames *preview = nullptr, AuxImage *aux = nullptr) {
+    double seconds = 0.0;
+    with_scene<T>(opts, desc, view, [&](const TScene<T>& scene, const Sampler& sampler) {
+        seconds = trace_image(opts, scene, view, sampler, fb, cost, true, checkpoint, preview, aux);
+    });
+    return seconds;
+}
+
+/* every format asked for under one base name. both PPM flavours asked
+ * for: the ASCII one gets its own name
+ */
+static std::vector<ImageTarget> image_targets(const RenderOptions& opts, const std::string& base) {
+    std::vector<ImageTarget> targets;
+    const bool both_ppm = std::count(opts.formats.begin(), opts.formats.end(), IMAGE_P6) &&
+                          std::count(opts.formats.begin(), opts.formats.end(), IMAGE_P3);
+    for (const ImageFormat f : opts.formats) {
+        targets.push_back(ImageTarget { f, base + (f == IMAGE_P3 && both_ppm ? ".p3" : "") + format_extension(f) });
+    }
+    return targets;
+}
+
+/* frames at even steps over the key times, the first and last on the
+ * first and last key. the accelerators persist, between frames they are
+ * refitted to the new poses or rebuilt once refitting has degraded them,
+ * and each frame goes to the writer while the next one traces
+ */
+template <typename T>
+static void render_sequence(const RenderOptions& opts, const SceneDesc& desc, const View& view, ImageWriter& writer) {
+    const Animation anim(desc);
+    if (anim.empty()) {
+        std::cout << "scene has no keys, every frame is the same\n";
+    }
+    if (strcmp(opts.accel, "bvh")) {
+        std::cout << "sequences refit a bvh, --accel " << opts.accel << " is not used\n";
+    }
+
+    auto build_start = std::chrono::steady_clock::now();
+    TAnimatedScene<T> animated(desc, anim, anim.begin(), opts.rebuild_ratio);
+    std::cout << "accelerator built in " << std::fixed << std::setprecision(2)
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count() * 1e3 << " ms\n";
+
+    TScene<T> scene;
+    scene.accel = animated.accel();
+    scene_shading(opts, desc, view, scene);
+    Sampler *sampler = scene_sampler(opts, view);
+
+    double update_sec = 0.0;
+    double trace_sec = 0.0;
+    int rebuilds = 0;
+    for (int f = 0; f < opts.frames; f++) {
+        const double time = opts.frames > 1 ? anim.begin() + (anim.end() - anim.begin()) * f / (opts.frames - 1) : anim.begin();
+        FrameUpdate u = { 0.0, 1.0, 1.0, false, false };
+        if (f > 0) {
+            u = animated.update(time);
+        }
+        Framebuffer fb(view.width, view.height);
+        const double sec = trace_image(opts, scene, view, *sampler, fb, nullptr, false);
+        char name[16];
+        snprintf(name, sizeof(name), "_%04d", f);
+        writer.submit(std::move(fb), image_targets(opts, std::string(opts.output) + name));
+
+        update_sec += u.seconds;
+        trace_sec += sec;
+        rebuilds += u.sphere_rebuilt + u.instance_rebuilt;
+        std::cout << "frame " << std::setw(4) << f << " t " << std::fixed << std::setprecision(3) << time
+                  << ": spheres " << (u.sphere_rebuilt ? "rebuilt" : "refit") << " sah x" << std::setprecision(2) << u.sphere_ratio
+                  << ", instances " << (u.instance_rebuilt ? "rebuilt" : "refit") << " sah x" << u.instance_ratio
+                  << ", update " << u.seconds * 1e3 << " ms, trace " << sec << " s" << std::endl;
+    }
+    std::cout << "sequence: " << opts.frames << " frames, " << rebuilds << " rebuilds, update "
+              << std::fixed << std::setprecision(2) << update_sec * 1e3 / opts.frames << " ms and trace "
+              << trace_sec / opts.frames << " s per frame\n";
+
+    delete sampler;
+    free_shading(scene);
+}
+
+/* largest per channel difference of the float render against the double
+ * reference, in linear radiance and in written 8 bit values
+ */
+static void compare_precision(const Framebuffer& ref, const Framebuffer& fb, const double ref_sec, const double sec) {
+    double max_linear = 0.0;
+    int max_byte = 0;
+    size_t differ = 0;
+    for (int i = 0; i < ref.height(); i++) {
+        for (int j = 0; j < ref.width(); j++) {
+            const vec3& a = ref.at(j, i);
+            const vec3& b = fb.at(j, i);
+            bool same = true;
+            for (int c = 0; c < 3; c++) {
+                max_linear = std::max(max_linear, std::fabs(a[c] - b[c]));
+                const int d = std::abs(to_byte(a[c]) - to_byte(b[c]));
+                max_byte = std::max(max_byte, d);
+                same &= d == 0;
+            }
+            differ += same ? 0 : 1;
+        }
+    }
+    std::cout << "\nprecision  double " << std::fixed << std::setprecision(3) << ref_sec << " s"
+              << ", float " << sec << " s, speedup " << std::setprecision(2) << ref_sec / sec << "x\n"
+              << "float vs double: max linear diff " << std::scientific << std::setprecision(3) << max_linear
+              << ", max 8 bit diff " << max_byte << ", " << differ << " of "
+              << size_t(ref.width()) * ref.height() << " pixels differ\n" << std::defaultfloat;
+}
+
+/* the scene and every option the pixels depend on. threads, tiles and
+ * the wavefront order do not change them
+ */
+static uint64_t image_fingerprint(const RenderOptions& opts, const SceneDesc& desc) {
+    std::ostringstream s;
+    s << std::setprecision(17) << opts.seed << " " << opts.sampler << " " << opts.accel << " " << opts.precision << " "
+      << opts.recursive << " " << opts.min_weight << " " << opts.light_samples;
+    if (opts.roulette != ROULETTE_OFF) {
+        s << " " << opts.roulette << " " << opts.roulette_depth << " " << opts.roulette_p;
+    }
+    if (opts.ci > 0.0) {
+        s << " " << opts.ci << " " << opts.min_spp << " " << opts.pass_spp << " " << opts.max_spp;
+    }
+    const std::string str = s.str();
+    return fnv1a(str.data(), str.size(), scene_fingerprint(desc));
+}
+
+/* worker mode: the scene built as for a local render, the coordinator's
+ * tiles traced on this thread
+ */
+template <typename T>
+static int run_worker(const RenderOptions& opts, const SceneDesc& desc, const View& view) {
+    std::string err;
+    int fd = -1;
+    /* a coordinator on another node may still be coming up */
+    for (int tries = 0; fd < 0 && tries < 50; tries++) {
+        fd = net_socket(opts.worker, false, err);
+        if (fd < 0) {
+            usleep(100000);
+        }
+    }
+    if (fd < 0) {
+        std::cerr << err << "\n";
+        return 1;
+    }
+    bool ok = false;
+    Framebuffer fb(view.width, view.height);
+    with_scene<T>(opts, desc, view, [&](const TScene<T>& scene, const Sampler& sampler) {
+        const TileFunc job = [&](const Tile& t, unsigned) {
+            if (opts.wavefront) {
+                render_tile_wavefront(scene, view, sampler, t, opts, fb, nullptr);
             } else {
-                /* reflection push pos outwards origin
-                 */
-                nor = pos - obj->origin();
-                nor.normalize();
-                vec3 modify_reflect_pos = pos;
-                while(dot(modify_reflect_pos-obj->origin(), modify_reflect_pos-obj->origin()) < obj->radius()*obj->radius()) {
-                    modify_reflect_pos += nor * bias;
-                }
+                render_tile(scene, view, sampler, t, opts, fb, nullptr);
+            }
+        };
+        ok = serve_tiles(fd, image_fingerprint(opts, desc), fb, job);
+    });
+    close(fd);
+    if (!ok) {
+        std::cerr << opts.worker << ": connection lost\n";
+    }
+    return ok ? 0 : 1;
+}
 
-                vec3 refldir = reflect(r.direction(), nor);
-                Ray next_reflect_r(modify_reflect_pos, refldir.normalize());
-                C += tracer(objects, lights, next_reflect_r, depth+1)*0.25;
-                /* refraction pull pos towards origin
-                 */
-                vec3 modify_refract_pos = pos;
-                while(dot(modify_refract_pos-obj->origin(), modify_refract_pos-obj->origin()) > obj->radius()*obj->radius()) {
-                    modify_refract_pos = modify_refract_pos - nor * bias;
-                }
+/* coordinator: starts opts.distribute copies of this program as workers
+ * on the listening address, with the arguments it got minus those that
+ * make it a coordinator, and assembles their tiles in fb
+ */
+static bool render_distributed(const RenderOptions& opts, const SceneDesc& desc, const View& view, Framebuffer& fb, Checkpoint *checkpoint, int argc, char const *argv[]) {
+    const std::string address = opts.listen ? opts.listen : "unix:/tmp/rt-" + std::to_string(getpid()) + ".sock";
+    std::string err;
+    const int fd = net_socket(address, true, err);
+    if (fd < 0) {
+        std::cerr << err << "\n";
+        return false;
+    }
+    std::cout << "coordinator on " << address << "\n";
 
-                vec3 rin = r.direction();
-                rin.normalize();
+    std::vector<const char *> args;
+    for (int i = 0; i < argc; i++) {
+        if (!strcmp(argv[i], "--distribute") || !strcmp(argv[i], "--listen") || !strcmp(argv[i], "--checkpoint") ||
+            !strcmp(argv[i], "--baseline")) {
+            i++;
+            continue;
+        }
+        args.push_back(argv[i]);
+    }
+    args.push_back("--worker");
+    args.push_back(address.c_str());
+    args.push_back(nullptr);
+    char self[4096] = {};
+    if (readlink("/proc/self/exe", self, sizeof(self) - 1) <= 0) {
+        strcpy(self, "/proc/self/exe");
+    }
+    std::vector<pid_t> pids;
+    for (int i = 0; i < opts.distribute; i++) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            /* workers keep stderr, their scene reports would repeat ours */
+            const int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            execv(self, const_cast<char *const *>(args.data()));
+            _exit(127);
+        }
+        pids.push_back(pid);
+    }
 
-                vec3 refradir = refract(rin, nor, 1.0 / obj->matte()->refract_idx());
-                if (dot(rin, nor) < 0.0) {
-                    Ray next_refract_r(modify_refract_pos, refradir.normalize());
-                    C += tracer(objects, lights, next_refract_r, depth+1)*0.75;
-                }
+    std::vector<Tile> tiles = split_tiles(view.width, view.height, opts.tile);
+    if (checkpoint) {
+        tiles = resume_tiles(*checkpoint, fb, tiles);
+    }
+    TileCoordinator coordinator(fd, image_fingerprint(opts, desc), fb, pids);
+    const bool ok = coordinator.run(tiles, [&](const Tile& t) {
+        if (checkpoint) {
+            checkpoint->finished(t);
+        }
+    }, err);
+    close(fd);
+    if (0 == address.compare(0, 5, "unix:")) {
+        unlink(address.c_str() + 5);
+    }
+    std::cout << coordinator;
+    if (opts.baseline > 0.0) {
+        std::cout << "parallel efficiency " << std::fixed << std::setprecision(2) << coordinator.efficiency(opts.baseline) * 100.0
+                  << "% of " << coordinator.traced() << " workers against " << opts.baseline << " s on one\n";
+    }
+    if (!ok) {
+        std::cerr << err << "\n";
+    }
+
+    /* workers leave on quit, one that is stopped or hung is killed */
+    for (int waited = 0; waited < 20 && std::count(pids.begin(), pids.end(), pid_t(0)) < int(pids.size()); waited++) {
+        for (auto& pid : pids) {
+            if (pid > 0 && waitpid(pid, nullptr, WNOHANG) != 0) {
+                pid = 0;
+            }
+        }
+        usleep(waited ? 100000 : 0);
+    }
+    for (const pid_t pid : pids) {
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char const *argv[])
+{
+    RenderOptions opts;
+    if (!parse_options(argc, argv, opts)) {
+        return 1;
+    }
+
+    SceneDesc desc;
+    auto load_start = std::chrono::steady_clock::now();
+    std::string err;
+    if (opts.scene) {
+        if (!desc.load(opts.scene, err)) {
+            std::cerr << opts.scene << ": " << err << "\n";
+            return 1;
+        }
+    } else {
+        demo_scene(desc);
+    }
+    if (!desc.validate(err)) {
+        std::cerr << (opts.scene ? opts.scene : "demo scene") << ": " << err << "\n";
+        return 1;
+    }
+    std::cout << "scene: " << desc.sphere_count() << " spheres, " << desc.material_count() << " materials, "
+              << desc.light_count() << " lights, " << (desc.mapped() ? "mapped" : "parsed") << " in "
+              << std::fixed << std::setprecision(2)
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count() * 1e3 << " ms\n";
+
+    if (opts.export_text || opts.export_binary) {
+        const char *path = opts.export_text ? opts.export_text : opts.export_binary;
+        if (!(opts.export_text ? desc.save_text(path, err) : desc.save_binary(path, err))) {
+            std::cerr << path << ": " << err << "\n";
+            return 1;
+        }
+        std::cout << "wrote scene " << path << "\n";
+        return 0;
+    }
+
+    const View view = make_view(desc);
+    if (opts.worker) {
+        return 0 == strcmp(opts.precision, "float") ? run_worker<float>(opts, desc, view) : run_worker<double>(opts, desc, view);
+    }
+    ImageWriter writer(opts.frames ? SEQUENCE_PENDING_FRAMES : 0);
+    CostMap *cost = nullptr;
+    Checkpoint *checkpoint = nullptr;
+    AuxImage *aux = nullptr;
+    Framebuffer *noisy = nullptr;
+    int images = opts.compare_precision ? 2 : 1;
+
+    if (opts.frames) {
+        images = opts.frames;
+        if (0 == strcmp(opts.precision, "float")) {
+            render_sequence<float>(opts, desc, view, writer);
+        } else {
+            render_sequence<double>(opts, desc, view, writer);
+        }
+    } else {
+        Framebuffer fb(view.width, view.height);
+        cost = opts.heatmap != HEATMAP_OFF ? new CostMap(view.width, view.height, opts.heatmap) : nullptr;
+        if (opts.checkpoint) {
+            checkpoint = new Checkpoint(opts.checkpoint, image_fingerprint(opts, desc), opts.checkpoint_interval);
+            if (!checkpoint->check(opts.ci > 0.0 ? CHECKPOINT_PASSES : CHECKPOINT_TILES, view.width, view.height, err)) {
+                std::cerr << err << "\n";
+                delete checkpoint;
+                delete cost;
+                return 1;
             }
+        }
+
+        if (opts.distribute >= 0) {
+            /* the tracing and its counters are in the workers */
+            images = 0;
+            if (cost) {
+                std::cout << "no heatmap for distributed renders\n";
+                delete cost;
+                cost = nullptr;
+            }
+            if (!render_distributed(opts, desc, view, fb, checkpoint, argc, argv)) {
+                delete checkpoint;
+                return 1;
+            }
+        } else if (opts.compare_precision) {
+            Framebuffer fbf(view.width, view.height);
+            const double sec = render<double>(opts, desc, view, fb, cost);
+            const double secf = render<float>(opts, desc, view, fbf);
+            compare_precision(fb, fbf, sec, secf);
         } else {
-            if (dot(r.direction(), nor) < 0.0) {
-                vec3 refldir = reflect(r.direction(), nor);
-                Ray next_r(pos, refldir.normalize());
-                C += tracer(objects, lights, next_r, depth+1)*0.5;
+            PreviewFrames *preview = opts.preview ? new PreviewFrames(view.width, view.height) : nullptr;
+            PreviewDump *dump = preview ? new PreviewDump(*preview, opts.preview) : nullptr;
+            aux = opts.denoise || opts.aov ? new AuxImage(view.width, view.height) : nullptr;
+            if (0 == strcmp(opts.precision, "float")) {
+                render<float>(opts, desc, view, fb, cost, checkpoint, preview, aux);
+            } else {
+                render<double>(opts, desc, view, fb, cost, checkpoint, preview, aux);
+            }
+            if (preview) {
+                preview->close();
+                dump->wait();
+                std::cout << *dump;
+                delete dump;
+                delete preview;
             }
         }
+        if (checkpoint) {
+            checkpoint->stop();
+        }
+
+        if (aux && opts.denoise) {
+            noisy = new Framebuffer(fb);
+        }
+        writer.submit(std::move(fb), image_targets(opts, opts.output));
+        if (aux && opts.aov) {
+            const std::string base = opts.output;
+            writer.submit(aux->albedo_image(), { ImageTarget { IMAGE_PFM, base + ".albedo.pfm" } });
+            writer.submit(aux->normal_image(), { ImageTarget { IMAGE_PFM, base + ".normal.pfm" } });
+            writer.submit(aux->depth_image(), { ImageTarget { IMAGE_PFM, base + ".depth.pfm" } });
+        }
+        if (cost) {
+            /* colour saturates at the 99th percentile so a few pathological
+             * pixels do not flatten the rest, the PFM keeps the raw values
+             */
+            const std::string base = std::string(opts.output) + ".cost";
+            writer.submit(cost->colour(cost->quantile(0.99)), { ImageTarget { IMAGE_P6, base + ".ppm" } });
+            writer.submit(cost->raw(), { ImageTarget { IMAGE_PFM, base + ".pfm" } });
+        }
     }
-    return C;
+
+    const TraceStats stats = StatsRegistry::instance().collect();
+    if (images) {
+        std::cout << "\n" << stats << "rays per pixel  " << std::fixed << std::setprecision(2)
+                  << double(stats.rays + stats.shadow_rays) / (double(view.width) * view.height * images) << "\n";
+    }
+
+    if (opts.stats) {
+        std::ofstream json(opts.stats);
+        write_stats_json(json, stats);
+        if (!json.good()) {
+            std::cerr << "cannot write " << opts.stats << "\n";
+        }
+    }
+
+    if (cost) {
+        std::cout << *cost;
+        delete cost;
+    }
+
+    if (noisy) {
+        /* after the counters are collected, the filter bands are no render tiles */
+        const AtrousKernels kernels = select_atrous(detect_isa());
+        auto start = std::chrono::steady_clock::now();
+        if (opts.threads == 1) {
+            denoise(*noisy, *aux, DenoiseParams(), kernels, nullptr);
+        } else {
+            TileScheduler scheduler(opts.threads);
+            denoise(*noisy, *aux, DenoiseParams(), kernels, &scheduler);
+        }
+        std::cout << "denoised in " << std::fixed << std::setprecision(2)
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e3 << " ms ("
+                  << isa_name(kernels.isa) << ", " << opts.threads << " threads)\n";
+        writer.submit(std::move(*noisy), image_targets(opts, std::string(opts.output) + ".denoised"));
+        delete noisy;
+    }
+    delete aux;
+
+    writer.wait();
+    std::cout << writer;
+
+    if (checkpoint) {
+        /* the image has to be on disk before the work behind it goes */
+        bool written = true;
+        for (const auto& r : writer.records()) {
+            written &= r.ok;
+        }
+        if (written && !checkpoint->kept()) {
+            checkpoint->remove();
+        }
+        std::cout << *checkpoint << (written && !checkpoint->kept() ? "removed" : "kept") << " " << checkpoint->path() << "\n";
+        delete checkpoint;
+    }
+
+    return 0;
 }
@@ -0,0 +1,105 @@
+#ifndef _RNG_HPP_
+#define _RNG_HPP_
+
+#include <cstdint>
+
+// Philox4x32 round multipliers and key schedule (Salmon et al. 2011)
+constexpr uint32_t PHILOX_M0 = 0xD2511F53u;
+constexpr uint32_t PHILOX_M1 = 0xCD9E8D57u;
+constexpr uint32_t PHILOX_W0 = 0x9E3779B9u;
+constexpr uint32_t PHILOX_W1 = 0xBB67AE85u;
+
+// Rounds, 10 is the crush resistant count of the reference implementation
+constexpr int PHILOX_ROUNDS = 10;
+
+/* Philox4x32-10: a keyed bijection of a 128 bit counter, so the n-th
+ * number of a stream is computed directly with no state carried between
+ * calls
+ */
+inline void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r = 0; r < PHILOX_ROUNDS; r++) {
+        const uint64_t p0 = uint64_t(PHILOX_M0) * c0;
+        const uint64_t p1 = uint64_t(PHILOX_M1) * c2;
+        const uint32_t n0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+        const uint32_t n2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+        c1 = uint32_t(p1);
+        c3 = uint32_t(p0);
+        c0 = n0;
+        c2 = n2;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+/* [0, 1) from 32 random bits, exact in float and double */
+inline double to_unit(const uint32_t x) {
+    return x * (1.0 / 4294967296.0);
+}
+
+/* random numbers of one sample of one pixel, keyed by (seed, pixel,
+ * sample, dimension). dimensions are drawn in order with next() and come
+ * four to a Philox block, uniform(d) reads any dimension directly. the
+ * same key gives the same numbers on any thread in any order
+ */
+class SampleRng {
+public:
+    ~SampleRng() {}
+    SampleRng() = delete;
+    SampleRng(const uint64_t seed, const uint32_t pixel, const uint32_t sample) :
+        _key { uint32_t(seed), uint32_t(seed >> 32) },
+        _pixel(pixel),
+        _sample(sample) {}
+
+    inline uint32_t pixel() const { return _pixel; }
+    inline uint32_t sample() const { return _sample; }
+    inline uint32_t dimension() const { return _dim; }
+
+    uint32_t next_u32() {
+        if (_block != _dim >> 2) {
+            fill(_dim >> 2);
+        }
+        return _bits[_dim++ & 3];
+    }
+
+    inline double next() { return to_unit(next_u32()); }
+
+    uint32_t u32(const uint32_t dim) const {
+        uint32_t bits[4];
+        const uint32_t ctr[4] = { _pixel, _sample, dim >> 2, 0 };
+        philox4x32(ctr, _key, bits);
+        return bits[dim & 3];
+    }
+
+    inline double uniform(const uint32_t dim) const { return to_unit(u32(dim)); }
+
+    /* continue the sequential draws at dimension dim */
+    inline void skip_to(const uint32_t dim) { _dim = dim; }
+
+    /* a block of four off the dimension stream: c3 with the top bit set
+     * never meets a dimension block, whatever c2 is
+     */
+    void draw(const uint32_t c2, const uint32_t c3, uint32_t out[4]) const {
+        const uint32_t ctr[4] = { _pixel, _sample, c2, c3 | 0x80000000u };
+        philox4x32(ctr, _key, out);
+    }
+private:
+    void fill(const uint32_t block) {
+        const uint32_t ctr[4] = { _pixel, _sample, block, 0 };
+        philox4x32(ctr, _key, _bits);
+        _block = block;
+    }
+
+    uint32_t _key[2];
+    uint32_t _pixel;
+    uint32_t _sample;
+    uint32_t _dim = 0;
+    uint32_t _block = ~0u;
+    uint32_t _bits[4];
+};
+#endif
@@ -0,0 +1,327 @@
+#ifndef _SAMPLER_HPP_
+#define _SAMPLER_HPP_
+
+#include "rng.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/* 2D sample points for the pixel integral. a sampler returns the point of
+ * dimension pair dim of sample k of a pixel, pair 0 is the sub pixel
+ * jitter. samplers are stateless and shared by the render threads
+ */
+class Sampler {
+public:
+    virtual ~Sampler() {}
+    virtual const char *name() const = 0;
+    /* pixel is the index the random streams are keyed by, x and y locate
+     * it on the image for samplers that correlate neighbours
+     */
+    virtual void get_2d(const int x, const int y, const uint32_t pixel, const uint32_t k, const uint32_t dim, double uv[2]) const = 0;
+};
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+/* 32 bit integer mixer (lowbias32), for seeds derived from seeds */
+inline uint32_t hash_u32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hash_u32(const uint32_t a, const uint32_t b) {
+    return hash_u32(a ^ hash_u32(b + 0x9e3779b9u));
+}
+
+/* first two Sobol dimensions: van der Corput and the x + 1 polynomial,
+ * whose direction numbers follow v ^= v >> 1
+ */
+inline uint32_t sobol_u32(uint32_t index, const uint32_t dim) {
+    if (dim == 0) {
+        return reverse_bits(index);
+    }
+    uint32_t r = 0;
+    for (uint32_t v = 0x80000000u; index; index >>= 1, v ^= v >> 1) {
+        if (index & 1) {
+            r ^= v;
+        }
+    }
+    return r;
+}
+
+/* hash based nested uniform (Owen) scramble, Burley 2020 with the
+ * Laine-Karras style hash improved by Vegdahl. every bit is flipped by a
+ * hash of the bits above it, which keeps the net properties
+ */
+inline uint32_t owen_scramble(uint32_t x, const uint32_t seed) {
+    x = reverse_bits(x);
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return reverse_bits(x);
+}
+
+/* random permutation of [0, n) by cycle walking a hash (Kensler 2013) */
+inline uint32_t permute(uint32_t i, const uint32_t n, const uint32_t p) {
+    uint32_t w = n - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893du;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3fu;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return (i + p) % n;
+}
+
+/* independent uniform points, the Philox stream of the sample */
+class RandomSampler : public Sampler {
+public:
+    ~RandomSampler() {}
+    RandomSampler() = delete;
+    RandomSampler(const uint64_t seed) : _seed(seed) {}
+    const char *name() const { return "random"; }
+    void get_2d(const int, const int, const uint32_t pixel, const uint32_t k, const uint32_t dim, double uv[2]) const {
+        const SampleRng rng(_seed, pixel, k);
+        uv[0] = rng.uniform(2 * dim);
+        uv[1] = rng.uniform(2 * dim + 1);
+    }
+private:
+    uint64_t _seed;
+};
+
+/* jittered grid of spp strata, the most square nx x ny = spp split. the
+ * samples visit the strata in a per pixel random order, so a pixel that
+ * stops early still covers it evenly, and start a fresh order past spp
+ */
+class StratifiedSampler : public Sampler {
+public:
+    ~StratifiedSampler() {}
+    StratifiedSampler() = delete;
+    StratifiedSampler(const uint64_t seed, const int spp) : _seed(seed) {
+        const uint32_t n = uint32_t(spp > 0 ? spp : 1);
+        _ny = uint32_t(std::sqrt(double(n)));
+        while (n % _ny) {
+            _ny--;
+        }
+        _nx = n / _ny;
+    }
+    const char *name() const { return "stratified"; }
+    void get_2d(const int, const int, const uint32_t pixel, const uint32_t k, const uint32_t dim, double uv[2]) const {
+        const uint32_t n = _nx * _ny;
+        const uint32_t key = hash_u32(hash_u32(uint32_t(_seed), pixel), dim * 0x10000u + k / n);
+        const uint32_t s = permute(k % n, n, key);
+        const SampleRng rng(_seed, pixel, k);
+        uv[0] = (s % _nx + rng.uniform(2 * dim)) / _nx;
+        uv[1] = (s / _nx + rng.uniform(2 * dim + 1)) / _ny;
+    }
+private:
+    uint64_t _seed;
+    uint32_t _nx;
+    uint32_t _ny;
+};
+
+/* Owen scrambled 2D Sobol points, shuffled and scrambled per pixel and per
+ * dimension pair (Burley 2020). any power of two prefix is a stratified
+ * (0, m, 2)-net, so the sample count needs no fixing up front
+ */
+class SobolSampler : public Sampler {
+public:
+    ~SobolSampler() {}
+    SobolSampler() = delete;
+    SobolSampler(const uint64_t seed) : _seed(hash_u32(uint32_t(seed), uint32_t(seed >> 32))) {}
+    const char *name() const { return "sobol"; }
+    void get_2d(const int, const int, const uint32_t pixel, const uint32_t k, const uint32_t dim, double uv[2]) const {
+        const uint32_t key = hash_u32(hash_u32(_seed, pixel), dim);
+        const uint32_t index = owen_scramble(k, key);
+        uv[0] = to_unit(owen_scramble(sobol_u32(index, 0), hash_u32(key, 1)));
+        uv[1] = to_unit(owen_scramble(sobol_u32(index, 1), hash_u32(key, 2)));
+    }
+private:
+    uint32_t _seed;
+};
+
+// Blue noise mask edge, and the gaussian energy radius of void and cluster
+constexpr int BLUE_NOISE_SIZE = 64;
+constexpr double BLUE_NOISE_SIGMA = 1.5;
+
+/* ranked dither mask with blue noise spectrum, built once by Ulichney's
+ * void and cluster method on a torus. at(x, y) is the rank of the texel
+ * mapped to (0, 1), every value occurs once
+ */
+class BlueNoiseMask {
+public:
+    static const BlueNoiseMask& instance() {
+        static const BlueNoiseMask mask;
+        return mask;
+    }
+    inline double at(const int x, const int y) const {
+        return _rank[(y & (BLUE_NOISE_SIZE - 1)) * BLUE_NOISE_SIZE + (x & (BLUE_NOISE_SIZE - 1))];
+    }
+private:
+    BlueNoiseMask() : _rank(N) {
+        /* toroidal gaussian, indexed by the wrapped offset */
+        std::vector<double> kernel(N);
+        for (int dy = 0; dy < BLUE_NOISE_SIZE; dy++) {
+            for (int dx = 0; dx < BLUE_NOISE_SIZE; dx++) {
+                const int wx = std::min(dx, BLUE_NOISE_SIZE - dx);
+                const int wy = std::min(dy, BLUE_NOISE_SIZE - dy);
+                kernel[dy * BLUE_NOISE_SIZE + dx] = std::exp(-(wx * wx + wy * wy) / (2 * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+            }
+        }
+
+        /* random initial pattern of a tenth of the texels, relaxed by moving
+         * the tightest cluster into the largest void until it is stable
+         */
+        std::vector<char> bits(N, 0);
+        std::vector<double> energy(N, 0.0);
+        const SampleRng rng(0x5eed, 0, 0);
+        int ones = 0;
+        for (uint32_t d = 0; ones < N / 10; d++) {
+            const int p = int(rng.u32(d) % N);
+            if (!bits[p]) {
+                flip(kernel, bits, energy, p);
+                ones++;
+            }
+        }
+        for (;;) {
+            const int cluster = extreme(bits, energy, 1);
+            flip(kernel, bits, energy, cluster);
+            const int hole = extreme(bits, energy, 0);
+            flip(kernel, bits, energy, hole);
+            if (hole == cluster) {
+                break;
+            }
+        }
+        const std::vector<char> initial_bits = bits;
+        const std::vector<double> initial_energy = energy;
+
+        /* ranks below the initial pattern, removing clusters */
+        for (int rank = ones - 1; rank >= 0; rank--) {
+            const int cluster = extreme(bits, energy, 1);
+            flip(kernel, bits, energy, cluster);
+            _rank[cluster] = rank;
+        }
+        /* ranks above it, filling voids. past half the largest void of the
+         * ones is the tightest cluster of the zeros, so one rule covers both
+         */
+        bits = initial_bits;
+        energy = initial_energy;
+        for (int rank = ones; rank < N; rank++) {
+            const int hole = extreme(bits, energy, 0);
+            flip(kernel, bits, energy, hole);
+            _rank[hole] = rank;
+        }
+        for (auto& r : _rank) {
+            r = (r + 0.5) / N;
+        }
+    }
+
+    static void flip(const std::vector<double>& kernel, std::vector<char>& bits, std::vector<double>& energy, const int p) {
+        const double sign = bits[p] ? -1.0 : 1.0;
+        bits[p] = !bits[p];
+        const int px = p % BLUE_NOISE_SIZE;
+        const int py = p / BLUE_NOISE_SIZE;
+        for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+            const int ky = ((y - py) & (BLUE_NOISE_SIZE - 1)) * BLUE_NOISE_SIZE;
+            for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+                energy[y * BLUE_NOISE_SIZE + x] += sign * kernel[ky + ((x - px) & (BLUE_NOISE_SIZE - 1))];
+            }
+        }
+    }
+
+    /* highest energy set texel (tightest cluster) or lowest energy unset
+     * texel (largest void)
+     */
+    static int extreme(const std::vector<char>& bits, const std::vector<double>& energy, const char set) {
+        int best = -1;
+        for (int p = 0; p < N; p++) {
+            if (bits[p] == set && (best < 0 || (set ? energy[p] > energy[best] : energy[p] < energy[best]))) {
+                best = p;
+            }
+        }
+        return best;
+    }
+
+    static constexpr int N = BLUE_NOISE_SIZE * BLUE_NOISE_SIZE;
+    std::vector<double> _rank;
+};
+
+/* the same 2D Sobol points in every pixel, each pixel shifted toroidally
+ * (Cranley-Patterson rotation) by blue noise mask values. the per pixel
+ * error stays that of the sequence but neighbouring pixels err in
+ * different directions, leaving high frequency noise that the eye and a
+ * filter average away
+ */
+class BlueNoiseSampler : public Sampler {
+public:
+    ~BlueNoiseSampler() {}
+    BlueNoiseSampler() = delete;
+    BlueNoiseSampler(const uint64_t seed) : _mask(BlueNoiseMask::instance()), _seed(hash_u32(uint32_t(seed), uint32_t(seed >> 32))) {}
+    const char *name() const { return "bluenoise"; }
+    void get_2d(const int x, const int y, const uint32_t, const uint32_t k, const uint32_t dim, double uv[2]) const {
+        /* every dimension pair and axis reads the mask at its own offset */
+        const uint32_t h = hash_u32(_seed, dim);
+        const double su = _mask.at(x + int(h & 63), y + int(h >> 6 & 63));
+        const double sv = _mask.at(x + int(h >> 12 & 63) + BLUE_NOISE_SIZE / 2, y + int(h >> 18 & 63) + BLUE_NOISE_SIZE / 2);
+        const uint32_t index = owen_scramble(k, _seed ^ dim);
+        uv[0] = wrap(to_unit(sobol_u32(index, 0)) + su);
+        uv[1] = wrap(to_unit(sobol_u32(index, 1)) + sv);
+    }
+private:
+    static inline double wrap(const double u) { return u >= 1.0 ? u - 1.0 : u; }
+
+    const BlueNoiseMask& _mask;
+    uint32_t _seed;
+};
+
+// Sampler names accepted by make_sampler
+#define SAMPLER_NAMES "random|stratified|sobol|bluenoise"
+
+/* sampler by name, spp is the budget stratified splits the pixel into.
+ * nullptr for an unknown name
+ */
+inline Sampler *make_sampler(const char *name, const uint64_t seed, const int spp) {
+    if (0 == strcmp(name, "random")) {
+        return new RandomSampler(seed);
+    } else if (0 == strcmp(name, "stratified")) {
+        return new StratifiedSampler(seed, spp);
+    } else if (0 == strcmp(name, "sobol")) {
+        return new SobolSampler(seed);
+    } else if (0 == strcmp(name, "bluenoise")) {
+        return new BlueNoiseSampler(seed);
+    }
+    return nullptr;
+}
+#endif
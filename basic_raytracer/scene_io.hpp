@@ -0,0 +1,519 @@
+#ifndef _SCENE_IO_HPP_
+#define _SCENE_IO_HPP_
+
+#include "geometry.hpp"
+#include "instance.hpp"
+#include "mesh_io.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* scene description: render settings, camera, a material table, lights and
+ * spheres. spheres refer to materials by index into the table.
+ *
+ * text form, one record per line, '#' starts a comment:
+ *
+ *   resolution W H
+ *   spp N
+ *   camera EX EY EZ  TX TY TZ  RX RY RZ  DX DY DZ
+ *       eye, top left corner of the canvas, canvas right and down edges
+ *   material KD_R KD_G KD_B  KS_R KS_G KS_B  SPECULAR_FACTOR  TRANSPARENT  REFRACT_IDX
+ *   light OX OY OZ  R G B  ENERGY
+ *   sphere CX CY CZ  RADIUS  MATERIAL
+ *   mesh PATH  MATERIAL
+ *       triangles from an .obj or .ply file, relative paths start at the
+ *       directory of the scene file
+ *   geometry PATH  MATERIAL
+ *       a mesh that is only placed by instances
+ *   instance MESH  M00 M01 M02 M03  M10 M11 M12 M13  M20 M21 M22 M23  [MATERIAL]
+ *       the MESH-th mesh or geometry record, counted from 0, moved to world
+ *       by the affine map M (rows, translation last). the material, when
+ *       given, replaces the mesh's
+ *   key sphere INDEX TIME  CX CY CZ  RADIUS
+ *       the INDEX-th sphere at TIME. between keys centre and radius are
+ *       interpolated linearly, before the first and after the last they
+ *       hold
+ *   key instance INDEX TIME  TX TY TZ  AX AY AZ  ANGLE  SCALE
+ *       motion of the INDEX-th instance at TIME on top of its placement:
+ *       scaled by SCALE and turned by ANGLE degrees around the axis A
+ *       through the point its object origin is placed at, then moved by
+ *       T. every value is interpolated linearly, the axis renormalised
+ *
+ * binary form is a SceneHeader followed by the material, light and sphere
+ * arrays at 8 byte aligned offsets, in host byte order. the sphere array
+ * has the in memory layout of Sphere, so a mapped file is used in place.
+ * meshes live in their own files and only text scenes refer to them or
+ * instance them, the same goes for keys
+ */
+
+struct RenderSettings {
+    uint32_t width;
+    uint32_t height;
+    uint32_t spp;
+    uint32_t reserved;
+};
+
+struct CameraRecord {
+    double eye[3];
+    double topleft[3];
+    double right[3]; /* canvas edge from the left to the right border */
+    double down[3];  /* canvas edge from the top to the bottom border */
+};
+
+struct MaterialRecord {
+    double kdiffuse[3];
+    double kspecular[3];
+    double specular_factor;
+    double refract_idx;
+    uint32_t transparent;
+    uint32_t reserved;
+};
+
+struct LightRecord {
+    double origin[3];
+    double illumination[3];
+    double energy;
+};
+
+constexpr char SCENE_MAGIC[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '1' };
+
+struct SceneHeader {
+    char magic[8];
+    uint64_t file_bytes;
+    RenderSettings settings;
+    CameraRecord camera;
+    uint64_t material_offset, material_count;
+    uint64_t light_offset, light_count;
+    uint64_t sphere_offset, sphere_count;
+};
+
+static_assert(std::is_standard_layout<Sphere>::value, "spheres are mapped from scene files");
+static_assert(sizeof(Sphere) == 5 * sizeof(double), "sphere record is centre, radius, material, pad");
+static_assert(sizeof(MaterialRecord) % 8 == 0 && sizeof(LightRecord) % 8 == 0, "records keep 8 byte alignment");
+
+inline Material to_material(const MaterialRecord& m) {
+    return Material(vec3(m.kdiffuse[0], m.kdiffuse[1], m.kdiffuse[2]),
+                    vec3(m.kspecular[0], m.kspecular[1], m.kspecular[2]),
+                    m.specular_factor, m.transparent != 0, m.refract_idx);
+}
+
+/* a mesh record and the triangles loaded from it */
+struct MeshRecord {
+    std::string path; /* as written in the scene */
+    uint32_t material;
+    bool placed;      /* false for geometry records */
+    MeshData data;
+};
+
+/* material is INSTANCE_GEOMETRY_MATERIAL when the mesh's is kept */
+struct InstanceRecord {
+    uint32_t mesh;
+    uint32_t material;
+    double to_world[3][4];
+};
+
+enum KeyKind : uint32_t {
+    KEY_SPHERE,
+    KEY_INSTANCE,
+};
+
+/* one key of an animated sphere or instance, the values in the order of
+ * the text record
+ */
+struct KeyRecord {
+    KeyKind kind;
+    uint32_t index;
+    double time;
+    double value[8];
+};
+
+inline int key_values(const KeyKind kind) { return kind == KEY_SPHERE ? 4 : 8; }
+
+/* a loaded scene. binary files are mapped copy on write and the arrays
+ * point into the mapping, text files are parsed into owned vectors
+ */
+class SceneDesc {
+public:
+    SceneDesc() {}
+    SceneDesc(const SceneDesc&) = delete;
+    ~SceneDesc() { unmap(); }
+
+    RenderSettings settings = { 0, 0, 0, 0 };
+    CameraRecord camera = {};
+
+    inline size_t material_count() const { return _material_count; }
+    inline size_t light_count() const { return _light_count; }
+    inline size_t sphere_count() const { return _sphere_count; }
+    inline const MaterialRecord *materials() const { return _materials; }
+    inline const LightRecord *lights() const { return _lights; }
+    inline Sphere *spheres() const { return _spheres; }
+    inline const std::vector<MeshRecord>& meshes() const { return _meshes; }
+    inline const std::vector<InstanceRecord>& instances() const { return _instances; }
+    inline const std::vector<KeyRecord>& keys() const { return _keys; }
+    inline bool mapped() const { return _map != nullptr; }
+
+    void add_material(const MaterialRecord& m) { _own_materials.push_back(m); own(); }
+    void add_light(const LightRecord& l) { _own_lights.push_back(l); own(); }
+    void add_sphere(const Sphere& s) { _own_spheres.push_back(s); own(); }
+    void add_mesh(MeshRecord&& m) { _meshes.push_back(std::move(m)); }
+    void add_instance(const InstanceRecord& i) { _instances.push_back(i); }
+    void add_key(const KeyRecord& k) { _keys.push_back(k); }
+
+    /* text or binary, told apart by the magic */
+    bool load(const char *path, std::string& err);
+    bool save_text(const char *path, std::string& err) const;
+    bool save_binary(const char *path, std::string& err) const;
+    /* settings in range and every sphere has a material, load runs it */
+    bool validate(std::string& err) const;
+private:
+    bool load_text(const char *path, std::string& err);
+    bool load_binary(const char *path, std::string& err);
+    void unmap() {
+        if (_map) {
+            munmap(_map, _map_bytes);
+            _map = nullptr;
+        }
+    }
+    void own() {
+        _materials = _own_materials.data();
+        _material_count = _own_materials.size();
+        _lights = _own_lights.data();
+        _light_count = _own_lights.size();
+        _spheres = _own_spheres.data();
+        _sphere_count = _own_spheres.size();
+    }
+
+    const MaterialRecord *_materials = nullptr;
+    const LightRecord *_lights = nullptr;
+    Sphere *_spheres = nullptr;
+    size_t _material_count = 0;
+    size_t _light_count = 0;
+    size_t _sphere_count = 0;
+
+    std::vector<MaterialRecord> _own_materials;
+    std::vector<LightRecord> _own_lights;
+    std::vector<Sphere> _own_spheres;
+    std::vector<MeshRecord> _meshes;
+    std::vector<InstanceRecord> _instances;
+    std::vector<KeyRecord> _keys;
+
+    void *_map = nullptr;
+    size_t _map_bytes = 0;
+};
+
+inline bool SceneDesc::load(const char *path, std::string& err) {
+    char magic[sizeof(SCENE_MAGIC)] = {};
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        err = std::string("cannot open ") + path;
+        return false;
+    }
+    const size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    if (n == sizeof(magic) && 0 == memcmp(magic, SCENE_MAGIC, sizeof(magic))) {
+        return load_binary(path, err);
+    }
+    return load_text(path, err);
+}
+
+inline bool SceneDesc::load_text(const char *path, std::string& err) {
+    std::ifstream in(path);
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line)) {
+        lineno++;
+        const size_t hash = line.find('#');
+        if (hash != std::string::npos) {
+            line.resize(hash);
+        }
+        std::istringstream ls(line);
+        std::string key;
+        if (!(ls >> key)) {
+            continue;
+        }
+        bool ok = true;
+        if (key == "resolution") {
+            ok = bool(ls >> settings.width >> settings.height);
+        } else if (key == "spp") {
+            ok = bool(ls >> settings.spp);
+        } else if (key == "camera") {
+            for (double *v : { camera.eye, camera.topleft, camera.right, camera.down }) {
+                ok = ok && bool(ls >> v[0] >> v[1] >> v[2]);
+            }
+        } else if (key == "material") {
+            MaterialRecord m = {};
+            ok = bool(ls >> m.kdiffuse[0] >> m.kdiffuse[1] >> m.kdiffuse[2]
+                         >> m.kspecular[0] >> m.kspecular[1] >> m.kspecular[2]
+                         >> m.specular_factor >> m.transparent >> m.refract_idx);
+            _own_materials.push_back(m);
+        } else if (key == "light") {
+            LightRecord l = {};
+            ok = bool(ls >> l.origin[0] >> l.origin[1] >> l.origin[2]
+                         >> l.illumination[0] >> l.illumination[1] >> l.illumination[2] >> l.energy);
+            _own_lights.push_back(l);
+        } else if (key == "sphere") {
+            double c[3], r;
+            uint32_t m;
+            ok = bool(ls >> c[0] >> c[1] >> c[2] >> r >> m);
+            _own_spheres.push_back(Sphere(vec3(c[0], c[1], c[2]), r, m));
+        } else if (key == "mesh" || key == "geometry") {
+            MeshRecord m;
+            m.placed = key == "mesh";
+            ok = bool(ls >> m.path >> m.material);
+            if (ok) {
+                const char *slash = strrchr(path, '/');
+                const std::string file = m.path[0] == '/' || !slash ? m.path : std::string(path, slash + 1) + m.path;
+                if (!load_mesh(file.c_str(), m.data, err)) {
+                    err = std::string(path) + ":" + std::to_string(lineno) + ": " + err;
+                    return false;
+                }
+                _meshes.push_back(std::move(m));
+            }
+        } else if (key == "instance") {
+            InstanceRecord r = {};
+            ok = bool(ls >> r.mesh);
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 4; j++) {
+                    ok = ok && bool(ls >> r.to_world[i][j]);
+                }
+            }
+            /* optional trailing material */
+            std::string material;
+            r.material = INSTANCE_GEOMETRY_MATERIAL;
+            if (ok && (ls >> material)) {
+                char *end;
+                r.material = uint32_t(strtoul(material.c_str(), &end, 10));
+                ok = *end == '\0' && r.material != INSTANCE_GEOMETRY_MATERIAL;
+            }
+            _instances.push_back(r);
+        } else if (key == "key") {
+            KeyRecord k = {};
+            std::string kind;
+            ok = bool(ls >> kind >> k.index >> k.time) && (kind == "sphere" || kind == "instance");
+            k.kind = kind == "sphere" ? KEY_SPHERE : KEY_INSTANCE;
+            for (int i = 0; ok && i < key_values(k.kind); i++) {
+                ok = bool(ls >> k.value[i]);
+            }
+            _keys.push_back(k);
+        } else {
+            ok = false;
+        }
+        std::string rest;
+        if (!ok || (ls >> rest)) {
+            err = std::string(path) + ":" + std::to_string(lineno) + ": bad " + key + " record";
+            return false;
+        }
+    }
+    if (in.bad() || lineno == 0) {
+        err = std::string("cannot read ") + path;
+        return false;
+    }
+    own();
+    return validate(err);
+}
+
+inline bool SceneDesc::load_binary(const char *path, std::string& err) {
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        err = std::string("cannot open ") + path;
+        return false;
+    }
+    _map_bytes = st.st_size;
+    /* private writable mapping: pages are shared with the page cache until
+     * something writes them, which the renderer does not
+     */
+    void *map = _map_bytes >= sizeof(SceneHeader) ? mmap(nullptr, _map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        err = std::string("cannot map ") + path;
+        return false;
+    }
+    _map = map;
+
+    const char *base = static_cast<const char *>(_map);
+    const SceneHeader *h = reinterpret_cast<const SceneHeader *>(base);
+    /* every array has to lie inside the file and keep its alignment */
+    auto fits = [&](const uint64_t offset, const uint64_t count, const size_t size) {
+        return offset % 8 == 0 && offset <= _map_bytes && count <= (_map_bytes - offset) / size;
+    };
+    if (h->file_bytes != _map_bytes ||
+        !fits(h->material_offset, h->material_count, sizeof(MaterialRecord)) ||
+        !fits(h->light_offset, h->light_count, sizeof(LightRecord)) ||
+        !fits(h->sphere_offset, h->sphere_count, sizeof(Sphere))) {
+        err = std::string(path) + ": corrupt scene header";
+        unmap();
+        return false;
+    }
+    settings = h->settings;
+    camera = h->camera;
+    _materials = reinterpret_cast<const MaterialRecord *>(base + h->material_offset);
+    _material_count = h->material_count;
+    _lights = reinterpret_cast<const LightRecord *>(base + h->light_offset);
+    _light_count = h->light_count;
+    _spheres = reinterpret_cast<Sphere *>(static_cast<char *>(_map) + h->sphere_offset);
+    _sphere_count = h->sphere_count;
+    return validate(err);
+}
+
+inline bool SceneDesc::validate(std::string& err) const {
+    if (settings.width == 0 || settings.height == 0 || settings.spp == 0) {
+        err = "scene needs a resolution and spp";
+        return false;
+    }
+    for (size_t i = 0; i < _sphere_count; i++) {
+        if (_spheres[i].material() >= _material_count || !(_spheres[i].radius() > 0.0)) {
+            err = "sphere " + std::to_string(i) + ": bad material index or radius";
+            return false;
+        }
+    }
+    for (const MeshRecord& m : _meshes) {
+        if (m.material >= _material_count) {
+            err = "mesh " + m.path + ": bad material index";
+            return false;
+        }
+    }
+    for (size_t i = 0; i < _instances.size(); i++) {
+        const InstanceRecord& r = _instances[i];
+        double inv[3][4];
+        if (r.mesh >= _meshes.size() || (r.material != INSTANCE_GEOMETRY_MATERIAL && r.material >= _material_count) ||
+            !invert_affine(r.to_world, inv)) {
+            err = "instance " + std::to_string(i) + ": bad mesh or material index or singular transform";
+            return false;
+        }
+    }
+    for (const KeyRecord& k : _keys) {
+        const bool sphere = k.kind == KEY_SPHERE;
+        const double axis = k.value[3] * k.value[3] + k.value[4] * k.value[4] + k.value[5] * k.value[5];
+        if (k.index >= (sphere ? _sphere_count : _instances.size()) || !std::isfinite(k.time) ||
+            (sphere ? !(k.value[3] > 0.0) : !(axis > 0.0) || !(k.value[7] > 0.0))) {
+            err = std::string(sphere ? "sphere" : "instance") + " key " + std::to_string(k.index) +
+                  ": bad index, time, radius, axis or scale";
+            return false;
+        }
+    }
+    return true;
+}
+
+/* shortest of 15 or 17 digits that reads back to the same double, so
+ * hand written values stay as written
+ */
+inline std::string scene_number(const double d) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.15g", d);
+    if (strtod(buf, nullptr) != d) {
+        snprintf(buf, sizeof(buf), "%.17g", d);
+    }
+    return buf;
+}
+
+inline void write_numbers(std::ostream& out, const double *v, const int n) {
+    for (int i = 0; i < n; i++) {
+        out << " " << scene_number(v[i]);
+    }
+}
+
+inline bool SceneDesc::save_text(const char *path, std::string& err) const {
+    std::ofstream out(path);
+    out << "resolution " << settings.width << " " << settings.height << "\n"
+        << "spp " << settings.spp << "\n"
+        << "camera";
+    for (const double *v : { camera.eye, camera.topleft, camera.right, camera.down }) {
+        out << " ";
+        write_numbers(out, v, 3);
+    }
+    out << "\n";
+    for (size_t i = 0; i < _material_count; i++) {
+        const MaterialRecord& m = _materials[i];
+        out << "material";
+        write_numbers(out, m.kdiffuse, 3);
+        out << " ";
+        write_numbers(out, m.kspecular, 3);
+        out << "  " << scene_number(m.specular_factor) << " " << m.transparent << " " << scene_number(m.refract_idx) << "\n";
+    }
+    for (size_t i = 0; i < _light_count; i++) {
+        const LightRecord& l = _lights[i];
+        out << "light";
+        write_numbers(out, l.origin, 3);
+        out << " ";
+        write_numbers(out, l.illumination, 3);
+        out << "  " << scene_number(l.energy) << "\n";
+    }
+    for (size_t i = 0; i < _sphere_count; i++) {
+        const Sphere& s = _spheres[i];
+        const double c[3] = { s.origin().x(), s.origin().y(), s.origin().z() };
+        out << "sphere";
+        write_numbers(out, c, 3);
+        out << "  " << scene_number(s.radius()) << " " << s.material() << "\n";
+    }
+    for (const MeshRecord& m : _meshes) {
+        out << (m.placed ? "mesh " : "geometry ") << m.path << "  " << m.material << "\n";
+    }
+    for (const InstanceRecord& r : _instances) {
+        out << "instance " << r.mesh;
+        for (int i = 0; i < 3; i++) {
+            out << " ";
+            write_numbers(out, r.to_world[i], 4);
+        }
+        if (r.material != INSTANCE_GEOMETRY_MATERIAL) {
+            out << "  " << r.material;
+        }
+        out << "\n";
+    }
+    for (const KeyRecord& k : _keys) {
+        out << "key " << (k.kind == KEY_SPHERE ? "sphere " : "instance ") << k.index << " " << scene_number(k.time) << " ";
+        write_numbers(out, k.value, key_values(k.kind));
+        out << "\n";
+    }
+    if (!out.good()) {
+        err = std::string("cannot write ") + path;
+        return false;
+    }
+    return true;
+}
+
+inline bool SceneDesc::save_binary(const char *path, std::string& err) const {
+    if (!_meshes.empty() || !_keys.empty()) {
+        err = "meshes and keys are only kept in text scenes";
+        return false;
+    }
+    SceneHeader h = {};
+    memcpy(h.magic, SCENE_MAGIC, sizeof(SCENE_MAGIC));
+    h.settings = settings;
+    h.camera = camera;
+    h.material_offset = sizeof(SceneHeader);
+    h.material_count = _material_count;
+    h.light_offset = h.material_offset + _material_count * sizeof(MaterialRecord);
+    h.light_count = _light_count;
+    h.sphere_offset = h.light_offset + _light_count * sizeof(LightRecord);
+    h.sphere_count = _sphere_count;
+    h.file_bytes = h.sphere_offset + _sphere_count * sizeof(Sphere);
+
+    FILE *f = fopen(path, "wb");
+    bool ok = f &&
+        fwrite(&h, sizeof(h), 1, f) == 1 &&
+        fwrite(_materials, sizeof(MaterialRecord), _material_count, f) == _material_count &&
+        fwrite(_lights, sizeof(LightRecord), _light_count, f) == _light_count &&
+        fwrite(_spheres, sizeof(Sphere), _sphere_count, f) == _sphere_count;
+    ok = f && 0 == fclose(f) && ok;
+    if (!ok) {
+        err = std::string("cannot write ") + path;
+    }
+    return ok;
+}
+#endif
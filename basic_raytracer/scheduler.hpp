@@ -0,0 +1,224 @@
+#ifndef _SCHEDULER_HPP_
+#define _SCHEDULER_HPP_
+
+#include "stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Tile {
+    int x0, y0; /* inclusive */
+    int x1, y1; /* exclusive */
+};
+
+/* split the canvas into tile_size x tile_size blocks in scanline order,
+ * the right and bottom borders get the remainder
+ */
+inline std::vector<Tile> split_tiles(int w, int h, int tile_size) {
+    std::vector<Tile> tiles;
+    for (int y = 0; y < h; y += tile_size) {
+        for (int x = 0; x < w; x += tile_size) {
+            Tile t;
+            t.x0 = x;
+            t.y0 = y;
+            t.x1 = std::min(x + tile_size, w);
+            t.y1 = std::min(y + tile_size, h);
+            tiles.push_back(t);
+        }
+    }
+    return tiles;
+}
+
+typedef std::function<void(const Tile&, unsigned)> TileFunc;
+
+/* run one tile job on worker thread, its wall time goes to the thread's
+ * stats
+ */
+inline void run_tile(const TileFunc& fn, const Tile& t, const unsigned thread) {
+#if TRACE_STATS
+    auto start = std::chrono::steady_clock::now();
+    fn(t, thread);
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    thread_stats().tiles.push_back(TileTime { t.x0, t.y0, t.x1, t.y1, thread, sec });
+#else
+    fn(t, thread);
+#endif
+}
+
+/* persistent pool of render threads, each owning a deque of tile indices.
+ * a worker pops from the front of its own deque and, once that is empty,
+ * steals from the back of the others', so expensive regions (glass spheres)
+ * are spread over whoever runs out of work first
+ */
+class TileScheduler {
+public:
+    ~TileScheduler() {
+        {
+            std::lock_guard<std::mutex> lk(_lock);
+            _quit = true;
+        }
+        _wake.notify_all();
+        for (auto& t : _workers) {
+            t.join();
+        }
+        for (auto q : _queues) {
+            delete q;
+        }
+    }
+    TileScheduler() = delete;
+    TileScheduler(const TileScheduler&) = delete;
+    explicit TileScheduler(unsigned nthreads) :
+        _executed(std::max(1u, nthreads), 0),
+        _stolen(std::max(1u, nthreads), 0) {
+        nthreads = std::max(1u, nthreads);
+        for (unsigned i = 0; i < nthreads; i++) {
+            _queues.push_back(new WorkQueue);
+        }
+        for (unsigned i = 0; i < nthreads; i++) {
+            _workers.push_back(std::thread(&TileScheduler::worker, this, i));
+        }
+    }
+
+    inline unsigned threads() const { return _queues.size(); }
+    inline const std::vector<uint64_t>& executed() const { return _executed; }
+    inline const std::vector<uint64_t>& stolen() const { return _stolen; }
+
+    /* execute fn on every tile and block until all of them are done,
+     * progress is reported on stdout by the calling thread
+     */
+    void run(const std::vector<Tile>& tiles, const TileFunc& fn);
+
+    friend std::ostream & operator<<(std::ostream &os, const TileScheduler& s) {
+        uint64_t total = 0;
+        for (auto n : s.executed()) {
+            total += n;
+        }
+        for (unsigned i = 0; i < s.threads(); i++) {
+            os << "thread " << std::setw(3) << i << ": "
+               << std::setw(6) << s.executed()[i] << " tiles ("
+               << std::setw(6) << s.stolen()[i] << " stolen) "
+               << std::fixed << std::setprecision(2)
+               << (total ? s.executed()[i] * 100.0 / total : 0.0) << "%\n";
+        }
+        return os;
+    }
+private:
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<int> tiles;
+    };
+
+    bool pop(unsigned self, int& tile) {
+        WorkQueue *q = _queues[self];
+        std::lock_guard<std::mutex> lk(q->lock);
+        if (q->tiles.empty()) {
+            return false;
+        }
+        tile = q->tiles.front();
+        q->tiles.pop_front();
+        return true;
+    }
+
+    bool steal(unsigned self, int& tile) {
+        for (unsigned i = 1; i < _queues.size(); i++) {
+            WorkQueue *q = _queues[(self + i) % _queues.size()];
+            std::lock_guard<std::mutex> lk(q->lock);
+            if (!q->tiles.empty()) {
+                tile = q->tiles.back();
+                q->tiles.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker(unsigned self);
+
+    std::vector<std::thread> _workers;
+    std::vector<WorkQueue *> _queues;
+    std::vector<uint64_t> _executed; /* written by owner thread only */
+    std::vector<uint64_t> _stolen;
+
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    uint64_t _generation = 0;
+    unsigned _active = 0;
+    bool _quit = false;
+    const std::vector<Tile> *_tiles = nullptr;
+    const TileFunc *_job = nullptr;
+    std::atomic<size_t> _finished {0};
+};
+
+inline void TileScheduler::run(const std::vector<Tile>& tiles, const TileFunc& fn) {
+    /* deal contiguous runs of tiles to each worker, stealing takes care of
+     * the imbalance between cheap and expensive runs
+     */
+    const size_t n = _queues.size();
+    for (size_t i = 0; i < n; i++) {
+        std::lock_guard<std::mutex> lk(_queues[i]->lock);
+        size_t begin = tiles.size() * i / n;
+        size_t end = tiles.size() * (i + 1) / n;
+        for (size_t t = begin; t < end; t++) {
+            _queues[i]->tiles.push_back(int(t));
+        }
+    }
+
+    std::unique_lock<std::mutex> lk(_lock);
+    _tiles = &tiles;
+    _job = &fn;
+    _finished = 0;
+    _active = n;
+    _generation++;
+    _wake.notify_all();
+
+    while (!_done.wait_for(lk, std::chrono::milliseconds(100), [this]{ return _active == 0; })) {
+        std::cout << "Ray Trace Processing: " << std::fixed << std::setprecision(2)
+                  << _finished * 100.0 / tiles.size() << "%\r" << std::flush;
+    }
+    _tiles = nullptr;
+    _job = nullptr;
+}
+
+inline void TileScheduler::worker(unsigned self) {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lk(_lock);
+            _wake.wait(lk, [&]{ return _quit || _generation != seen; });
+            if (_quit) {
+                return;
+            }
+            seen = _generation;
+        }
+
+        int t = -1;
+        for (;;) {
+            bool own = pop(self, t);
+            if (!own && !steal(self, t)) {
+                break;
+            }
+            if (!own) {
+                _stolen[self]++;
+            }
+            run_tile(*_job, (*_tiles)[t], self);
+            _executed[self]++;
+            _finished++;
+        }
+
+        std::lock_guard<std::mutex> lk(_lock);
+        if (--_active == 0) {
+            _done.notify_all();
+        }
+    }
+}
+#endif
@@ -0,0 +1,541 @@
+#ifndef _SIMD_SPHERE_HPP_
+#define _SIMD_SPHERE_HPP_
+
+#include "bvh.hpp"
+#include <immintrin.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/* structure of arrays sphere storage with one ray x N spheres and
+ * 8 rays x one sphere kernels. the AVX2 and AVX-512 kernels are compiled
+ * with per function target attributes and picked at run time from CPUID,
+ * so the binary still runs on machines without them
+ */
+
+/* the vector kernels evaluate the same expressions lane wise. products must
+ * not be fused into FMAs, else they drift an ulp from the scalar path and
+ * the glass spheres amplify that into visibly different pixels
+ */
+#if defined(__clang__)
+#define SIMD_AVX2_KERNEL __attribute__((target("avx2")))
+#define SIMD_AVX512_KERNEL __attribute__((target("avx512f")))
+#else
+#define SIMD_AVX2_KERNEL __attribute__((target("avx2"), optimize("fp-contract=off")))
+#define SIMD_AVX512_KERNEL __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#endif
+
+enum SimdIsa {
+    SIMD_SCALAR = 0,
+    SIMD_AVX2,
+    SIMD_AVX512,
+};
+
+inline const char *isa_name(const SimdIsa isa) {
+    switch (isa) {
+        case SIMD_AVX2:
+            return "avx2";
+        case SIMD_AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
+
+inline bool isa_supported(const SimdIsa isa) {
+    __builtin_cpu_init();
+    switch (isa) {
+        case SIMD_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case SIMD_AVX512:
+            return __builtin_cpu_supports("avx512f");
+        default:
+            return true;
+    }
+}
+
+inline SimdIsa detect_isa() {
+    if (isa_supported(SIMD_AVX512)) {
+        return SIMD_AVX512;
+    }
+    if (isa_supported(SIMD_AVX2)) {
+        return SIMD_AVX2;
+    }
+    return SIMD_SCALAR;
+}
+
+/* arrays are padded to a multiple of SOA_WIDTH with spheres of negative
+ * squared radius, which no ray can hit, so kernels never need a tail loop
+ */
+constexpr size_t SOA_WIDTH = 8;
+
+class SphereSoA {
+public:
+    ~SphereSoA() {}
+    SphereSoA() = delete;
+    SphereSoA(const SphereSoA&) = delete;
+    explicit SphereSoA(const std::vector<Sphere *>& objects) : _count(objects.size()), _objects(objects) {
+        const size_t padded = (_count + SOA_WIDTH - 1) / SOA_WIDTH * SOA_WIDTH;
+        _cx.assign(padded, 0.0);
+        _cy.assign(padded, 0.0);
+        _cz.assign(padded, 0.0);
+        _r2.assign(padded, -1.0);
+        _mat.assign(padded, 0);
+
+        for (size_t i = 0; i < _count; i++) {
+            const vec3 o = objects[i]->origin();
+            _cx[i] = o.x();
+            _cy[i] = o.y();
+            _cz[i] = o.z();
+            _r2[i] = objects[i]->radius() * objects[i]->radius();
+            _mat[i] = objects[i]->material();
+        }
+    }
+
+    inline size_t size() const { return _count; }
+    inline size_t padded() const { return _cx.size(); }
+    inline const double *cx() const { return _cx.data(); }
+    inline const double *cy() const { return _cy.data(); }
+    inline const double *cz() const { return _cz.data(); }
+    inline const double *r2() const { return _r2.data(); }
+    inline const uint32_t *mat() const { return _mat.data(); }
+    inline const Sphere *object(const size_t i) const { return _objects[i]; }
+private:
+    size_t _count;
+    std::vector<double> _cx, _cy, _cz, _r2;
+    std::vector<uint32_t> _mat;
+    std::vector<Sphere *> _objects;
+};
+
+/* 8 rays in SoA form, t holds the current nearest distance on input and
+ * hit the sphere index (-1 for none) on output
+ */
+struct RayPacket8 {
+    double ox[8], oy[8], oz[8];
+    double dx[8], dy[8], dz[8];
+    double t[8];
+    int32_t hit[8];
+    bool inside[8];
+};
+
+/* nearest sphere under the Hit rules (exit point when the origin is inside,
+ * entry point otherwise, nothing behind the origin), t is the limit on input
+ */
+typedef int (*NearestKernel)(const SphereSoA& s, const double o[3], const double d[3], double& t, bool& inside);
+/* any sphere in (0, tmax), tests reports how many spheres were looked at */
+typedef bool (*OccludedKernel)(const SphereSoA& s, const double o[3], const double d[3], const double tmax, uint64_t& tests);
+/* closest hit of 8 rays against sphere i */
+typedef void (*PacketKernel)(const SphereSoA& s, const size_t i, RayPacket8& p);
+
+struct SphereKernels {
+    SimdIsa isa;
+    NearestKernel nearest;
+    OccludedKernel occluded;
+    PacketKernel packet;
+};
+
+static int nearest_scalar(const SphereSoA& s, const double o[3], const double d[3], double& t, bool& inside) {
+    const double a = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+    int best = -1;
+    for (size_t i = 0; i < s.size(); i++) {
+        const double ocx = o[0] - s.cx()[i];
+        const double ocy = o[1] - s.cy()[i];
+        const double ocz = o[2] - s.cz()[i];
+        const double hb = ocx*d[0] + ocy*d[1] + ocz*d[2];
+        const double c = ocx*ocx + ocy*ocy + ocz*ocz - s.r2()[i];
+        const double delta = hb*hb - a*c;
+        if (delta < 0.0) {
+            continue;
+        }
+        const double sq = sqrt(delta);
+        const bool in = c < 0.0;
+        const double tt = (in ? (-hb + sq) : (-hb - sq)) / a;
+        if (tt >= 0.0 && tt < t) {
+            t = tt;
+            inside = in;
+            best = int(i);
+        }
+    }
+    return best;
+}
+
+static bool occluded_scalar(const SphereSoA& s, const double o[3], const double d[3], const double tmax, uint64_t& tests) {
+    const double a = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+    for (size_t i = 0; i < s.size(); i++) {
+        const double ocx = o[0] - s.cx()[i];
+        const double ocy = o[1] - s.cy()[i];
+        const double ocz = o[2] - s.cz()[i];
+        const double hb = ocx*d[0] + ocy*d[1] + ocz*d[2];
+        const double c = ocx*ocx + ocy*ocy + ocz*ocz - s.r2()[i];
+        if (c >= 0.0 && hb >= 0.0) {
+            continue;
+        }
+        const double delta = hb*hb - a*c;
+        if (delta < 0.0) {
+            continue;
+        }
+        const double sq = sqrt(delta);
+        if (((c < 0.0) ? (-hb + sq) : (-hb - sq)) < tmax * a) {
+            tests += i + 1;
+            return true;
+        }
+    }
+    tests += s.size();
+    return false;
+}
+
+static void packet_scalar(const SphereSoA& s, const size_t i, RayPacket8& p) {
+    for (int k = 0; k < 8; k++) {
+        const double ocx = p.ox[k] - s.cx()[i];
+        const double ocy = p.oy[k] - s.cy()[i];
+        const double ocz = p.oz[k] - s.cz()[i];
+        const double a = p.dx[k]*p.dx[k] + p.dy[k]*p.dy[k] + p.dz[k]*p.dz[k];
+        const double hb = ocx*p.dx[k] + ocy*p.dy[k] + ocz*p.dz[k];
+        const double c = ocx*ocx + ocy*ocy + ocz*ocz - s.r2()[i];
+        const double delta = hb*hb - a*c;
+        if (delta < 0.0) {
+            continue;
+        }
+        const double sq = sqrt(delta);
+        const bool in = c < 0.0;
+        const double tt = (in ? (-hb + sq) : (-hb - sq)) / a;
+        if (tt >= 0.0 && tt < p.t[k]) {
+            p.t[k] = tt;
+            p.hit[k] = int32_t(i);
+            p.inside[k] = in;
+        }
+    }
+}
+
+SIMD_AVX2_KERNEL
+static int nearest_avx2(const SphereSoA& s, const double o[3], const double d[3], double& t, bool& inside) {
+    const __m256d ox = _mm256_set1_pd(o[0]);
+    const __m256d oy = _mm256_set1_pd(o[1]);
+    const __m256d oz = _mm256_set1_pd(o[2]);
+    const __m256d dx = _mm256_set1_pd(d[0]);
+    const __m256d dy = _mm256_set1_pd(d[1]);
+    const __m256d dz = _mm256_set1_pd(d[2]);
+    const __m256d a = _mm256_set1_pd(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d four = _mm256_set1_pd(4.0);
+
+    __m256d best_t = _mm256_set1_pd(t);
+    __m256d best_i = _mm256_set1_pd(-1.0);
+    __m256d best_in = zero;
+    __m256d idx = _mm256_setr_pd(0.0, 1.0, 2.0, 3.0);
+
+    for (size_t i = 0; i < s.padded(); i += 4) {
+        const __m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(s.cx() + i));
+        const __m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(s.cy() + i));
+        const __m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(s.cz() + i));
+        const __m256d hb = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+        const __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+        const __m256d c = _mm256_sub_pd(oc2, _mm256_loadu_pd(s.r2() + i));
+        const __m256d delta = _mm256_sub_pd(_mm256_mul_pd(hb, hb), _mm256_mul_pd(a, c));
+        const __m256d valid = _mm256_cmp_pd(delta, zero, _CMP_GE_OQ);
+        const __m256d sq = _mm256_sqrt_pd(_mm256_max_pd(delta, zero));
+        const __m256d in = _mm256_cmp_pd(c, zero, _CMP_LT_OQ);
+        const __m256d nhb = _mm256_sub_pd(zero, hb);
+        const __m256d num = _mm256_blendv_pd(_mm256_sub_pd(nhb, sq), _mm256_add_pd(nhb, sq), in);
+        const __m256d tt = _mm256_div_pd(num, a);
+        const __m256d accept = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(tt, zero, _CMP_GE_OQ), _mm256_cmp_pd(tt, best_t, _CMP_LT_OQ)));
+        best_t = _mm256_blendv_pd(best_t, tt, accept);
+        best_i = _mm256_blendv_pd(best_i, idx, accept);
+        best_in = _mm256_blendv_pd(best_in, in, accept);
+        idx = _mm256_add_pd(idx, four);
+    }
+
+    double lt[4], li[4], lin[4];
+    _mm256_storeu_pd(lt, best_t);
+    _mm256_storeu_pd(li, best_i);
+    _mm256_storeu_pd(lin, best_in);
+    int best = -1;
+    for (int k = 0; k < 4; k++) {
+        /* ties go to the lower index, as in the scalar loop */
+        if (li[k] >= 0.0 && (best < 0 || lt[k] < t || (lt[k] == t && int(li[k]) < best))) {
+            t = lt[k];
+            best = int(li[k]);
+            inside = lin[k] != 0.0;
+        }
+    }
+    return best;
+}
+
+SIMD_AVX2_KERNEL
+static bool occluded_avx2(const SphereSoA& s, const double o[3], const double d[3], const double tmax, uint64_t& tests) {
+    const __m256d ox = _mm256_set1_pd(o[0]);
+    const __m256d oy = _mm256_set1_pd(o[1]);
+    const __m256d oz = _mm256_set1_pd(o[2]);
+    const __m256d dx = _mm256_set1_pd(d[0]);
+    const __m256d dy = _mm256_set1_pd(d[1]);
+    const __m256d dz = _mm256_set1_pd(d[2]);
+    const double sa = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+    const __m256d a = _mm256_set1_pd(sa);
+    const __m256d limit = _mm256_set1_pd(tmax * sa);
+    const __m256d zero = _mm256_setzero_pd();
+
+    for (size_t i = 0; i < s.padded(); i += 4) {
+        const __m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(s.cx() + i));
+        const __m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(s.cy() + i));
+        const __m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(s.cz() + i));
+        const __m256d hb = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+        const __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+        const __m256d c = _mm256_sub_pd(oc2, _mm256_loadu_pd(s.r2() + i));
+        const __m256d delta = _mm256_sub_pd(_mm256_mul_pd(hb, hb), _mm256_mul_pd(a, c));
+        const __m256d sq = _mm256_sqrt_pd(_mm256_max_pd(delta, zero));
+        const __m256d in = _mm256_cmp_pd(c, zero, _CMP_LT_OQ);
+        const __m256d nhb = _mm256_sub_pd(zero, hb);
+        const __m256d num = _mm256_blendv_pd(_mm256_sub_pd(nhb, sq), _mm256_add_pd(nhb, sq), in);
+        /* behind: outside and moving away */
+        const __m256d behind = _mm256_and_pd(_mm256_cmp_pd(c, zero, _CMP_GE_OQ), _mm256_cmp_pd(hb, zero, _CMP_GE_OQ));
+        const __m256d block = _mm256_andnot_pd(behind, _mm256_and_pd(_mm256_cmp_pd(delta, zero, _CMP_GE_OQ), _mm256_cmp_pd(num, limit, _CMP_LT_OQ)));
+        const int mask = _mm256_movemask_pd(block);
+        if (mask) {
+            tests += i + __builtin_ctz(mask) + 1;
+            return true;
+        }
+    }
+    tests += s.size();
+    return false;
+}
+
+SIMD_AVX2_KERNEL
+static void packet_avx2(const SphereSoA& s, const size_t i, RayPacket8& p) {
+    const __m256d cx = _mm256_set1_pd(s.cx()[i]);
+    const __m256d cy = _mm256_set1_pd(s.cy()[i]);
+    const __m256d cz = _mm256_set1_pd(s.cz()[i]);
+    const __m256d r2 = _mm256_set1_pd(s.r2()[i]);
+    const __m256d zero = _mm256_setzero_pd();
+
+    for (int h = 0; h < 8; h += 4) {
+        const __m256d dx = _mm256_loadu_pd(p.dx + h);
+        const __m256d dy = _mm256_loadu_pd(p.dy + h);
+        const __m256d dz = _mm256_loadu_pd(p.dz + h);
+        const __m256d ocx = _mm256_sub_pd(_mm256_loadu_pd(p.ox + h), cx);
+        const __m256d ocy = _mm256_sub_pd(_mm256_loadu_pd(p.oy + h), cy);
+        const __m256d ocz = _mm256_sub_pd(_mm256_loadu_pd(p.oz + h), cz);
+        const __m256d a = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+        const __m256d hb = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+        const __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+        const __m256d c = _mm256_sub_pd(oc2, r2);
+        const __m256d delta = _mm256_sub_pd(_mm256_mul_pd(hb, hb), _mm256_mul_pd(a, c));
+        const __m256d valid = _mm256_cmp_pd(delta, zero, _CMP_GE_OQ);
+        const __m256d sq = _mm256_sqrt_pd(_mm256_max_pd(delta, zero));
+        const __m256d in = _mm256_cmp_pd(c, zero, _CMP_LT_OQ);
+        const __m256d nhb = _mm256_sub_pd(zero, hb);
+        const __m256d num = _mm256_blendv_pd(_mm256_sub_pd(nhb, sq), _mm256_add_pd(nhb, sq), in);
+        const __m256d tt = _mm256_div_pd(num, a);
+        const __m256d cur = _mm256_loadu_pd(p.t + h);
+        const __m256d accept = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(tt, zero, _CMP_GE_OQ), _mm256_cmp_pd(tt, cur, _CMP_LT_OQ)));
+        _mm256_storeu_pd(p.t + h, _mm256_blendv_pd(cur, tt, accept));
+        int mask = _mm256_movemask_pd(accept);
+        const int inmask = _mm256_movemask_pd(in);
+        while (mask) {
+            const int k = __builtin_ctz(mask);
+            p.hit[h + k] = int32_t(i);
+            p.inside[h + k] = (inmask >> k) & 1;
+            mask &= mask - 1;
+        }
+    }
+}
+
+SIMD_AVX512_KERNEL
+static int nearest_avx512(const SphereSoA& s, const double o[3], const double d[3], double& t, bool& inside) {
+    const __m512d ox = _mm512_set1_pd(o[0]);
+    const __m512d oy = _mm512_set1_pd(o[1]);
+    const __m512d oz = _mm512_set1_pd(o[2]);
+    const __m512d dx = _mm512_set1_pd(d[0]);
+    const __m512d dy = _mm512_set1_pd(d[1]);
+    const __m512d dz = _mm512_set1_pd(d[2]);
+    const __m512d a = _mm512_set1_pd(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d eight = _mm512_set1_pd(8.0);
+
+    __m512d best_t = _mm512_set1_pd(t);
+    __m512d best_i = _mm512_set1_pd(-1.0);
+    __mmask8 best_in = 0;
+    __m512d idx = _mm512_setr_pd(0.0, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0);
+
+    for (size_t i = 0; i < s.padded(); i += 8) {
+        const __m512d ocx = _mm512_sub_pd(ox, _mm512_loadu_pd(s.cx() + i));
+        const __m512d ocy = _mm512_sub_pd(oy, _mm512_loadu_pd(s.cy() + i));
+        const __m512d ocz = _mm512_sub_pd(oz, _mm512_loadu_pd(s.cz() + i));
+        const __m512d hb = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, dx), _mm512_mul_pd(ocy, dy)), _mm512_mul_pd(ocz, dz));
+        const __m512d oc2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz));
+        const __m512d c = _mm512_sub_pd(oc2, _mm512_loadu_pd(s.r2() + i));
+        const __m512d delta = _mm512_sub_pd(_mm512_mul_pd(hb, hb), _mm512_mul_pd(a, c));
+        const __mmask8 valid = _mm512_cmp_pd_mask(delta, zero, _CMP_GE_OQ);
+        const __m512d sq = _mm512_maskz_sqrt_pd(valid, delta);
+        const __mmask8 in = _mm512_cmp_pd_mask(c, zero, _CMP_LT_OQ);
+        const __m512d nhb = _mm512_sub_pd(zero, hb);
+        const __m512d num = _mm512_mask_blend_pd(in, _mm512_sub_pd(nhb, sq), _mm512_add_pd(nhb, sq));
+        const __m512d tt = _mm512_div_pd(num, a);
+        const __mmask8 accept = valid & _mm512_cmp_pd_mask(tt, zero, _CMP_GE_OQ) & _mm512_cmp_pd_mask(tt, best_t, _CMP_LT_OQ);
+        best_t = _mm512_mask_blend_pd(accept, best_t, tt);
+        best_i = _mm512_mask_blend_pd(accept, best_i, idx);
+        best_in = (best_in & ~accept) | (in & accept);
+        idx = _mm512_add_pd(idx, eight);
+    }
+
+    double lt[8], li[8];
+    _mm512_storeu_pd(lt, best_t);
+    _mm512_storeu_pd(li, best_i);
+    int best = -1;
+    for (int k = 0; k < 8; k++) {
+        if (li[k] >= 0.0 && (best < 0 || lt[k] < t || (lt[k] == t && int(li[k]) < best))) {
+            t = lt[k];
+            best = int(li[k]);
+            inside = (best_in >> k) & 1;
+        }
+    }
+    return best;
+}
+
+SIMD_AVX512_KERNEL
+static bool occluded_avx512(const SphereSoA& s, const double o[3], const double d[3], const double tmax, uint64_t& tests) {
+    const __m512d ox = _mm512_set1_pd(o[0]);
+    const __m512d oy = _mm512_set1_pd(o[1]);
+    const __m512d oz = _mm512_set1_pd(o[2]);
+    const __m512d dx = _mm512_set1_pd(d[0]);
+    const __m512d dy = _mm512_set1_pd(d[1]);
+    const __m512d dz = _mm512_set1_pd(d[2]);
+    const double sa = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+    const __m512d a = _mm512_set1_pd(sa);
+    const __m512d limit = _mm512_set1_pd(tmax * sa);
+    const __m512d zero = _mm512_setzero_pd();
+
+    for (size_t i = 0; i < s.padded(); i += 8) {
+        const __m512d ocx = _mm512_sub_pd(ox, _mm512_loadu_pd(s.cx() + i));
+        const __m512d ocy = _mm512_sub_pd(oy, _mm512_loadu_pd(s.cy() + i));
+        const __m512d ocz = _mm512_sub_pd(oz, _mm512_loadu_pd(s.cz() + i));
+        const __m512d hb = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, dx), _mm512_mul_pd(ocy, dy)), _mm512_mul_pd(ocz, dz));
+        const __m512d oc2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz));
+        const __m512d c = _mm512_sub_pd(oc2, _mm512_loadu_pd(s.r2() + i));
+        const __m512d delta = _mm512_sub_pd(_mm512_mul_pd(hb, hb), _mm512_mul_pd(a, c));
+        const __mmask8 valid = _mm512_cmp_pd_mask(delta, zero, _CMP_GE_OQ);
+        const __m512d sq = _mm512_maskz_sqrt_pd(valid, delta);
+        const __mmask8 in = _mm512_cmp_pd_mask(c, zero, _CMP_LT_OQ);
+        const __m512d nhb = _mm512_sub_pd(zero, hb);
+        const __m512d num = _mm512_mask_blend_pd(in, _mm512_sub_pd(nhb, sq), _mm512_add_pd(nhb, sq));
+        const __mmask8 behind = _mm512_cmp_pd_mask(c, zero, _CMP_GE_OQ) & _mm512_cmp_pd_mask(hb, zero, _CMP_GE_OQ);
+        const __mmask8 block = ~behind & valid & _mm512_cmp_pd_mask(num, limit, _CMP_LT_OQ);
+        if (block) {
+            tests += i + __builtin_ctz(block) + 1;
+            return true;
+        }
+    }
+    tests += s.size();
+    return false;
+}
+
+SIMD_AVX512_KERNEL
+static void packet_avx512(const SphereSoA& s, const size_t i, RayPacket8& p) {
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d dx = _mm512_loadu_pd(p.dx);
+    const __m512d dy = _mm512_loadu_pd(p.dy);
+    const __m512d dz = _mm512_loadu_pd(p.dz);
+    const __m512d ocx = _mm512_sub_pd(_mm512_loadu_pd(p.ox), _mm512_set1_pd(s.cx()[i]));
+    const __m512d ocy = _mm512_sub_pd(_mm512_loadu_pd(p.oy), _mm512_set1_pd(s.cy()[i]));
+    const __m512d ocz = _mm512_sub_pd(_mm512_loadu_pd(p.oz), _mm512_set1_pd(s.cz()[i]));
+    const __m512d a = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), _mm512_mul_pd(dz, dz));
+    const __m512d hb = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, dx), _mm512_mul_pd(ocy, dy)), _mm512_mul_pd(ocz, dz));
+    const __m512d oc2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz));
+    const __m512d c = _mm512_sub_pd(oc2, _mm512_set1_pd(s.r2()[i]));
+    const __m512d delta = _mm512_sub_pd(_mm512_mul_pd(hb, hb), _mm512_mul_pd(a, c));
+    const __mmask8 valid = _mm512_cmp_pd_mask(delta, zero, _CMP_GE_OQ);
+    const __m512d sq = _mm512_maskz_sqrt_pd(valid, delta);
+    const __mmask8 in = _mm512_cmp_pd_mask(c, zero, _CMP_LT_OQ);
+    const __m512d nhb = _mm512_sub_pd(zero, hb);
+    const __m512d num = _mm512_mask_blend_pd(in, _mm512_sub_pd(nhb, sq), _mm512_add_pd(nhb, sq));
+    const __m512d tt = _mm512_div_pd(num, a);
+    const __m512d cur = _mm512_loadu_pd(p.t);
+    __mmask8 accept = valid & _mm512_cmp_pd_mask(tt, zero, _CMP_GE_OQ) & _mm512_cmp_pd_mask(tt, cur, _CMP_LT_OQ);
+    _mm512_storeu_pd(p.t, _mm512_mask_blend_pd(accept, cur, tt));
+    while (accept) {
+        const int k = __builtin_ctz(accept);
+        p.hit[k] = int32_t(i);
+        p.inside[k] = (in >> k) & 1;
+        accept &= accept - 1;
+    }
+}
+
+/* falls back to the widest supported ISA when the requested one is missing */
+inline SphereKernels select_kernels(SimdIsa isa) {
+    if (!isa_supported(isa)) {
+        isa = detect_isa();
+    }
+    SphereKernels k;
+    k.isa = isa;
+    switch (isa) {
+        case SIMD_AVX512:
+            k.nearest = nearest_avx512;
+            k.occluded = occluded_avx512;
+            k.packet = packet_avx512;
+            break;
+        case SIMD_AVX2:
+            k.nearest = nearest_avx2;
+            k.occluded = occluded_avx2;
+            k.packet = packet_avx2;
+            break;
+        default:
+            k.nearest = nearest_scalar;
+            k.occluded = occluded_scalar;
+            k.packet = packet_scalar;
+            break;
+    }
+    return k;
+}
+
+/* linear scan over SoA spheres, a whole vector of spheres per step
+ */
+class SoAList : public Accelerator {
+public:
+    ~SoAList() {}
+    SoAList() = delete;
+    explicit SoAList(const std::vector<Sphere *>& objects, const SimdIsa isa = detect_isa()) :
+        _soa(objects),
+        _kernels(select_kernels(isa)) {}
+    inline SimdIsa isa() const { return _kernels.isa; }
+    bool intersect(const Ray& r, Hit& hit) const final {
+        const vec3 o = r.origin();
+        const vec3 d = r.direction();
+        const double org[3] = { o.x(), o.y(), o.z() };
+        const double dir[3] = { d.x(), d.y(), d.z() };
+        double t = hit.t;
+        bool inside = false;
+        int i = _kernels.nearest(_soa, org, dir, t, inside);
+        /* the kernels test every sphere and only report the nearest */
+        TRACE_STAT(TraceStats& stats = thread_stats(); stats.sphere_tests += _soa.size(); stats.sphere_hits += i >= 0);
+        if (i < 0) {
+            return false;
+        }
+        hit.t = t;
+        hit.obj = _soa.object(i);
+        hit.mesh = nullptr;
+        hit.inst = nullptr;
+        hit.inside = inside;
+        return true;
+    }
+    bool occluded(const Ray& r, const double tmax) const final {
+        const vec3 o = r.origin();
+        const vec3 d = r.direction();
+        const double org[3] = { o.x(), o.y(), o.z() };
+        const double dir[3] = { d.x(), d.y(), d.z() };
+        uint64_t tests = 0;
+        bool blocked = _kernels.occluded(_soa, org, dir, tmax, tests);
+        TRACE_STAT(thread_stats().shadow_tests += tests);
+        (void)tests;
+        return blocked;
+    }
+    AABB bounds() const final {
+        AABB box;
+        for (size_t i = 0; i < _soa.size(); i++) {
+            grow_sphere(box, *_soa.object(i));
+        }
+        return box;
+    }
+private:
+    SphereSoA _soa;
+    SphereKernels _kernels;
+};
+#endif
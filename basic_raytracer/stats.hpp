@@ -0,0 +1,215 @@
+#ifndef _STATS_HPP_
+#define _STATS_HPP_
+
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+/* instrumentation of the tracer. every counter update goes through
+ * TRACE_STAT, building with -DTRACE_STATS=0 compiles them all out
+ */
+#ifndef TRACE_STATS
+#define TRACE_STATS 1
+#endif
+
+#if TRACE_STATS
+#define TRACE_STATS_LOCAL(name) TraceStats& name = thread_stats()
+#define TRACE_STAT(...) do { __VA_ARGS__; } while (0)
+#else
+#define TRACE_STATS_LOCAL(name) do {} while (0)
+#define TRACE_STAT(...) do {} while (0)
+#endif
+
+// Depth histogram bins, deeper rays land in the last one
+constexpr int STATS_DEPTH_BINS = 64;
+
+/* wall time of one tile job, thread is the scheduler worker index */
+struct TileTime {
+    int x0, y0, x1, y1;
+    unsigned thread;
+    double seconds;
+};
+
+/* ray counters, every thread owns a copy and they are summed on demand
+ */
+struct TraceStats {
+    uint64_t rays = 0;            /* closest hit queries */
+    uint64_t primary_rays = 0;    /* closest hit queries by kind */
+    uint64_t reflection_rays = 0;
+    uint64_t refraction_rays = 0;
+    uint64_t sphere_tests = 0;    /* sphere tests done by closest hit queries */
+    uint64_t sphere_hits = 0;     /* tests that moved the nearest hit */
+    uint64_t triangle_tests = 0;  /* triangle tests done by closest hit queries */
+    uint64_t triangle_hits = 0;
+    uint64_t instance_tests = 0;  /* rays moved into the object space of an instance */
+    uint64_t shadow_rays = 0;     /* occlusion queries */
+    uint64_t shadow_occluded = 0; /* occlusion queries that found a blocker */
+    uint64_t shadow_tests = 0;    /* sphere and triangle tests done by occlusion queries */
+    uint64_t shadow_nodes = 0;    /* BVH nodes visited by occlusion queries */
+    uint64_t pruned = 0;          /* secondary rays dropped below the weight threshold */
+    uint64_t rouletted = 0;       /* secondary rays dropped by russian roulette */
+    uint64_t offsets = 0;         /* hit points moved off the surface, one step each */
+    uint64_t depth[STATS_DEPTH_BINS] = {}; /* closest hit queries by ray depth */
+    std::vector<TileTime> tiles;
+
+    void merge(const TraceStats& s) {
+        rays += s.rays;
+        primary_rays += s.primary_rays;
+        reflection_rays += s.reflection_rays;
+        refraction_rays += s.refraction_rays;
+        sphere_tests += s.sphere_tests;
+        sphere_hits += s.sphere_hits;
+        triangle_tests += s.triangle_tests;
+        triangle_hits += s.triangle_hits;
+        instance_tests += s.instance_tests;
+        shadow_rays += s.shadow_rays;
+        shadow_occluded += s.shadow_occluded;
+        shadow_tests += s.shadow_tests;
+        shadow_nodes += s.shadow_nodes;
+        pruned += s.pruned;
+        rouletted += s.rouletted;
+        offsets += s.offsets;
+        for (int i = 0; i < STATS_DEPTH_BINS; i++) {
+            depth[i] += s.depth[i];
+        }
+        tiles.insert(tiles.end(), s.tiles.begin(), s.tiles.end());
+    }
+
+    inline void count_depth(const unsigned d) {
+        depth[d < unsigned(STATS_DEPTH_BINS) ? d : STATS_DEPTH_BINS - 1]++;
+    }
+
+    /* depth of the average closest hit query, the last bin counts as its own depth */
+    double mean_depth() const {
+        uint64_t n = 0;
+        double sum = 0.0;
+        for (int i = 0; i < STATS_DEPTH_BINS; i++) {
+            n += depth[i];
+            sum += double(i) * depth[i];
+        }
+        return n ? sum / n : 0.0;
+    }
+
+    friend std::ostream & operator<<(std::ostream &os, const TraceStats& s) {
+#if TRACE_STATS
+        const uint64_t total = s.rays + s.shadow_rays;
+        os << std::fixed << std::setprecision(2)
+           << "rays            " << total << "\n"
+           << "  closest hit   " << s.rays << " (primary " << s.primary_rays << ", reflection " << s.reflection_rays
+           << ", refraction " << s.refraction_rays << ")\n"
+           << "  shadow        " << s.shadow_rays << " (" << (total ? s.shadow_rays * 100.0 / total : 0.0) << "%)\n"
+           << "sphere tests    " << s.sphere_tests << " (" << (s.rays ? double(s.sphere_tests) / s.rays : 0.0) << " per ray, "
+           << (s.sphere_tests ? s.sphere_hits * 100.0 / s.sphere_tests : 0.0) << "% hit)\n";
+        if (s.triangle_tests) {
+            os << "triangle tests  " << s.triangle_tests << " (" << (s.rays ? double(s.triangle_tests) / s.rays : 0.0) << " per ray, "
+               << s.triangle_hits * 100.0 / s.triangle_tests << "% hit)\n";
+        }
+        if (s.instance_tests) {
+            os << "instance tests  " << s.instance_tests << " (" << (total ? double(s.instance_tests) / total : 0.0) << " per ray)\n";
+        }
+        os << "shadow occluded " << s.shadow_occluded << " (" << (s.shadow_rays ? s.shadow_occluded * 100.0 / s.shadow_rays : 0.0) << "%)\n"
+           << "shadow tests    " << s.shadow_tests << " (" << (s.shadow_rays ? double(s.shadow_tests) / s.shadow_rays : 0.0) << " per ray)\n"
+           << "shadow nodes    " << s.shadow_nodes << " (" << (s.shadow_rays ? double(s.shadow_nodes) / s.shadow_rays : 0.0) << " per ray)\n"
+           << "pruned          " << s.pruned << "\n"
+           << "rouletted       " << s.rouletted << "\n"
+           << "ray tree        " << (s.primary_rays ? double(s.rays) / s.primary_rays : 0.0) << " rays per primary, mean depth "
+           << s.mean_depth() << "\n"
+           << "offsets         " << s.offsets << "\n";
+#else
+        (void)s;
+        os << "stats compiled out (TRACE_STATS=0)\n";
+#endif
+        return os;
+    }
+};
+
+/* the merged counters as one JSON object, tiles in completion order */
+inline void write_stats_json(std::ostream& os, const TraceStats& s) {
+    os << "{\n  \"enabled\": " << (TRACE_STATS ? "true" : "false") << ",\n"
+       << "  \"rays\": { \"closest_hit\": " << s.rays << ", \"primary\": " << s.primary_rays
+       << ", \"reflection\": " << s.reflection_rays << ", \"refraction\": " << s.refraction_rays
+       << ", \"shadow\": " << s.shadow_rays << ", \"pruned\": " << s.pruned
+       << ", \"rouletted\": " << s.rouletted << " },\n"
+       << "  \"spheres\": { \"tests\": " << s.sphere_tests << ", \"hits\": " << s.sphere_hits << " },\n"
+       << "  \"triangles\": { \"tests\": " << s.triangle_tests << ", \"hits\": " << s.triangle_hits << " },\n"
+       << "  \"instances\": { \"tests\": " << s.instance_tests << " },\n"
+       << "  \"shadow\": { \"occluded\": " << s.shadow_occluded << ", \"tests\": " << s.shadow_tests
+       << ", \"nodes\": " << s.shadow_nodes << " },\n"
+       << "  \"offsets\": " << s.offsets << ",\n"
+       << "  \"depth_histogram\": [";
+    int last = STATS_DEPTH_BINS - 1;
+    while (last > 0 && s.depth[last] == 0) {
+        last--;
+    }
+    for (int i = 0; i <= last; i++) {
+        os << (i ? ", " : "") << s.depth[i];
+    }
+    os << "],\n  \"tiles\": [";
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::scientific << std::setprecision(6);
+    for (size_t i = 0; i < s.tiles.size(); i++) {
+        const TileTime& t = s.tiles[i];
+        os << (i ? ",\n    " : "\n    ") << "{ \"x0\": " << t.x0 << ", \"y0\": " << t.y0 << ", \"x1\": " << t.x1
+           << ", \"y1\": " << t.y1 << ", \"thread\": " << t.thread << ", \"seconds\": " << t.seconds << " }";
+    }
+    os.flags(flags);
+    os.precision(precision);
+    os << (s.tiles.empty() ? "]\n}\n" : "\n  ]\n}\n");
+}
+
+/* threads register their counters on first use and fold them into the
+ * retired total when they exit, so the hot path never takes a lock
+ */
+class StatsRegistry {
+public:
+    static StatsRegistry& instance() {
+        static StatsRegistry registry;
+        return registry;
+    }
+
+    void attach(TraceStats *s) {
+        std::lock_guard<std::mutex> lk(_lock);
+        _live.push_back(s);
+    }
+
+    void detach(TraceStats *s) {
+        std::lock_guard<std::mutex> lk(_lock);
+        _retired.merge(*s);
+        for (size_t i = 0; i < _live.size(); i++) {
+            if (_live[i] == s) {
+                _live[i] = _live.back();
+                _live.pop_back();
+                break;
+            }
+        }
+    }
+
+    /* only meaningful once the render threads are idle */
+    TraceStats collect() {
+        std::lock_guard<std::mutex> lk(_lock);
+        TraceStats total = _retired;
+        for (const auto s : _live) {
+            total.merge(*s);
+        }
+        return total;
+    }
+private:
+    std::mutex _lock;
+    std::vector<TraceStats *> _live;
+    TraceStats _retired;
+};
+
+struct ThreadStats {
+    ThreadStats() { StatsRegistry::instance().attach(&stats); }
+    ~ThreadStats() { StatsRegistry::instance().detach(&stats); }
+    TraceStats stats;
+};
+
+inline TraceStats& thread_stats() {
+    thread_local ThreadStats local;
+    return local.stats;
+}
+#endif
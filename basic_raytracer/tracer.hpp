@@ -0,0 +1,402 @@
+#ifndef _TRACER_HPP_
+#define _TRACER_HPP_
+
+#include "bvh.hpp"
+#include "instance.hpp"
+#include "light_tree.hpp"
+#include "stats.hpp"
+#include <vector>
+
+// Recursive depth
+constexpr uint TRACE_DEPTH = 40;
+static_assert(TRACE_DEPTH < HIT_DEPTHS, "the draws at a hit are keyed by its depth");
+
+// Russian roulette: depth of the first branches it may drop, survival floor
+// of the weight policy and survival probability of the fixed one
+constexpr uint TRACE_ROULETTE_DEPTH = 3;
+constexpr double TRACE_ROULETTE_FLOOR = 0.05;
+constexpr double TRACE_ROULETTE_FIXED = 0.5;
+
+// LI Ambient
+static vec3 TRACE_AMBIENT = vec3(0.009, 0.009, 0.01);
+
+
+#define TRACE_LI_DIFFUSE 1
+#define TRACE_LI_SPECULAR 1
+
+/* how a branch's survival probability is chosen, see roulette() */
+enum RoulettePolicy {
+    ROULETTE_OFF,
+    ROULETTE_WEIGHT,
+    ROULETTE_FIXED,
+};
+
+template <typename T>
+struct TScene {
+    const TAccelerator<T> *accel;
+    std::vector<TLightBase<T> *> lights;
+    std::vector<TMaterial<T>> materials; /* indexed by TSphere::material() */
+    tvec3<T> eye; /* specular highlights are computed towards the eye */
+    /* with a light tree, each opaque hit shades light_samples lights drawn
+     * from it instead of every light
+     */
+    const TLightTree<T> *light_tree = nullptr;
+    uint light_samples = 0;
+    /* russian roulette on the branches from roulette_depth on, roulette_p
+     * is the floor of the weight policy or the fixed probability
+     */
+    RoulettePolicy roulette = ROULETTE_OFF;
+    uint roulette_depth = TRACE_ROULETTE_DEPTH;
+    T roulette_p = T(TRACE_ROULETTE_FLOOR);
+};
+
+typedef TScene<double> Scene;
+
+enum RayKind {
+    RAY_PRIMARY,
+    RAY_REFLECTION,
+    RAY_REFRACTION,
+};
+
+/* secondary ray spawned by a hit: weight is the factor its radiance is
+ * scaled by before it is added to the parent
+ */
+template <typename T>
+struct TBranch {
+    tvec3<T> origin;
+    tvec3<T> direction;
+    T weight;
+    uint depth;
+    RayKind kind;
+};
+
+/* what the primary ray sees first, for the denoiser to tell edges apart:
+ * diffuse colour and unit normal of the surface and its distance along
+ * the ray. a miss has the ambient colour, a zero normal and depth 0
+ */
+template <typename T>
+struct TAux {
+    tvec3<T> albedo;
+    tvec3<T> normal;
+    T depth = T(0.0);
+};
+typedef TAux<double> Aux;
+
+inline void count_ray(TraceStats& stats, const RayKind kind) {
+    switch (kind) {
+    case RAY_PRIMARY: stats.primary_rays++; break;
+    case RAY_REFLECTION: stats.reflection_rays++; break;
+    case RAY_REFRACTION: stats.refraction_rays++; break;
+    }
+}
+
+/* diffuse and specular light from one light at pos, added to C unless a
+ * shadow ray finds the light blocked
+ */
+template <typename T>
+void shade_light(const TScene<T>& scene, const TLightBase<T>& light, const TMaterial<T>& mat, const tvec3<T>& pos, const tvec3<T>& nor, tvec3<T>& C) {
+    TRACE_STATS_LOCAL(stats);
+    tvec3<T> shadow_ray_dir = light.origin() - pos;
+    T light_distance = std::sqrt(dot(shadow_ray_dir, shadow_ray_dir));
+    shadow_ray_dir.normalize();
+    TRay<T> shadow_ray(pos, shadow_ray_dir);
+
+    /* only objects between the hit point and the light cast shadow
+     */
+    bool inshadow = scene.accel->occluded(shadow_ray, light_distance);
+    TRACE_STAT(stats.shadow_rays++; stats.shadow_occluded += inshadow);
+
+    if (false == inshadow) {
+        T distance = dot(light.origin() - pos, light.origin() - pos);
+        distance = T(1.0) / distance;
+
+#if TRACE_LI_DIFFUSE
+        T diffuse = std::max(T(0.0), dot(nor, shadow_ray_dir));
+        C += light.calc_illumination(pos) * mat.kdiffuse() * diffuse * distance;
+#endif
+
+#if TRACE_LI_SPECULAR
+        tvec3<T> pos2eye = scene.eye - pos;
+        pos2eye.normalize();
+
+        tvec3<T> specular_light;
+        if (dot(shadow_ray_dir, nor) < 0.0) {
+            /* no specular light */
+        } else {
+            specular_light = reflect(pos - light.origin(), nor);
+            specular_light.normalize();
+        }
+        T specular = std::max(T(0.0), dot(pos2eye, specular_light));
+
+        C += light.calc_illumination(pos) * mat.kdiffuse() * std::pow(specular, mat.specular_factor()) * distance;
+#endif
+    }
+}
+
+/* local illumination of the nearest hit along r goes to C, the reflected
+ * and refracted rays that still have to be traced go to next, returns how
+ * many of them there are. rng is the sample r belongs to, light draws are
+ * keyed by it. aux, when given, gets the hit
+ */
+template <typename T>
+int shade(const TScene<T>& scene, const TRay<T>& r, const uint depth, const SampleRng& rng, tvec3<T>& C, TBranch<T> next[2], TAux<T> *aux = nullptr) {
+    /* find the nearest hit object
+     */
+    TRACE_STATS_LOCAL(stats);
+    TRACE_STAT(stats.rays++; stats.count_depth(depth));
+
+    const tvec3<T> ambient(TRACE_AMBIENT);
+
+    THit<T> hit;
+    scene.accel->intersect(r, hit);
+    T tnearest = hit.t;
+    /* when non-transparent object is very close to transparent object
+     * it becomes very diffult to handle the hit position biasing
+     */
+    bool ray_origin_inside_object = hit.inside;
+
+    if (!hit.found()) {
+        C = ambient;
+        if (aux) {
+            *aux = TAux<T>();
+            aux->albedo = ambient;
+        }
+        return 0;
+    }
+    const TMaterial<T>& mat = scene.materials[hit.material()];
+
+    /* calculate the position and normal of the hit point
+     * and add a bias of the original hit point.
+     * after parameterize t, we can not gaurantee, that position is absolutely
+     * the same relative location of inside or outside the objects
+     */ 
+    tvec3<T> pos = r.parameterize_at(tnearest);
+    tvec3<T> nor;
+    C = ambient;
+    int n = 0;
+    if (aux) {
+        /* facing the ray, the inside of glass looks like its outside */
+        aux->albedo = mat.kdiffuse();
+        aux->normal = hit.normal(pos);
+        if (dot(aux->normal, r.direction()) > T(0.0)) {
+            aux->normal = -aux->normal;
+        }
+        aux->depth = tnearest * std::sqrt(dot(r.direction(), r.direction()));
+    }
+
+    if(false == mat.transparent()) {
+        /* bias hit position outwards sphere's origin for non-transparent objects
+         * so that there's no chance for next ray's origin resident inside
+         * non-transparent objects after recursive iterations. the back of
+         * an opaque triangle is lit on the side the ray came from
+         */
+        const bool back_face = hit.mesh && ray_origin_inside_object;
+        nor = hit.normal(pos);
+        if (back_face) {
+            nor = -nor;
+        }
+        pos = hit.offset(pos, !back_face);
+        TRACE_STAT(stats.offsets++);
+
+        /* calculate local illumination (ambient, diffuse, specular)
+         * generate shadow ray from hit point towards lights, if it
+         * doesn't intersect any objects than shade LI
+         */
+        if (scene.light_tree && scene.light_samples) {
+            /* unbiased estimate of the sum over every light: each draw is
+             * weighted by one over its probability and the draw count
+             */
+            T u[4];
+            /* a zero specular exponent lights from behind too */
+            const tvec3<T> side = mat.specular_factor() > T(0.0) ? nor : tvec3<T>();
+            for (uint k = 0; k < scene.light_samples; k++) {
+                if (k % 4 == 0) {
+                    hit_random(rng, pos, HIT_LIGHTS, depth, k / 4, u);
+                }
+                T pdf;
+                /* a draw can end in a subtree with nothing in front of
+                 * the surface, it adds nothing but still counts
+                 */
+                const int l = scene.light_tree->sample(pos, side, u[k % 4], pdf);
+                if (l < 0) {
+                    continue;
+                }
+                tvec3<T> Cl;
+                shade_light(scene, *scene.lights[l], mat, pos, nor, Cl);
+                C += Cl * (T(1.0) / (pdf * T(scene.light_samples)));
+            }
+        } else {
+            for (const auto lightiter : scene.lights) {
+                shade_light(scene, *lightiter, mat, pos, nor, C);
+            }
+        }
+    }
+
+    if (depth < TRACE_DEPTH) {
+        /* recursive to calculate global illumination
+         */
+        if (mat.transparent()) {
+            if (ray_origin_inside_object) {
+                /* reflection pull pos towards origin
+                 */
+                nor = -hit.normal(pos);
+                tvec3<T> modify_reflect_pos = hit.offset(pos, false);
+                TRACE_STAT(stats.offsets++);
+
+                tvec3<T> refldir = reflect(r.direction(), nor);
+                refldir.normalize();
+                next[n++] = TBranch<T>{ modify_reflect_pos, refldir, T(0.25), depth+1, RAY_REFLECTION };
+                /* refraction push pos outwards origin
+                 */
+                tvec3<T> modify_refract_pos = hit.offset(pos, true);
+                TRACE_STAT(stats.offsets++);
+
+                tvec3<T> rin = r.direction();
+                rin.normalize();
+
+                tvec3<T> refradir;
+                if (dot(rin, nor) < 0.0) {
+                    refradir = refract(rin, nor, mat.refract_idx());
+                }
+                /* a zero direction is total internal reflection, no refract
+                 */
+                if (dot(refradir, refradir) > T(0.0)) {
+                    refradir.normalize();
+                    next[n++] = TBranch<T>{ modify_refract_pos, refradir, T(0.75), depth+1, RAY_REFRACTION };
+                }
+            } else {
+                /* reflection push pos outwards origin
+                 */
+                nor = hit.normal(pos);
+                tvec3<T> modify_reflect_pos = hit.offset(pos, true);
+                TRACE_STAT(stats.offsets++);
+
+                tvec3<T> refldir = reflect(r.direction(), nor);
+                refldir.normalize();
+                next[n++] = TBranch<T>{ modify_reflect_pos, refldir, T(0.25), depth+1, RAY_REFLECTION };
+                /* refraction pull pos towards origin
+                 */
+                tvec3<T> modify_refract_pos = hit.offset(pos, false);
+                TRACE_STAT(stats.offsets++);
+
+                tvec3<T> rin = r.direction();
+                rin.normalize();
+
+                tvec3<T> refradir = refract(rin, nor, T(1.0) / mat.refract_idx());
+                if (dot(rin, nor) < 0.0) {
+                    refradir.normalize();
+                    next[n++] = TBranch<T>{ modify_refract_pos, refradir, T(0.75), depth+1, RAY_REFRACTION };
+                }
+            }
+        } else {
+            if (dot(r.direction(), nor) < 0.0) {
+                tvec3<T> refldir = reflect(r.direction(), nor);
+                refldir.normalize();
+                next[n++] = TBranch<T>{ pos, refldir, T(0.5), depth+1, RAY_REFLECTION };
+            }
+        }
+    }
+    return n;
+}
+
+/* russian roulette on branch b, w the weight of its path. returns the
+ * probability it survived with, which its weight is divided by so the
+ * expected radiance stays the same; 0 when it is dropped, 1 before
+ * roulette_depth or with the roulette off. the weight policy survives
+ * with the path weight, at least roulette_p: a survivor carries w / p <= 1,
+ * so roulette never scales a sample up and the variance it adds is
+ * bounded. the fixed policy survives with roulette_p and scales survivors
+ * up by its inverse. the draw is keyed by the sample, branch origin and
+ * depth like the light draws but on a stream of its own, so it does not
+ * depend on the thread or trace order and never repeats a light draw
+ */
+template <typename T>
+inline T roulette(const TScene<T>& scene, const SampleRng& rng, const TBranch<T>& b, const T w) {
+    if (scene.roulette == ROULETTE_OFF || b.depth < scene.roulette_depth) {
+        return T(1.0);
+    }
+    const T p = scene.roulette == ROULETTE_WEIGHT ? std::max(scene.roulette_p, std::min(w, T(1.0))) : scene.roulette_p;
+    if (p >= T(1.0)) {
+        return T(1.0);
+    }
+    T u[4];
+    hit_random(rng, b.origin, HIT_ROULETTE, b.depth, 0, u);
+    return u[0] < p ? p : T(0.0);
+}
+
+/* recursive reference: children are traced depth first as soon as they
+ * are spawned. rng is the sample r belongs to. weight is the product of
+ * the weights along the path of r, for the roulette. aux gets the first
+ * hit of r
+ */
+template <typename T>
+tvec3<T> tracer(const TScene<T>& scene, const TRay<T>& r, const uint depth, const SampleRng& rng, TAux<T> *aux = nullptr, const T weight = T(1.0)) {
+    TRACE_STAT(if (depth == 0) count_ray(thread_stats(), RAY_PRIMARY));
+    tvec3<T> C;
+    TBranch<T> next[2];
+    const int n = shade(scene, r, depth, rng, C, next, aux);
+    for (int i = 0; i < n; i++) {
+        const T p = roulette(scene, rng, next[i], weight * next[i].weight);
+        if (p == T(0.0)) {
+            TRACE_STAT(thread_stats().rouletted++);
+            continue;
+        }
+        TRACE_STAT(count_ray(thread_stats(), next[i].kind));
+        const T f = p < T(1.0) ? next[i].weight / p : next[i].weight;
+        C += tracer<T>(scene, TRay<T>(next[i].origin, next[i].direction), next[i].depth, rng, nullptr, weight * f)*f;
+    }
+    return C;
+}
+
+/* every pop spawns at most two entries, so a depth first walk never holds
+ * more than one pending sibling per level
+ */
+constexpr uint TRACE_STACK = TRACE_DEPTH + 2;
+
+/* iterative evaluation of the same ray tree on an explicit stack, each
+ * entry carries the product of the weights along its path. branches go
+ * through the roulette, then those whose weight drops below min_weight are
+ * not traced. rng is the sample r belongs to. aux gets the first hit of r
+ */
+template <typename T>
+tvec3<T> trace_path(const TScene<T>& scene, const TRay<T>& r, const T min_weight, const SampleRng& rng, TAux<T> *aux = nullptr) {
+    TRACE_STATS_LOCAL(stats);
+    TBranch<T> stack[TRACE_STACK];
+    int sp = 0;
+    stack[sp++] = TBranch<T>{ r.origin(), r.direction(), T(1.0), 0, RAY_PRIMARY };
+
+    tvec3<T> L;
+    while (sp) {
+        const TBranch<T> cur = stack[--sp];
+        TRACE_STAT(count_ray(stats, cur.kind));
+        tvec3<T> C;
+        TBranch<T> next[2];
+        const int n = shade(scene, TRay<T>(cur.origin, cur.direction), cur.depth, rng, C, next, aux);
+        aux = nullptr;
+        L += C * cur.weight;
+        /* push in reverse so the first child is traced first like the
+         * recursive version does
+         */
+        for (int i = n - 1; i >= 0; i--) {
+            T w = cur.weight * next[i].weight;
+            const T p = roulette(scene, rng, next[i], w);
+            if (p == T(0.0)) {
+                TRACE_STAT(stats.rouletted++);
+                continue;
+            }
+            if (p < T(1.0)) {
+                w /= p;
+            }
+            if (w < min_weight) {
+                TRACE_STAT(stats.pruned++);
+                continue;
+            }
+            assert(sp < int(TRACE_STACK));
+            stack[sp] = next[i];
+            stack[sp].weight = w;
+            sp++;
+        }
+    }
+    return L;
+}
+#endif
@@ -15,61 +15,67 @@
 #include <cassert>
 #endif
 
-class vec3 {
+template <typename T>
+class tvec3 {
 public:
-    ~vec3() {}
-    vec3() : _x(0), _y(0), _z(0) {}
-    vec3(const vec3& v) : _x(v.x()), _y(v.y()), _z(v.z()) {}
-    vec3(const double x, const double y, const double z) : _x(x), _y(y), _z(z) {}
-    inline double x() const { return _x; }
-    inline double y() const { return _y; }
-    inline double z() const { return _z; }
-    inline double r() const { return _x; }
-    inline double g() const { return _y; }
-    inline double b() const { return _z; }
-    vec3 operator=(const vec3& v) {
+    typedef T value_type;
+    ~tvec3() {}
+    tvec3() : _x(0), _y(0), _z(0) {}
+    tvec3(const tvec3& v) : _x(v.x()), _y(v.y()), _z(v.z()) {}
+    tvec3(const T x, const T y, const T z) : _x(x), _y(y), _z(z) {}
+    /* precision conversion has to be spelled out */
+    template <typename U>
+    explicit tvec3(const tvec3<U>& v) : _x(T(v.x())), _y(T(v.y())), _z(T(v.z())) {}
+    inline T x() const { return _x; }
+    inline T y() const { return _y; }
+    inline T z() const { return _z; }
+    inline T r() const { return _x; }
+    inline T g() const { return _y; }
+    inline T b() const { return _z; }
+    inline T operator[](const int i) const { return i == 0 ? _x : (i == 1 ? _y : _z); }
+    tvec3 operator=(const tvec3& v) {
         _x = v.x();
         _y = v.y();
         _z = v.z();
         return *this;
     }
 
-    friend std::ostream & operator<<(std::ostream &os, const vec3& v) {
+    friend std::ostream & operator<<(std::ostream &os, const tvec3& v) {
         os << "[" << v.x() << " " << v.y() << " " << v.z() << "]";
         return os;
     }
 
-    vec3 operator+(const vec3& v) const {
-        return vec3(_x + v.x(), _y + v.y(), _z + v.z());
+    tvec3 operator+(const tvec3& v) const {
+        return tvec3(_x + v.x(), _y + v.y(), _z + v.z());
     }
 
-    vec3& operator+=(const vec3& v) {
+    tvec3& operator+=(const tvec3& v) {
         _x += v.x();
         _y += v.y();
         _z += v.z();
         return *this;
     }
 
-    vec3 operator-() const {
-        return vec3(-_x, -_y, -_z);
+    tvec3 operator-() const {
+        return tvec3(-_x, -_y, -_z);
     }
 
-    vec3 operator-(const vec3& v) const {
-        return vec3(_x - v.x(), _y - v.y(), _z - v.z());
+    tvec3 operator-(const tvec3& v) const {
+        return tvec3(_x - v.x(), _y - v.y(), _z - v.z());
     }
 
-    vec3 operator*(const vec3& v) const {
-        return vec3(_x * v.x(), _y * v.y(), _z * v.z());
+    tvec3 operator*(const tvec3& v) const {
+        return tvec3(_x * v.x(), _y * v.y(), _z * v.z());
     }
 
-    vec3 operator*(const double t) const {
-        return vec3(_x * t, _y * t, _z * t);
+    tvec3 operator*(const T t) const {
+        return tvec3(_x * t, _y * t, _z * t);
     }
 
-    vec3& normalize() {
-        double nor = sqrt(_x*_x + _y*_y + _z*_z);
-        if (nor > double(0.0)) {
-            double nor_inv = 1.0 / nor;
+    tvec3& normalize() {
+        T nor = std::sqrt(_x*_x + _y*_y + _z*_z);
+        if (nor > T(0.0)) {
+            T nor_inv = T(1.0) / nor;
             _x *= nor_inv;
             _y *= nor_inv;
             _z *= nor_inv;
@@ -80,49 +86,56 @@ public:
     }
 
 private:
-    double _x, _y, _z;
+    T _x, _y, _z;
 };
 
-double dot(const vec3& u, const vec3& v) {
-    double res = u.x() * v.x() + u.y() * v.y() + u.z() * v.z();
+typedef tvec3<double> vec3;
+typedef tvec3<float> vec3f;
+
+template <typename T>
+T dot(const tvec3<T>& u, const tvec3<T>& v) {
+    T res = u.x() * v.x() + u.y() * v.y() + u.z() * v.z();
     return res;
 }
 
-vec3 cross(const vec3& u, const vec3& v) {
-    return vec3(
+template <typename T>
+tvec3<T> cross(const tvec3<T>& u, const tvec3<T>& v) {
+    return tvec3<T>(
         u.y() * v.z() - u.z() * v.y(),
         u.z() * v.x() - u.x() * v.z(),
         u.x() * v.y() - u.y() * v.x());
 }
 
-vec3 reflect(const vec3& i, const vec3& n) {
+template <typename T>
+tvec3<T> reflect(const tvec3<T>& i, const tvec3<T>& n) {
     assert(dot(i, n) <= 0.0);
-    vec3 r = i - n * dot(i, n) * 2.0;
+    tvec3<T> r = i - n * dot(i, n) * T(2.0);
     assert(dot(r, n) >= 0.0);
     return r;
 }
 
-vec3 refract(const vec3& i, const vec3& n, const double eta) {
+template <typename T>
+tvec3<T> refract(const tvec3<T>& i, const tvec3<T>& n, const T eta) {
     /* i and n should be normalized
      */
-    assert(fabs(i.x()*i.x() + i.y()*i.y() + i.z()*i.z() - 1.0) <= 1e-8);
-    assert(fabs(n.x()*n.x() + n.y()*n.y() + n.z()*n.z() - 1.0) <= 1e-8);
+    assert(std::fabs(i.x()*i.x() + i.y()*i.y() + i.z()*i.z() - 1.0) <= 1e-8);
+    assert(std::fabs(n.x()*n.x() + n.y()*n.y() + n.z()*n.z() - 1.0) <= 1e-8);
     assert(dot(i, n) <= 0.0);
 
-    vec3 res;
-    double c = - dot(i, n);
+    tvec3<T> res;
+    T c = - dot(i, n);
 
-    double r = eta;
+    T r = eta;
 
-    double delta = 1.0 - r*r*(1 - c*c);
+    T delta = T(1.0) - r*r*(T(1) - c*c);
 
-    if (delta < 0.0) {
+    if (delta < T(0.0)) {
         /* represent internal full reflect, no refract
          */
         return res;
     }
 
-    res = i*r + n*(r*c - sqrt(delta));
+    res = i*r + n*(r*c - std::sqrt(delta));
     assert(dot(res, n) <= 0.0);
 
     return res;
@@ -0,0 +1,160 @@
+#ifndef _WAVEFRONT_HPP_
+#define _WAVEFRONT_HPP_
+
+#include "heatmap.hpp"
+#include "tracer.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Morton bits per axis of the origin key
+constexpr int WAVEFRONT_MORTON_BITS = 10;
+
+/* queued ray: the branch with the product of the weights along its path,
+ * the slot its radiance is added to and the pixel and sample it belongs to
+ */
+template <typename T>
+struct TWaveRay {
+    TBranch<T> branch;
+    uint32_t slot;
+    uint32_t pixel;
+    uint32_t sample;
+};
+
+/* low WAVEFRONT_MORTON_BITS bits of v moved to every third bit */
+inline uint32_t morton_spread(uint32_t v) {
+    v &= (1u << WAVEFRONT_MORTON_BITS) - 1;
+    v = (v | (v << 16)) & 0x030000FFu;
+    v = (v | (v << 8)) & 0x0300F00Fu;
+    v = (v | (v << 4)) & 0x030C30C3u;
+    v = (v | (v << 2)) & 0x09249249u;
+    return v;
+}
+
+/* breadth first evaluation of the ray trees trace_path walks depth first.
+ * a generation of rays is traced as one batch, the children it spawns
+ * form the next. before tracing, a batch is sorted by direction octant
+ * and then by the Morton code of the origin within the bounds of the
+ * batch, so rays that run through the same nodes and primitives are
+ * traced back to back while those are still in cache. ties keep the queue
+ * order, primary rays of one origin stay in scanline order. the radiance
+ * of a slot is the same sum trace_path computes, added in another order
+ */
+template <typename T>
+class TWavefront {
+public:
+    ~TWavefront() {}
+    TWavefront() = delete;
+    TWavefront(const TWavefront&) = delete;
+    /* seed keys the draws at the hits as trace_path's rng does. unsorted
+     * keeps every generation in spawn order, for comparison
+     */
+    TWavefront(const TScene<T>& scene, const T min_weight, const uint64_t seed, const bool sorted = true) :
+        _scene(scene), _min_weight(min_weight), _seed(seed), _sorted(sorted) {}
+
+    inline void push(const TRay<T>& r, const uint32_t slot, const uint32_t pixel, const uint32_t sample) {
+        _queue.push_back(TWaveRay<T>{ TBranch<T>{ r.origin(), r.direction(), T(1.0), 0, RAY_PRIMARY }, slot, pixel, sample });
+    }
+    /* traces everything pushed and what it spawns, radiance[slot] is
+     * added to and has to cover every slot. the primitive tests of each
+     * ray are added to tests[slot] when given
+     */
+    void run(std::vector<tvec3<T>>& radiance, std::vector<double> *tests = nullptr);
+    /* generations traced by the last run */
+    inline int generations() const { return _generations; }
+private:
+    void sort();
+
+    const TScene<T>& _scene;
+    T _min_weight;
+    uint64_t _seed;
+    bool _sorted;
+    int _generations = 0;
+    std::vector<TWaveRay<T>> _queue;
+    std::vector<TWaveRay<T>> _next;
+    std::vector<std::pair<uint64_t, uint32_t>> _keys;
+};
+
+template <typename T>
+void TWavefront<T>::sort() {
+    AABB box;
+    for (const auto& w : _queue) {
+        const double p[3] = { double(w.branch.origin.x()), double(w.branch.origin.y()), double(w.branch.origin.z()) };
+        box.grow(p);
+    }
+    const double cells = double(1u << WAVEFRONT_MORTON_BITS);
+    double scale[3];
+    for (int a = 0; a < 3; a++) {
+        const double extent = box.hi[a] - box.lo[a];
+        scale[a] = extent > 0.0 ? (cells - 1.0) / extent : 0.0;
+    }
+
+    _keys.resize(_queue.size());
+    for (uint32_t i = 0; i < _queue.size(); i++) {
+        const TBranch<T>& b = _queue[i].branch;
+        const uint64_t octant = (b.direction.x() < T(0.0)) | (b.direction.y() < T(0.0)) << 1 | (b.direction.z() < T(0.0)) << 2;
+        uint32_t morton = 0;
+        for (int a = 0; a < 3; a++) {
+            morton |= morton_spread(uint32_t((double(b.origin[a]) - box.lo[a]) * scale[a])) << a;
+        }
+        _keys[i] = std::make_pair(octant << (3 * WAVEFRONT_MORTON_BITS) | morton, i);
+    }
+    std::sort(_keys.begin(), _keys.end());
+
+    _next.resize(_queue.size());
+    for (size_t i = 0; i < _keys.size(); i++) {
+        _next[i] = _queue[_keys[i].second];
+    }
+    _queue.swap(_next);
+}
+
+template <typename T>
+void TWavefront<T>::run(std::vector<tvec3<T>>& radiance, std::vector<double> *tests) {
+    TRACE_STATS_LOCAL(stats);
+    PixelMeter meter(HEATMAP_TESTS);
+    _generations = 0;
+    while (!_queue.empty()) {
+        if (_sorted) {
+            sort();
+        }
+        _generations++;
+        _next.clear();
+        for (const auto& w : _queue) {
+            const TBranch<T>& cur = w.branch;
+            TRACE_STAT(count_ray(stats, cur.kind));
+            const SampleRng rng(_seed, w.pixel, w.sample);
+            tvec3<T> C;
+            TBranch<T> next[2];
+            if (tests) {
+                meter.start();
+            }
+            const int n = shade(_scene, TRay<T>(cur.origin, cur.direction), cur.depth, rng, C, next);
+            if (tests) {
+                (*tests)[w.slot] += meter.stop();
+            }
+            radiance[w.slot] += C * cur.weight;
+            for (int i = 0; i < n; i++) {
+                T weight = cur.weight * next[i].weight;
+                const T p = roulette(_scene, rng, next[i], weight);
+                if (p == T(0.0)) {
+                    TRACE_STAT(stats.rouletted++);
+                    continue;
+                }
+                if (p < T(1.0)) {
+                    weight /= p;
+                }
+                if (weight < _min_weight) {
+                    TRACE_STAT(stats.pruned++);
+                    continue;
+                }
+                _next.push_back(TWaveRay<T>{ next[i], w.slot, w.pixel, w.sample });
+                _next.back().branch.weight = weight;
+            }
+        }
+        _queue.swap(_next);
+    }
+}
+
+typedef TWavefront<double> Wavefront;
+#endif
@@ -325,7 +325,10 @@ public:
                 imb.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
                 break;
             case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-                imb.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+                imb.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+                break;
+            case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+                imb.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
                 break;
             default:
                 assert(0);
@@ -494,7 +497,9 @@ private:
         info.imageColorSpace = surfacefmtkhr[0].colorSpace;
         info.imageExtent = surfacecapkhr.currentExtent;
         info.imageArrayLayers = 1;
-        info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        /* transfer dst lets an app blit straight into the presented image */
+        info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+            (surfacecapkhr.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
         info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
         info.preTransform = surfacecapkhr.currentTransform;
         info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
@@ -716,6 +721,7 @@ public:
     vector<VkSurfaceFormatKHR> surfacefmtkhr;
     VkSurfaceCapabilitiesKHR surfacecapkhr;
     VkSwapchainKHR swapchain;
+    vector<VkImage> swapchain_img;
     vector<VkImageView> swapchain_imgv;
     VkImageView depth_imgv;
     VkRenderPass renderpass;
@@ -733,7 +739,6 @@ private:
     uint32_t gfxQueueIndex;
     uint32_t nongfxQueueIndex;
     VkSurfaceKHR surface;
-    vector<VkImage> swapchain_img;
     VkImage depth_img;
     VkDeviceMemory depth_mem;
     VkCommandPool cmdpool;
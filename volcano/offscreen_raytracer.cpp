@@ -0,0 +1,588 @@
+#include "lava_offscreen_lite.hpp"
+#include "../basic_raytracer/tracer.hpp"
+#include "../basic_raytracer/camera.hpp"
+#include "../basic_raytracer/sampler.hpp"
+#include "../basic_raytracer/scheduler.hpp"
+#include "../basic_raytracer/image_io.hpp"
+#include <chrono>
+#include <iomanip>
+#include <thread>
+
+/* headless compute port of the sphere raytracer (raytracer.comp). the scene
+ * file of basic_raytracer goes into storage buffers, one dispatch renders
+ * every pixel into a host visible radiance buffer which is written as PPM.
+ * only spheres are ported, scenes with meshes or instances are refused.
+ * the same scene is then rendered by the CPU tiled renderer for timing and
+ * as the reference the GPU image is checked against, and a render.ppm of
+ * the CPU binary can be checked as well:
+ *
+ *   ../basic_raytracer/rt --scene demo.scene --seed 1 --precision float --output render
+ *   ./ovc_raytracer --scene demo.scene --seed 1 --reference render.ppm
+ *
+ * the shader traces in float as the CPU reference does, only a handful of
+ * pixels along glass edges may differ. on a machine without a GPU run it on
+ * lavapipe:
+ *
+ *   VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json ./ovc_raytracer
+ */
+
+// Path weight pruning of the CPU renderer default
+constexpr float MIN_WEIGHT = 1e-3f;
+
+// Largest 8 bit difference a pixel may show and still match
+constexpr int MATCH_TOLERANCE = 2;
+
+// Pixels past MATCH_TOLERANCE an image may have and still match
+constexpr size_t MATCH_MAX_PIXELS = 8;
+
+/* std430 records of raytracer.comp */
+struct GPUSphere {
+    float origin[3];
+    float radius;
+    uint32_t material;
+    uint32_t pad[3];
+};
+
+struct GPUMaterial {
+    float kdiffuse[3];
+    float specular_factor;
+    float kspecular[3];
+    float refract_idx;
+    uint32_t transparent;
+    uint32_t pad[3];
+};
+
+struct GPULight {
+    float origin[3];
+    float pad0;
+    float illumination[3]; /* times energy */
+    float pad1;
+};
+
+struct GPUView {
+    float eye[4];
+    float topleft[4];
+    float u[4];
+    float v[4];
+    uint32_t width;
+    uint32_t height;
+    uint32_t spp;
+    uint32_t sphere_count;
+    uint32_t light_count;
+    uint32_t seed_lo;
+    uint32_t seed_hi;
+    float min_weight;
+};
+
+static_assert(sizeof(GPUSphere) == 32 && sizeof(GPUMaterial) == 48 && sizeof(GPULight) == 32, "std430 layout of raytracer.comp");
+static_assert(sizeof(GPUView) <= 128, "push constants fit the guaranteed minimum");
+
+struct Options {
+    const char *scene = "../basic_raytracer/scenes/demo.scene";
+    const char *reference = nullptr;
+    const char *output = "raytracer.ppm";
+    int width = 0;  /* 0 is the scene resolution */
+    int height = 0;
+    int spp = 0;    /* 0 is the scene spp */
+    long seed = 0;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    int tile = 32;
+    bool cpu = true;
+};
+
+static void usage(const char *prog) {
+    std::cerr << "usage: " << prog << " [--scene FILE] [--size W H] [--spp N] [--seed N] [--reference FILE]\n"
+              << "       [--output FILE] [--threads N] [--tile N] [--no-cpu]\n"
+              << "  --scene FILE      scene of basic_raytracer, spheres only: meshes and instances are\n"
+              << "                    not ported and such scenes are rejected\n"
+              << "  --reference FILE  PPM of the CPU renderer the GPU image is checked against\n"
+              << "  --no-cpu          skip the CPU render and timing\n";
+}
+
+static bool parse_options(int argc, char const *argv[], Options& opts) {
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--scene") && i + 1 < argc) {
+            opts.scene = argv[++i];
+        } else if (0 == strcmp(argv[i], "--size") && i + 2 < argc) {
+            opts.width = std::max(1, atoi(argv[++i]));
+            opts.height = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--spp") && i + 1 < argc) {
+            opts.spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--seed") && i + 1 < argc) {
+            opts.seed = atol(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--reference") && i + 1 < argc) {
+            opts.reference = argv[++i];
+        } else if (0 == strcmp(argv[i], "--output") && i + 1 < argc) {
+            opts.output = argv[++i];
+        } else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc) {
+            opts.threads = unsigned(std::max(1, atoi(argv[++i])));
+        } else if (0 == strcmp(argv[i], "--tile") && i + 1 < argc) {
+            opts.tile = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--no-cpu")) {
+            opts.cpu = false;
+        } else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* 8 bit image of a P3 or P6 file, values above 255 are clamped */
+static bool read_ppm(const char *path, int& w, int& h, vector<uint8_t>& rgb) {
+    ifstream f(path, std::ios::binary);
+    string magic;
+    int maxval = 0;
+    f >> magic;
+    auto skip = [&f]() {
+        while (f >> std::ws && f.peek() == '#') {
+            string line;
+            std::getline(f, line);
+        }
+    };
+    skip(); f >> w;
+    skip(); f >> h;
+    skip(); f >> maxval;
+    if (!f || (magic != "P3" && magic != "P6") || w <= 0 || h <= 0 || maxval != 255) {
+        return false;
+    }
+    rgb.resize(size_t(w) * h * 3);
+    if (magic == "P6") {
+        f.get();
+        f.read((char *)rgb.data(), rgb.size());
+    } else {
+        for (auto& c : rgb) {
+            int v;
+            f >> v;
+            c = uint8_t(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+    }
+    return bool(f);
+}
+
+static vector<uint8_t> to_rgb8(const Framebuffer& fb) {
+    vector<uint8_t> rgb(size_t(fb.width()) * fb.height() * 3);
+    for (int i = 0; i < fb.height(); i++) {
+        for (int j = 0; j < fb.width(); j++) {
+            for (int c = 0; c < 3; c++) {
+                rgb[(size_t(i) * fb.width() + j) * 3 + c] = to_u8(fb.at(j, i)[c]);
+            }
+        }
+    }
+    return rgb;
+}
+
+/* written 8 bit values of the GPU image against a reference */
+static bool compare(const char *name, const vector<uint8_t>& ref, const vector<uint8_t>& img) {
+    int max_diff = 0;
+    double sum = 0.0;
+    size_t differ = 0;
+    const size_t pixels = img.size() / 3;
+    for (size_t p = 0; p < pixels; p++) {
+        int d = 0;
+        for (int c = 0; c < 3; c++) {
+            d = std::max(d, std::abs(int(ref[p * 3 + c]) - int(img[p * 3 + c])));
+            sum += std::abs(int(ref[p * 3 + c]) - int(img[p * 3 + c]));
+        }
+        max_diff = std::max(max_diff, d);
+        differ += d > MATCH_TOLERANCE ? 1 : 0;
+    }
+    /* GPU and CPU float rays may still round differently and take other
+     * branches along the glass silhouettes, a handful of pixels, anything
+     * more is a porting bug
+     */
+    const bool ok = differ <= MATCH_MAX_PIXELS;
+    std::cout << "gpu vs " << name << ": max 8 bit diff " << max_diff << ", mean " << std::fixed << std::setprecision(4)
+              << sum / img.size() << ", " << differ << " of " << pixels << " pixels off by more than "
+              << MATCH_TOLERANCE << (ok ? ", match\n" : ", MISMATCH\n") << std::defaultfloat;
+    return ok;
+}
+
+class App : public Volcano {
+public:
+    ~App() {
+        vkFreeDescriptorSets(device, com_descpool, 1, &com_descset);
+        vkDestroyDescriptorPool(device, com_descpool, nullptr);
+        vkDestroyDescriptorSetLayout(device, com_descset_layout, nullptr);
+        vkDestroyPipelineLayout(device, com_pipeline_layout, nullptr);
+        vkDestroyPipeline(device, com_pipeline, nullptr);
+
+        resource_manager.freeBuf(device);
+    }
+
+    App() = delete;
+    App(const SceneDesc& desc, const View& view, const Options& opts) : Volcano(view.width, view.height) {
+        initBuffer(desc, view, opts);
+        auto start = std::chrono::steady_clock::now();
+        initCOMPipeline();
+        pipeline_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        initCOMDescriptor();
+        initCOMCommand(view.width, view.height);
+    }
+
+    void initBuffer(const SceneDesc& desc, const View& view, const Options& opts) {
+        /* empty arrays still get a record, buffers can not be zero sized */
+        vector<GPUSphere> spheres(std::max<size_t>(1, desc.sphere_count()));
+        for (size_t i = 0; i < desc.sphere_count(); i++) {
+            const Sphere& s = desc.spheres()[i];
+            GPUSphere& g = spheres[i];
+            for (int c = 0; c < 3; c++) {
+                g.origin[c] = float(s.origin()[c]);
+            }
+            g.radius = float(s.radius());
+            g.material = s.material();
+        }
+
+        vector<GPUMaterial> materials(std::max<size_t>(1, desc.material_count()));
+        for (size_t i = 0; i < desc.material_count(); i++) {
+            const MaterialRecord& m = desc.materials()[i];
+            GPUMaterial& g = materials[i];
+            for (int c = 0; c < 3; c++) {
+                g.kdiffuse[c] = float(m.kdiffuse[c]);
+                g.kspecular[c] = float(m.kspecular[c]);
+            }
+            g.specular_factor = float(m.specular_factor);
+            g.refract_idx = float(m.refract_idx);
+            g.transparent = m.transparent;
+        }
+
+        vector<GPULight> lights(std::max<size_t>(1, desc.light_count()));
+        for (size_t i = 0; i < desc.light_count(); i++) {
+            const LightRecord& l = desc.lights()[i];
+            GPULight& g = lights[i];
+            for (int c = 0; c < 3; c++) {
+                g.origin[c] = float(l.origin[c]);
+                g.illumination[c] = float(l.illumination[c] * l.energy);
+            }
+        }
+
+        const VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        sphere_bytes = spheres.size() * sizeof(GPUSphere);
+        material_bytes = materials.size() * sizeof(GPUMaterial);
+        light_bytes = lights.size() * sizeof(GPULight);
+        radiance_bytes = size_t(view.width) * view.height * 4 * sizeof(float);
+        resource_manager.allocBuf(device, pdmp, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                sphere_bytes, spheres.data(), "spherebuf", hostVisible);
+        resource_manager.allocBuf(device, pdmp, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                material_bytes, materials.data(), "materialbuf", hostVisible);
+        resource_manager.allocBuf(device, pdmp, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                light_bytes, lights.data(), "lightbuf", hostVisible);
+        resource_manager.allocBuf(device, pdmp, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                radiance_bytes, nullptr, "radiancebuf", hostVisible);
+
+        const vec3 *cam[4] = { &view.eye, &view.topleft, &view.u, &view.v };
+        float *dst[4] = { gpu_view.eye, gpu_view.topleft, gpu_view.u, gpu_view.v };
+        for (int k = 0; k < 4; k++) {
+            for (int c = 0; c < 3; c++) {
+                dst[k][c] = float((*cam[k])[c]);
+            }
+            dst[k][3] = 0.0f;
+        }
+        gpu_view.width = view.width;
+        gpu_view.height = view.height;
+        gpu_view.spp = view.spp;
+        gpu_view.sphere_count = desc.sphere_count();
+        gpu_view.light_count = desc.light_count();
+        gpu_view.seed_lo = uint32_t(uint64_t(opts.seed));
+        gpu_view.seed_hi = uint32_t(uint64_t(opts.seed) >> 32);
+        gpu_view.min_weight = MIN_WEIGHT;
+    }
+
+    void initCOMPipeline() {
+        VkShaderModule compShaderModule = initShaderModule("raytracer.comp.spv");
+
+        VkPipelineShaderStageCreateInfo shaderStageInfo {};
+        shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        shaderStageInfo.module = compShaderModule;
+        shaderStageInfo.pName = "main";
+
+        /* spheres, materials, lights, radiance */
+        VkDescriptorSetLayoutBinding bindings[4] = {};
+        for (uint32_t i = 0; i < 4; i++) {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+
+        VkDescriptorSetLayoutCreateInfo dsLayoutInfo = {};
+        dsLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        dsLayoutInfo.bindingCount = 4;
+        dsLayoutInfo.pBindings = bindings;
+        vkCreateDescriptorSetLayout(device, &dsLayoutInfo, nullptr, &com_descset_layout);
+
+        VkPushConstantRange pushRange = {};
+        pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushRange.offset = 0;
+        pushRange.size = sizeof(GPUView);
+
+        VkPipelineLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &com_descset_layout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushRange;
+        vkCreatePipelineLayout(device, &layoutInfo, nullptr, &com_pipeline_layout);
+
+        VkComputePipelineCreateInfo comPipelineInfo = {};
+        comPipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        comPipelineInfo.stage = shaderStageInfo;
+        comPipelineInfo.layout = com_pipeline_layout;
+        vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &comPipelineInfo, nullptr, &com_pipeline);
+
+        vkDestroyShaderModule(device, compShaderModule, nullptr);
+    }
+
+    void initCOMDescriptor() {
+        VkDescriptorPoolSize poolSize = {};
+        poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSize.descriptorCount = 4;
+
+        VkDescriptorPoolCreateInfo dsPoolInfo = {};
+        dsPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        dsPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+        dsPoolInfo.maxSets = 1;
+        dsPoolInfo.poolSizeCount = 1;
+        dsPoolInfo.pPoolSizes = &poolSize;
+        vkCreateDescriptorPool(device, &dsPoolInfo, nullptr, &com_descpool);
+
+        VkDescriptorSetAllocateInfo dsAllocInfo = {};
+        dsAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        dsAllocInfo.descriptorPool = com_descpool;
+        dsAllocInfo.descriptorSetCount = 1;
+        dsAllocInfo.pSetLayouts = &com_descset_layout;
+        vkAllocateDescriptorSets(device, &dsAllocInfo, &com_descset);
+
+        /* Update DescriptorSets */
+        const char *tokens[4] = { "spherebuf", "materialbuf", "lightbuf", "radiancebuf" };
+        const VkDeviceSize ranges[4] = { sphere_bytes, material_bytes, light_bytes, radiance_bytes };
+        VkDescriptorBufferInfo descBufInfo[4] = {};
+        VkWriteDescriptorSet wds[4] = {};
+        for (uint32_t i = 0; i < 4; i++) {
+            descBufInfo[i].buffer = resource_manager.queryBuf(tokens[i]);
+            descBufInfo[i].offset = 0;
+            descBufInfo[i].range = ranges[i];
+
+            wds[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            wds[i].dstSet = com_descset;
+            wds[i].dstBinding = i;
+            wds[i].dstArrayElement = 0;
+            wds[i].descriptorCount = 1;
+            wds[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            wds[i].pBufferInfo = &descBufInfo[i];
+        }
+        vkUpdateDescriptorSets(device, 4, wds, 0, nullptr);
+    }
+
+    void initCOMCommand(uint32_t w, uint32_t h) {
+        VkCommandBuffer & comcmdbuf = cmdbuf[0];
+        VkCommandBufferBeginInfo cbi = {};
+        cbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        cbi.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+        vkBeginCommandBuffer(comcmdbuf, &cbi);
+        vkCmdBindPipeline(comcmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, com_pipeline);
+        vkCmdBindDescriptorSets(comcmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, com_pipeline_layout, 0, 1, &com_descset, 0, nullptr);
+        vkCmdPushConstants(comcmdbuf, com_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUView), &gpu_view);
+        /* 8x8 local size of raytracer.comp */
+        vkCmdDispatch(comcmdbuf, (w + 7) / 8, (h + 7) / 8, 1);
+
+        /* make the radiance visible to the mapped readback */
+        VkBufferMemoryBarrier bmb = {};
+        bmb.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bmb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        bmb.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        bmb.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bmb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bmb.buffer = resource_manager.queryBuf("radiancebuf");
+        bmb.offset = 0;
+        bmb.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(comcmdbuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bmb, 0, nullptr);
+
+        vkEndCommandBuffer(comcmdbuf);
+    }
+
+    /* submit the dispatch and wait for it, returns the wall time in
+     * seconds and the radiance in fb
+     */
+    double run(Framebuffer& fb) {
+        VkFence fence;
+        VkFenceCreateInfo fenceInfo {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        vkCreateFence(device, &fenceInfo, nullptr, &fence);
+
+        VkSubmitInfo si {};
+        si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        si.commandBufferCount = 1;
+        si.pCommandBuffers = &cmdbuf[0];
+
+        auto start = std::chrono::steady_clock::now();
+        vkQueueSubmit(gfxQ, 1, &si, fence);
+
+        VkResult res = VK_SUCCESS;
+        do {
+            res = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+        } while (res == VK_TIMEOUT);
+        assert(res == VK_SUCCESS);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        vkDestroyFence(device, fence, nullptr);
+
+        vector<float> radiance(radiance_bytes / sizeof(float));
+        resource_manager.readBufContent(device, "radiancebuf", radiance.data(), radiance_bytes);
+        for (int i = 0; i < fb.height(); i++) {
+            for (int j = 0; j < fb.width(); j++) {
+                const float *p = &radiance[(size_t(i) * fb.width() + j) * 4];
+                fb.at(j, i) = vec3(p[0], p[1], p[2]);
+            }
+        }
+        return seconds;
+    }
+
+    double pipeline_seconds = 0.0;
+private:
+    GPUView gpu_view {};
+    VkDeviceSize sphere_bytes;
+    VkDeviceSize material_bytes;
+    VkDeviceSize light_bytes;
+    VkDeviceSize radiance_bytes;
+    VkDescriptorSetLayout com_descset_layout;
+    VkPipelineLayout com_pipeline_layout;
+    VkPipeline com_pipeline;
+    VkDescriptorPool com_descpool;
+    VkDescriptorSet com_descset;
+};
+
+/* the CPU tiled renderer on the same scene: BVH, float precision as the
+ * shader traces, random sampler, returns the wall time of the trace in seconds
+ */
+static double render_cpu(const SceneDesc& desc, const View& view, const Options& opts, Framebuffer& fb) {
+    vector<TSphere<float>> storage;
+    vector<TSphere<float> *> objects;
+    storage.reserve(desc.sphere_count());
+    for (size_t i = 0; i < desc.sphere_count(); i++) {
+        const Sphere& s = desc.spheres()[i];
+        storage.push_back(TSphere<float>(vec3f(s.origin()), float(s.radius()), s.material()));
+    }
+    for (auto& s : storage) {
+        objects.push_back(&s);
+    }
+    TBVH<float> bvh(objects);
+    TScene<float> scene;
+    scene.accel = &bvh;
+    for (size_t i = 0; i < desc.light_count(); i++) {
+        const LightRecord& l = desc.lights()[i];
+        scene.lights.push_back(new TConstantLight<float>(vec3f(l.origin[0], l.origin[1], l.origin[2]),
+            vec3f(l.illumination[0], l.illumination[1], l.illumination[2]), float(l.energy)));
+    }
+    for (size_t i = 0; i < desc.material_count(); i++) {
+        const Material m = to_material(desc.materials()[i]);
+        scene.materials.push_back(TMaterial<float>(vec3f(m.kdiffuse()), vec3f(m.kspecular()), float(m.specular_factor()),
+            m.transparent(), float(m.refract_idx())));
+    }
+    scene.eye = vec3f(view.eye);
+    RandomSampler sampler(uint64_t(opts.seed));
+
+    auto start = std::chrono::steady_clock::now();
+    TileScheduler scheduler(opts.threads);
+    scheduler.run(split_tiles(view.width, view.height, opts.tile), [&](const Tile& t, unsigned) {
+        for (int i = t.y0; i < t.y1; i++) {
+            for (int j = t.x0; j < t.x1; j++) {
+                vec3f res;
+                for (int k = 0; k < view.spp; k++) {
+                    double uv[2];
+                    sampler.get_2d(j, i, uint32_t(i * view.width + j), uint32_t(k), 0, uv);
+                    const SampleRng rng(uint64_t(opts.seed), uint32_t(i * view.width + j), uint32_t(k));
+                    res += trace_path(scene, camera_ray<float>(view, j, i, uv[0], uv[1]), MIN_WEIGHT, rng);
+                }
+                fb.at(j, i) = vec3(res * float(1.0 / view.spp));
+            }
+        }
+    });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "\n";
+
+    for (auto l : scene.lights) {
+        delete l;
+    }
+    return seconds;
+}
+
+int main(int argc, char const *argv[])
+{
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        return 1;
+    }
+
+    SceneDesc desc;
+    string err;
+    if (!desc.load(opts.scene, err)) {
+        std::cerr << opts.scene << ": " << err << "\n";
+        return 1;
+    }
+    if (!desc.meshes().empty() || !desc.instances().empty()) {
+        std::cerr << opts.scene << ": " << desc.meshes().size() << " meshes, " << desc.instances().size()
+                  << " instances, the compute port traces spheres only\n";
+        return 1;
+    }
+    /* the camera spans the same canvas at another resolution */
+    if (opts.width) {
+        desc.settings.width = opts.width;
+        desc.settings.height = opts.height;
+    }
+    if (opts.spp) {
+        desc.settings.spp = opts.spp;
+    }
+    const View view = make_view(desc);
+    const double samples = double(view.width) * view.height * view.spp;
+    std::cout << view.width << "x" << view.height << ", " << view.spp << " spp, "
+              << desc.sphere_count() << " spheres, " << desc.light_count() << " lights\n";
+
+    Framebuffer gpu(view.width, view.height);
+    double gpu_seconds = 0.0;
+    {
+        App app(desc, view, opts);
+        gpu_seconds = app.run(gpu);
+        std::cout << "gpu  pipeline " << std::fixed << std::setprecision(2) << app.pipeline_seconds * 1e3
+                  << " ms, dispatch " << std::setprecision(3) << gpu_seconds << " s, "
+                  << std::setprecision(2) << samples / gpu_seconds * 1e-6 << " Msamples/s\n" << std::defaultfloat;
+    }
+
+    string encoded;
+    encode_image(gpu, IMAGE_P6, encoded);
+    std::ofstream out(opts.output, std::ios::binary);
+    out.write(encoded.data(), encoded.size());
+    if (!out) {
+        std::cerr << "can not write " << opts.output << "\n";
+        return 1;
+    }
+    std::cout << "wrote " << opts.output << "\n";
+
+    const vector<uint8_t> gpu_rgb = to_rgb8(gpu);
+    bool ok = true;
+    if (opts.cpu) {
+        Framebuffer cpu(view.width, view.height);
+        const double cpu_seconds = render_cpu(desc, view, opts, cpu);
+        std::cout << "cpu  " << opts.threads << " threads, " << std::fixed << std::setprecision(3) << cpu_seconds << " s, "
+                  << std::setprecision(2) << samples / cpu_seconds * 1e-6 << " Msamples/s\n"
+                  << "gpu speedup " << cpu_seconds / gpu_seconds << "x\n" << std::defaultfloat;
+        ok &= compare("cpu", to_rgb8(cpu), gpu_rgb);
+    }
+    if (opts.reference) {
+        int w = 0, h = 0;
+        vector<uint8_t> ref;
+        if (!read_ppm(opts.reference, w, h, ref)) {
+            std::cerr << opts.reference << ": not an 8 bit PPM\n";
+            return 1;
+        }
+        if (w != view.width || h != view.height) {
+            std::cerr << opts.reference << ": " << w << "x" << h << ", rendered " << view.width << "x" << view.height << "\n";
+            return 1;
+        }
+        ok &= compare(opts.reference, ref, gpu_rgb);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,376 @@
+#include "lava_lite.hpp"
+#include "../basic_raytracer/tracer.hpp"
+#include "../basic_raytracer/camera.hpp"
+#include "../basic_raytracer/sampler.hpp"
+#include "../basic_raytracer/scheduler.hpp"
+#include "../basic_raytracer/preview.hpp"
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <thread>
+
+/* live view of a progressive CPU render. the render of basic_raytracer
+ * runs on its own threads and resolves every tile it traces into a
+ * persistently mapped staging buffer holding the three frames of a
+ * PreviewFrames. each frame of the window loop copies the latest published
+ * pass into an image and blits it to the swapchain image, letterboxed.
+ * the render threads never touch Vulkan and never wait for the window,
+ * passes that finish faster than the display are skipped. the render
+ * builds spheres only, scenes with meshes or instances are refused:
+ *
+ *   ./vc_preview --scene ../basic_raytracer/scenes/demo.scene --ci 0.02
+ *
+ * the image goes to --output once every pixel has converged. closing the
+ * window before stops the render. the same passes without a window are
+ * written by rt --ci E --preview NAME
+ */
+
+// Path weight pruning of the CPU renderer default
+constexpr double MIN_WEIGHT = 1e-3;
+
+// Progressive defaults of the CPU renderer
+constexpr double PREVIEW_CI = 0.02;
+constexpr int PREVIEW_MIN_SPP = 16;
+constexpr int PREVIEW_PASS_SPP = 4;
+
+struct Options {
+    const char *scene = "../basic_raytracer/scenes/demo.scene";
+    const char *output = "preview.ppm";
+    int width = 0;  /* 0 is the scene resolution */
+    int height = 0;
+    double ci = PREVIEW_CI;
+    int min_spp = PREVIEW_MIN_SPP;
+    int pass_spp = PREVIEW_PASS_SPP;
+    int max_spp = 0; /* 0 is the scene spp */
+    long seed = 0;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    int tile = 32;
+};
+
+static void usage(const char *prog) {
+    std::cerr << "usage: " << prog << " [--scene FILE] [--size W H] [--ci E] [--min-spp N] [--pass-spp N]\n"
+              << "       [--max-spp N] [--seed N] [--threads N] [--tile N] [--output FILE]\n"
+              << "  --scene FILE scene of basic_raytracer, spheres only: scenes with meshes or\n"
+              << "               instances are rejected\n"
+              << "  --ci E       a pixel stops once the 95% confidence interval of its luminance\n"
+              << "               is within E of the mean (default " << PREVIEW_CI << ")\n"
+              << "  --max-spp N  per pixel sample cap (default the scene spp)\n";
+}
+
+static bool parse_options(int argc, char const *argv[], Options& opts) {
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--scene") && i + 1 < argc) {
+            opts.scene = argv[++i];
+        } else if (0 == strcmp(argv[i], "--size") && i + 2 < argc) {
+            opts.width = std::max(1, atoi(argv[++i]));
+            opts.height = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--ci") && i + 1 < argc) {
+            opts.ci = std::max(0.0, atof(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--min-spp") && i + 1 < argc) {
+            opts.min_spp = std::max(2, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--pass-spp") && i + 1 < argc) {
+            opts.pass_spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--max-spp") && i + 1 < argc) {
+            opts.max_spp = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--seed") && i + 1 < argc) {
+            opts.seed = atol(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc) {
+            opts.threads = unsigned(std::max(1, atoi(argv[++i])));
+        } else if (0 == strcmp(argv[i], "--tile") && i + 1 < argc) {
+            opts.tile = std::max(1, atoi(argv[++i]));
+        } else if (0 == strcmp(argv[i], "--output") && i + 1 < argc) {
+            opts.output = argv[++i];
+        } else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_srgb(VkFormat fmt) {
+    return fmt == VK_FORMAT_B8G8R8A8_SRGB || fmt == VK_FORMAT_R8G8B8A8_SRGB || fmt == VK_FORMAT_A8B8G8R8_SRGB_PACK32;
+}
+
+class App : public Volcano {
+public:
+    ~App() {
+        vkQueueWaitIdle(gfxQ);
+        vkFreeMemory(device, texObj.memory, nullptr);
+        vkDestroyImage(device, texObj.img, nullptr);
+        resource_manager.freeBuf(device);
+    }
+
+    App() = delete;
+    App(int w, int h) : width(w), height(h) {
+        initBuffer();
+        initTexture();
+    }
+
+    /* the frames the render writes into, mapped for the life of the app */
+    uint8_t *staging() { return pStaging; }
+
+    /* the frames over staging(), before run() */
+    void attach(PreviewFrames *f) {
+        frames = f;
+        initCommand(frames->front_index());
+    }
+
+    /* a new pass is recorded into every command buffer, once the queue is
+     * idle: the frame the last submits read may be the one the render
+     * writes next
+     */
+    void drawFrame() override {
+        if (!frames->fresh()) {
+            return;
+        }
+        vkQueueWaitIdle(gfxQ);
+        PreviewInfo info;
+        frames->acquire(info);
+        initCommand(frames->front_index());
+
+        char title[96];
+        snprintf(title, sizeof(title), "pass %u, %.2f spp, %.2f s", info.pass, info.spp, info.seconds);
+        glfwSetWindowTitle(glfw, title);
+    }
+
+    void initBuffer() {
+        const VkDeviceSize bytes = VkDeviceSize(width) * height * 4 * PREVIEW_FRAMES;
+        resource_manager.allocBuf(device, pdmp, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, bytes, nullptr, "stagingbuf",
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        pStaging = (uint8_t *)resource_manager.mapBuf(device, "stagingbuf");
+        /* black until the first pass is in */
+        memset(pStaging, 0, bytes);
+    }
+
+    void initTexture() {
+        /* display values go through as they are: an sRGB swapchain decodes
+         * the source as sRGB and encodes it again
+         */
+        const VkFormat fmt = is_srgb(surfacefmtkhr[0].format) ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+        bakeImage(texObj, fmt, width, height, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, nullptr);
+        preTransitionImgLayout(texObj.img, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    }
+
+    /* staging frame -> image -> swapchain image, the image stays in
+     * transfer dst layout between frames
+     */
+    void initCommand(uint32_t frame) {
+        const VkExtent2D extent = surfacecapkhr.currentExtent;
+        /* largest rectangle of the image aspect, centered */
+        int32_t dw = extent.width;
+        int32_t dh = int32_t(int64_t(extent.width) * height / width);
+        if (dh > int32_t(extent.height)) {
+            dh = extent.height;
+            dw = int32_t(int64_t(extent.height) * width / height);
+        }
+        const int32_t dx = (int32_t(extent.width) - dw) / 2;
+        const int32_t dy = (int32_t(extent.height) - dh) / 2;
+
+        VkCommandBufferBeginInfo cbi = {};
+        cbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        cbi.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+        for (uint8_t i = 0; i < swapchain_img.size(); i++) {
+            vkBeginCommandBuffer(cmdbuf[i], &cbi);
+
+            VkBufferImageCopy copy {};
+            copy.bufferOffset = VkDeviceSize(frame) * width * height * 4;
+            copy.bufferRowLength = 0;
+            copy.bufferImageHeight = 0;
+            copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copy.imageSubresource.mipLevel = 0;
+            copy.imageSubresource.baseArrayLayer = 0;
+            copy.imageSubresource.layerCount = 1;
+            copy.imageOffset = { 0, 0, 0 };
+            copy.imageExtent = { uint32_t(width), uint32_t(height), 1 };
+            vkCmdCopyBufferToImage(cmdbuf[i], resource_manager.queryBuf("stagingbuf"), texObj.img,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+
+            transitionImgLayout(cmdbuf[i], texObj.img,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            /* the wait on the acquired image is at color output, starting
+             * the barrier there chains the transfer after it
+             */
+            transitionImgLayout(cmdbuf[i], swapchain_img[i],
+                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+            VkClearColorValue black = { { 0.0, 0.0, 0.0, 1.0 } };
+            VkImageSubresourceRange range {};
+            range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            range.baseMipLevel = 0;
+            range.levelCount = 1;
+            range.baseArrayLayer = 0;
+            range.layerCount = 1;
+            vkCmdClearColorImage(cmdbuf[i], swapchain_img[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &black, 1, &range);
+            transitionImgLayout(cmdbuf[i], swapchain_img[i],
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+            VkImageBlit region {};
+            region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.srcSubresource.mipLevel = 0;
+            region.srcSubresource.baseArrayLayer = 0;
+            region.srcSubresource.layerCount = 1;
+            region.srcOffsets[0] = { 0, 0, 0 };
+            region.srcOffsets[1] = { width, height, 1 };
+            region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.dstSubresource.mipLevel = 0;
+            region.dstSubresource.baseArrayLayer = 0;
+            region.dstSubresource.layerCount = 1;
+            region.dstOffsets[0] = { dx, dy, 0 };
+            region.dstOffsets[1] = { dx + dw, dy + dh, 1 };
+            vkCmdBlitImage(cmdbuf[i], texObj.img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                swapchain_img[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
+
+            transitionImgLayout(cmdbuf[i], swapchain_img[i],
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+            transitionImgLayout(cmdbuf[i], texObj.img,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+            vkEndCommandBuffer(cmdbuf[i]);
+        }
+    }
+
+private:
+    int width;
+    int height;
+    uint8_t *pStaging = nullptr;
+    PreviewFrames *frames = nullptr;
+    TexObj texObj {};
+};
+
+/* the progressive render of basic_raytracer: BVH, double precision,
+ * random sampler, the passes of rt --ci. every tile is resolved into the
+ * preview once traced and every pass is published. quit stops it between
+ * tiles, the image is written only when it ran to the end
+ */
+static void render_cpu(const SceneDesc& desc, const View& view, const Options& opts, PreviewFrames& frames, const std::atomic<bool>& quit) {
+    vector<Sphere *> objects;
+    for (size_t i = 0; i < desc.sphere_count(); i++) {
+        objects.push_back(&desc.spheres()[i]);
+    }
+    BVH bvh(objects);
+    Scene scene;
+    scene.accel = &bvh;
+    for (size_t i = 0; i < desc.light_count(); i++) {
+        const LightRecord& l = desc.lights()[i];
+        scene.lights.push_back(new ConstantLight(vec3(l.origin[0], l.origin[1], l.origin[2]),
+            vec3(l.illumination[0], l.illumination[1], l.illumination[2]), l.energy));
+    }
+    for (size_t i = 0; i < desc.material_count(); i++) {
+        scene.materials.push_back(to_material(desc.materials()[i]));
+    }
+    scene.eye = view.eye;
+    RandomSampler sampler(uint64_t(opts.seed));
+
+    ProgressiveImage img(view.width, view.height);
+    const int max_spp = std::max(opts.max_spp ? opts.max_spp : view.spp, 2);
+    int pass_spp = std::min(opts.min_spp, max_spp);
+    const TileFunc pass = [&](const Tile& tile, unsigned) {
+        if (quit) {
+            return;
+        }
+        for (int i = tile.y0; i < tile.y1; i++) {
+            for (int j = tile.x0; j < tile.x1; j++) {
+                PixelEstimate& p = img.at(j, i);
+                if (p.done) {
+                    continue;
+                }
+                const int n = std::min<int>(pass_spp, max_spp - p.n);
+                for (int k = 0; k < n; k++) {
+                    double uv[2];
+                    sampler.get_2d(j, i, uint32_t(i * view.width + j), p.n, 0, uv);
+                    const SampleRng rng(uint64_t(opts.seed), uint32_t(i * view.width + j), p.n);
+                    p.add(trace_path(scene, camera_ray<double>(view, j, i, uv[0], uv[1]), MIN_WEIGHT, rng));
+                }
+                p.done = int(p.n) >= max_spp || (int(p.n) >= opts.min_spp && p.converged(opts.ci));
+            }
+        }
+        frames.resolve(img, tile);
+    };
+
+    const double pixels = double(view.width) * view.height;
+    const vector<Tile> tiles = split_tiles(view.width, view.height, opts.tile);
+    TileScheduler scheduler(opts.threads);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t passes = 1; !quit; passes++) {
+        scheduler.run(tiles, pass);
+        pass_spp = opts.pass_spp;
+        if (quit) {
+            break;
+        }
+        PreviewInfo info;
+        info.pass = passes;
+        info.spp = double(img.samples()) / pixels;
+        info.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        frames.publish(info);
+        if (img.active() == 0) {
+            break;
+        }
+    }
+    frames.close();
+
+    if (!quit) {
+        Framebuffer fb(view.width, view.height);
+        img.resolve(fb);
+        string encoded;
+        encode_image(fb, IMAGE_P6, encoded);
+        std::ofstream out(opts.output, std::ios::binary);
+        out.write(encoded.data(), encoded.size());
+        std::cout << "converged in " << std::fixed << std::setprecision(2)
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s, "
+                  << double(img.samples()) / pixels << " spp, " << (out ? "wrote " : "can not write ")
+                  << opts.output << "\n" << std::defaultfloat;
+    }
+
+    for (auto l : scene.lights) {
+        delete l;
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        return 1;
+    }
+
+    SceneDesc desc;
+    string err;
+    if (!desc.load(opts.scene, err)) {
+        std::cerr << opts.scene << ": " << err << "\n";
+        return 1;
+    }
+    if (!desc.meshes().empty() || !desc.instances().empty()) {
+        std::cerr << opts.scene << ": " << desc.meshes().size() << " meshes, " << desc.instances().size()
+                  << " instances, the preview renders spheres only\n";
+        return 1;
+    }
+    /* the camera spans the same canvas at another resolution */
+    if (opts.width) {
+        desc.settings.width = opts.width;
+        desc.settings.height = opts.height;
+    }
+    const View view = make_view(desc);
+    std::cout << view.width << "x" << view.height << ", ci " << opts.ci << ", " << opts.threads << " threads, "
+              << desc.sphere_count() << " spheres, " << desc.light_count() << " lights\n";
+
+    App app(view.width, view.height);
+    PreviewFrames frames(view.width, view.height, app.staging());
+    app.attach(&frames);
+
+    std::atomic<bool> quit(false);
+    std::thread render(render_cpu, std::cref(desc), std::cref(view), std::cref(opts), std::ref(frames), std::cref(quit));
+    app.run();
+    /* the render writes into the staging buffer, it has to stop first */
+    quit = true;
+    render.join();
+    return 0;
+}
@@ -3,6 +3,7 @@
 
 #include <vulkan/vulkan.h>
 #include <cassert>
+#include <cstring>
 #include <string>
 #include <map>
 
@@ -66,8 +67,9 @@ public:
             uint8_t *pDST = nullptr;
             vkMapMemory(dev, bufMem, 0, req.size, 0, (void **)&pDST);
 
+            /* req.size may be padded past the source data */
             uint8_t *pSRC = (uint8_t *)pDATA;
-            for (uint32_t i = 0; i < req.size; i++) {
+            for (uint32_t i = 0; i < size; i++) {
                 *(pDST + i) = *(pSRC + i);
             }
 
@@ -112,6 +114,28 @@ public:
         vkUnmapMemory(dev, bufMem);
     }
 
+    /* map a host visible buffer as a whole and leave it mapped, freeBuf
+     * unmaps it along with its memory */
+    void *mapBuf(VkDevice dev, const string token) {
+        auto res = _buf.find(token);
+        assert(res != _buf.end());
+        void *pDST = nullptr;
+        vkMapMemory(dev, res->second.second, 0, VK_WHOLE_SIZE, 0, &pDST);
+        return pDST;
+    }
+
+    /* copy size bytes back from a host visible buffer */
+    void readBufContent(VkDevice dev, const string token, void *pDATA, VkDeviceSize size) {
+        auto res = _buf.find(token);
+        assert(res != _buf.end());
+        VkDeviceMemory bufMem = res->second.second;
+
+        uint8_t *pSRC = nullptr;
+        vkMapMemory(dev, bufMem, 0, size, 0, (void **)&pSRC);
+        memcpy(pDATA, pSRC, size);
+        vkUnmapMemory(dev, bufMem);
+    }
+
 private:
     map<const string, pair<VkBuffer, VkDeviceMemory>> _buf;
 };